@@ -0,0 +1,360 @@
+/*
+ * Микро-бенчмарки модулей прошивки на ПК
+ * Время - std::chrono реальной машины (часы HostHal здесь не участвуют):
+ * абсолютные числа не равны Due, но отношение между прогонами одного CI
+ * ловит регрессии ядер. Каждое ядро сначала проверяется на верный результат.
+ *
+ *   due_bench            ~0.2 с на ядро
+ *   due_bench --quick    короткий прогон для ctest
+ *   due_bench --csv      name,ns_per_op,bytes_per_s для сравнения прогонов
+ */
+
+#include "HostHal.h"
+#include "base64.h"
+#include "LinkProtocol.h"
+#include "LinkJson.h"
+#include "rgb565_gray.h"
+#include "Logger.h"
+#include "CommandDictionary.h"
+#include "FrameCodec.h"
+#include "MemoryArena.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static bool csvOutput = false;
+static double targetSeconds = 0.2;
+static int failures = 0;
+
+// Результат ядра уходит сюда, чтобы компилятор не выбросил вызов
+static volatile uint32_t sink;
+
+#define VERIFY(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "verify failed %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+ * Прогон op() повторами до targetSeconds
+ * @param bytesPerOp байт, обработанных за вызов (0 - без bytes/s)
+ */
+template <typename Op>
+static void bench(const char* name, size_t bytesPerOp, Op op) {
+    typedef std::chrono::steady_clock Clock;
+
+    // Разогрев и оценка числа повторов
+    uint64_t iterations = 1;
+    double seconds = 0;
+    while (true) {
+        Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            op();
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= targetSeconds || iterations >= (1ull << 40)) {
+            break;
+        }
+        uint64_t scale = (seconds > 0) ? (uint64_t)(targetSeconds / seconds * 1.2) + 1 : 10;
+        iterations *= (scale < 2) ? 2 : (scale > 10 ? 10 : scale);
+    }
+
+    double nsPerOp = seconds * 1e9 / (double)iterations;
+    double bytesPerSec = (bytesPerOp > 0) ? (double)bytesPerOp * iterations / seconds : 0;
+    if (csvOutput) {
+        printf("%s,%.2f,%.0f\n", name, nsPerOp, bytesPerSec);
+    } else if (bytesPerOp > 0) {
+        printf("%-24s %12.1f ns/op %10.2f MB/s\n", name, nsPerOp, bytesPerSec / 1e6);
+    } else {
+        printf("%-24s %12.1f ns/op\n", name, nsPerOp);
+    }
+}
+
+// ==================== ДАННЫЕ ====================
+
+static const size_t FRAME_PIXELS = (size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT;
+
+static uint8_t grayFrame[FRAME_PIXELS];
+static uint8_t grayNext[FRAME_PIXELS];
+static uint8_t rgbLine[Hardware::CAM_WIDTH * 2];
+static uint8_t grayLine[Hardware::CAM_WIDTH];
+
+static void fillFrames() {
+    // Сцена, похожая на камеру: градиент, крупные пятна и шум датчика
+    uint32_t lcg = 1;
+    for (size_t i = 0; i < FRAME_PIXELS; i++) {
+        lcg = lcg * 1103515245u + 12345u;
+        size_t x = i % Hardware::CAM_WIDTH;
+        size_t y = i / Hardware::CAM_WIDTH;
+        uint8_t base = (uint8_t)(x / 2 + y + (((x / 20) + (y / 15)) & 1) * 60);
+        grayFrame[i] = (uint8_t)(base + ((lcg >> 16) & 0x03));
+        grayNext[i] = (x > 60 && x < 90 && y > 40 && y < 70) ? (uint8_t)(base + 40) : grayFrame[i];
+    }
+    for (size_t i = 0; i < sizeof(rgbLine); i++) {
+        lcg = lcg * 1103515245u + 12345u;
+        rgbLine[i] = (uint8_t)(lcg >> 24);
+    }
+}
+
+// Приёмник LinkFrameWriter: байты кадра в память
+class BufferPrint : public Print {
+public:
+    std::vector<uint8_t> bytes;
+
+    size_t write(uint8_t c) override {
+        bytes.push_back(c);
+        return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        bytes.insert(bytes.end(), buffer, buffer + size);
+        return size;
+    }
+    using Print::write;
+};
+
+// ==================== ЯДРА ====================
+
+static void benchChecksums() {
+    static const uint8_t check[] = "123456789";
+    VERIFY(crc16_ccitt(check, 9) == 0x29B1);
+    bench("crc16_ccitt 19200", FRAME_PIXELS, []() {
+        sink = crc16_ccitt(grayFrame, FRAME_PIXELS);
+    });
+}
+
+static void benchBase64() {
+    static const uint8_t check[] = "Man";
+    char text[8];
+    VERIFY(base64_encode(check, 3, text, sizeof(text)) == 4 && memcmp(text, "TWFu", 4) == 0);
+
+    // Чанк текстового режима: 192 байт -> 256 символов, с CRC чанка
+    static char out[260];
+    bench("base64 chunk 192", 192, []() {
+        uint16_t crc = 0xFFFF;
+        sink = (uint32_t)base64_encode(grayFrame, 192, out, sizeof(out), &crc);
+    });
+}
+
+static void benchGray() {
+    VERIFY(rgb565_gray_self_test());
+    rgb565_gray_init();
+
+    // Строка камеры QQVGA; кадр - 120 таких строк за захват
+    bench("gray reference line", sizeof(rgbLine), []() {
+        rgb565_to_gray_reference(rgbLine, grayLine, Hardware::CAM_WIDTH);
+        sink = grayLine[Hardware::CAM_WIDTH - 1];
+    });
+    bench("gray lut line", sizeof(rgbLine), []() {
+        rgb565_to_gray_lut(rgbLine, grayLine, Hardware::CAM_WIDTH);
+        sink = grayLine[Hardware::CAM_WIDTH - 1];
+    });
+    bench("gray packed line", sizeof(rgbLine), []() {
+        rgb565_to_gray_packed(rgbLine, grayLine, Hardware::CAM_WIDTH);
+        sink = grayLine[Hardware::CAM_WIDTH - 1];
+    });
+}
+
+static void benchLink() {
+    // Бинарный чанк: заголовок, индекс, 240 байт, CRC
+    static BufferPrint out;
+    static uint16_t frameCrc;
+    bench("frame write chunk 240", 240, []() {
+        out.bytes.clear();
+        LinkFrameWriter w(out);
+        w.begin(LINK_IMG_CHUNK, 1, 242);
+        w.writeU16(7);
+        w.write(grayFrame, 240, frameCrc);
+        sink = w.end();
+    });
+
+    static LinkFrameParser parser;
+    parser.reset();
+    bool parsed = false;
+    for (size_t i = 0; i < out.bytes.size(); i++) {
+        parsed = parser.feed(out.bytes[i]);
+    }
+    VERIFY(parsed && parser.type() == LINK_IMG_CHUNK && parser.payloadU16(0) == 7);
+    bench("frame parse chunk 240", out.bytes.size(), []() {
+        uint32_t frames = 0;
+        for (size_t i = 0; i < out.bytes.size(); i++) {
+            frames += parser.feed(out.bytes[i]);
+        }
+        sink = frames;
+    });
+}
+
+static void benchJson() {
+    // Запись DATA того же вида, что WifiLink::queueData()
+    static char buffer[SCRATCH_DATA_JSON_SIZE];
+    static size_t written = 0;
+    bench("json write DATA", 0, []() {
+        JsonWriter json(buffer, sizeof(buffer));
+        json.lit(LINK_DATA_IMAGE_ID_PREFIX);
+        json.fill(' ', LINK_DATA_IMAGE_ID_SLOT);
+        json.lit(",\"width\":");
+        json.u32(160);
+        json.lit(",\"height\":");
+        json.u32(120);
+        json.lit("},\"session_id\":");
+        json.u32(7);
+        json.lit(",\"step_id\":");
+        json.u32(12345);
+        json.lit(",\"ts\":");
+        json.str("01:01:2025 12:00:00");
+        json.lit(",\"sensors\":{\"distance_cm\":");
+        json.fixed(42.5f, 1);
+        json.lit(",\"light_raw\":");
+        json.i32(512);
+        json.lit(",\"is_dark\":");
+        json.boolean(false);
+        const float imu[] = { 0.12f, -0.05f, 9.81f, 0.001f, -0.002f, 0.03f, 1.5f, -2.25f, 90.0f };
+        const char* keys[] = { ",\"ax\":", ",\"ay\":", ",\"az\":", ",\"gx\":", ",\"gy\":", ",\"gz\":",
+                               ",\"roll\":", ",\"pitch\":", ",\"yaw\":" };
+        for (size_t i = 0; i < 9; i++) {
+            json.raw(keys[i], strlen(keys[i]));
+            json.fixed(imu[i], 3);
+        }
+        json.lit("}}");
+        written = json.length();
+        sink = (uint32_t)written;
+    });
+    VERIFY(written > 0 && written < sizeof(buffer));
+
+    static const char cmd[] =
+        "{\"command\":\"FORWARD\",\"duration_ms\":1200,\"step\":12345,\"image_mode\":\"half\","
+        "\"speed\":80,\"seq\":[{\"command\":\"LEFT\",\"duration_ms\":300},"
+        "{\"command\":\"FORWARD\",\"duration_ms\":900}],\"reason\":\"clear path ahead\"}";
+    static long duration = 0;
+    bench("json read CMD", sizeof(cmd) - 1, []() {
+        JsonReader json(cmd);
+        char key[16];
+        char name[16];
+        long value = 0;
+        uint32_t fields = 0;
+        json.beginObject();
+        while (json.nextKey(key, sizeof(key))) {
+            if (strcmp(key, "command") == 0) {
+                json.readString(name, sizeof(name));
+            } else if (strcmp(key, "duration_ms") == 0) {
+                json.readInt(duration);
+            } else if (strcmp(key, "seq") == 0 && json.beginArray()) {
+                while (json.nextElement()) {
+                    json.beginObject();
+                    while (json.nextKey(key, sizeof(key))) {
+                        if (strcmp(key, "duration_ms") == 0) {
+                            json.readInt(value);
+                        } else {
+                            json.readString(name, sizeof(name));
+                        }
+                    }
+                    fields++;
+                }
+            } else {
+                json.skipValue();
+            }
+        }
+        sink = fields + (json.ok() ? 1 : 0);
+    });
+    VERIFY(duration == 1200);
+}
+
+static void benchCodec() {
+    static FrameCodec codec;
+    codec.begin();
+
+    codec.setCodec(CODEC_INTRA);
+    EncodedFrame intra = codec.encode(grayFrame, Hardware::CAM_WIDTH, Hardware::CAM_HEIGHT);
+    VERIFY(intra.codec == CODEC_INTRA && intra.size > 0 && intra.size < FRAME_PIXELS);
+    codec.commit(false);
+    bench("codec intra 160x120", FRAME_PIXELS, []() {
+        EncodedFrame f = codec.encode(grayFrame, Hardware::CAM_WIDTH, Hardware::CAM_HEIGHT);
+        codec.commit(false);
+        sink = (uint32_t)f.size;
+    });
+
+    // Разностный к принятому ключевому кадру: сцена сдвинулась в одном пятне
+    codec.setCodec(CODEC_INTER);
+    EncodedFrame key = codec.encode(grayFrame, Hardware::CAM_WIDTH, Hardware::CAM_HEIGHT);
+    VERIFY((key.flags & FRAME_FLAG_KEY) != 0);
+    codec.commit(true);
+    EncodedFrame inter = codec.encode(grayNext, Hardware::CAM_WIDTH, Hardware::CAM_HEIGHT);
+    VERIFY(inter.codec == CODEC_INTER && inter.size < key.size);
+    codec.commit(false);
+    bench("codec inter 160x120", FRAME_PIXELS, []() {
+        EncodedFrame f = codec.encode(grayNext, Hardware::CAM_WIDTH, Hardware::CAM_HEIGHT);
+        codec.commit(false);
+        sink = (uint32_t)f.size;
+    });
+}
+
+static void benchModules() {
+    static CommandDictionary dictionary;
+    dictionary.begin();
+    VERIFY(dictionary.lookup("FORWARD") >= 0);
+    VERIFY(dictionary.lookup("NO_SUCH_COMMAND") < 0);
+    bench("dictionary lookup hit", 0, []() {
+        sink = (uint32_t)dictionary.lookup("RIGHT");
+    });
+    bench("dictionary lookup miss", 0, []() {
+        sink = (uint32_t)dictionary.lookup("NO_SUCH_COMMAND");
+    });
+
+    // Запись журнала: упаковка в RAM, страница во flash на каждой заполненной
+    static Logger logger;
+    logger.begin(&dictionary);
+    static LogEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.ts.dd = 1;
+    entry.ts.MM = 1;
+    entry.ts.yyyy = 2025;
+    strcpy(entry.commandName, "FORWARD");
+    entry.durationMs = 1200;
+    entry.distanceCm = 42.5f;
+    entry.lightRaw = 512;
+    logger.add(entry);
+    LogEntry back;
+    VERIFY(logger.getEntry(logger.getCount() - 1, back) && back.durationMs == entry.durationMs &&
+           strcmp(back.commandName, "FORWARD") == 0);
+    bench("logger add", 0, []() {
+        entry.durationMs += 10;
+        logger.add(entry);
+        sink = (uint32_t)logger.getCount();
+    });
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            targetSeconds = 0.002;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csvOutput = true;
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--csv]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Модули пишут в Serial: на ПК это только накопленный текст консоли
+    MemoryArena::begin();
+    fillFrames();
+    if (csvOutput) {
+        printf("name,ns_per_op,bytes_per_s\n");
+    }
+
+    benchChecksums();
+    benchBase64();
+    benchGray();
+    benchLink();
+    benchJson();
+    benchCodec();
+    benchModules();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d verification(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
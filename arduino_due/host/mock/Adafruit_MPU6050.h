@@ -0,0 +1,26 @@
+#ifndef HOST_ADAFRUIT_MPU6050_H
+#define HOST_ADAFRUIT_MPU6050_H
+
+#include "Wire.h"
+#include "Adafruit_Sensor.h"
+
+enum {
+    MPU6050_RANGE_8_G = 2,
+    MPU6050_RANGE_500_DEG = 1,
+    MPU6050_BAND_44_HZ = 3,
+    MPU6050_BAND_21_HZ = 4
+};
+
+/**
+ * MPU6050 не отвечает (как и всё на TwoWire): begin() - false
+ */
+class Adafruit_MPU6050 {
+public:
+    bool begin(uint8_t = 0x68, TwoWire* = &Wire, int32_t = 0) { return false; }
+    void setAccelerometerRange(int) {}
+    void setGyroRange(int) {}
+    void setFilterBandwidth(int) {}
+    bool getEvent(sensors_event_t*, sensors_event_t*, sensors_event_t*) { return false; }
+};
+
+#endif // HOST_ADAFRUIT_MPU6050_H
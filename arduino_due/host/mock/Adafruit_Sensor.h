@@ -0,0 +1,14 @@
+#ifndef HOST_ADAFRUIT_SENSOR_H
+#define HOST_ADAFRUIT_SENSOR_H
+
+struct sensors_vec_t {
+    float x, y, z;
+};
+
+struct sensors_event_t {
+    sensors_vec_t acceleration;
+    sensors_vec_t gyro;
+    float temperature;
+};
+
+#endif // HOST_ADAFRUIT_SENSOR_H
@@ -0,0 +1,313 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+ * Arduino Due для сборки на ПК (arduino_due/host)
+ * Ровно то, что использует прошивка: типы и константы ядра, регистры
+ * периферии, Print/Stream и Serial/Serial1. Поведение (часы, UART с PDC,
+ * таймеры TC, выводы, I2C, flash) - в HostHal.cpp, управление из тестов -
+ * HostHal.h
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 2
+#define FALLING 3
+#define RISING 4
+#define HEX 16
+#define DEC 10
+#define A0 54
+#define PI 3.1415926535897932384626433832795
+
+#define VARIANT_MCK 84000000
+extern uint32_t SystemCoreClock;
+
+// ==================== РЕГИСТРЫ ====================
+
+// Регистры, за которыми стоит модель HostHal: чтение и запись - вызовы,
+// каждое чтение - шаг часов (цикл ожидания на регистре не зависает).
+// index - номер экземпляра: порт PIO (0..3) или канал TC (0..8)
+enum HostRegisterId : uint8_t {
+    HOST_REG_US_CSR = 0,
+    HOST_REG_US_BRGR,
+    HOST_REG_US_TPR,
+    HOST_REG_US_TCR,
+    HOST_REG_US_TNPR,
+    HOST_REG_US_TNCR,
+    HOST_REG_US_PTCR,
+    HOST_REG_US_PTSR,
+    HOST_REG_DWT_CTRL,
+    HOST_REG_DWT_CYCCNT,
+    HOST_REG_PIO_SODR,
+    HOST_REG_PIO_CODR,
+    HOST_REG_TC_CCR,
+    HOST_REG_TC_CV,
+    HOST_REG_TC_SR,
+    HOST_REG_TC_IER,
+    HOST_REG_TC_IDR,
+    HOST_REG_TC_IMR,
+    HOST_REG_COUNT
+};
+
+uint32_t hostRegisterRead(HostRegisterId id, uint8_t index);
+void hostRegisterWrite(HostRegisterId id, uint8_t index, uint32_t value);
+
+// (void)reg - не чтение: у класса преобразование не вызывается
+class HostRegister {
+public:
+    explicit HostRegister(HostRegisterId id, uint8_t index = 0) : id(id), index(index) {}
+
+    operator uint32_t() const { return hostRegisterRead(id, index); }
+    HostRegister& operator=(uint32_t value) {
+        hostRegisterWrite(id, index, value);
+        return *this;
+    }
+    HostRegister& operator|=(uint32_t mask) { return *this = (uint32_t)*this | mask; }
+    HostRegister& operator&=(uint32_t mask) { return *this = (uint32_t)*this & mask; }
+
+private:
+    HostRegisterId id;
+    uint8_t index;
+
+    HostRegister(const HostRegister&);
+    HostRegister& operator=(const HostRegister&);
+};
+
+// PIO: SODR/CODR - модель (фронты выводов для устройств HostHal),
+// PIO_PDSR - память, которую устройства обновляют до чтения прошивкой
+struct Pio {
+    Pio(uint8_t port) : PIO_SODR(HOST_REG_PIO_SODR, port), PIO_CODR(HOST_REG_PIO_CODR, port) {}
+
+    volatile uint32_t PIO_PER, PIO_PDR, PIO_OER, PIO_ODR;
+    HostRegister PIO_SODR;
+    HostRegister PIO_CODR;
+    volatile uint32_t PIO_ODSR, PIO_PDSR, PIO_OWER, PIO_OWDR, PIO_OWSR;
+};
+extern Pio* PIOA;
+extern Pio* PIOB;
+extern Pio* PIOC;
+extern Pio* PIOD;
+
+struct PinDescription {
+    Pio* pPort;
+    uint32_t ulPin;
+    uint32_t ulPeripheralId;
+};
+extern PinDescription g_APinDescription[];
+
+// TC: счётчик, совпадения RA/RB/RC и прерывания TCn_Handler - модель HostHal;
+// CMR и RA/RB/RC - память, модель читает их в момент расчёта совпадения
+struct TcChannel {
+    TcChannel(uint8_t channel)
+        : TC_CCR(HOST_REG_TC_CCR, channel), TC_CV(HOST_REG_TC_CV, channel),
+          TC_SR(HOST_REG_TC_SR, channel), TC_IER(HOST_REG_TC_IER, channel),
+          TC_IDR(HOST_REG_TC_IDR, channel), TC_IMR(HOST_REG_TC_IMR, channel) {}
+
+    HostRegister TC_CCR;
+    volatile uint32_t TC_CMR;
+    HostRegister TC_CV;
+    volatile uint32_t TC_RA, TC_RB, TC_RC;
+    HostRegister TC_SR;
+    HostRegister TC_IER;
+    HostRegister TC_IDR;
+    HostRegister TC_IMR;
+};
+struct Tc {
+    Tc(uint8_t block)
+        : TC_CHANNEL{ {(uint8_t)(block * 3)}, {(uint8_t)(block * 3 + 1)}, {(uint8_t)(block * 3 + 2)} } {}
+
+    TcChannel TC_CHANNEL[3];
+};
+extern Tc* TC0;
+extern Tc* TC1;
+extern Tc* TC2;
+
+#define TC_CCR_CLKEN 1u
+#define TC_CCR_CLKDIS 2u
+#define TC_CCR_SWTRG 4u
+#define TC_CMR_TCCLKS_Msk 7u
+#define TC_CMR_TCCLKS_TIMER_CLOCK1 0u
+#define TC_CMR_TCCLKS_TIMER_CLOCK2 1u
+#define TC_CMR_TCCLKS_TIMER_CLOCK3 2u
+#define TC_CMR_TCCLKS_TIMER_CLOCK4 3u
+#define TC_CMR_WAVE (1u << 15)
+#define TC_CMR_WAVSEL_UP_RC (2u << 13)
+#define TC_CMR_CPCSTOP (1u << 6)
+#define TC_IER_CPAS (1u << 2)
+#define TC_IER_CPBS (1u << 3)
+#define TC_IER_CPCS (1u << 4)
+#define TC_IDR_CPCS (1u << 4)
+#define TC_SR_CPAS (1u << 2)
+#define TC_SR_CPBS (1u << 3)
+#define TC_SR_CPCS (1u << 4)
+
+// Обработчики прерываний TC, как в CMSIS; без определения в прошивке - пустые
+extern "C" {
+void TC0_Handler(void);
+void TC1_Handler(void);
+void TC2_Handler(void);
+void TC3_Handler(void);
+void TC4_Handler(void);
+void TC5_Handler(void);
+void TC6_Handler(void);
+void TC7_Handler(void);
+void TC8_Handler(void);
+}
+
+typedef int IRQn_Type;
+enum {
+    USART0_IRQn = 17,
+    TC0_IRQn = 27, TC1_IRQn, TC2_IRQn, TC3_IRQn, TC4_IRQn, TC5_IRQn, TC6_IRQn, TC7_IRQn, TC8_IRQn
+};
+#define ID_TC0 27
+#define ID_TC3 30
+#define ID_TC4 31
+#define ID_TC5 32
+
+inline void NVIC_EnableIRQ(IRQn_Type) {}
+inline void NVIC_DisableIRQ(IRQn_Type) {}
+inline void NVIC_ClearPendingIRQ(IRQn_Type) {}
+inline void NVIC_SetPriority(IRQn_Type, uint32_t) {}
+inline uint32_t pmc_enable_periph_clk(uint32_t) { return 0; }
+inline void __NOP() {}
+inline void __disable_irq() {}
+inline void __enable_irq() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// DWT->CYCCNT идёт по часам HostHal (84 такта на мкс)
+struct DWT_Type {
+    HostRegister CTRL{HOST_REG_DWT_CTRL};
+    HostRegister CYCCNT{HOST_REG_DWT_CYCCNT};
+};
+struct CoreDebug_Type {
+    volatile uint32_t DEMCR;
+};
+extern DWT_Type* DWT;
+extern CoreDebug_Type* CoreDebug;
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+
+// USART0 (Serial1): PDC передачи и делитель скорости - модель HostHal
+struct Usart {
+    HostRegister US_CSR{HOST_REG_US_CSR};
+    HostRegister US_BRGR{HOST_REG_US_BRGR};
+    HostRegister US_TPR{HOST_REG_US_TPR};
+    HostRegister US_TCR{HOST_REG_US_TCR};
+    HostRegister US_TNPR{HOST_REG_US_TNPR};
+    HostRegister US_TNCR{HOST_REG_US_TNCR};
+    HostRegister US_PTCR{HOST_REG_US_PTCR};
+    HostRegister US_PTSR{HOST_REG_US_PTSR};
+};
+extern Usart* USART0;
+#define US_PTCR_TXTEN 0x100u
+#define US_PTCR_TXTDIS 0x200u
+#define US_CSR_ENDTX (1u << 4)
+#define US_CSR_TXEMPTY (1u << 9)
+#define US_BRGR_CD(v) ((uint32_t)(v))
+#define US_BRGR_FP(v) ((uint32_t)(v) << 16)
+
+// ==================== ЯДРО ====================
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+int analogRead(uint32_t pin);
+long pulseIn(uint32_t pin, uint32_t state, uint32_t timeout);
+void attachInterrupt(uint32_t pin, void (*handler)(void), uint32_t mode);
+void detachInterrupt(uint32_t pin);
+#define digitalPinToInterrupt(p) (p)
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+    size_t print(const char* s);
+    size_t print(char c);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println();
+    size_t println(const char* s);
+    size_t println(char c);
+    size_t println(int value, int base = DEC);
+    size_t println(unsigned int value, int base = DEC);
+    size_t println(long value, int base = DEC);
+    size_t println(unsigned long value, int base = DEC);
+    size_t println(double value, int digits = 2);
+
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+/**
+ * Serial - консоль (stdout и входная очередь HostHal),
+ * Serial1 - линия к NodeMCU: приём с буфером ядра Due (128 байт), передача байтом
+ * через тот же UART, что и PDC
+ */
+class HardwareSerial : public Stream {
+public:
+    explicit HardwareSerial(uint8_t port) : port(port) {}
+
+    void begin(unsigned long baud);
+    void end() {}
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+    void flush() override {}
+    operator bool() { return true; }
+
+private:
+    uint8_t port;
+};
+
+class UARTClass : public HardwareSerial {
+public:
+    explicit UARTClass(uint8_t port) : HardwareSerial(port) {}
+};
+
+class USARTClass : public UARTClass {
+public:
+    explicit USARTClass(uint8_t port) : UARTClass(port) {}
+};
+
+extern UARTClass Serial;
+extern USARTClass Serial1;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,17 @@
+#ifndef HOST_DUE_FLASH_STORAGE_H
+#define HOST_DUE_FLASH_STORAGE_H
+
+#include "Arduino.h"
+
+/**
+ * IFLASH1 в памяти процесса (HostHal::flash(), после старта - 0xFF как стёртая)
+ */
+class DueFlashStorage {
+public:
+    byte read(uint32_t address);
+    byte* readAddress(uint32_t address);
+    boolean write(uint32_t address, byte value);
+    boolean write(uint32_t address, byte* data, uint32_t dataLength);
+};
+
+#endif // HOST_DUE_FLASH_STORAGE_H
@@ -0,0 +1,938 @@
+#include "HostHal.h"
+#include "Wire.h"
+#include "DueFlashStorage.h"
+#include <deque>
+#include <string>
+
+uint32_t SystemCoreClock = VARIANT_MCK;
+
+static Pio pioMemory[4] = { {0}, {1}, {2}, {3} };
+Pio* PIOA = &pioMemory[0];
+Pio* PIOB = &pioMemory[1];
+Pio* PIOC = &pioMemory[2];
+Pio* PIOD = &pioMemory[3];
+
+static Tc tcMemory[3] = { {0}, {1}, {2} };
+Tc* TC0 = &tcMemory[0];
+Tc* TC1 = &tcMemory[1];
+Tc* TC2 = &tcMemory[2];
+
+static DWT_Type dwtMemory;
+static CoreDebug_Type coreDebugMemory;
+DWT_Type* DWT = &dwtMemory;
+CoreDebug_Type* CoreDebug = &coreDebugMemory;
+
+static Usart usartMemory;
+Usart* USART0 = &usartMemory;
+
+UARTClass Serial(0);
+USARTClass Serial1(1);
+TwoWire Wire;
+TwoWire Wire1;
+
+// Порт и бит вывода 0..78 - как в variant.cpp Arduino Due (у D4 и D10 - первый из двух)
+struct DuePin {
+    uint8_t port;
+    uint8_t bit;
+};
+static const DuePin DUE_PINS[] = {
+    {0, 8},  {0, 9},  {1, 25}, {2, 28}, {2, 26}, {2, 25}, {2, 24}, {2, 23}, {2, 22}, {2, 21},
+    {2, 29}, {3, 7},  {3, 8},  {1, 27}, {3, 4},  {3, 5},  {0, 13}, {0, 12}, {0, 11}, {0, 10},
+    {1, 12}, {1, 13}, {1, 26}, {0, 14}, {0, 15}, {3, 0},  {3, 1},  {3, 2},  {3, 3},  {3, 6},
+    {3, 9},  {0, 7},  {3, 10}, {2, 1},  {2, 2},  {2, 3},  {2, 4},  {2, 5},  {2, 6},  {2, 7},
+    {2, 8},  {2, 9},  {0, 19}, {0, 20}, {2, 19}, {2, 18}, {2, 17}, {2, 16}, {2, 15}, {2, 14},
+    {2, 13}, {2, 12}, {1, 21}, {1, 14}, {0, 16}, {0, 24}, {0, 23}, {0, 22}, {0, 6},  {0, 4},
+    {0, 3},  {0, 2},  {1, 17}, {1, 18}, {1, 19}, {1, 20}, {1, 15}, {1, 16}, {0, 1},  {0, 0},
+    {0, 17}, {0, 18}, {2, 30}, {0, 21}, {0, 25}, {0, 26}, {0, 27}, {0, 28}, {1, 23}
+};
+static const uint32_t DUE_PIN_COUNT = sizeof(DUE_PINS) / sizeof(DUE_PINS[0]);
+
+// Номера сверх платы остаются для тестов: без порта и бита
+static const uint32_t PIN_COUNT = 128;
+PinDescription g_APinDescription[PIN_COUNT] = {};
+static const uint8_t NO_PIN = 0xFF;
+static uint8_t pinAtBit[4][32];
+
+// ==================== СОСТОЯНИЕ ====================
+
+// Буфер приёма UARTClass ядра Due
+static const size_t DUE_RX_BUFFER_SIZE = 128;
+
+struct PendingByte {
+    uint8_t value;
+    uint32_t baud;         // скорость стороны в момент отправки
+    uint64_t arrivalNs;
+};
+
+static uint64_t nowNs = 0;
+static uint32_t cpuStepNs = 1000;
+
+static bool consoleEcho = false;
+static std::string consoleText;
+static std::deque<uint8_t> consoleRx;
+
+static HostSerialPeer* peer = nullptr;
+static uint32_t dueBaud = 115200;
+static HostSerialStats stats;
+
+// Передача Due: регистры PDC, сдвиговый регистр и байты Serial1.write() мимо PDC
+static uint32_t usBrgr = 0;
+static uint32_t pdcTpr = 0;
+static uint32_t pdcTcr = 0;
+static uint32_t pdcTnpr = 0;
+static uint32_t pdcTncr = 0;
+static bool pdcEnabled = false;
+static std::deque<uint8_t> directTx;
+static bool txActive = false;
+static uint8_t txByte = 0;
+static uint32_t txBaud = 0;
+static uint64_t txDoneNs = 0;
+
+// Приём Due: байты в пути от стороны и буфер ядра
+static std::deque<PendingByte> rxWire;
+static uint64_t rxWireFreeNs = 0;
+static std::deque<uint8_t> dueRx;
+
+static uint32_t cycleOffset = 0;
+static uint32_t dwtCtrl = 0;
+
+static int digitalInputs[PIN_COUNT];
+static int digitalOutputs[PIN_COUNT];
+static int analogInputs[PIN_COUNT];
+static long pulseWidths[PIN_COUNT];
+static void (*pinHandlers[PIN_COUNT])(void);
+static uint32_t pinInterruptModes[PIN_COUNT];
+
+static HostDevice* devices[HostHal::MAX_DEVICES];
+static size_t deviceCount = 0;
+
+static std::string consoleLine;
+static void (*consoleListener)(const char* line) = nullptr;
+
+// Каналы TC: счётчик от startNs, отработанное в периоде совпадение - lastTicks
+struct TimerState {
+    bool enabled;
+    uint64_t startNs;
+    uint32_t lastTicks;
+    uint32_t heldTicks;    // CV после CLKDIS
+    uint32_t sr;
+    uint32_t imr;
+};
+static const uint8_t TC_CHANNEL_COUNT = 9;
+static TimerState timers[TC_CHANNEL_COUNT];
+
+static uint8_t flashMemory[HostHal::FLASH_SIZE];
+
+// ==================== ЛИНИЯ ====================
+
+static uint64_t byteNs(uint32_t baud) {
+    // 8N1: 10 бит на байт
+    return (baud > 0) ? 10000000000ULL / baud : 1;
+}
+
+static uint8_t corrupt(uint8_t b) {
+    // Приёмник на другой скорости видит мусор того же объёма
+    stats.corruptedBytes++;
+    return (uint8_t)(b ^ 0x3C);
+}
+
+static void startTx() {
+    // Следующий байт в сдвиговый регистр: сначала Serial1.write(), затем PDC
+    if (txActive) {
+        return;
+    }
+    if (!directTx.empty()) {
+        txByte = directTx.front();
+        directTx.pop_front();
+    } else if (pdcEnabled && pdcTcr > 0) {
+        txByte = *(const uint8_t*)(uintptr_t)pdcTpr;
+        pdcTpr++;
+        pdcTcr--;
+        if (pdcTcr == 0 && pdcTncr > 0) {
+            pdcTpr = pdcTnpr;
+            pdcTcr = pdcTncr;
+            pdcTnpr = 0;
+            pdcTncr = 0;
+        }
+    } else {
+        return;
+    }
+    txActive = true;
+    txBaud = dueBaud;
+    txDoneNs = nowNs + byteNs(txBaud);
+}
+
+static void finishTx() {
+    txActive = false;
+    stats.bytesToPeer++;
+    if (peer != nullptr) {
+        peer->onSerialByte(peer->serialBaud() == txBaud ? txByte : corrupt(txByte));
+    }
+    startTx();
+}
+
+static void deliverRx() {
+    PendingByte b = rxWire.front();
+    rxWire.pop_front();
+    uint8_t value = b.value;
+    if (b.baud != dueBaud) {
+        value = corrupt(value);
+    }
+    if (dueRx.size() >= DUE_RX_BUFFER_SIZE) {
+        stats.rxOverruns++;
+        return;
+    }
+    dueRx.push_back(value);
+    stats.bytesToDue++;
+}
+
+// ==================== ТАЙМЕРЫ TC ====================
+
+// Погашенные обработчики (TCn_Handler без определения в прошивке)
+extern "C" {
+__attribute__((weak)) void TC0_Handler(void) {}
+__attribute__((weak)) void TC1_Handler(void) {}
+__attribute__((weak)) void TC2_Handler(void) {}
+__attribute__((weak)) void TC3_Handler(void) {}
+__attribute__((weak)) void TC4_Handler(void) {}
+__attribute__((weak)) void TC5_Handler(void) {}
+__attribute__((weak)) void TC6_Handler(void) {}
+__attribute__((weak)) void TC7_Handler(void) {}
+__attribute__((weak)) void TC8_Handler(void) {}
+}
+
+static void (*const tcHandlers[TC_CHANNEL_COUNT])(void) = {
+    TC0_Handler, TC1_Handler, TC2_Handler, TC3_Handler, TC4_Handler,
+    TC5_Handler, TC6_Handler, TC7_Handler, TC8_Handler
+};
+
+static TcChannel& tcChannel(uint8_t ch) {
+    return tcMemory[ch / 3].TC_CHANNEL[ch % 3];
+}
+
+static uint64_t tcTicksToNs(uint8_t ch, uint64_t ticks) {
+    // TIMER_CLOCK1..4 = MCK/2, /8, /32, /128
+    static const uint32_t DIVIDERS[4] = { 2, 8, 32, 128 };
+    uint32_t clks = tcChannel(ch).TC_CMR & TC_CMR_TCCLKS_Msk;
+    uint32_t divider = (clks < 4) ? DIVIDERS[clks] : 128;
+    return ticks * divider * 1000 / (VARIANT_MCK / 1000000);
+}
+
+static uint32_t tcNsToTicks(uint8_t ch, uint64_t ns) {
+    uint64_t perTick = tcTicksToNs(ch, 1000);
+    return (uint32_t)(ns * 1000 / (perTick > 0 ? perTick : 1));
+}
+
+/**
+ * Ближайшее совпадение канала (режим WAVSEL_UP_RC - единственный в прошивке):
+ * RA/RB - если их прерывание разрешено и они раньше RC, RC - всегда (сброс счётчика)
+ */
+static bool tcNextCompare(uint8_t ch, uint64_t& atNs, uint32_t& ticks, uint32_t& flag) {
+    const TimerState& t = timers[ch];
+    if (!t.enabled) {
+        return false;
+    }
+    TcChannel& regs = tcChannel(ch);
+    uint32_t rc = regs.TC_RC;
+    ticks = (rc > t.lastTicks) ? rc : t.lastTicks + 1;
+    flag = TC_SR_CPCS;
+    uint32_t ra = regs.TC_RA;
+    uint32_t rb = regs.TC_RB;
+    if ((t.imr & TC_SR_CPAS) && ra > t.lastTicks && ra < ticks) {
+        ticks = ra;
+        flag = TC_SR_CPAS;
+    }
+    if ((t.imr & TC_SR_CPBS) && rb > t.lastTicks && rb < ticks) {
+        ticks = rb;
+        flag = TC_SR_CPBS;
+    }
+    atNs = t.startNs + tcTicksToNs(ch, ticks);
+    return true;
+}
+
+static void tcFire(uint8_t ch, uint32_t ticks, uint32_t flag) {
+    // Состояние - до обработчика: его чтения регистров двигают часы дальше
+    TimerState& t = timers[ch];
+    t.sr |= flag;
+    if (flag == TC_SR_CPCS) {
+        t.startNs += tcTicksToNs(ch, ticks);
+        t.lastTicks = 0;
+        if (tcChannel(ch).TC_CMR & TC_CMR_CPCSTOP) {
+            t.enabled = false;
+            t.heldTicks = 0;
+        }
+    } else {
+        t.lastTicks = ticks;
+    }
+    if (t.imr & flag) {
+        tcHandlers[ch]();
+    }
+}
+
+static void advanceTo(uint64_t targetNs) {
+    // События по порядку: конец байта передачи, приход байта, таймер стороны,
+    // совпадение TC, таймер устройства
+    while (true) {
+        uint64_t next = UINT64_MAX;
+        uint8_t kind = 0;
+        uint8_t source = 0;
+        uint32_t tcTicks = 0;
+        uint32_t tcFlag = 0;
+        if (txActive && txDoneNs < next) {
+            next = txDoneNs;
+            kind = 1;
+        }
+        if (!rxWire.empty() && rxWire.front().arrivalNs < next) {
+            next = rxWire.front().arrivalNs;
+            kind = 2;
+        }
+        if (peer != nullptr) {
+            uint64_t timer = peer->nextEventMicros();
+            if (timer != UINT64_MAX && timer * 1000 < next) {
+                next = timer * 1000;
+                kind = 3;
+            }
+        }
+        for (uint8_t ch = 0; ch < TC_CHANNEL_COUNT; ch++) {
+            uint64_t at;
+            uint32_t ticks, flag;
+            if (tcNextCompare(ch, at, ticks, flag) && at < next) {
+                next = at;
+                kind = 4;
+                source = ch;
+                tcTicks = ticks;
+                tcFlag = flag;
+            }
+        }
+        for (size_t i = 0; i < deviceCount; i++) {
+            uint64_t timer = devices[i]->nextEventMicros();
+            if (timer != UINT64_MAX && timer * 1000 < next) {
+                next = timer * 1000;
+                kind = 5;
+                source = (uint8_t)i;
+            }
+        }
+        if (kind == 0 || next > targetNs) {
+            break;
+        }
+        if (next > nowNs) {
+            nowNs = next;
+        }
+        if (kind == 1) {
+            finishTx();
+        } else if (kind == 2) {
+            deliverRx();
+        } else if (kind == 3) {
+            peer->onTime(nowNs / 1000);
+        } else if (kind == 4) {
+            tcFire(source, tcTicks, tcFlag);
+        } else {
+            devices[source]->onTime(nowNs / 1000);
+        }
+    }
+    if (targetNs > nowNs) {
+        nowNs = targetNs;
+    }
+}
+
+static void cpuStep() {
+    advanceTo(nowNs + cpuStepNs);
+}
+
+// ==================== РЕГИСТРЫ ====================
+
+// ==================== ВЫВОДЫ ====================
+
+static void setOutput(uint32_t pin, int level) {
+    if (digitalOutputs[pin] == level) {
+        return;
+    }
+    digitalOutputs[pin] = level;
+    for (size_t i = 0; i < deviceCount; i++) {
+        devices[i]->onPinOutput(pin, level);
+    }
+}
+
+static void writePortBits(uint8_t port, uint32_t mask, int level) {
+    Pio& pio = pioMemory[port];
+    pio.PIO_ODSR = (level == HIGH) ? (pio.PIO_ODSR | mask) : (pio.PIO_ODSR & ~mask);
+    while (mask != 0) {
+        uint8_t bit = (uint8_t)__builtin_ctz(mask);
+        mask &= mask - 1;
+        if (pinAtBit[port][bit] != NO_PIN) {
+            setOutput(pinAtBit[port][bit], level);
+        }
+    }
+}
+
+// ==================== РЕГИСТРЫ ====================
+
+uint32_t hostRegisterRead(HostRegisterId id, uint8_t index) {
+    cpuStep();
+    switch (id) {
+        case HOST_REG_US_CSR: {
+            uint32_t csr = 0;
+            if (pdcTcr == 0) {
+                csr |= US_CSR_ENDTX;
+            }
+            if (!txActive && pdcTcr == 0 && pdcTncr == 0 && directTx.empty()) {
+                csr |= US_CSR_TXEMPTY;
+            }
+            return csr;
+        }
+        case HOST_REG_US_BRGR:   return usBrgr;
+        case HOST_REG_US_TPR:    return pdcTpr;
+        case HOST_REG_US_TCR:    return pdcTcr;
+        case HOST_REG_US_TNPR:   return pdcTnpr;
+        case HOST_REG_US_TNCR:   return pdcTncr;
+        case HOST_REG_US_PTCR:   return 0;
+        case HOST_REG_US_PTSR:   return pdcEnabled ? 1u : 0u;
+        case HOST_REG_DWT_CTRL:  return dwtCtrl;
+        case HOST_REG_DWT_CYCCNT:
+            return (uint32_t)(nowNs * (VARIANT_MCK / 1000000) / 1000) - cycleOffset;
+        case HOST_REG_TC_CV: {
+            const TimerState& t = timers[index % TC_CHANNEL_COUNT];
+            return t.enabled ? tcNsToTicks(index % TC_CHANNEL_COUNT, nowNs - t.startNs) : t.heldTicks;
+        }
+        case HOST_REG_TC_SR: {
+            // Флаги совпадений сбрасываются чтением
+            TimerState& t = timers[index % TC_CHANNEL_COUNT];
+            uint32_t sr = t.sr;
+            t.sr = 0;
+            return sr;
+        }
+        case HOST_REG_TC_IMR:
+            return timers[index % TC_CHANNEL_COUNT].imr;
+        default:
+            // PIO_SODR/PIO_CODR, TC_CCR/IER/IDR - только запись
+            return 0;
+    }
+}
+
+static void writeTimerControl(uint8_t ch, uint32_t value) {
+    TimerState& t = timers[ch];
+    if (value & TC_CCR_CLKDIS) {
+        if (t.enabled) {
+            t.heldTicks = tcNsToTicks(ch, nowNs - t.startNs);
+        }
+        t.enabled = false;
+    } else if ((value & TC_CCR_CLKEN) && !t.enabled) {
+        // Счёт продолжается с остановленного значения
+        t.enabled = true;
+        t.startNs = nowNs - tcTicksToNs(ch, t.heldTicks);
+    }
+    if (value & TC_CCR_SWTRG) {
+        t.startNs = nowNs;
+        t.lastTicks = 0;
+        t.heldTicks = 0;
+    }
+}
+
+void hostRegisterWrite(HostRegisterId id, uint8_t index, uint32_t value) {
+    switch (id) {
+        case HOST_REG_PIO_SODR: writePortBits(index % 4, value, HIGH); return;
+        case HOST_REG_PIO_CODR: writePortBits(index % 4, value, LOW); return;
+        case HOST_REG_TC_CCR:   writeTimerControl(index % TC_CHANNEL_COUNT, value); return;
+        case HOST_REG_TC_IER:   timers[index % TC_CHANNEL_COUNT].imr |= value; return;
+        case HOST_REG_TC_IDR:   timers[index % TC_CHANNEL_COUNT].imr &= ~value; return;
+        case HOST_REG_US_BRGR: usBrgr = value; break;
+        case HOST_REG_US_TPR:  pdcTpr = value; break;
+        case HOST_REG_US_TCR:  pdcTcr = value; break;
+        case HOST_REG_US_TNPR: pdcTnpr = value; break;
+        case HOST_REG_US_TNCR: pdcTncr = value; break;
+        case HOST_REG_US_PTCR:
+            if (value & US_PTCR_TXTDIS) {
+                pdcEnabled = false;
+            }
+            if (value & US_PTCR_TXTEN) {
+                pdcEnabled = true;
+            }
+            break;
+        case HOST_REG_DWT_CTRL:
+            dwtCtrl = value;
+            break;
+        case HOST_REG_DWT_CYCCNT:
+            cycleOffset = (uint32_t)(nowNs * (VARIANT_MCK / 1000000) / 1000) - value;
+            break;
+        default:
+            break;
+    }
+    startTx();
+}
+
+// ==================== ЯДРО ====================
+
+uint32_t millis() {
+    cpuStep();
+    return (uint32_t)(nowNs / 1000000);
+}
+
+uint32_t micros() {
+    cpuStep();
+    return (uint32_t)(nowNs / 1000);
+}
+
+void delay(uint32_t ms) {
+    advanceTo(nowNs + (uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    advanceTo(nowNs + (uint64_t)us * 1000);
+}
+
+void yield() {
+    cpuStep();
+}
+
+void pinMode(uint32_t, uint32_t) {}
+
+void digitalWrite(uint32_t pin, uint32_t value) {
+    if (pin >= PIN_COUNT) {
+        return;
+    }
+    // Как у ядра: через SODR/CODR порта вывода
+    const PinDescription& desc = g_APinDescription[pin];
+    if (desc.ulPin != 0) {
+        desc.pPort->PIO_ODSR = value ? (desc.pPort->PIO_ODSR | desc.ulPin) : (desc.pPort->PIO_ODSR & ~desc.ulPin);
+    }
+    setOutput(pin, value ? HIGH : LOW);
+}
+
+int digitalRead(uint32_t pin) {
+    return (pin < PIN_COUNT) ? digitalInputs[pin] : LOW;
+}
+
+int analogRead(uint32_t pin) {
+    return (pin < PIN_COUNT) ? analogInputs[pin] : 0;
+}
+
+long pulseIn(uint32_t pin, uint32_t, uint32_t timeout) {
+    long width = (pin < PIN_COUNT) ? pulseWidths[pin] : 0;
+    // Без импульса pulseIn ждёт весь таймаут
+    delayMicroseconds(width > 0 ? (uint32_t)width : timeout);
+    return width;
+}
+
+void attachInterrupt(uint32_t pin, void (*handler)(void), uint32_t mode) {
+    if (pin < PIN_COUNT) {
+        pinHandlers[pin] = handler;
+        pinInterruptModes[pin] = mode;
+    }
+}
+
+void detachInterrupt(uint32_t pin) {
+    if (pin < PIN_COUNT) {
+        pinHandlers[pin] = nullptr;
+    }
+}
+
+// ==================== PRINT ====================
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size-- > 0) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+static size_t printNumber(Print& out, unsigned long value, int base) {
+    char digits[8 * sizeof(long) + 1];
+    if (base == HEX) {
+        snprintf(digits, sizeof(digits), "%lX", value);
+    } else {
+        snprintf(digits, sizeof(digits), "%lu", value);
+    }
+    return out.write(digits);
+}
+
+static size_t printSigned(Print& out, long value, int base) {
+    if (base == DEC && value < 0) {
+        return out.write((uint8_t)'-') + printNumber(out, (unsigned long)(-(value + 1)) + 1, DEC);
+    }
+    // Как в ядре Arduino: HEX отрицательного - его дополнительный код
+    return printNumber(out, (unsigned long)value, base);
+}
+
+size_t Print::print(const char* s) { return write(s); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(int value, int base) {
+    return (base == DEC) ? printSigned(*this, value, base) : printNumber(*this, (unsigned int)value, base);
+}
+size_t Print::print(unsigned int value, int base) { return printNumber(*this, value, base); }
+size_t Print::print(long value, int base) { return printSigned(*this, value, base); }
+size_t Print::print(unsigned long value, int base) { return printNumber(*this, value, base); }
+size_t Print::print(double value, int digits) {
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text);
+}
+
+size_t Print::println() { return write("\r\n"); }
+size_t Print::println(const char* s) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(int value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned int value, int base) { return print(value, base) + println(); }
+size_t Print::println(long value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned long value, int base) { return print(value, base) + println(); }
+size_t Print::println(double value, int digits) { return print(value, digits) + println(); }
+
+// ==================== SERIAL ====================
+
+void HardwareSerial::begin(unsigned long baud) {
+    if (port == 0) {
+        return;
+    }
+    // Как UARTClass::begin(): новый делитель, PDC выключен, буфер приёма пуст
+    dueBaud = (uint32_t)baud;
+    pdcEnabled = false;
+    pdcTcr = 0;
+    pdcTncr = 0;
+    directTx.clear();
+    dueRx.clear();
+}
+
+int HardwareSerial::available() {
+    cpuStep();
+    return (int)((port == 0) ? consoleRx.size() : dueRx.size());
+}
+
+int HardwareSerial::read() {
+    std::deque<uint8_t>& rx = (port == 0) ? consoleRx : dueRx;
+    if (rx.empty()) {
+        return -1;
+    }
+    uint8_t c = rx.front();
+    rx.pop_front();
+    return c;
+}
+
+int HardwareSerial::peek() {
+    std::deque<uint8_t>& rx = (port == 0) ? consoleRx : dueRx;
+    return rx.empty() ? -1 : rx.front();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (port == 0) {
+        consoleText.push_back((char)c);
+        if (consoleEcho) {
+            putchar(c);
+        }
+        if (c == '\n') {
+            if (consoleListener != nullptr) {
+                consoleListener(consoleLine.c_str());
+            }
+            consoleLine.clear();
+        } else if (c != '\r') {
+            consoleLine.push_back((char)c);
+        }
+        return 1;
+    }
+    directTx.push_back(c);
+    startTx();
+    return 1;
+}
+
+// ==================== I2C ====================
+
+TwoWire::TwoWire()
+    : deviceCount(0), clockHz(100000), txAddress(0), txLength(0), rxLength(0), rxPos(0) {}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address;
+    txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t b) {
+    if (txLength >= BUFFER_LENGTH) {
+        return 0;
+    }
+    txBuffer[txLength++] = b;
+    return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+    HostI2cDevice* device = find(txAddress);
+    if (device == nullptr) {
+        busTime(1);
+        return 2;   // NACK адреса
+    }
+    busTime(1 + txLength);
+    return device->i2cWrite(txBuffer, txLength) ? 0 : 3;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t) {
+    rxLength = 0;
+    rxPos = 0;
+    HostI2cDevice* device = find(address);
+    if (device == nullptr) {
+        busTime(1);
+        return 0;
+    }
+    rxLength = device->i2cRead(rxBuffer, (quantity < BUFFER_LENGTH) ? quantity : BUFFER_LENGTH);
+    busTime(1 + rxLength);
+    return (uint8_t)rxLength;
+}
+
+int TwoWire::available() {
+    return (int)(rxLength - rxPos);
+}
+
+int TwoWire::read() {
+    return (rxPos < rxLength) ? rxBuffer[rxPos++] : -1;
+}
+
+int TwoWire::peek() {
+    return (rxPos < rxLength) ? rxBuffer[rxPos] : -1;
+}
+
+void TwoWire::attachDevice(uint8_t address, HostI2cDevice* device) {
+    if (deviceCount < MAX_DEVICES) {
+        devices[deviceCount].address = address;
+        devices[deviceCount].device = device;
+        deviceCount++;
+    }
+}
+
+void TwoWire::detachAll() {
+    deviceCount = 0;
+}
+
+HostI2cDevice* TwoWire::find(uint8_t address) const {
+    for (uint8_t i = 0; i < deviceCount; i++) {
+        if (devices[i].address == address) {
+            return devices[i].device;
+        }
+    }
+    return nullptr;
+}
+
+void TwoWire::busTime(size_t bytes) {
+    // Байт - 8 бит и ACK, старт со стопом - ещё такт
+    uint32_t hz = (clockHz > 0) ? clockHz : 100000;
+    HostHal::advanceNanos(((uint64_t)bytes * 9 + 1) * 1000000000ULL / hz);
+}
+
+// ==================== FLASH ====================
+
+byte DueFlashStorage::read(uint32_t address) {
+    return (address < HostHal::FLASH_SIZE) ? flashMemory[address] : 0xFF;
+}
+
+byte* DueFlashStorage::readAddress(uint32_t address) {
+    return flashMemory + ((address < HostHal::FLASH_SIZE) ? address : 0);
+}
+
+boolean DueFlashStorage::write(uint32_t address, byte value) {
+    return write(address, &value, 1);
+}
+
+boolean DueFlashStorage::write(uint32_t address, byte* data, uint32_t dataLength) {
+    if (address + dataLength > HostHal::FLASH_SIZE) {
+        return false;
+    }
+    memcpy(flashMemory + address, data, dataLength);
+    return true;
+}
+
+// ==================== HostHal ====================
+
+void HostHal::reset() {
+    // PDC получает адреса как uint32_t: статические буферы прошивки должны лежать ниже 4 ГБ
+    static uint8_t probe;
+    if ((uintptr_t)&probe > 0xFFFFFFFFu) {
+        fprintf(stderr, "HostHal: static data above 4 GB, link with -no-pie\n");
+        abort();
+    }
+
+    nowNs = 0;
+    cpuStepNs = 1000;
+    consoleText.clear();
+    consoleRx.clear();
+    consoleLine.clear();
+    consoleListener = nullptr;
+    peer = nullptr;
+    dueBaud = 115200;
+    memset(&stats, 0, sizeof(stats));
+
+    usBrgr = 0;
+    pdcTpr = 0;
+    pdcTcr = 0;
+    pdcTnpr = 0;
+    pdcTncr = 0;
+    pdcEnabled = false;
+    directTx.clear();
+    txActive = false;
+    rxWire.clear();
+    rxWireFreeNs = 0;
+    dueRx.clear();
+    cycleOffset = 0;
+    dwtCtrl = 0;
+
+    deviceCount = 0;
+    Wire.detachAll();
+    Wire1.detachAll();
+
+    memset(pinAtBit, NO_PIN, sizeof(pinAtBit));
+    for (uint32_t pin = 0; pin < PIN_COUNT; pin++) {
+        if (pin < DUE_PIN_COUNT) {
+            g_APinDescription[pin].pPort = &pioMemory[DUE_PINS[pin].port];
+            g_APinDescription[pin].ulPin = 1u << DUE_PINS[pin].bit;
+            pinAtBit[DUE_PINS[pin].port][DUE_PINS[pin].bit] = (uint8_t)pin;
+        } else {
+            g_APinDescription[pin].pPort = PIOD;
+            g_APinDescription[pin].ulPin = 0;
+        }
+        g_APinDescription[pin].ulPeripheralId = 0;
+        digitalInputs[pin] = LOW;
+        digitalOutputs[pin] = LOW;
+        analogInputs[pin] = 0;
+        pulseWidths[pin] = 0;
+        pinHandlers[pin] = nullptr;
+        pinInterruptModes[pin] = CHANGE;
+    }
+    for (Pio& pio : pioMemory) {
+        pio.PIO_PER = 0;
+        pio.PIO_PDR = 0;
+        pio.PIO_OER = 0;
+        pio.PIO_ODR = 0;
+        pio.PIO_ODSR = 0;
+        pio.PIO_PDSR = 0;
+        pio.PIO_OWER = 0;
+        pio.PIO_OWDR = 0;
+        pio.PIO_OWSR = 0;
+    }
+    for (uint8_t ch = 0; ch < TC_CHANNEL_COUNT; ch++) {
+        TcChannel& regs = tcChannel(ch);
+        regs.TC_CMR = 0;
+        regs.TC_RA = 0;
+        regs.TC_RB = 0;
+        regs.TC_RC = 0;
+    }
+    memset(timers, 0, sizeof(timers));
+    memset(flashMemory, 0xFF, sizeof(flashMemory));
+}
+
+uint64_t HostHal::nanos() {
+    return nowNs;
+}
+
+void HostHal::advanceMicros(uint64_t us) {
+    advanceTo(nowNs + us * 1000);
+}
+
+void HostHal::advanceNanos(uint64_t ns) {
+    advanceTo(nowNs + ns);
+}
+
+void HostHal::setCpuStepNs(uint32_t ns) {
+    cpuStepNs = ns;
+}
+
+void HostHal::setConsoleEcho(bool on) {
+    consoleEcho = on;
+}
+
+const std::string& HostHal::console() {
+    return consoleText;
+}
+
+void HostHal::clearConsole() {
+    consoleText.clear();
+}
+
+void HostHal::consoleInput(const char* text) {
+    while (*text != '\0') {
+        consoleRx.push_back((uint8_t)*text++);
+    }
+}
+
+void HostHal::setConsoleListener(void (*listener)(const char* line)) {
+    consoleListener = listener;
+}
+
+void HostHal::attachSerial1(HostSerialPeer* serialPeer) {
+    peer = serialPeer;
+}
+
+void HostHal::sendToDue(const uint8_t* data, size_t len) {
+    // Уже отправленное уходит на прежней скорости (как Serial.flush() перед сменой)
+    uint32_t baud = (peer != nullptr) ? peer->serialBaud() : dueBaud;
+    uint64_t step = byteNs(baud);
+    uint64_t t = (rxWireFreeNs > nowNs) ? rxWireFreeNs : nowNs;
+    for (size_t i = 0; i < len; i++) {
+        t += step;
+        PendingByte b = { data[i], baud, t };
+        rxWire.push_back(b);
+    }
+    rxWireFreeNs = t;
+}
+
+uint32_t HostHal::serial1Baud() {
+    return dueBaud;
+}
+
+HostSerialStats HostHal::serial1Stats() {
+    return stats;
+}
+
+void HostHal::attachDevice(HostDevice* device) {
+    if (deviceCount < MAX_DEVICES) {
+        devices[deviceCount++] = device;
+    }
+}
+
+void HostHal::setDigitalInput(uint32_t pin, int value) {
+    if (pin >= PIN_COUNT) {
+        return;
+    }
+    int level = value ? HIGH : LOW;
+    int previous = digitalInputs[pin];
+    digitalInputs[pin] = level;
+    const PinDescription& desc = g_APinDescription[pin];
+    if (desc.ulPin != 0) {
+        desc.pPort->PIO_PDSR = level ? (desc.pPort->PIO_PDSR | desc.ulPin) : (desc.pPort->PIO_PDSR & ~desc.ulPin);
+    }
+    if (level == previous || pinHandlers[pin] == nullptr) {
+        return;
+    }
+    uint32_t mode = pinInterruptModes[pin];
+    if (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)) {
+        pinHandlers[pin]();
+    }
+}
+
+void HostHal::setAnalogInput(uint32_t pin, int value) {
+    if (pin < PIN_COUNT) {
+        analogInputs[pin] = value;
+    }
+}
+
+int HostHal::digitalOutput(uint32_t pin) {
+    return (pin < PIN_COUNT) ? digitalOutputs[pin] : LOW;
+}
+
+void HostHal::setPulseWidth(uint32_t pin, long us) {
+    if (pin < PIN_COUNT) {
+        pulseWidths[pin] = us;
+    }
+}
+
+void HostHal::triggerInterrupt(uint32_t pin) {
+    if (pin < PIN_COUNT && pinHandlers[pin] != nullptr) {
+        pinHandlers[pin]();
+    }
+}
+
+bool HostHal::timerRunning(uint8_t channel) {
+    return channel < TC_CHANNEL_COUNT && timers[channel].enabled;
+}
+
+uint8_t* HostHal::flash() {
+    return flashMemory;
+}
+
+// Раскладка выводов нужна уже конструкторам глобальных объектов прошивки
+static struct HostHalInit {
+    HostHalInit() { HostHal::reset(); }
+} hostHalInit;
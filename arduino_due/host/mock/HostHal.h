@@ -0,0 +1,181 @@
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include "Arduino.h"
+#include <string>
+
+/**
+ * Вторая сторона Serial1 (модель NodeMCU в sim/NodeMcuSim.h)
+ * Байты от Due приходят по одному в момент окончания стоп-бита;
+ * таймеры стороны - через nextEventMicros()/onTime()
+ */
+class HostSerialPeer {
+public:
+    virtual ~HostSerialPeer() {}
+
+    /**
+     * Принят байт от Due (при разных скоростях сторон - уже испорченный)
+     */
+    virtual void onSerialByte(uint8_t b) = 0;
+
+    /**
+     * Текущая скорость стороны, бод
+     */
+    virtual uint32_t serialBaud() const = 0;
+
+    /**
+     * Время ближайшего таймера стороны, мкс (UINT64_MAX - нет)
+     */
+    virtual uint64_t nextEventMicros() const { return UINT64_MAX; }
+
+    /**
+     * Наступило время nextEventMicros()
+     */
+    virtual void onTime(uint64_t /*nowMicros*/) {}
+};
+
+/**
+ * Устройство на выводах платы (модели в sim/: камера, дальномер)
+ * Видит фронты выходов Due (digitalWrite и PIO_SODR/PIO_CODR), отвечает
+ * через HostHal::setDigitalInput(); таймеры - как у HostSerialPeer
+ */
+class HostDevice {
+public:
+    virtual ~HostDevice() {}
+
+    /**
+     * Выход Due сменил уровень
+     */
+    virtual void onPinOutput(uint32_t /*pin*/, int /*level*/) {}
+
+    /**
+     * Время ближайшего таймера устройства, мкс (UINT64_MAX - нет)
+     */
+    virtual uint64_t nextEventMicros() const { return UINT64_MAX; }
+
+    /**
+     * Наступило время nextEventMicros()
+     */
+    virtual void onTime(uint64_t /*nowMicros*/) {}
+};
+
+// Счётчики линии Serial1
+struct HostSerialStats {
+    uint32_t bytesToPeer;        // ушло от Due
+    uint32_t bytesToDue;         // принято Due (в буфер ядра)
+    uint32_t corruptedBytes;     // пришло при разных скоростях сторон
+    uint32_t rxOverruns;         // потеряно: буфер приёма Due (128 байт) полон
+};
+
+/**
+ * Модель платы для сборки на ПК
+ * Часы виртуальные: идут только вперёд, при вызове delay()/advanceMicros()
+ * и на шаг cpuStepNs при каждом millis()/micros() и чтении регистра -
+ * так циклы ожидания прошивки не зависают, а время не зависит от скорости ПК.
+ * Serial1 - UART с PDC передачи (USART0), скоростью из Serial1.begin() и
+ * буфером приёма ядра Due; вторая сторона - HostSerialPeer.
+ * Таймеры TC считают по MCK и вызывают TCn_Handler на совпадениях RA/RB/RC;
+ * выводы - раскладка variant.cpp Due, входы с attachInterrupt() вызывают
+ * обработчик на фронтах, устройства на выводах и I2C - HostDevice/HostI2cDevice
+ */
+class HostHal {
+public:
+    /**
+     * Начальное состояние: часы 0, flash стёрта, линии и выводы пусты
+     */
+    static void reset();
+
+    // ==================== ЧАСЫ ====================
+
+    static uint64_t nanos();
+    static uint64_t micros64() { return nanos() / 1000; }
+
+    /**
+     * Продвинуть часы, обработав по порядку все события линии и таймеры стороны
+     */
+    static void advanceMicros(uint64_t us);
+    static void advanceNanos(uint64_t ns);
+
+    /**
+     * Шаг часов на каждое millis()/micros()/чтение регистра, нс (по умолчанию 1000)
+     */
+    static void setCpuStepNs(uint32_t ns);
+
+    // ==================== КОНСОЛЬ (Serial) ====================
+
+    /**
+     * Дублировать вывод Serial в stdout
+     */
+    static void setConsoleEcho(bool on);
+
+    /**
+     * Накопленный вывод Serial (с последнего clearConsole())
+     */
+    static const std::string& console();
+    static void clearConsole();
+
+    /**
+     * Строка во входной буфер Serial (команды SerialCommandProcessor)
+     */
+    static void consoleInput(const char* text);
+
+    /**
+     * Вызывать для каждой законченной строки Serial (без \r\n), nullptr - снять
+     */
+    static void setConsoleListener(void (*listener)(const char* line));
+
+    // ==================== SERIAL1 ====================
+
+    static void attachSerial1(HostSerialPeer* peer);
+
+    /**
+     * Байты от стороны к Due на её скорости, следом за уже отправленными
+     */
+    static void sendToDue(const uint8_t* data, size_t len);
+
+    /**
+     * Скорость Due (последний Serial1.begin()), бод
+     */
+    static uint32_t serial1Baud();
+
+    static HostSerialStats serial1Stats();
+
+    // ==================== ВЫВОДЫ И FLASH ====================
+
+    /**
+     * Устройство на выводах (до MAX_DEVICES, снимаются в reset())
+     */
+    static void attachDevice(HostDevice* device);
+    static const size_t MAX_DEVICES = 4;
+
+    /**
+     * Уровень входа: бит в PIO_PDSR порта; смена уровня - фронт для
+     * обработчика attachInterrupt() (по режиму CHANGE/RISING/FALLING)
+     */
+    static void setDigitalInput(uint32_t pin, int value);
+    static void setAnalogInput(uint32_t pin, int value);
+    static int digitalOutput(uint32_t pin);
+
+    /**
+     * Длительность импульса для pulseIn(), мкс (0 - нет импульса)
+     */
+    static void setPulseWidth(uint32_t pin, long us);
+
+    /**
+     * Вызвать обработчик attachInterrupt() вывода
+     */
+    static void triggerInterrupt(uint32_t pin);
+
+    /**
+     * Таймер TC канала (0..8) включён (CLKEN без последующего CLKDIS)
+     */
+    static bool timerRunning(uint8_t channel);
+
+    /**
+     * Память IFLASH1 (адреса DueFlashStorage)
+     */
+    static uint8_t* flash();
+    static const size_t FLASH_SIZE = 256 * 1024;
+};
+
+#endif // HOST_HAL_H
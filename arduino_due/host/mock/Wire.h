@@ -0,0 +1,75 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+/**
+ * Устройство на шине TwoWire модели (камера SCCB в sim/Ov7670Sim.h)
+ * Передача - одна запись с адресом до стопа; чтение - requestFrom()
+ */
+class HostI2cDevice {
+public:
+    virtual ~HostI2cDevice() {}
+
+    /**
+     * Принятые после адреса байты; false - NACK данных
+     */
+    virtual bool i2cWrite(const uint8_t* data, size_t len) = 0;
+
+    /**
+     * Заполнить out (до len байт), вернуть число выданных
+     */
+    virtual size_t i2cRead(uint8_t* out, size_t len) = 0;
+};
+
+/**
+ * I2C: устройства подключает модель (attachDevice), без устройства по адресу -
+ * NACK адреса. Передача занимает время шины: 9 тактов на байт по setClock()
+ */
+class TwoWire : public Stream {
+public:
+    static const size_t BUFFER_LENGTH = 32;   // буфер Wire ядра Due
+    static const uint8_t MAX_DEVICES = 4;
+
+    TwoWire();
+
+    void begin() {}
+    void setClock(uint32_t hz) { clockHz = hz; }
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool stop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t stop = 1);
+    size_t write(uint8_t b) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+
+    // ==================== МОДЕЛЬ ====================
+
+    void attachDevice(uint8_t address, HostI2cDevice* device);
+    void detachAll();
+
+private:
+    struct Slot {
+        uint8_t address;
+        HostI2cDevice* device;
+    };
+
+    Slot devices[MAX_DEVICES];
+    uint8_t deviceCount;
+    uint32_t clockHz;
+    uint8_t txAddress;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    size_t txLength;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    size_t rxLength;
+    size_t rxPos;
+
+    HostI2cDevice* find(uint8_t address) const;
+    void busTime(size_t bytes);
+};
+
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+#endif // HOST_WIRE_H
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+Выгрузка сессии с сервера для due_replay
+
+Читает /metrics и /llm-log, скачивает кадры /images/{filename} и пишет
+каталог: steps.tsv (строка на шаг) и кадры PGM (P5, серый).
+Шаги с подставленным кадром (image_reused) и без кадра получают '-':
+due_replay оставляет сцену прошлого шага.
+
+    python3 fetch_session.py --server http://localhost:8000 OUT_DIR
+
+Сервер хранит последние шаги в памяти (MAX_METRICS_HISTORY, MAX_LLM_LOG)
+и кадры на диске (MAX_SAVED_IMAGES) - выгружать сразу после заезда.
+"""
+
+import argparse
+import json
+import os
+import sys
+import urllib.error
+import urllib.request
+from datetime import datetime
+from io import BytesIO
+
+# Размеры кадров прошивки для .raw (сервер без Pillow): байт -> (ширина, высота)
+RAW_SIZES = {
+    160 * 120: (160, 120),
+    80 * 60: (80, 60),
+    160 * 40: (160, 40),
+}
+
+DEFAULT_DURATION_MS = 1000
+
+
+def fetch(server, path):
+    with urllib.request.urlopen(server.rstrip("/") + path, timeout=30) as resp:
+        return resp.read()
+
+
+def fetch_json(server, path):
+    return json.loads(fetch(server, path).decode("utf-8"))
+
+
+def decode_image(filename, data):
+    """Байты файла сервера -> (ширина, высота, серые пиксели) или None"""
+    if filename.endswith(".raw"):
+        size = RAW_SIZES.get(len(data))
+        if size is None:
+            return None
+        return size[0], size[1], data
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("fetch_session: PNG frames need Pillow (pip install pillow)")
+    img = Image.open(BytesIO(data)).convert("L")
+    return img.width, img.height, img.tobytes()
+
+
+def write_pgm(path, width, height, pixels):
+    with open(path, "wb") as f:
+        f.write(b"P5 %d %d 255\n" % (width, height))
+        f.write(pixels)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Выгрузка сессии для due_replay")
+    parser.add_argument("out_dir", help="каталог сессии (steps.tsv и кадры)")
+    parser.add_argument("--server", default="http://localhost:8000")
+    parser.add_argument("--session", type=int, default=None,
+                        help="session_id (по умолчанию - последней записи)")
+    parser.add_argument("--limit", type=int, default=1000, help="сколько последних записей запросить")
+    args = parser.parse_args()
+
+    metrics = fetch_json(args.server, "/metrics?limit=%d" % args.limit)["metrics"]
+    llm = fetch_json(args.server, "/llm-log?limit=%d" % args.limit)["entries"]
+    if not metrics:
+        sys.exit("fetch_session: no metrics on server")
+
+    session = args.session if args.session is not None else metrics[-1]["session_id"]
+    rows = [m for m in metrics if m["session_id"] == session]
+    # Повтор DATA (потеря ответа) даёт вторую запись шага: берём первую
+    by_step = {}
+    for m in rows:
+        by_step.setdefault(m["step"], m)
+    replies = {}
+    for e in llm:
+        if e.get("session_id") == session:
+            replies[e["step"]] = e
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    first_received = None
+    frames, missing = 0, 0
+    lines = ["# step\tdistance_cm\tlight_raw\tframe\tcommand\tduration_ms\tllm_ms\treceived_ms"]
+
+    for step in sorted(by_step):
+        m = by_step[step]
+        sensors = m.get("sensors", {})
+        received = datetime.fromisoformat(m["received_at"])
+        if first_received is None:
+            first_received = received
+        received_ms = int((received - first_received).total_seconds() * 1000)
+
+        frame = "-"
+        filename = m.get("image_path")
+        if filename:
+            try:
+                image = decode_image(filename, fetch(args.server, "/images/" + filename))
+            except urllib.error.HTTPError:
+                image = None   # вытеснен MAX_SAVED_IMAGES
+            if image is not None:
+                frame = "step%04d.pgm" % step
+                write_pgm(os.path.join(args.out_dir, frame), *image)
+                frames += 1
+            else:
+                missing += 1
+
+        reply = replies.get(step, {})
+        command = reply.get("parsed_command") or "STOP"
+        duration = reply.get("parsed_duration_ms") or DEFAULT_DURATION_MS
+        latency = reply.get("latency_ms")
+        lines.append("%d\t%.1f\t%d\t%s\t%s\t%d\t%d\t%d" % (
+            step, sensors.get("distance_cm", 400.0), sensors.get("light_raw", 0), frame,
+            command, duration, latency if latency is not None else -1, received_ms))
+
+    with open(os.path.join(args.out_dir, "steps.tsv"), "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+    print("session %s: %d steps, %d frames (%d not on server) -> %s" % (
+        session, len(by_step), frames, missing, args.out_dir))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,439 @@
+/*
+ * Воспроизведение записанной сессии на модулях Due с моделью платы
+ * CarController целиком, как в arduino_due.ino: камера - Ov7670Sim со сценой
+ * из сохранённых сервером кадров, дальномер - HcSr04Sim, свет - A0, мост -
+ * NodeMcuSim с ответами из журнала LLM. Serial1 - со скоростью по согласованию
+ * (потолок --baud), Wi-Fi - задержка --rtt на IMG_START и DATA, LLM - записанная
+ * задержка или --llm. Итог: этапы каждого шага и распределение времени цикла.
+ *
+ * Сессия - каталог от fetch_session.py: steps.tsv и кадры PGM
+ * (без --session - синтетическая сцена, --steps шагов).
+ * Время виртуальное: итог не зависит от скорости ПК
+ */
+
+#include "HostHal.h"
+#include "NodeMcuSim.h"
+#include "Ov7670Sim.h"
+#include "HcSr04Sim.h"
+#include "CarController.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// ==================== СЕССИЯ ====================
+
+struct ReplayStep {
+    uint32_t step;
+    float distanceCm;
+    int lightRaw;
+    std::string command;
+    uint32_t durationMs;
+    int32_t llmMs;                    // -1 - нет в журнале
+    int64_t receivedMs;               // приход на сервер от первого шага, -1 - нет
+    bool hasFrame;                    // иначе сцена прошлого шага
+    uint16_t width;
+    uint16_t height;
+    std::vector<uint8_t> frame;
+};
+
+static bool readPgm(const std::string& path, ReplayStep& step) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    unsigned int width = 0, height = 0, maxval = 0;
+    bool ok = fscanf(f, "P5 %u %u %u", &width, &height, &maxval) == 3 && maxval == 255 &&
+              width > 0 && height > 0 && fgetc(f) != EOF;
+    if (ok) {
+        step.width = (uint16_t)width;
+        step.height = (uint16_t)height;
+        step.frame.resize((size_t)width * height);
+        ok = fread(step.frame.data(), 1, step.frame.size(), f) == step.frame.size();
+    }
+    fclose(f);
+    return ok;
+}
+
+/**
+ * steps.tsv: строка на шаг, поля через табуляцию, '#' - комментарий
+ * step distance_cm light_raw frame command duration_ms llm_ms received_ms
+ */
+static bool loadSession(const std::string& dir, std::vector<ReplayStep>& steps) {
+    std::string path = dir + "/steps.tsv";
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) {
+        fprintf(stderr, "replay: cannot open %s\n", path.c_str());
+        return false;
+    }
+    char line[1024];
+    unsigned lineNo = 0;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        lineNo++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        ReplayStep step;
+        char frame[512], command[64];
+        unsigned int stepId = 0, durationMs = 0;
+        int llmMs = -1;
+        long long receivedMs = -1;
+        if (sscanf(line, "%u\t%f\t%d\t%511s\t%63s\t%u\t%d\t%lld", &stepId, &step.distanceCm, &step.lightRaw,
+                   frame, command, &durationMs, &llmMs, &receivedMs) < 6) {
+            fprintf(stderr, "replay: %s:%u: bad line\n", path.c_str(), lineNo);
+            fclose(f);
+            return false;
+        }
+        step.step = stepId;
+        step.command = command;
+        step.durationMs = durationMs;
+        step.llmMs = llmMs;
+        step.receivedMs = receivedMs;
+        step.hasFrame = strcmp(frame, "-") != 0;
+        step.width = step.height = 0;
+        if (step.hasFrame && !readPgm(dir + "/" + frame, step)) {
+            fprintf(stderr, "replay: %s:%u: cannot read frame %s\n", path.c_str(), lineNo, frame);
+            fclose(f);
+            return false;
+        }
+        steps.push_back(step);
+    }
+    fclose(f);
+    return true;
+}
+
+static void syntheticSession(uint32_t count, std::vector<ReplayStep>& steps) {
+    // Коридор с полосой, уходящей вбок: кадр меняется от шага к шагу
+    static const char* COMMANDS[] = { "FORWARD", "FORWARD", "LEFT", "FORWARD", "RIGHT" };
+    static const uint32_t DURATIONS[] = { 1000, 800, 500, 1000, 500 };
+    for (uint32_t i = 0; i < count; i++) {
+        ReplayStep step;
+        step.step = i + 1;
+        step.distanceCm = 150.0f - (float)(i % 10) * 10.0f;
+        step.lightRaw = 600;
+        step.command = COMMANDS[i % 5];
+        step.durationMs = DURATIONS[i % 5];
+        step.llmMs = 700 + (int32_t)((i * 37) % 5) * 100;
+        step.receivedMs = -1;
+        step.hasFrame = true;
+        step.width = Hardware::CAM_WIDTH;
+        step.height = Hardware::CAM_HEIGHT;
+        step.frame.resize((size_t)step.width * step.height);
+        for (uint16_t y = 0; y < step.height; y++) {
+            for (uint16_t x = 0; x < step.width; x++) {
+                int stripe = (x + (int)i * 9 - y / 2) % 40;
+                step.frame[(size_t)y * step.width + x] = (uint8_t)(60 + y + (stripe < 8 ? 80 : 0));
+            }
+        }
+        steps.push_back(step);
+    }
+}
+
+// ==================== НАБЛЮДЕНИЕ ====================
+
+// Отметки строк Serial прошивки, мкс
+struct ConsoleMarks {
+    std::vector<uint64_t> collected;   // "Step N:" - данные шага сняты
+    std::vector<uint64_t> started;     // "Received command" / "Command timeout" - моторы запущены
+    std::vector<uint64_t> executed;    // "Executed:" - команда закончена
+};
+
+static ConsoleMarks marks;
+
+static void onConsoleLine(const char* line) {
+    uint64_t now = HostHal::micros64();
+    if (strncmp(line, "Step ", 5) == 0) {
+        marks.collected.push_back(now);
+    } else if (strncmp(line, "Received command:", 17) == 0 || strncmp(line, "Command timeout", 15) == 0) {
+        marks.started.push_back(now);
+    } else if (strncmp(line, "Executed:", 9) == 0) {
+        marks.executed.push_back(now);
+    }
+}
+
+// ==================== ИТОГИ ====================
+
+struct StepTimes {
+    double collectS;    // снятие данных шага от старта, с
+    double captureMs;   // кадр: начало записи в FIFO - конец чтения (-1 - без кадра)
+    double imageMs;     // IMG_START - IMG_END на мосту (-1 - без кадра)
+    double uplinkMs;    // снятие - DATA на мосту
+    double serverMs;    // DATA - CMD (Wi-Fi + LLM + очередь моста)
+    double execMs;      // запуск моторов - конец команды
+    double cycleMs;     // снятие - снятие следующего шага
+};
+
+static double ms(uint64_t fromUs, uint64_t toUs) {
+    return (toUs >= fromUs) ? (double)(toUs - fromUs) / 1000.0 : -1.0;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t idx = (size_t)(p * (values.size() - 1) + 0.5);
+    return values[idx];
+}
+
+static void printDistribution(const char* title, const std::vector<double>& values) {
+    if (values.empty()) {
+        return;
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < values.size(); i++) {
+        sum += values[i];
+    }
+    double lo = percentile(values, 0.0);
+    double hi = percentile(values, 1.0);
+    printf("\n%s, ms (%u cycles)\n", title, (unsigned)values.size());
+    printf("  min %.0f  p50 %.0f  mean %.0f  p90 %.0f  p99 %.0f  max %.0f\n", lo, percentile(values, 0.5),
+           sum / values.size(), percentile(values, 0.9), percentile(values, 0.99), hi);
+
+    static const int BINS = 10;
+    unsigned counts[BINS] = { 0 };
+    double width = (hi - lo) / BINS;
+    for (size_t i = 0; i < values.size(); i++) {
+        int bin = (width > 0.0) ? (int)((values[i] - lo) / width) : 0;
+        counts[bin < BINS ? bin : BINS - 1]++;
+    }
+    unsigned peak = *std::max_element(counts, counts + BINS);
+    for (int b = 0; b < BINS; b++) {
+        if (width <= 0.0 && b > 0) {
+            break;
+        }
+        int bar = peak > 0 ? (int)(counts[b] * 40 / peak) : 0;
+        printf("  %6.0f..%-6.0f %4u %s\n", lo + width * b, lo + width * (b + 1), counts[b],
+               std::string(bar, '#').c_str());
+    }
+}
+
+static void printOption(const char* text) {
+    printf("  %s\n", text);
+}
+
+static void usage() {
+    printf("usage: due_replay [options]\n");
+    printOption("--session DIR     steps.tsv and PGM frames from fetch_session.py");
+    printOption("--steps N         replay at most N steps (synthetic scene: default 20)");
+    printOption("--baud B          Serial1 ceiling: bridge refuses faster rates");
+    printOption("--window N        chunk window (1 - stop-and-wait)");
+    printOption("--codec C         raw|intra|inter");
+    printOption("--link M          text|binary");
+    printOption("--pipelined       send step N+1 while step N is executed");
+    printOption("--rtt MS          Wi-Fi round trip per HTTP request (default 60)");
+    printOption("--llm MS          LLM latency for every step instead of the recorded one");
+    printOption("--cmd LINE        extra Serial command before the first step (repeatable)");
+    printOption("--csv FILE        per-step timeline as CSV");
+    printOption("--echo            print firmware Serial output");
+}
+
+int main(int argc, char** argv) {
+    std::string sessionDir;
+    uint32_t maxSteps = 0;
+    uint32_t maxBaud = 0;
+    uint32_t rttMs = 60;
+    int32_t llmMs = -1;
+    const char* csvPath = nullptr;
+    bool echo = false;
+    std::vector<std::string> commands;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--session" && hasValue) {
+            sessionDir = argv[++i];
+        } else if (arg == "--steps" && hasValue) {
+            maxSteps = (uint32_t)atol(argv[++i]);
+        } else if (arg == "--baud" && hasValue) {
+            maxBaud = (uint32_t)atol(argv[++i]);
+        } else if (arg == "--window" && hasValue) {
+            commands.push_back(std::string("window ") + argv[++i]);
+        } else if (arg == "--codec" && hasValue) {
+            commands.push_back(std::string("codec ") + argv[++i]);
+        } else if (arg == "--link" && hasValue) {
+            commands.push_back(std::string("link ") + argv[++i]);
+        } else if (arg == "--pipelined") {
+            commands.push_back("step pipelined");
+        } else if (arg == "--rtt" && hasValue) {
+            rttMs = (uint32_t)atol(argv[++i]);
+        } else if (arg == "--llm" && hasValue) {
+            llmMs = atoi(argv[++i]);
+        } else if (arg == "--cmd" && hasValue) {
+            commands.push_back(argv[++i]);
+        } else if (arg == "--csv" && hasValue) {
+            csvPath = argv[++i];
+        } else if (arg == "--echo") {
+            echo = true;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::vector<ReplayStep> steps;
+    if (sessionDir.empty()) {
+        syntheticSession(maxSteps > 0 ? maxSteps : 20, steps);
+    } else if (!loadSession(sessionDir, steps)) {
+        return 2;
+    }
+    if (maxSteps > 0 && steps.size() > maxSteps) {
+        steps.resize(maxSteps);
+    }
+    if (steps.empty()) {
+        fprintf(stderr, "replay: no steps\n");
+        return 2;
+    }
+
+    // ---- Плата и окружение ----
+    HostHal::reset();
+    HostHal::setConsoleEcho(echo);
+    HostHal::setConsoleListener(onConsoleLine);
+
+    NodeMcuSim bridge;
+    bridge.attach();
+    bridge.setReadyDelayMicros(rttMs * 1000);
+    if (maxBaud > 0) {
+        bridge.setMaxBaud(maxBaud);
+    }
+    // Ответы по порядку DATA: записанная команда через RTT + время LLM
+    for (size_t i = 0; i < steps.size(); i++) {
+        char json[128];
+        snprintf(json, sizeof(json), "{\"command\":\"%s\",\"duration_ms\":%u}", steps[i].command.c_str(),
+                 (unsigned)steps[i].durationMs);
+        int32_t llm = (llmMs >= 0) ? llmMs : (steps[i].llmMs > 0 ? steps[i].llmMs : 0);
+        bridge.queueReply(json, (rttMs + (uint32_t)llm) * 1000);
+    }
+
+    Ov7670Sim camera;
+    camera.attach();
+    HcSr04Sim sonar;
+    sonar.attach();
+
+    size_t applied = 0;
+    const ReplayStep* scene = nullptr;
+    auto applyStep = [&](size_t idx) {
+        const ReplayStep& step = steps[idx];
+        if (step.hasFrame) {
+            scene = &step;
+        }
+        if (scene != nullptr) {
+            camera.setScene(scene->frame.data(), scene->width, scene->height);
+        }
+        sonar.setDistanceCm(step.distanceCm);
+        HostHal::setAnalogInput(Hardware::LIGHT_PIN, step.lightRaw);
+    };
+    applyStep(0);
+
+    static CarController car;
+    car.begin();
+    for (size_t i = 0; i < commands.size(); i++) {
+        HostHal::consoleInput((commands[i] + "\n").c_str());
+    }
+
+    // ---- Прогон: loop() до конца последней команды ----
+    uint64_t limitUs = HostHal::micros64() + (uint64_t)steps.size() * 30000000ULL + 10000000ULL;
+    while (marks.executed.size() < steps.size() && HostHal::micros64() < limitUs) {
+        car.tick();
+        HostHal::advanceMicros(10);
+        // DATA шага k ушёл: датчики и сцена - уже шага k+1
+        while (applied < bridge.dataTimes().size() && applied + 1 < steps.size()) {
+            applyStep(++applied);
+        }
+    }
+    bool finished = marks.executed.size() >= steps.size();
+
+    // ---- Этапы шагов ----
+    size_t count = std::min(marks.executed.size(), steps.size());
+    std::vector<StepTimes> times(count);
+    std::vector<double> cycles;
+    const std::vector<Ov7670Sim::Capture>& captures = camera.captures();
+    const std::vector<NodeMcuSim::Image>& images = bridge.images();
+    size_t captureIdx = 0, imageIdx = 0;
+
+    for (size_t k = 0; k < count; k++) {
+        StepTimes& t = times[k];
+        uint64_t collected = (k < marks.collected.size()) ? marks.collected[k] : 0;
+        uint64_t data = (k < bridge.dataTimes().size()) ? bridge.dataTimes()[k] : 0;
+        uint64_t cmd = (k < bridge.commandTimes().size()) ? bridge.commandTimes()[k] : 0;
+        t.collectS = collected / 1e6;
+
+        // Кадр шага - последний дочитанный до снятия данных
+        t.captureMs = -1.0;
+        while (captureIdx < captures.size() && captures[captureIdx].readEndMicros <= collected) {
+            t.captureMs = ms(captures[captureIdx].frameStartMicros, captures[captureIdx].readEndMicros);
+            captureIdx++;
+        }
+        // Передача шага - кадры, законченные до его DATA
+        t.imageMs = -1.0;
+        while (imageIdx < images.size() && images[imageIdx].endMicros <= data) {
+            t.imageMs = ms(images[imageIdx].startMicros, images[imageIdx].endMicros);
+            imageIdx++;
+        }
+        t.uplinkMs = ms(collected, data);
+        t.serverMs = ms(data, cmd);
+        t.execMs = (k < marks.started.size()) ? ms(marks.started[k], marks.executed[k]) : -1.0;
+        t.cycleMs = (k + 1 < marks.collected.size()) ? ms(collected, marks.collected[k + 1]) : -1.0;
+        if (t.cycleMs >= 0.0 && k + 1 < count) {
+            cycles.push_back(t.cycleMs);
+        }
+    }
+
+    printf("replay: %u steps%s%s, Serial1 %lu baud, rtt %u ms, llm %s\n", (unsigned)count,
+           sessionDir.empty() ? " (synthetic)" : " from ", sessionDir.c_str(),
+           (unsigned long)HostHal::serial1Baud(), (unsigned)rttMs, llmMs >= 0 ? "fixed" : "recorded");
+    for (size_t i = 0; i < commands.size(); i++) {
+        printf("  %s\n", commands[i].c_str());
+    }
+    printf("\n%5s %8s %8s %8s %8s %8s %8s %8s  %s\n", "step", "t,s", "capture", "image", "uplink", "server",
+           "exec", "cycle", "command");
+    for (size_t k = 0; k < count; k++) {
+        const StepTimes& t = times[k];
+        char capture[16], image[16], cycle[16];
+        snprintf(capture, sizeof(capture), t.captureMs >= 0.0 ? "%.1f" : "-", t.captureMs);
+        snprintf(image, sizeof(image), t.imageMs >= 0.0 ? "%.1f" : "-", t.imageMs);
+        snprintf(cycle, sizeof(cycle), t.cycleMs >= 0.0 ? "%.0f" : "-", t.cycleMs);
+        printf("%5u %8.2f %8s %8s %8.1f %8.1f %8.1f %8s  %s %u\n", (unsigned)steps[k].step, t.collectS, capture,
+               image, t.uplinkMs, t.serverMs, t.execMs, cycle, steps[k].command.c_str(),
+               (unsigned)steps[k].durationMs);
+    }
+
+    printDistribution("Cycle time (replay)", cycles);
+    std::vector<double> recorded;
+    for (size_t k = 1; k < count; k++) {
+        if (steps[k].receivedMs >= 0 && steps[k - 1].receivedMs >= 0) {
+            recorded.push_back((double)(steps[k].receivedMs - steps[k - 1].receivedMs));
+        }
+    }
+    printDistribution("Cycle time (recorded on server)", recorded);
+
+    HostSerialStats link = HostHal::serial1Stats();
+    printf("\nlink: %lu bytes to bridge, %u images, %u chunks (%u dropped by sim), %u camera frames read\n",
+           (unsigned long)link.bytesToPeer, (unsigned)images.size(), (unsigned)bridge.chunksReceived(),
+           (unsigned)bridge.chunksLost(), (unsigned)captures.size());
+
+    if (csvPath != nullptr) {
+        FILE* csv = fopen(csvPath, "w");
+        if (csv == nullptr) {
+            fprintf(stderr, "replay: cannot write %s\n", csvPath);
+            return 2;
+        }
+        fprintf(csv, "step,t_s,capture_ms,image_ms,uplink_ms,server_ms,exec_ms,cycle_ms,command,duration_ms\n");
+        for (size_t k = 0; k < count; k++) {
+            const StepTimes& t = times[k];
+            fprintf(csv, "%u,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%s,%u\n", (unsigned)steps[k].step, t.collectS,
+                    t.captureMs, t.imageMs, t.uplinkMs, t.serverMs, t.execMs, t.cycleMs, steps[k].command.c_str(),
+                    (unsigned)steps[k].durationMs);
+        }
+        fclose(csv);
+    }
+
+    if (!finished) {
+        printf("replay: stopped after %u of %u steps (virtual time limit)\n", (unsigned)count,
+               (unsigned)steps.size());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#include "HcSr04Sim.h"
+#include "types.h"
+
+HcSr04Sim::HcSr04Sim()
+    : distanceCm(0.0f), echoHigh(false), echoWidthUs(0), nextEdgeUs(UINT64_MAX), pingCount(0) {}
+
+void HcSr04Sim::attach() {
+    HostHal::attachDevice(this);
+    HostHal::setDigitalInput(Hardware::ECHO_PIN, LOW);
+}
+
+void HcSr04Sim::onPinOutput(uint32_t pin, int level) {
+    // Новый запуск во время эха датчик не принимает
+    if (pin != Hardware::TRIG_PIN || level != LOW || nextEdgeUs != UINT64_MAX) {
+        return;
+    }
+    pingCount++;
+    bool inRange = distanceCm > 0.0f && distanceCm <= 400.0f;
+    echoWidthUs = inRange ? (uint32_t)(distanceCm * 58.0f) : NO_ECHO_US;
+    nextEdgeUs = HostHal::micros64() + BURST_US;
+}
+
+void HcSr04Sim::onTime(uint64_t nowMicros) {
+    // Следующий фронт - до смены уровня: обработчик эха читает часы
+    if (!echoHigh) {
+        echoHigh = true;
+        nextEdgeUs = nowMicros + echoWidthUs;
+        HostHal::setDigitalInput(Hardware::ECHO_PIN, HIGH);
+        return;
+    }
+    echoHigh = false;
+    nextEdgeUs = UINT64_MAX;
+    HostHal::setDigitalInput(Hardware::ECHO_PIN, LOW);
+}
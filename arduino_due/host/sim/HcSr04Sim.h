@@ -0,0 +1,44 @@
+#ifndef HC_SR04_SIM_H
+#define HC_SR04_SIM_H
+
+#include "HostHal.h"
+
+/**
+ * Модель HC-SR04 на Hardware::TRIG_PIN/ECHO_PIN
+ * Спад TRIG запускает замер: через 450 мкс (пачка 40 кГц) ECHO поднимается на
+ * 58 мкс на сантиметр; нет препятствия в пределах 400 см - импульс 38 мс
+ */
+class HcSr04Sim : public HostDevice {
+public:
+    HcSr04Sim();
+
+    /**
+     * Подключиться к выводам HostHal (после HostHal::reset())
+     */
+    void attach();
+
+    /**
+     * Расстояние до препятствия, см (0 или больше 400 - нет препятствия)
+     */
+    void setDistanceCm(float cm) { distanceCm = cm; }
+
+    uint32_t pings() const { return pingCount; }
+
+    // ==================== HostDevice ====================
+
+    void onPinOutput(uint32_t pin, int level) override;
+    uint64_t nextEventMicros() const override { return nextEdgeUs; }
+    void onTime(uint64_t nowMicros) override;
+
+private:
+    static const uint32_t BURST_US = 450;
+    static const uint32_t NO_ECHO_US = 38000;
+
+    float distanceCm;
+    bool echoHigh;
+    uint32_t echoWidthUs;
+    uint64_t nextEdgeUs;
+    uint32_t pingCount;
+};
+
+#endif // HC_SR04_SIM_H
@@ -0,0 +1,584 @@
+#include "NodeMcuSim.h"
+#include "LinkProtocol.h"
+#include "types.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const uint32_t SERIAL_BAUD = Hardware::SERIAL1_BAUD;
+
+static const char DATA_IMAGE_ID_PREFIX[] = "{\"image\":{\"image_id\":";
+static const size_t DATA_IMAGE_ID_OFFSET = sizeof(DATA_IMAGE_ID_PREFIX) - 1;
+
+static size_t decodeBase64(const char* src, size_t len, uint8_t* dst, size_t capacity, uint16_t* crc) {
+    uint32_t acc = 0;
+    uint8_t bits = 0;
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = src[i];
+        uint8_t v;
+        if (c >= 'A' && c <= 'Z')      v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+')             v = 62;
+        else if (c == '/')             v = 63;
+        else if (c == '=')             break;
+        else                           return 0;
+
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (out >= capacity) {
+                return 0;
+            }
+            uint8_t byte = (acc >> bits) & 0xFF;
+            *crc = crc16_ccitt_step(*crc, byte);
+            dst[out++] = byte;
+        }
+    }
+    return out;
+}
+
+NodeMcuSim::NodeMcuSim()
+    : rxState(RX_IDLE), rxLen(0), rxPos(0), rxCrcAcc(0xFFFF), replyBinary(false), txSeq(0),
+      transfer(false), transferBinary(false), window(1), firstMissing(0), receivedChunks(0),
+      expectedCrc(0), imageSerial(0),
+      readyAt(UINT64_MAX), readyBinary(false),
+      baud(SERIAL_BAUD), confirmedBaud(SERIAL_BAUD), pendingBaud(0), pendingBaudDeadline(UINT64_MAX),
+      replyDelayUs(40000), readyDelayUs(20000),
+      commandJson("{\"command\":\"FORWARD\",\"duration_ms\":1000}"), lossEvery(0), streamDropAfter(0),
+      maxBaud(UINT32_MAX), chunkCount(0), lostCount(0), ackCount(0), nakCount(0), sackCount(0),
+      restartCount(0), commandCount(0),
+      badFrameCount(0) {
+    current = Image();
+}
+
+void NodeMcuSim::attach() {
+    HostHal::attachSerial1(this);
+}
+
+void NodeMcuSim::queueReply(const char* json, uint32_t delayUs) {
+    ScriptedReply reply = { json, delayUs };
+    script.push_back(reply);
+}
+
+// ==================== ПРИЁМ ====================
+
+void NodeMcuSim::onSerialByte(uint8_t b) {
+    feed(b);
+}
+
+void NodeMcuSim::feed(uint8_t b) {
+    switch (rxState) {
+        case RX_IDLE:
+            if (b == LINK_SYNC_0) {
+                rxState = RX_SYNC1;
+                return;
+            }
+            if (b == '\r' || b == '\n') {
+                return;
+            }
+            rxPos = 0;
+            rxState = RX_LINE;
+            // fall through - первый байт строки
+        case RX_LINE:
+            if (b == '\n') {
+                rxState = RX_IDLE;
+                while (rxPos > 0 && (buffer[rxPos - 1] == ' ' || buffer[rxPos - 1] == '\t')) {
+                    rxPos--;
+                }
+                buffer[rxPos] = '\0';
+                replyBinary = false;
+                processLine((char*)buffer, rxPos);
+                return;
+            }
+            if (b == '\r') {
+                return;
+            }
+            if (rxPos >= MAX_PAYLOAD) {
+                rxState = RX_LINE_SKIP;
+                return;
+            }
+            buffer[rxPos++] = b;
+            return;
+
+        case RX_LINE_SKIP:
+            if (b == '\n') {
+                rxState = RX_IDLE;
+            }
+            return;
+
+        case RX_SYNC1:
+            if (b == LINK_SYNC_1) {
+                rxPos = 0;
+                rxCrcAcc = 0xFFFF;
+                rxState = RX_HEADER;
+            } else if (b != LINK_SYNC_0) {
+                drop();
+            }
+            return;
+
+        case RX_HEADER:
+            rxHeader[rxPos++] = b;
+            rxCrcAcc = crc16_ccitt_step(rxCrcAcc, b);
+            if (rxPos < sizeof(rxHeader)) {
+                return;
+            }
+            rxLen = rxHeader[2] | ((uint16_t)rxHeader[3] << 8);
+            if (rxLen > MAX_PAYLOAD) {
+                drop();
+                return;
+            }
+            rxPos = 0;
+            rxState = (rxLen > 0) ? RX_PAYLOAD : RX_CRC;
+            return;
+
+        case RX_PAYLOAD:
+            buffer[rxPos++] = b;
+            rxCrcAcc = crc16_ccitt_step(rxCrcAcc, b);
+            if (rxPos == rxLen) {
+                rxPos = 0;
+                rxState = RX_CRC;
+            }
+            return;
+
+        case RX_CRC:
+            rxCrc[rxPos++] = b;
+            if (rxPos < sizeof(rxCrc)) {
+                return;
+            }
+            if (rxCrcAcc != (rxCrc[0] | ((uint16_t)rxCrc[1] << 8))) {
+                drop();
+                return;
+            }
+            rxState = RX_IDLE;
+            buffer[rxLen] = '\0';
+            replyBinary = true;
+            processFrame(rxHeader[0], buffer, rxLen);
+            return;
+    }
+}
+
+void NodeMcuSim::drop() {
+    // Как rxDrop() моста: битый кадр посреди передачи - NAK 0xFFFE сразу
+    bool inFrame = rxState >= RX_SYNC1;
+    rxState = RX_IDLE;
+    if (inFrame) {
+        badFrameCount++;
+        if (transfer) {
+            replyBinary = true;
+            sendNak(-2);
+        }
+    }
+}
+
+void NodeMcuSim::processLine(char* line, size_t len) {
+    if (strncmp(line, "DATA ", 5) == 0) {
+        handleData(line + 5, len - 5);
+    } else if (strncmp(line, "IMG_START ", 10) == 0) {
+        unsigned int width = 0, height = 0, total = 0, crc = 0;
+        unsigned int chunkWindow = 1, codec = 0, flags = 0, keyId = 0;
+        int fields = sscanf(line + 10, "%u %u %u %x %u %u %u %u", &width, &height, &total, &crc,
+                            &chunkWindow, &codec, &flags, &keyId);
+        if (fields >= 4) {
+            startImage(width, height, total, crc, chunkWindow, codec, flags, keyId);
+        }
+    } else if (strncmp(line, "IMG_CHUNK ", 10) == 0) {
+        if (!transfer) {
+            sendNak(-1);
+            return;
+        }
+        const char* args = line + 10;
+        char* data = NULL;
+        unsigned long idx = strtoul(args, &data, 10);
+        if (data == args || *data != ' ') {
+            sendNak(-2);
+            return;
+        }
+        data++;
+        size_t dataLen = len - 10 - (data - args);
+        const char* crcField = (const char*)memchr(data, ' ', dataLen);
+        if (crcField != NULL) {
+            dataLen = crcField - data;
+        }
+        uint8_t raw[MAX_PAYLOAD];
+        uint16_t crc = 0xFFFF;
+        size_t rawLen = decodeBase64(data, dataLen, raw, sizeof(raw), &crc);
+        if (rawLen == 0 || (crcField != NULL && crc != strtoul(crcField + 1, NULL, 16))) {
+            sendNak((int)idx);
+            return;
+        }
+        acceptChunk((uint16_t)idx, raw, rawLen);
+    } else if (strncmp(line, "IMG_END", 7) == 0) {
+        if (line[7] == ' ') {
+            expectedCrc = (uint16_t)strtoul(line + 8, NULL, 16);
+        }
+        endImage();
+    } else if (strncmp(line, "IMG_ABORT", 9) == 0) {
+        transfer = false;
+    }
+}
+
+static uint16_t payloadU16(const uint8_t* p, size_t offset) {
+    return p[offset] | ((uint16_t)p[offset + 1] << 8);
+}
+
+void NodeMcuSim::processFrame(uint8_t type, const uint8_t* payload, size_t len) {
+    switch (type) {
+        case LINK_DATA:
+            handleData((char*)buffer, len);
+            break;
+
+        case LINK_IMG_START:
+            if (len >= 10) {
+                startImage(payloadU16(payload, 0), payloadU16(payload, 2), payloadU16(payload, 4),
+                           payloadU16(payload, 6), (len >= 12) ? payloadU16(payload, 10) : 1,
+                           (len >= 15) ? payload[12] : 0, (len >= 15) ? payload[13] : 0,
+                           (len >= 15) ? payload[14] : 0);
+            }
+            break;
+
+        case LINK_IMG_CHUNK:
+            if (len < 2) {
+                sendNak(-2);
+            } else if (!transfer) {
+                sendNak(-1);
+            } else {
+                acceptChunk(payloadU16(payload, 0), payload + 2, len - 2);
+            }
+            break;
+
+        case LINK_IMG_END:
+            if (len >= 2) {
+                expectedCrc = payloadU16(payload, 0);
+            }
+            endImage();
+            break;
+
+        case LINK_IMG_ABORT:
+            transfer = false;
+            break;
+
+        case LINK_BAUD_REQ:
+            if (len >= 4) {
+                handleBaudRequest(payloadU16(payload, 0) | ((uint32_t)payloadU16(payload, 2) << 16));
+            }
+            break;
+
+        case LINK_BAUD_TEST:
+            handleBaudTest(payload, len);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// ==================== ИЗОБРАЖЕНИЕ ====================
+
+void NodeMcuSim::startImage(uint16_t width, uint16_t height, uint16_t totalChunks, uint16_t crc,
+                            uint16_t chunkWindow, uint8_t codec, uint8_t flags, uint8_t keyId) {
+    transfer = false;
+    if (totalChunks > MAX_IMAGE_CHUNKS) {
+        return;
+    }
+    current = Image();
+    current.width = width;
+    current.height = height;
+    current.totalChunks = totalChunks;
+    current.codec = codec;
+    current.flags = flags;
+    current.keyId = keyId;
+    current.binary = replyBinary;
+    current.startMicros = HostHal::micros64();
+    transferBinary = replyBinary;
+    window = chunkWindow;
+    expectedCrc = crc;
+    firstMissing = 0;
+    receivedChunks = 0;
+    chunks.assign(totalChunks, std::vector<uint8_t>());
+
+    // IMG_READY - после ответа /image/start
+    readyAt = HostHal::micros64() + readyDelayUs;
+    readyBinary = replyBinary;
+}
+
+bool NodeMcuSim::isReceived(uint32_t idx) const {
+    return idx < chunks.size() && !chunks[idx].empty();
+}
+
+void NodeMcuSim::acceptChunk(uint16_t idx, const uint8_t* data, size_t len) {
+    chunkCount++;
+    if (lossEvery > 0 && chunkCount % lossEvery == 0) {
+        // Потерян на линии: мост его не видел и не отвечает
+        lostCount++;
+        return;
+    }
+    if (idx >= current.totalChunks || len == 0) {
+        sendNak(idx);
+        return;
+    }
+
+    if (window <= 1) {
+        if (idx + 1 == firstMissing) {
+            sendAck(idx);
+            return;
+        }
+        if (idx != firstMissing) {
+            sendNak(idx);
+            return;
+        }
+    }
+
+    if (!isReceived(idx)) {
+        chunks[idx].assign(data, data + len);
+        receivedChunks++;
+        while (firstMissing < current.totalChunks && isReceived(firstMissing)) {
+            firstMissing++;
+        }
+    }
+    if (window <= 1) {
+        sendAck(idx);
+    } else {
+        sendSack();
+    }
+
+    if (streamDropAfter > 0 && receivedChunks == streamDropAfter) {
+        // restartImageUpload() моста: подтверждённое забыто, кадр - с чанка 0
+        streamDropAfter = 0;
+        restartCount++;
+        firstMissing = 0;
+        receivedChunks = 0;
+        chunks.assign(current.totalChunks, std::vector<uint8_t>());
+        if (replyBinary) {
+            sendFrame(LINK_IMG_READY, NULL, 0);
+        } else {
+            sendText("IMG_READY");
+        }
+    }
+}
+
+void NodeMcuSim::endImage() {
+    if (!transfer) {
+        return;
+    }
+    transfer = false;
+    current.endMicros = HostHal::micros64();
+    current.complete = (receivedChunks == current.totalChunks);
+    current.data.clear();
+    for (size_t i = 0; i < chunks.size(); i++) {
+        current.data.insert(current.data.end(), chunks[i].begin(), chunks[i].end());
+    }
+    current.crcOk = current.complete &&
+                    crc16_ccitt(current.data.data(), current.data.size()) == expectedCrc;
+    receivedImages.push_back(current);
+    if (current.crcOk) {
+        char id[32];
+        snprintf(id, sizeof(id), "sim_%u", (unsigned)++imageSerial);
+        imageId = id;
+    }
+}
+
+// ==================== DATA ====================
+
+void NodeMcuSim::handleData(char* json, size_t len) {
+    // image_id собранного кадра - в место под него, как handleSensorData()
+    if (!imageId.empty()) {
+        if (len >= DATA_IMAGE_ID_OFFSET + LINK_DATA_IMAGE_ID_SLOT &&
+            imageId.size() + 2 <= LINK_DATA_IMAGE_ID_SLOT &&
+            memcmp(json, DATA_IMAGE_ID_PREFIX, DATA_IMAGE_ID_OFFSET) == 0) {
+            char* slot = json + DATA_IMAGE_ID_OFFSET;
+            memset(slot, ' ', LINK_DATA_IMAGE_ID_SLOT);
+            slot[0] = '"';
+            memcpy(slot + 1, imageId.data(), imageId.size());
+            slot[imageId.size() + 1] = '"';
+        }
+        imageId.clear();
+    }
+    receivedData.push_back(std::string(json, len));
+    uint64_t now = HostHal::micros64();
+    dataMicros.push_back(now);
+
+    Reply reply;
+    uint32_t delayUs = replyDelayUs;
+    reply.json = commandJson;
+    if (!script.empty()) {
+        reply.json = script.front().json;
+        delayUs = script.front().delayUs;
+        script.pop_front();
+    }
+    // Следующий POST - после ответа на предыдущий
+    uint64_t start = (!replies.empty() && replies.back().atMicros > now) ? replies.back().atMicros : now;
+    reply.atMicros = start + delayUs;
+    reply.binary = replyBinary;
+    replies.push_back(reply);
+}
+
+// ==================== СКОРОСТЬ ====================
+
+void NodeMcuSim::switchBaud(uint32_t newBaud) {
+    // Ответ, уже отданный в линию, уходит на прежней скорости (HostHal::sendToDue)
+    baud = newBaud;
+    rxState = RX_IDLE;
+}
+
+void NodeMcuSim::handleBaudRequest(uint32_t requested) {
+    bool supported = (requested == SERIAL_BAUD);
+    for (uint8_t i = 0; i < LINK_BAUD_RATE_COUNT; i++) {
+        if (LINK_BAUD_RATES[i] == requested) {
+            supported = true;
+        }
+    }
+    if (!supported || requested > maxBaud) {
+        sendBaudAck(0);
+        return;
+    }
+    sendBaudAck(requested);
+    switchBaud(requested);
+    if (requested == SERIAL_BAUD) {
+        confirmedBaud = requested;
+        pendingBaud = 0;
+        pendingBaudDeadline = UINT64_MAX;
+    } else {
+        pendingBaud = requested;
+        pendingBaudDeadline = HostHal::micros64() + BAUD_TEST_TIMEOUT_US;
+    }
+}
+
+void NodeMcuSim::handleBaudTest(const uint8_t* payload, size_t len) {
+    if (pendingBaud == 0 || len != LINK_BAUD_TEST_SIZE) {
+        return;
+    }
+    for (size_t i = 0; i < LINK_BAUD_TEST_SIZE; i++) {
+        if (payload[i] != linkBaudTestByte(i)) {
+            return;
+        }
+    }
+    confirmedBaud = pendingBaud;
+    pendingBaud = 0;
+    pendingBaudDeadline = UINT64_MAX;
+    sendBaudAck(confirmedBaud);
+}
+
+// ==================== ТАЙМЕРЫ ====================
+
+uint64_t NodeMcuSim::nextEventMicros() const {
+    uint64_t next = readyAt;
+    if (!replies.empty() && replies.front().atMicros < next) {
+        next = replies.front().atMicros;
+    }
+    if (pendingBaudDeadline < next) {
+        next = pendingBaudDeadline;
+    }
+    return next;
+}
+
+void NodeMcuSim::onTime(uint64_t nowMicros) {
+    if (readyAt <= nowMicros) {
+        readyAt = UINT64_MAX;
+        transfer = true;
+        replyBinary = readyBinary;
+        if (replyBinary) {
+            sendFrame(LINK_IMG_READY, NULL, 0);
+        } else {
+            sendText("IMG_READY");
+        }
+    }
+    if (!replies.empty() && replies.front().atMicros <= nowMicros) {
+        Reply reply = replies.front();
+        replies.pop_front();
+        replyBinary = reply.binary;
+        if (!statusLine.empty()) {
+            // Текстом в любом режиме, как sendStatusLine()
+            sendText("STATUS " + statusLine);
+            statusLine.clear();
+        }
+        commandCount++;
+        commandMicros.push_back(nowMicros);
+        if (replyBinary) {
+            sendFrame(LINK_CMD, (const uint8_t*)reply.json.data(), (uint16_t)reply.json.size());
+        } else {
+            sendText("CMD " + reply.json);
+        }
+    }
+    if (pendingBaudDeadline <= nowMicros) {
+        // Образца нет: назад на подтверждённую скорость
+        pendingBaudDeadline = UINT64_MAX;
+        pendingBaud = 0;
+        switchBaud(confirmedBaud);
+    }
+}
+
+// ==================== ОТВЕТЫ ====================
+
+void NodeMcuSim::sendFrame(uint8_t type, const uint8_t* payload, uint16_t len) {
+    std::vector<uint8_t> frame;
+    frame.reserve(LINK_HEADER_SIZE + len + LINK_CRC_SIZE);
+    const uint8_t header[6] = {
+        LINK_SYNC_0, LINK_SYNC_1, type, txSeq++, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)
+    };
+    frame.insert(frame.end(), header, header + sizeof(header));
+    if (len > 0) {
+        frame.insert(frame.end(), payload, payload + len);
+    }
+    uint16_t crc = crc16_ccitt(frame.data() + 2, frame.size() - 2);
+    frame.push_back((uint8_t)(crc & 0xFF));
+    frame.push_back((uint8_t)(crc >> 8));
+    HostHal::sendToDue(frame.data(), frame.size());
+}
+
+void NodeMcuSim::sendText(const std::string& line) {
+    std::string out = line + "\r\n";
+    HostHal::sendToDue((const uint8_t*)out.data(), out.size());
+}
+
+void NodeMcuSim::sendAck(uint16_t idx) {
+    ackCount++;
+    if (replyBinary) {
+        uint8_t payload[2] = { (uint8_t)(idx & 0xFF), (uint8_t)(idx >> 8) };
+        sendFrame(LINK_ACK, payload, sizeof(payload));
+    } else {
+        sendText("ACK " + std::to_string(idx));
+    }
+}
+
+void NodeMcuSim::sendNak(int idx) {
+    nakCount++;
+    if (replyBinary) {
+        uint16_t value = (uint16_t)idx;
+        uint8_t payload[2] = { (uint8_t)(value & 0xFF), (uint8_t)(value >> 8) };
+        sendFrame(LINK_NAK, payload, sizeof(payload));
+    } else {
+        sendText("NAK " + std::to_string(idx));
+    }
+}
+
+void NodeMcuSim::sendSack() {
+    sackCount++;
+    uint16_t first = firstMissing;
+    uint32_t mask = 0;
+    for (uint8_t b = 0; b < 32; b++) {
+        if (isReceived((uint32_t)first + 1 + b)) {
+            mask |= 1u << b;
+        }
+    }
+    if (replyBinary) {
+        uint8_t payload[6] = {
+            (uint8_t)(first & 0xFF), (uint8_t)(first >> 8),
+            (uint8_t)(mask & 0xFF), (uint8_t)(mask >> 8), (uint8_t)(mask >> 16), (uint8_t)(mask >> 24)
+        };
+        sendFrame(LINK_SACK, payload, sizeof(payload));
+    } else {
+        char line[32];
+        snprintf(line, sizeof(line), "SACK %u 0x%lX", (unsigned)first, (unsigned long)mask);
+        sendText(line);
+    }
+}
+
+void NodeMcuSim::sendBaudAck(uint32_t value) {
+    uint8_t payload[4] = {
+        (uint8_t)(value & 0xFF), (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)
+    };
+    sendFrame(LINK_BAUD_ACK, payload, sizeof(payload));
+}
@@ -0,0 +1,229 @@
+#ifndef NODEMCU_SIM_H
+#define NODEMCU_SIM_H
+
+#include "HostHal.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * Модель моста NodeMCU (nodemcu/nodemcu.ino) на второй стороне Serial1
+ * Тот же протокол: строки и кадры A5 5A, ответ в формате последнего
+ * принятого сообщения, ACK/SACK по окну, согласование скорости с тестом
+ * образца. HTTP заменён задержками: DATA получает CMD через replyDelay,
+ * IMG_START - IMG_READY через readyDelay. Запросы идут по одному, как HTTP
+ * моста: DATA во время ожидания ответа ждёт своей очереди. Потери чанков -
+ * детерминированные
+ */
+class NodeMcuSim : public HostSerialPeer {
+public:
+    // Изображение, собранное по IMG_END
+    struct Image {
+        uint16_t width;
+        uint16_t height;
+        uint16_t totalChunks;
+        uint8_t codec;
+        uint8_t flags;
+        uint8_t keyId;
+        bool binary;                  // пришло кадрами (иначе строками base64)
+        bool complete;                // все чанки приняты
+        bool crcOk;                   // CRC16 собранных байт совпала с IMG_END
+        uint64_t startMicros;         // принят IMG_START
+        uint64_t endMicros;           // принят IMG_END
+        std::vector<uint8_t> data;
+    };
+
+    NodeMcuSim();
+
+    /**
+     * Подключиться к Serial1 модели HostHal
+     */
+    void attach();
+
+    // ==================== НАСТРОЙКА ====================
+
+    /**
+     * Время POST /data до ответа CMD, мкс
+     */
+    void setReplyDelayMicros(uint32_t us) { replyDelayUs = us; }
+
+    /**
+     * Время POST /image/start до IMG_READY, мкс
+     */
+    void setReadyDelayMicros(uint32_t us) { readyDelayUs = us; }
+
+    /**
+     * JSON ответа сервера на DATA
+     */
+    void setCommandJson(const char* json) { commandJson = json; }
+
+    /**
+     * Ответ на следующий ещё не принятый DATA (очередь, по одному на DATA);
+     * пустая очередь - setCommandJson()/setReplyDelayMicros()
+     */
+    void queueReply(const char* json, uint32_t delayUs);
+
+    /**
+     * Наибольшая скорость моста: BAUD_REQ выше неё получает отказ
+     */
+    void setMaxBaud(uint32_t value) { maxBaud = value; }
+
+    /**
+     * Терять каждый n-й принятый чанк без ответа (0 - без потерь)
+     */
+    void setChunkLossEvery(uint16_t n) { lossEvery = n; }
+
+    /**
+     * Обрыв потока /image/stream после n-го принятого чанка следующего кадра:
+     * мост забывает принятые чанки и снова шлёт IMG_READY (0 - без обрыва)
+     */
+    void setStreamDropAfter(uint16_t n) { streamDropAfter = n; }
+
+    /**
+     * Строка STATUS перед следующим CMD (как раз в STATUS_INTERVAL у моста)
+     */
+    void queueStatusLine(const char* text) { statusLine = text; }
+
+    // ==================== ИТОГИ ====================
+
+    const std::vector<Image>& images() const { return receivedImages; }
+
+    /**
+     * JSON принятых DATA (image_id уже вписан, как перед POST)
+     */
+    const std::vector<std::string>& dataMessages() const { return receivedData; }
+
+    /**
+     * Время приёма каждого DATA и отправки каждой CMD, мкс
+     */
+    const std::vector<uint64_t>& dataTimes() const { return dataMicros; }
+    const std::vector<uint64_t>& commandTimes() const { return commandMicros; }
+
+    uint32_t chunksReceived() const { return chunkCount; }
+    uint32_t chunksLost() const { return lostCount; }
+    uint32_t acksSent() const { return ackCount; }
+    uint32_t naksSent() const { return nakCount; }
+    uint32_t sacksSent() const { return sackCount; }
+    uint32_t transferRestarts() const { return restartCount; }
+    uint32_t commandsSent() const { return commandCount; }
+    uint32_t badFrames() const { return badFrameCount; }
+
+    /**
+     * Подтверждённая скорость (после BAUD_TEST)
+     */
+    uint32_t linkBaud() const { return confirmedBaud; }
+
+    // ==================== HostSerialPeer ====================
+
+    void onSerialByte(uint8_t b) override;
+    uint32_t serialBaud() const override { return baud; }
+    uint64_t nextEventMicros() const override;
+    void onTime(uint64_t nowMicros) override;
+
+private:
+    static const size_t MAX_PAYLOAD = 1280;   // LINK_MAX_PAYLOAD моста
+    static const uint32_t BAUD_TEST_TIMEOUT_US = 300000;
+    static const uint16_t MAX_IMAGE_CHUNKS = 256;
+
+    enum RxState : uint8_t {
+        RX_IDLE,
+        RX_LINE,
+        RX_LINE_SKIP,
+        RX_SYNC1,
+        RX_HEADER,
+        RX_PAYLOAD,
+        RX_CRC
+    };
+
+    // Разбор входящих
+    RxState rxState;
+    uint8_t rxHeader[4];
+    uint8_t rxCrc[2];
+    uint16_t rxLen;
+    uint16_t rxPos;
+    uint16_t rxCrcAcc;
+    uint8_t buffer[MAX_PAYLOAD + 1];
+    bool replyBinary;
+    uint8_t txSeq;
+
+    // Изображение в приёме
+    bool transfer;
+    bool transferBinary;
+    uint16_t window;
+    uint16_t firstMissing;
+    uint16_t receivedChunks;
+    uint16_t expectedCrc;
+    Image current;
+    std::vector<std::vector<uint8_t> > chunks;
+    std::string imageId;             // id последнего собранного кадра для DATA
+    uint32_t imageSerial;
+
+    // Отложенные ответы (HTTP)
+    struct Reply {
+        uint64_t atMicros;
+        std::string json;
+        bool binary;
+    };
+    struct ScriptedReply {
+        std::string json;
+        uint32_t delayUs;
+    };
+    uint64_t readyAt;
+    bool readyBinary;
+    std::deque<Reply> replies;
+    std::deque<ScriptedReply> script;
+
+    // Скорость
+    uint32_t baud;
+    uint32_t confirmedBaud;
+    uint32_t pendingBaud;
+    uint64_t pendingBaudDeadline;
+
+    // Настройка
+    uint32_t replyDelayUs;
+    uint32_t readyDelayUs;
+    std::string commandJson;
+    std::string statusLine;
+    uint16_t lossEvery;
+    uint16_t streamDropAfter;
+    uint32_t maxBaud;
+
+    // Итоги
+    std::vector<Image> receivedImages;
+    std::vector<std::string> receivedData;
+    std::vector<uint64_t> dataMicros;
+    std::vector<uint64_t> commandMicros;
+    uint32_t chunkCount;
+    uint32_t lostCount;
+    uint32_t ackCount;
+    uint32_t nakCount;
+    uint32_t sackCount;
+    uint32_t restartCount;
+    uint32_t commandCount;
+    uint32_t badFrameCount;
+
+    void feed(uint8_t b);
+    void drop();
+    void processLine(char* line, size_t len);
+    void processFrame(uint8_t type, const uint8_t* payload, size_t len);
+
+    void startImage(uint16_t width, uint16_t height, uint16_t totalChunks, uint16_t crc,
+                    uint16_t chunkWindow, uint8_t codec, uint8_t flags, uint8_t keyId);
+    void acceptChunk(uint16_t idx, const uint8_t* data, size_t len);
+    void endImage();
+    void handleData(char* json, size_t len);
+    void handleBaudRequest(uint32_t requested);
+    void handleBaudTest(const uint8_t* payload, size_t len);
+    void switchBaud(uint32_t newBaud);
+
+    void sendFrame(uint8_t type, const uint8_t* payload, uint16_t len);
+    void sendText(const std::string& line);
+    void sendAck(uint16_t idx);
+    void sendNak(int idx);
+    void sendSack();
+    void sendBaudAck(uint32_t value);
+
+    bool isReceived(uint32_t idx) const;
+};
+
+#endif // NODEMCU_SIM_H
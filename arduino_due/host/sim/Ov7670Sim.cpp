@@ -0,0 +1,164 @@
+#include "Ov7670Sim.h"
+#include "types.h"
+#include <cstring>
+
+// Строки кадра QQVGA из полного периода OV7670 (кадр 480 из 510 строк VGA)
+static const uint32_t ACTIVE_LINES = 480;
+static const uint32_t TOTAL_LINES = 510;
+
+static const size_t FRAME_PIXELS = (size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT;
+
+Ov7670Sim::Ov7670Sim()
+    : regPointer(0), scene(FRAME_PIXELS, 128), readPointer(0), readDummy(false), vsyncHigh(false),
+      frameStartUs(0), nextEdgeUs(UINT64_MAX), framePeriodUs(33333), readCycleNs(140),
+      writtenFrames(0), fifoFrameStartUs(0), fifoFrameEndUs(0), reading(false) {
+    memset(&current, 0, sizeof(current));
+    resetRegisters();
+}
+
+void Ov7670Sim::attach() {
+    Wire.attachDevice(I2C_ADDRESS, this);
+    HostHal::attachDevice(this);
+    HostHal::setDigitalInput(Hardware::CAM_VSYNC, LOW);
+    nextEdgeUs = HostHal::micros64() + framePeriodUs;
+}
+
+void Ov7670Sim::setScene(const uint8_t* gray, uint16_t width, uint16_t height) {
+    for (uint16_t y = 0; y < Hardware::CAM_HEIGHT; y++) {
+        const uint8_t* row = gray + (size_t)(y * height / Hardware::CAM_HEIGHT) * width;
+        for (uint16_t x = 0; x < Hardware::CAM_WIDTH; x++) {
+            scene[(size_t)y * Hardware::CAM_WIDTH + x] = row[x * width / Hardware::CAM_WIDTH];
+        }
+    }
+}
+
+void Ov7670Sim::resetRegisters() {
+    // Значения после сброса, которые читает прошивка; остальное - нули
+    memset(regs, 0, sizeof(regs));
+    regs[REG_PID] = 0x76;
+    regs[REG_VER] = 0x73;
+    regs[REG_COM15] = 0xC0;
+}
+
+// ==================== SCCB ====================
+
+bool Ov7670Sim::i2cWrite(const uint8_t* data, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    regPointer = data[0];
+    if (len < 2) {
+        return true;
+    }
+    if (regPointer == REG_COM7 && (data[1] & 0x80)) {
+        resetRegisters();
+        return true;
+    }
+    // PID/VER только для чтения
+    if (regPointer != REG_PID && regPointer != REG_VER) {
+        regs[regPointer] = data[1];
+    }
+    return true;
+}
+
+size_t Ov7670Sim::i2cRead(uint8_t* out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = regs[(uint8_t)(regPointer + i)];
+    }
+    return len;
+}
+
+// ==================== КАДРЫ ====================
+
+void Ov7670Sim::onTime(uint64_t nowMicros) {
+    // Следующий фронт - до смены уровня: обработчик VSYNC читает часы
+    if (!vsyncHigh) {
+        vsyncHigh = true;
+        frameStartUs = nowMicros;
+        nextEdgeUs = nowMicros + (uint64_t)framePeriodUs * ACTIVE_LINES / TOTAL_LINES;
+        HostHal::setDigitalInput(Hardware::CAM_VSYNC, HIGH);
+        return;
+    }
+
+    vsyncHigh = false;
+    nextEdgeUs = frameStartUs + framePeriodUs;
+    // Запись кадра в AL422B, если WR держался до конца кадра (неполные кадры не моделируются)
+    if (HostHal::digitalOutput(Hardware::CAM_WR) == HIGH) {
+        storeFrame(nowMicros);
+    }
+    HostHal::setDigitalInput(Hardware::CAM_VSYNC, LOW);
+}
+
+void Ov7670Sim::storeFrame(uint64_t nowMicros) {
+    // Порядок байт - как читает rgb565_to_gray(): младший, затем старший
+    bool rgb = (regs[REG_COM7] & 0x04) != 0;
+    fifo.resize(FRAME_PIXELS * 2);
+    for (size_t i = 0; i < FRAME_PIXELS; i++) {
+        uint8_t g = scene[i];
+        if (rgb) {
+            uint16_t pixel = (uint16_t)(((g >> 3) << 11) | ((g >> 2) << 5) | (g >> 3));
+            fifo[2 * i] = (uint8_t)(pixel & 0xFF);
+            fifo[2 * i + 1] = (uint8_t)(pixel >> 8);
+        } else {
+            // YUYV: Y, затем U или V без цвета
+            fifo[2 * i] = g;
+            fifo[2 * i + 1] = 128;
+        }
+    }
+    writtenFrames++;
+    fifoFrameStartUs = frameStartUs;
+    fifoFrameEndUs = nowMicros;
+}
+
+// ==================== FIFO ====================
+
+void Ov7670Sim::onPinOutput(uint32_t pin, int level) {
+    if (pin == Hardware::CAM_RST && level == LOW) {
+        resetRegisters();
+    } else if (pin == Hardware::CAM_RCK && level == HIGH) {
+        clockRead();
+    } else if (pin == Hardware::CAM_OE && level == HIGH) {
+        finishRead();
+    }
+}
+
+void Ov7670Sim::clockRead() {
+    HostHal::advanceNanos(readCycleNs);
+    uint64_t now = HostHal::micros64();
+
+    if (HostHal::digitalOutput(Hardware::CAM_RRST) == LOW) {
+        readPointer = 0;
+        readDummy = true;
+        reading = true;
+        current.frameStartMicros = fifoFrameStartUs;
+        current.frameEndMicros = fifoFrameEndUs;
+        current.readStartMicros = now;
+        current.readEndMicros = now;
+        current.bytesRead = 0;
+        return;
+    }
+    if (readDummy) {
+        readDummy = false;
+        return;
+    }
+    if (HostHal::digitalOutput(Hardware::CAM_OE) != LOW) {
+        return;
+    }
+
+    uint8_t value = (readPointer < fifo.size()) ? fifo[readPointer] : 0xFF;
+    readPointer++;
+    Pio* port = g_APinDescription[Hardware::CAM_D0].pPort;
+    const uint32_t mask = 0xFFu << Hardware::CAM_DATA_SHIFT;
+    port->PIO_PDSR = (port->PIO_PDSR & ~mask) | ((uint32_t)value << Hardware::CAM_DATA_SHIFT);
+    if (reading) {
+        current.readEndMicros = now;
+        current.bytesRead++;
+    }
+}
+
+void Ov7670Sim::finishRead() {
+    if (reading && current.bytesRead > 0) {
+        readouts.push_back(current);
+    }
+    reading = false;
+}
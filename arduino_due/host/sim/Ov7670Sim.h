@@ -0,0 +1,100 @@
+#ifndef OV7670_SIM_H
+#define OV7670_SIM_H
+
+#include "HostHal.h"
+#include "Wire.h"
+#include <vector>
+
+/**
+ * Модель OV7670 + AL422B на выводах CameraModule (Hardware::CAM_*) и SCCB
+ * Регистры по Wire (0x21): PID/VER, сброс по COM7 и выводу RST, формат
+ * вывода - COM7/COM15. Кадры идут непрерывно: VSYNC высокий на время кадра;
+ * кадр, при конце которого WR высокий, попадает в FIFO. Чтение - по фронтам
+ * RCK (PIO_SODR): сброс указателя при низком RRST, первый такт после
+ * сброса - холостой, байт на D0..D7 (PIO_PDSR) при низком OE.
+ * Такт RCK стоит времени цикла чтения прошивки (setReadCycleNs)
+ */
+class Ov7670Sim : public HostDevice, public HostI2cDevice {
+public:
+    // Одно чтение кадра прошивкой: от начала кадра в FIFO до подъёма OE
+    struct Capture {
+        uint64_t frameStartMicros;
+        uint64_t frameEndMicros;
+        uint64_t readStartMicros;
+        uint64_t readEndMicros;
+        uint32_t bytesRead;
+    };
+
+    Ov7670Sim();
+
+    /**
+     * Подключиться к Wire и выводам HostHal (после HostHal::reset())
+     */
+    void attach();
+
+    // ==================== НАСТРОЙКА ====================
+
+    /**
+     * Сцена - серый кадр любого размера (ближайший пиксель до 160x120)
+     */
+    void setScene(const uint8_t* gray, uint16_t width, uint16_t height);
+
+    /**
+     * Период кадра, мкс (по умолчанию 30 кадров/с)
+     */
+    void setFramePeriodMicros(uint32_t us) { framePeriodUs = us; }
+
+    /**
+     * Время одного такта RCK в цикле чтения прошивки, нс
+     */
+    void setReadCycleNs(uint32_t ns) { readCycleNs = ns; }
+
+    // ==================== ИТОГИ ====================
+
+    uint32_t framesWritten() const { return writtenFrames; }
+    const std::vector<Capture>& captures() const { return readouts; }
+
+    // ==================== HostDevice / HostI2cDevice ====================
+
+    void onPinOutput(uint32_t pin, int level) override;
+    uint64_t nextEventMicros() const override { return nextEdgeUs; }
+    void onTime(uint64_t nowMicros) override;
+
+    bool i2cWrite(const uint8_t* data, size_t len) override;
+    size_t i2cRead(uint8_t* out, size_t len) override;
+
+private:
+    static const uint8_t I2C_ADDRESS = 0x21;
+    static const uint8_t REG_PID = 0x0A;
+    static const uint8_t REG_VER = 0x0B;
+    static const uint8_t REG_COM7 = 0x12;
+    static const uint8_t REG_COM15 = 0x40;
+
+    uint8_t regs[256];
+    uint8_t regPointer;
+
+    std::vector<uint8_t> scene;
+    std::vector<uint8_t> fifo;
+    size_t readPointer;
+    bool readDummy;
+
+    bool vsyncHigh;
+    uint64_t frameStartUs;
+    uint64_t nextEdgeUs;
+    uint32_t framePeriodUs;
+    uint32_t readCycleNs;
+
+    uint32_t writtenFrames;
+    uint64_t fifoFrameStartUs;
+    uint64_t fifoFrameEndUs;
+    Capture current;
+    bool reading;
+    std::vector<Capture> readouts;
+
+    void resetRegisters();
+    void storeFrame(uint64_t nowMicros);
+    void clockRead();
+    void finishRead();
+};
+
+#endif // OV7670_SIM_H
@@ -0,0 +1,313 @@
+/*
+ * WifiLink против модели NodeMCU через Serial1 модели HostHal
+ * Согласование скорости, передача шага (изображение + DATA -> CMD) в текстовом
+ * и бинарном форматах, окно с потерями чанков, ключевой кадр по "refresh",
+ * повтор кадра после обрыва потока моста, строка STATUS, разбор "seq".
+ * Время виртуальное: итоги не зависят от скорости машины CI
+ */
+
+#include "HostHal.h"
+#include "NodeMcuSim.h"
+#include "WifiLink.h"
+#include "MemoryArena.h"
+#include "Perf.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static WifiLink link;
+static uint8_t frame[Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT];
+
+static void setUp(NodeMcuSim& peer) {
+    HostHal::reset();
+    peer.attach();
+    MemoryArena::begin();
+    Perf::begin();
+    // LINK_ECHO=1 - вывод прошивки в stdout
+    HostHal::setConsoleEcho(getenv("LINK_ECHO") != nullptr);
+    link.begin();
+}
+
+// poll() в цикле, как CarController::tick(), пока условие не выполнится
+template <typename Done>
+static bool pollUntil(Done done, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (!done()) {
+        if (millis() - start > timeoutMs) {
+            return false;
+        }
+        link.poll();
+        HostHal::advanceMicros(100);
+    }
+    return true;
+}
+
+static void fillFrame(uint8_t seed) {
+    // Плавный градиент с шумом: сцена меняется от шага к шагу
+    uint32_t lcg = 12345u + seed * 7919u;
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        lcg = lcg * 1103515245u + 12345u;
+        frame[i] = (uint8_t)((i % Hardware::CAM_WIDTH) + seed * 16 + ((lcg >> 16) & 0x07));
+    }
+}
+
+static void fillScene(uint8_t step) {
+    // Гладкий фон и светлый столбец, сдвигающийся с шагом: сжимается и intra, и inter
+    for (size_t y = 0; y < Hardware::CAM_HEIGHT; y++) {
+        for (size_t x = 0; x < Hardware::CAM_WIDTH; x++) {
+            bool bar = x >= step * 32u && x < step * 32u + 24u;
+            frame[y * Hardware::CAM_WIDTH + x] = bar ? 230 : (uint8_t)(x / 2);
+        }
+    }
+}
+
+static ImageSnapshot snapshot() {
+    ImageSnapshot image;
+    image.available = true;
+    image.width = Hardware::CAM_WIDTH;
+    image.height = Hardware::CAM_HEIGHT;
+    image.buffer = frame;
+    image.bufferSize = sizeof(frame);
+    image.geometry = GEOMETRY_FULL;
+    image.pixelFormat = PIXEL_RGB565;
+    return image;
+}
+
+/**
+ * Шаг: startSend, poll до CMD; возвращает время шага, мс (0 - CMD не пришла)
+ */
+static uint32_t runStep(uint32_t stepId, bool withImage, Command& cmd) {
+    DateTime ts = { 1, 1, 2025, 12, 0, 0 };
+    SensorSnapshot sensors;
+    memset(&sensors, 0, sizeof(sensors));
+    sensors.distanceCm = 42.0f;
+    ImageSnapshot image = snapshot();
+    image.available = withImage;
+
+    uint32_t start = millis();
+    if (!pollUntil([]() { return !link.isNegotiating(); }, 3000)) {
+        return 0;
+    }
+    if (!link.startSend(7, stepId, ts, sensors, image)) {
+        return 0;
+    }
+    bool got = pollUntil([&]() { return !link.isSending() && link.takeCommand(cmd); }, 20000);
+    return got ? (millis() - start) : 0;
+}
+
+static void testBaudNegotiation() {
+    printf("baud negotiation\n");
+    NodeMcuSim peer;
+    setUp(peer);
+    CHECK(pollUntil([]() { return !link.isNegotiating() && link.getBaud() != Hardware::SERIAL1_BAUD; }, 3000));
+    CHECK(link.getBaud() == WIFI_LINK_MAX_BAUD);
+    CHECK(peer.linkBaud() == WIFI_LINK_MAX_BAUD);
+    CHECK(HostHal::serial1Baud() == WIFI_LINK_MAX_BAUD);
+    printf("  %lu baud at %lu ms\n", (unsigned long)link.getBaud(), (unsigned long)millis());
+}
+
+static void testBinaryStep() {
+    printf("binary step, window %u\n", (unsigned)WIFI_LINK_DEFAULT_WINDOW);
+    NodeMcuSim peer;
+    setUp(peer);
+    link.setCodec(CODEC_RAW);
+    fillFrame(1);
+
+    Command cmd;
+    uint32_t ms = runStep(1, true, cmd);
+    CHECK(ms > 0);
+    CHECK(strcmp(cmd.name, "FORWARD") == 0);
+    CHECK(cmd.durationMs == 1000);
+    CHECK(peer.images().size() == 1);
+    if (peer.images().size() == 1) {
+        const NodeMcuSim::Image& got = peer.images()[0];
+        CHECK(got.binary);
+        CHECK(got.complete);
+        CHECK(got.crcOk);
+        CHECK(got.width == Hardware::CAM_WIDTH && got.height == Hardware::CAM_HEIGHT);
+        CHECK(got.codec == CODEC_RAW);
+        CHECK(got.data.size() == sizeof(frame) && memcmp(got.data.data(), frame, sizeof(frame)) == 0);
+    }
+    CHECK(peer.dataMessages().size() == 1);
+    if (!peer.dataMessages().empty()) {
+        CHECK(peer.dataMessages()[0].find("\"sim_1\"") != std::string::npos);
+    }
+    CHECK(peer.sacksSent() > 0);
+    CHECK(HostHal::serial1Stats().rxOverruns == 0);
+    // Первый шаг уходит до согласования скорости - на базовой
+    printf("  step %lu ms at %lu baud, %lu chunks, %lu bytes to NodeMCU\n", (unsigned long)ms,
+           (unsigned long)Hardware::SERIAL1_BAUD, (unsigned long)peer.chunksReceived(),
+           (unsigned long)HostHal::serial1Stats().bytesToPeer);
+}
+
+static void testTextStopAndWait() {
+    printf("text step, stop-and-wait\n");
+    NodeMcuSim peer;
+    setUp(peer);
+    link.setMode(WifiLink::MODE_TEXT);
+    link.setWindow(1);
+    link.setCodec(CODEC_RAW);
+    peer.setCommandJson("{\"command\":\"LEFT\",\"duration_ms\":500,\"step\":2}");
+    fillFrame(2);
+
+    Command cmd;
+    uint32_t ms = runStep(2, true, cmd);
+    CHECK(ms > 0);
+    CHECK(strcmp(cmd.name, "LEFT") == 0);
+    CHECK(cmd.stepId == 2);
+    CHECK(peer.images().size() == 1);
+    if (peer.images().size() == 1) {
+        const NodeMcuSim::Image& got = peer.images()[0];
+        CHECK(!got.binary);
+        CHECK(got.crcOk);
+        CHECK(got.data.size() == sizeof(frame) && memcmp(got.data.data(), frame, sizeof(frame)) == 0);
+    }
+    CHECK(peer.acksSent() == peer.chunksReceived());
+    CHECK(peer.sacksSent() == 0);
+    printf("  step %lu ms, %lu chunks\n", (unsigned long)ms, (unsigned long)peer.chunksReceived());
+}
+
+static void testWindowWithLoss() {
+    printf("binary step, window %u, every 7th chunk lost\n", (unsigned)WifiLink::MAX_WINDOW);
+    NodeMcuSim peer;
+    setUp(peer);
+    link.setWindow(WifiLink::MAX_WINDOW);
+    peer.setChunkLossEvery(7);
+
+    // Два шага подряд: ключевой кадр, затем разностный к нему (CODEC_INTER)
+    uint32_t ms[2];
+    for (uint8_t step = 0; step < 2; step++) {
+        fillFrame(3 + step);
+        Command cmd;
+        ms[step] = runStep(10 + step, true, cmd);
+        CHECK(ms[step] > 0);
+    }
+    CHECK(peer.chunksLost() > 0);
+    CHECK(peer.images().size() == 2);
+    for (size_t i = 0; i < peer.images().size(); i++) {
+        CHECK(peer.images()[i].complete);
+        CHECK(peer.images()[i].crcOk);
+    }
+    if (peer.images().size() == 2) {
+        CHECK((peer.images()[0].flags & FRAME_FLAG_KEY) != 0);
+    }
+    printf("  steps %lu ms (base baud) / %lu ms (%lu baud), %lu of %lu chunks lost and resent\n",
+           (unsigned long)ms[0], (unsigned long)ms[1], (unsigned long)link.getBaud(), (unsigned long)peer.chunksLost(), (unsigned long)peer.chunksReceived());
+}
+
+static void testKeyframeRefresh() {
+    printf("CODEC_INTER, server lost the keyframe\n");
+    NodeMcuSim peer;
+    setUp(peer);
+
+    // Шаг 2 - разностный к ключевому шага 1; ответ на него просит refresh,
+    // как сервер после "keyframe ... is not available" - шаг 3 снова ключевой
+    const char* replies[3] = {
+        "{\"command\":\"FORWARD\",\"duration_ms\":500}",
+        "{\"command\":\"FORWARD\",\"duration_ms\":500,\"refresh\":true}",
+        "{\"command\":\"FORWARD\",\"duration_ms\":500}",
+    };
+    for (uint8_t step = 0; step < 3; step++) {
+        fillScene(step);
+        peer.setCommandJson(replies[step]);
+        Command cmd;
+        CHECK(runStep(40 + step, true, cmd) > 0);
+        CHECK(cmd.refreshImage == (step == 1));
+    }
+    CHECK(peer.images().size() == 3);
+    if (peer.images().size() == 3) {
+        CHECK((peer.images()[0].flags & FRAME_FLAG_KEY) != 0);
+        CHECK(peer.images()[1].codec == CODEC_INTER && (peer.images()[1].flags & FRAME_FLAG_KEY) == 0);
+        CHECK((peer.images()[2].flags & FRAME_FLAG_KEY) != 0);
+        CHECK(peer.images()[2].keyId != peer.images()[0].keyId);
+    }
+}
+
+static void testStreamRestart() {
+    printf("bridge stream drop, transfer restarted from chunk 0\n");
+    NodeMcuSim peer;
+    setUp(peer);
+    link.setCodec(CODEC_RAW);
+    fillFrame(8);
+
+    // Первый шаг на базовой скорости: согласование не вмешивается в передачу
+    Command cmd;
+    CHECK(runStep(50, false, cmd) > 0);
+    peer.setStreamDropAfter(20);
+    uint32_t ms = runStep(51, true, cmd);
+    CHECK(ms > 0);
+    CHECK(peer.transferRestarts() == 1);
+    CHECK(peer.images().size() == 1);
+    if (peer.images().size() == 1) {
+        const NodeMcuSim::Image& got = peer.images()[0];
+        CHECK(got.complete);
+        CHECK(got.crcOk);
+        CHECK(got.data.size() == sizeof(frame) && memcmp(got.data.data(), frame, sizeof(frame)) == 0);
+    }
+    CHECK(peer.dataMessages().size() == 2);
+    if (peer.dataMessages().size() == 2) {
+        CHECK(peer.dataMessages()[1].find("\"sim_1\"") != std::string::npos);
+    }
+    printf("  step %lu ms, %lu chunks\n", (unsigned long)ms, (unsigned long)peer.chunksReceived());
+}
+
+static void testStatusAndDataOnly() {
+    printf("DATA without image, STATUS line\n");
+    NodeMcuSim peer;
+    setUp(peer);
+    peer.queueStatusLine("rssi=-61 heap=31000 heap_min=29000 block=20000 block_min=18000 frag=9 baud=2000000");
+
+    Command cmd;
+    uint32_t ms = runStep(20, false, cmd);
+    CHECK(ms > 0);
+    CHECK(peer.images().empty());
+    CHECK(peer.dataMessages().size() == 1);
+    CHECK(strncmp(link.getBridgeStatus(), "rssi=-61", 8) == 0);
+    CHECK(link.getRxCrcErrors() == 0);
+    printf("  step %lu ms\n", (unsigned long)ms);
+}
+
+static void testSequenceWithBadSegment() {
+    printf("CMD seq with a non-array element\n");
+    NodeMcuSim peer;
+    setUp(peer);
+    peer.setCommandJson("{\"command\":\"FORWARD\",\"duration_ms\":600,"
+                        "\"seq\":[[\"FORWARD\",400],5,[\"LEFT\",200]]}");
+
+    Command cmd;
+    uint32_t ms = runStep(30, false, cmd);
+    CHECK(ms > 0);
+    CHECK(cmd.segmentCount == 2);
+    if (cmd.segmentCount == 2) {
+        CHECK(strcmp(cmd.segments[0].name, "FORWARD") == 0 && cmd.segments[0].durationMs == 400);
+        CHECK(strcmp(cmd.segments[1].name, "LEFT") == 0 && cmd.segments[1].durationMs == 200);
+    }
+}
+
+int main() {
+    testBaudNegotiation();
+    testBinaryStep();
+    testTextStopAndWait();
+    testWindowWithLoss();
+    testKeyframeRefresh();
+    testStreamRestart();
+    testStatusAndDataOnly();
+    testSequenceWithBadSegment();
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -2,6 +2,7 @@
 #define CAMERA_MODULE_H
 
 #include "types.h"
+#include "MemoryArena.h"
 
 // Register-value pair for OV7670 configuration
 struct regval_list {
@@ -11,9 +12,33 @@ struct regval_list {
 
 #define REG_LIST_END_MARKER 0xFF
 
+// Конвейер пикселей после старта (переключается командой "cam rgb|yuv")
+#ifndef CAM_DEFAULT_PIXEL_FORMAT
+#define CAM_DEFAULT_PIXEL_FORMAT PIXEL_RGB565
+#endif
+
+// Частота SCCB; если OV7670 не отвечает на ней, шина переходит на 100 кГц
+#ifndef CAM_SCCB_CLOCK
+#define CAM_SCCB_CLOCK 400000
+#endif
+
+// Быстрая инициализация: пауза только после сброса и смены формата (COM7), короткие
+// ожидания сброса по даташиту; установка AEC/AGC - без delay, захват просто ждёт её.
+// 0 - как раньше: delay(1) после каждой записи и паузы 100/200/300 мс
+#ifndef CAM_FAST_INIT
+#define CAM_FAST_INIT 1
+#endif
+
+// Тёплый старт: если регистры-подпись уже как после configureSensor() (Due
+// перезапустился, а камера нет), сброс и полная настройка пропускаются
+#ifndef CAM_WARM_START
+#define CAM_WARM_START 1
+#endif
+
 /**
  * Модуль камеры OV7670 + AL422B FIFO для Arduino Due
- * Захватывает изображение в RGB565, конвертирует в grayscale для LLM
+ * Захватывает изображение в RGB565 (с конвертацией в grayscale)
+ * или в YUV422 (берётся только яркость Y) для LLM
  */
 class CameraModule {
 public:
@@ -31,27 +56,213 @@ public:
     ImageSnapshot captureIfLight(bool isDark);
     
     /**
-     * Захват изображения без проверки освещенности
+     * Захват изображения без проверки освещенности (блокирующий)
+     * Запускает фоновый захват, если он не идёт, и дожидается его окончания
      * @return структура ImageSnapshot с данными изображения
      */
     ImageSnapshot capture();
     
+    /**
+     * Запуск фонового захвата кадра в задний буфер (неблокирующий)
+     * Запись кадра в AL422B идёт по прерываниям VSYNC,
+     * вычитывание FIFO - порциями строк в pollCapture()
+     * @return true если захват запущен или уже идёт;
+     *         false если задний буфер закреплён (pinFrontFrame())
+     */
+    bool startCapture();
+    
+    /**
+     * Продвижение фонового захвата (вызывать каждый tick)
+     * @return true если в этом вызове опубликован новый кадр
+     */
+    bool pollCapture();
+    
+    /**
+     * Последний полностью захваченный кадр (передний буфер)
+     * Отмечает кадр как использованный для hasFreshFrame()
+     * @return ImageSnapshot; available=false если кадров ещё не было
+     */
+    ImageSnapshot latestFrame();
+    
+    /**
+     * Есть ли кадр новее, чем последний выданный latestFrame()
+     */
+    bool hasFreshFrame() const { return frontValid && frontSequence != consumedSequence; }
+    
+    /**
+     * Закрепление переднего кадра, пока его читает передача (WifiLink)
+     * Захват в его буфер не запускается до unpinFrame(); следующий кадр
+     * в другой буфер захватывается как обычно
+     */
+    void pinFrontFrame() { framePinned = frontValid; pinnedIndex = frontIndex; }
+    
+    /**
+     * Снятие закрепления кадра
+     */
+    void unpinFrame() { framePinned = false; }
+    
+    /**
+     * Идёт ли сейчас фоновый захват
+     */
+    bool isCaptureBusy() const { return captureState != CAPTURE_IDLE; }
+    
+    /**
+     * Выбор геометрии выходного изображения
+     * Применяется со следующего запущенного захвата
+     * @param geometry GEOMETRY_FULL / GEOMETRY_HALF / GEOMETRY_HORIZON
+     */
+    void setGeometry(ImageGeometry geometry) { requestedGeometry = geometry; }
+    
+    /**
+     * Текущая выбранная геометрия
+     */
+    ImageGeometry getGeometry() const { return requestedGeometry; }
+    
+    /**
+     * Имя геометрии ("full", "half", "horizon")
+     */
+    static const char* geometryName(ImageGeometry geometry);
+    
+    /**
+     * Разбор имени геометрии
+     * @return true если имя известно
+     */
+    static bool parseGeometry(const char* name, ImageGeometry& outGeometry);
+    
+    /**
+     * Выбор формата пикселей камеры (перепрограммирует OV7670)
+     * Идущий захват отменяется, новый формат действует со следующего кадра
+     * @param format PIXEL_RGB565 / PIXEL_YUV422
+     * @return true если регистры камеры записаны успешно
+     */
+    bool setPixelFormat(PixelFormat format);
+    
+    /**
+     * Текущий формат пикселей камеры
+     */
+    PixelFormat getPixelFormat() const { return pixelFormat; }
+    
+    /**
+     * Имя формата ("rgb565", "yuv422")
+     */
+    static const char* pixelFormatName(PixelFormat format);
+    
+    /**
+     * Разбор имени формата ("rgb565"/"rgb", "yuv422"/"yuv")
+     * @return true если имя известно
+     */
+    static bool parsePixelFormat(const char* name, PixelFormat& outFormat);
+    
     /**
      * Проверка, инициализирована ли камера
      */
     bool isInitialized() const { return cameraInitialized; }
+    
+    /**
+     * Итог begin(): камера уже была настроена (тёплый старт), частота SCCB
+     * и время инициализации
+     */
+    bool isWarmStarted() const { return warmStarted; }
+    uint32_t getSccbClock() const { return sccbClock; }
+    uint32_t getInitMillis() const { return initMillis; }
 
 private:
     bool cameraInitialized;
+    bool warmStarted;
+    uint32_t sccbClock;
+    uint32_t initMillis;
+    
+    // Первый кадр после настройки регистров - не раньше (AEC/AGC/AWB сходятся)
+    static const uint32_t SENSOR_SETTLE_MS = 300;
+    uint32_t settleUntilMillis;
     
-    // Буфер для изображения в grayscale (160x120 = 19200 байт)
+    // Двойной буфер grayscale (2 x 160x120 = 38400 байт, ARENA_FRAMES):
+    // передний отдаётся наружу, в задний пишется следующий кадр
     static const uint16_t IMAGE_WIDTH = Hardware::CAM_WIDTH;
     static const uint16_t IMAGE_HEIGHT = Hardware::CAM_HEIGHT;
     // Исходное разрешение камеры QQVGA (совпадает с выходным)
     static const uint16_t CAPTURE_WIDTH = 160;
     static const uint16_t CAPTURE_HEIGHT = 120;
     static const size_t IMAGE_BUFFER_SIZE = IMAGE_WIDTH * IMAGE_HEIGHT;
-    uint8_t imageBuffer[IMAGE_BUFFER_SIZE];
+    uint8_t* frameBuffers[2];
+    uint8_t frontIndex;
+    bool frontValid;
+    uint32_t frontSequence;
+    uint32_t consumedSequence;
+    bool framePinned;          // буфер pinnedIndex не перезаписывается
+    uint8_t pinnedIndex;
+    
+    // Состояния фонового захвата
+    enum CaptureState {
+        CAPTURE_IDLE,
+        CAPTURE_WAIT_FRAME_START,  // ждём начала кадра (фронт VSYNC)
+        CAPTURE_WRITING,           // AL422B пишет кадр, ждём конца кадра
+        CAPTURE_FRAME_IN_FIFO,     // кадр в FIFO, можно вычитывать
+        CAPTURE_READING            // вычитываем FIFO порциями строк
+    };
+    
+    volatile uint8_t captureState;
+    volatile uint32_t frameEndMicros;
+    uint32_t captureStartMillis;
+    uint16_t readRow;
+    
+    // Геометрия: запрошенная, активная (текущий захват) и переднего кадра
+    ImageGeometry requestedGeometry;
+    ImageGeometry activeGeometry;
+    ImageGeometry frontGeometry;
+    
+    // Формат пикселей, на который настроена камера, и формат переднего кадра
+    PixelFormat pixelFormat;
+    PixelFormat frontFormat;
+    
+    // Параметры вычитывания FIFO для активной геометрии
+    struct ReadoutPlan {
+        uint16_t width;       // выходная ширина
+        uint16_t height;      // выходная высота
+        uint16_t firstRow;    // первая строка кадра камеры
+        uint8_t rowStep;      // шаг по строкам (1 или 2)
+        uint8_t colStep;      // шаг по пикселям (1 или 2)
+    };
+    ReadoutPlan plan;
+    static ReadoutPlan planFor(ImageGeometry geometry);
+    
+    static const uint16_t ROWS_PER_POLL = 20;          // строк за один pollCapture()
+    static const uint32_t FIFO_SETTLE_US = 1000;       // пауза после WR перед чтением
+    static const uint32_t CAPTURE_TIMEOUT_MS = 500;    // нет VSYNC - отмена
+    
+    static CameraModule* vsyncOwner;
+    static void vsyncIsr();
+    void handleVsyncEdge();
+    
+    void abortCapture();
+    void convertRow(const uint8_t* src, uint8_t* dst, size_t pixels);
+    ImageSnapshot emptySnapshot() const;
+    
+    /**
+     * Запись регистров OV7670 для формата пикселей и QQVGA
+     * @return true если все списки регистров записаны
+     */
+    bool configureSensor(PixelFormat format);
+    
+    /**
+     * Регистры-подпись совпадают с тем, что пишет configureSensor(format)
+     */
+    bool isSensorConfigured(PixelFormat format);
+    
+    /**
+     * Выбор частоты SCCB: CAM_SCCB_CLOCK, если на ней читается PID, иначе 100 кГц
+     * @return PID, прочитанный на выбранной частоте
+     */
+    uint8_t probeSccbClock();
+    
+    // Строка RGB565 из FIFO (160 * 2 = 320 байт) - в ARENA_SCRATCH на время pollCapture()
+    static const size_t LINE_BYTES = CAPTURE_WIDTH * 2;
+    
+    // Быстрое чтение FIFO: D0-D7 на одном порту, RCK через SODR/CODR
+    bool parallelReadout;
+    Pio* dataPort;
+    Pio* rckPort;
+    uint32_t rckMask;
     
     // OV7670 I2C address
     static const uint8_t OV7670_I2C_ADDR = 0x21;
@@ -64,6 +275,41 @@ private:
     bool writeRegisterList(const regval_list* list);
     uint8_t readByte();
     
+    /**
+     * Чтение n байт из FIFO подряд (быстрый путь для целой строки)
+     * @param dst буфер назначения
+     * @param n количество байт
+     */
+    void readLine(uint8_t* dst, size_t n);
+    
+    /**
+     * Чтение строки с прореживанием: берётся каждый step-й пиксель RGB565,
+     * остальные только протактированы RCK (без выборки шины)
+     * @param dst буфер назначения (2 байта на взятый пиксель)
+     * @param pixels количество взятых пикселей
+     * @param step шаг по пикселям
+     */
+    void readPixelsStrided(uint8_t* dst, size_t pixels, uint8_t step);
+    
+    /**
+     * Чтение строки YUYV: из каждого step-го пикселя берётся байт Y,
+     * байт цветности и пропущенные пиксели только протактированы RCK
+     * @param dst буфер назначения (1 байт на взятый пиксель)
+     * @param pixels количество взятых пикселей
+     * @param step шаг по пикселям
+     */
+    void readLumaStrided(uint8_t* dst, size_t pixels, uint8_t step);
+    
+    /**
+     * Пропуск n байт FIFO (только тактирование RCK)
+     */
+    void skipBytes(size_t n);
+    
+    /**
+     * Проверка, что D0-D7 лежат на одном порту подряд начиная с CAM_DATA_SHIFT
+     */
+    bool checkParallelBus() const;
+    
     // Методы управления FIFO
     void fifoWriteEnable();
     void fifoWriteDisable();
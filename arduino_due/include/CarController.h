@@ -11,9 +11,29 @@
 #include "SerialCommandProcessor.h"
 #include "SoftRTC.h"
 
+// Конвейерный режим после старта (переключается командой "step serial|pipelined")
+#ifndef CAR_DEFAULT_PIPELINED
+#define CAR_DEFAULT_PIPELINED false
+#endif
+
+// Защитная остановка во время команды (команда "safety <cm>", 0 - выключена)
+#ifndef CAR_DEFAULT_SAFETY_CM
+#define CAR_DEFAULT_SAFETY_CM 15
+#endif
+
+// Порог удара для защитной остановки, g
+#ifndef CAR_SAFETY_IMPACT_G
+#define CAR_SAFETY_IMPACT_G 2.5f
+#endif
+
 /**
  * Главный контроллер автомобиля
  * Управляет всеми модулями и реализует конечный автомат
+ *
+ * Последовательный режим: датчики -> отправка -> ожидание команды -> выполнение.
+ * Конвейерный режим: данные шага N+1 снимаются и уходят на сервер, пока
+ * выполняется команда шага N; ответ ждёт окончания команды N, ответы
+ * на другие шаги отбрасываются по номеру шага
  */
 class CarController {
 public:
@@ -51,12 +71,13 @@ private:
     
     // Счетчики
     uint32_t sessionId;
-    uint32_t stepId;
+    uint32_t stepId;          // последний шаг, данные которого сняты
     
     // Таймеры
     uint32_t stateStartMillis;
     uint32_t commandWaitStartMillis;
     uint32_t commandExecStartMillis;
+    uint32_t lastCollectMillis;   // снятие данных прошлого шага (время шага для imageRate)
     
     // Текущие данные шага
     SensorSnapshot currentSensorSnapshot;
@@ -65,10 +86,23 @@ private:
     Command currentCommand;
     CommandConfig currentCommandConfig;
     uint32_t currentCommandDuration;
+    uint8_t currentAbortReason;   // AbortReason текущей команды
+    uint32_t lastSonarSequence;   // последний замер, проверенный защитой
+    
+    // Конвейер: следующий шаг, отправленный во время текущей команды
+    bool nextSent;
+    bool nextReady;           // ответ на него получен
+    uint32_t nextSentMillis;
+    SensorSnapshot nextSensorSnapshot;
+    ImageSnapshot nextImageSnapshot;
+    DateTime nextStepTimestamp;
+    Command nextCommand;
     
     // Конфигурация
     bool serialLoggingEnabled;
+    bool pipelinedMode;
     uint32_t defaultStepDurationMs;
+    uint16_t safetyDistanceCm;
     static const uint32_t COMMAND_WAIT_TIMEOUT_MS = 5000;
     
     // Обработчики состояний
@@ -80,6 +114,39 @@ private:
     
     void changeState(State newState);
     void logCurrentStep();
+    
+    /**
+     * Новый шаг: номер, время, датчики и кадр
+     */
+    void collectStep(SensorSnapshot& sensorsOut, ImageSnapshot& imageOut, DateTime& tsOut);
+    
+    /**
+     * Поиск конфигурации команды и запуск её выполнения
+     */
+    void acceptCommand(const Command& cmd);
+    void startCommand();
+    
+    /**
+     * Ответ на другой шаг (опоздавший после таймаута)
+     */
+    bool isStaleCommand(const Command& cmd, uint32_t expectedStepId);
+    
+    /**
+     * Защитный слой: новые замеры HC-SR04 и пик ускорения за tick
+     * @return AbortReason (ABORT_NONE - ехать дальше)
+     */
+    uint8_t checkReflexStop();
+    
+    /**
+     * Конвейер во время выполнения команды: отправка следующего шага, приём ответа
+     */
+    void advancePipeline();
+    
+    /**
+     * Запуск передачи шага с закреплением кадра камеры
+     * @return false если предыдущая передача ещё идёт
+     */
+    bool sendStep(const SensorSnapshot& sensorsIn, const ImageSnapshot& imageIn, const DateTime& ts);
 };
 
 #endif // CAR_CONTROLLER_H
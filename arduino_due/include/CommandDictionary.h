@@ -4,16 +4,50 @@
 #include "types.h"
 #include <DueFlashStorage.h>
 
-// Структура для хранения в энергонезависимой памяти
+// Задержка записи словаря во flash после последнего изменения, мс
+// (изменения подряд уходят одной записью)
+#ifndef COMMAND_DICT_SAVE_DELAY_MS
+#define COMMAND_DICT_SAVE_DELAY_MS 5000
+#endif
+
+// Шаг макроса: команда словаря и доля общего времени
+const uint8_t MAX_MACRO_STEPS = 4;
+struct CommandMacroStep {
+    uint8_t commandId;           // ID команды (не макроса)
+    uint8_t reserved;
+    uint16_t permille;           // доля длительности макроса, 1/1000
+};
+
+// Макрос: последовательность команд с параметром - общей длительностью
+struct CommandMacro {
+    char name[16];
+    uint32_t baseDurationMs;     // если сервер не передал duration_ms
+    uint8_t stepCount;
+    uint8_t reserved[3];
+    CommandMacroStep steps[MAX_MACRO_STEPS];
+};
+
+// Структура для хранения в энергонезависимой памяти (один слот)
 struct FlashCommandStorage {
     uint32_t magic;              // сигнатура для проверки валидности
-    size_t count;                // количество команд
-    CommandConfig commands[5];   // массив команд
+    uint32_t generation;         // номер записи: действует слот с наибольшим
+    uint16_t count;              // количество команд
+    uint16_t macroCount;         // количество макросов
+    uint16_t crc;                // CRC16-CCITT команд и макросов
+    uint16_t reserved;
+    CommandConfig commands[COMMAND_DICT_CAPACITY];
+    CommandMacro macros[COMMAND_MACRO_CAPACITY];
 };
 
 /**
  * Справочник команд в энергонезависимой памяти
- * Хранит конфигурации команд: FORWARD, BACKWARD, LEFT, RIGHT, STOP
+ * До 64 команд и 8 макросов; первые пять - FORWARD, BACKWARD, LEFT, RIGHT, STOP
+ *
+ * Поиск по имени - идеальная хеш-таблица, которая строится при загрузке
+ * (hash-and-displace: корзина по старшим битам хеша, смещение корзины подбирается так,
+ * чтобы все имена попали в разные слоты): одно хеширование и одно strcmp для проверки.
+ * Запись во flash - в слоты по кругу (выравнивание износа), не чаще чем раз
+ * в COMMAND_DICT_SAVE_DELAY_MS после последнего изменения
  */
 class CommandDictionary {
 public:
@@ -23,6 +57,16 @@ public:
      */
     bool begin();
     
+    /**
+     * Отложенная запись во flash (вызывать из tick)
+     */
+    void poll();
+    
+    /**
+     * Немедленная запись несохранённых изменений
+     */
+    void flush();
+    
     /**
      * Получение конфигурации команды по имени
      * @param name имя команды
@@ -32,30 +76,101 @@ public:
     bool getConfig(const char* name, CommandConfig& outCfg) const;
     
     /**
-     * Обновление или добавление конфигурации команды
+     * Получение конфигурации команды по ID
+     * @return false для макроса или неизвестного ID
+     */
+    bool getConfigById(uint8_t id, CommandConfig& outCfg) const;
+    
+    /**
+     * Обновление или добавление конфигурации команды (запись во flash - отложенная)
      * @param cfg конфигурация команды
      * @return true если успешно
      */
     bool updateConfig(const CommandConfig& cfg);
     
+    /**
+     * Обновление или добавление макроса (шаги - только команды, не макросы)
+     * @return true если успешно
+     */
+    bool updateMacro(const CommandMacro& macro);
+    
+    /**
+     * ID по имени (команда или макрос)
+     * @return ID или -1 если имени нет
+     */
+    int lookup(const char* name) const;
+    
+    /**
+     * Является ли ID макросом
+     */
+    bool isMacro(int id) const {
+        return id >= COMMAND_MACRO_ID_BASE && id < COMMAND_MACRO_ID_BASE + storage.macroCount;
+    }
+    
+    /**
+     * Разворачивание макроса в отрезки команды
+     * @param id ID макроса
+     * @param durationMs общая длительность (0 = baseDurationMs макроса)
+     * @param outCmd команда: заполняются segments и segmentCount
+     * @return false если id не макрос
+     */
+    bool expandMacro(int id, uint32_t durationMs, Command& outCmd) const;
+    
     /**
      * Вывод всех команд в Serial (для отладки)
      */
     void printAllToSerial() const;
-
+    
+    /**
+     * Индекс команды (для упакованного журнала)
+     * @return индекс или -1 если команды нет
+     */
+    int indexOf(const char* name) const { return lookup(name); }
+    
+    /**
+     * Имя команды или макроса по ID ("?" если ID нет)
+     */
+    const char* nameAt(uint8_t id) const;
+    
+    /**
+     * Количество команд и макросов
+     */
+    size_t getCount() const { return storage.count; }
+    size_t getMacroCount() const { return storage.macroCount; }
+    
 private:
-    static const uint32_t MAGIC = 0xCAFECAFE;
+    // Смена MAGIC сбрасывает словарь во flash к умолчаниям (64 команды, макросы, слоты)
+    static const uint32_t MAGIC = 0xCAFECB02;
     static const size_t DEFAULT_COMMAND_COUNT = 5;
     
+    // Слоты во flash (адреса DueFlashStorage 0..8191, дальше - журнал Logger)
+    static const uint32_t SLOT_SIZE = 2048;
+    static const uint8_t SLOT_COUNT = 4;
+    
+    // Идеальный хеш: 32 корзины, 128 слотов (ID или COMMAND_ID_NONE)
+    static const uint8_t HASH_BUCKETS = 32;
+    static const uint8_t HASH_SLOTS = 128;
+    
     DueFlashStorage flashStorage;
     FlashCommandStorage storage;
+    uint8_t activeSlot;
+    bool dirty;
+    uint32_t dirtyMillis;
+    
+    uint8_t hashDisplace[HASH_BUCKETS];
+    uint8_t hashSlots[HASH_SLOTS];
+    bool hashPerfect;            // false - не удалось построить, поиск перебором
     
     void initDefaultCommands();
     bool loadFromFlash();
     void saveToFlash();
-    int findCommandIndex(const char* name) const;
+    void markDirty();
+    uint16_t storageCrc() const;
+    
+    void buildHash();
+    static uint32_t hashName(const char* name);
+    static uint8_t hashSlot(uint32_t hash, uint8_t displace);
+    int findLinear(const char* name) const;
 };
 
 #endif // COMMAND_DICTIONARY_H
-
-
@@ -0,0 +1,118 @@
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include "types.h"
+#include "MemoryArena.h"
+
+// Кодеки кадра GRAY8 (номер передаётся в IMG_START, декодер - server/main.py)
+enum FrameCodecId : uint8_t {
+    CODEC_RAW = 0,     // байты кадра как есть
+    CODEC_INTRA = 1,   // разность с пикселем строкой выше + PackBits
+    CODEC_INTER = 2    // XOR с последним ключевым кадром + PackBits
+};
+
+// Кодек после старта (переключается командой "codec raw|intra|inter")
+#ifndef FRAME_CODEC_DEFAULT
+#define FRAME_CODEC_DEFAULT CODEC_INTER
+#endif
+
+// Флаги кадра в IMG_START
+const uint8_t FRAME_FLAG_KEY = 0x01;   // ключевой кадр: сервер запоминает его под keyId
+
+// Результат кодирования: откуда и что передавать
+struct EncodedFrame {
+    const uint8_t* data;   // буфер кодека или исходный кадр (CODEC_RAW)
+    size_t size;           // байт к передаче
+    uint8_t codec;         // FrameCodecId фактически применённого кодека
+    uint8_t flags;         // FRAME_FLAG_*
+    uint8_t keyId;         // ключевой кадр: его номер; разностный: номер опорного
+};
+
+/**
+ * Сжатие кадра перед передачей на NodeMCU
+ * Все буферы статические: выход (не больше исходного кадра) и копия ключевого кадра.
+ * Если сжатый кадр не меньше исходного, передаётся исходный (CODEC_RAW)
+ */
+class FrameCodec {
+public:
+    /**
+     * Сброс состояния, следующий разностный кадр будет ключевым
+     */
+    void begin();
+
+    /**
+     * Выбор кодека (действует со следующего кадра)
+     */
+    void setCodec(FrameCodecId id);
+
+    /**
+     * Текущий кодек
+     */
+    FrameCodecId getCodec() const { return codec; }
+
+    /**
+     * Имя кодека ("raw", "intra", "inter")
+     */
+    static const char* codecName(uint8_t id);
+
+    /**
+     * Разбор имени кодека
+     * @return true если имя известно
+     */
+    static bool parseCodec(const char* name, FrameCodecId& outId);
+
+    /**
+     * Кодирование кадра выбранным кодеком
+     * Результат действителен до следующего вызова encode()
+     * @param frame кадр GRAY8
+     * @param width ширина
+     * @param height высота
+     * @return описание данных для передачи
+     */
+    EncodedFrame encode(const uint8_t* frame, uint16_t width, uint16_t height);
+
+    /**
+     * Итог передачи последнего закодированного кадра
+     * Недоставленный ключевой кадр не становится опорным,
+     * после недоставленного разностного следующий кадр будет ключевым
+     * @param delivered true если сервер получил кадр
+     */
+    void commit(bool delivered);
+
+    /**
+     * Следующий кадр в режиме inter будет ключевым
+     */
+    void requestKeyframe() { keyValid = false; }
+
+private:
+    static const size_t MAX_FRAME_SIZE = (size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT;
+    static const uint8_t KEYFRAME_INTERVAL = 10;   // ключевой кадр не реже чем раз в 10 кадров
+
+    FrameCodecId codec;
+
+    // ARENA_CODEC_OUT и ARENA_CODEC_KEY; строка разности - ARENA_SCRATCH на время encode()
+    uint8_t* outBuffer;
+    uint8_t* keyFrame;
+
+    // Состояние опорного кадра
+    bool keyValid;
+    bool keyPending;         // последний кадр - ключевой, ждёт commit()
+    uint8_t keyId;
+    uint16_t keyWidth;
+    uint16_t keyHeight;
+    uint8_t framesSinceKey;
+
+    /**
+     * Сжатие строки PackBits
+     * @return записано байт или 0 если не хватило места
+     */
+    static size_t packBits(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+
+    /**
+     * Построчное кодирование: разность (intra) или XOR с ключевым кадром (inter)
+     * @return размер результата в outBuffer или 0 если он не меньше исходного
+     */
+    size_t encodeRows(const uint8_t* frame, uint16_t width, uint16_t height, bool inter);
+};
+
+#endif // FRAME_CODEC_H
@@ -0,0 +1,139 @@
+#ifndef IMAGE_RATE_CONTROLLER_H
+#define IMAGE_RATE_CONTROLLER_H
+
+#include "types.h"
+
+// Целевое время шага (снятие данных -> ответ -> выполнение), мс
+// (команда "rate <ms>", 0 - без адаптации: каждый кадр в геометрии сервера)
+#ifndef IMAGE_RATE_TARGET_CYCLE_MS
+#define IMAGE_RATE_TARGET_CYCLE_MS 6000
+#endif
+
+// Слабый сигнал WiFi у NodeMCU, дБм: не ниже уровня IMAGE_RATE_WEAK_LEVEL
+#ifndef IMAGE_RATE_WEAK_RSSI
+#define IMAGE_RATE_WEAK_RSSI -80
+#endif
+
+// Передача кадра дольше этого не ждётся, даже если бюджет шага меньше, мс
+#ifndef IMAGE_RATE_MIN_DEADLINE_MS
+#define IMAGE_RATE_MIN_DEADLINE_MS 1500
+#endif
+
+const uint8_t IMAGE_RATE_LEVELS = 6;
+const uint8_t IMAGE_RATE_WEAK_LEVEL = 2;
+const int8_t IMAGE_RATE_RSSI_NONE = 0;   // NodeMCU ещё не присылал STATUS
+
+// Итог одной передачи кадра (WifiLink::finishTransfer)
+struct ImageTransferStats {
+    uint32_t bytes;          // байт кадра после кодека
+    uint32_t pixels;         // пикселей кадра
+    uint32_t elapsedMs;      // startSend -> конец передачи
+    uint32_t readyMs;        // из них ожидание IMG_READY (HTTP /image/start у NodeMCU)
+    uint16_t chunks;
+    uint16_t retransmits;
+    bool compact;            // кадр кодировался CODEC_INTER по решению контроллера
+    bool delivered;
+};
+
+/**
+ * Выбор качества и частоты кадров по измеренной пропускной способности
+ * Уровни: 0 - геометрия сервера и кодек пользователя, 1 - кодек inter,
+ * 2 - full уменьшается до half, 3..5 - кадр только каждый 2/4/8-й шаг.
+ * Бюджет кадра - целевое время шага минус остальное время шага (EWMA);
+ * цена уровня - (ожидание IMG_READY + байты / скорость * (1 + доля повторов)) / период.
+ * Выбирается младший уровень, который укладывается в бюджет: вверх - сразу,
+ * вниз - по одному уровню после IMAGE_RATE_CALM_STEPS шагов с запасом.
+ * Сорванная передача поднимает уровень на два, слабый сигнал - не ниже 2
+ */
+class ImageRateController {
+public:
+    void begin();
+
+    /**
+     * Целевое время шага, мс (0 - без адаптации)
+     */
+    void setTargetCycle(uint32_t ms);
+    uint32_t getTargetCycle() const { return targetCycleMs; }
+
+    /**
+     * Геометрия, которую просит сервер (image_mode) или команда "cam"
+     */
+    void setRequestedGeometry(ImageGeometry geometry) { requested = geometry; }
+    ImageGeometry getRequestedGeometry() const { return requested; }
+
+    /**
+     * Геометрия для съёмки на текущем уровне
+     */
+    ImageGeometry getGeometry() const;
+
+    /**
+     * Кодировать кадр CODEC_INTER вместо кодека пользователя
+     */
+    bool useCompactCodec() const { return level >= 1; }
+
+    /**
+     * Снимать ли кадр в этом шаге (вызывать один раз за шаг, когда кадр возможен)
+     */
+    bool wantImage();
+
+    /**
+     * RSSI из строки STATUS NodeMCU, дБм
+     */
+    void setRssi(int8_t dbm) { rssi = dbm; }
+
+    /**
+     * Итог передачи кадра
+     */
+    void onTransfer(const ImageTransferStats& stats);
+
+    /**
+     * Начало нового шага: время от начала прошлого, мс. Здесь пересчитывается уровень
+     */
+    void onCycle(uint32_t cycleMs);
+
+    /**
+     * Предел времени передачи кадра для WifiLink, мс (0 - без предела)
+     */
+    uint32_t getDeadlineMs() const;
+
+    uint8_t getLevel() const { return level; }
+    uint8_t getPeriod() const { return periodFor(level); }
+    uint32_t getThroughput() const { return (uint32_t)bytesPerSec; }
+    uint16_t getRetryPermille() const { return (uint16_t)(retryRate * 1000.0f + 0.5f); }
+    uint32_t getBudgetMs() const { return budgetMs; }
+    uint32_t getCycleMs() const { return lastCycleMs; }
+    int8_t getRssi() const { return rssi; }
+    uint32_t getAborted() const { return aborted; }
+
+private:
+    static const uint8_t IMAGE_RATE_CALM_STEPS = 3;
+
+    uint32_t targetCycleMs;
+    ImageGeometry requested;
+    uint8_t level;
+    uint8_t calmSteps;           // шагов подряд, когда младший уровень укладывается с запасом
+    uint8_t sinceImage;          // шагов с последнего кадра
+    int8_t rssi;
+
+    // Оценки по прошлым передачам (EWMA), 0 - ещё не измерено
+    float bytesPerSec;
+    float retryRate;             // повторов на чанк
+    float readyMs;
+    float bytesPerPixel[2];      // [0] - кодек пользователя, [1] - inter
+
+    float otherMs;               // время шага без передачи кадра
+    uint32_t imageMs;            // передачи кадра в текущем шаге
+    uint32_t lastCycleMs;
+    uint32_t budgetMs;
+    uint32_t aborted;
+
+    static uint8_t periodFor(uint8_t level);
+    ImageGeometry geometryFor(uint8_t level) const;
+
+    /**
+     * Ожидаемое время передачи кадра на уровне, в пересчёте на шаг, мс
+     */
+    float costMs(uint8_t level) const;
+};
+
+#endif // IMAGE_RATE_CONTROLLER_H
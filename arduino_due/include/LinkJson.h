@@ -0,0 +1,133 @@
+#ifndef LINK_JSON_H
+#define LINK_JSON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Запись JSON фиксированного вида в готовый буфер (DATA для NodeMCU)
+ * Ключи и разделители - литералы, их длина известна при компиляции;
+ * целые - делением на 10, float - фиксированной точкой через целые.
+ * Ни кучи, ни промежуточного документа: запись собирается за один проход
+ */
+class JsonWriter {
+public:
+    JsonWriter(char* buffer, size_t capacity);
+    
+    /**
+     * Литерал: длина считается компилятором
+     */
+    template <size_t N>
+    void lit(const char (&s)[N]) { raw(s, N - 1); }
+    
+    void raw(const char* s, size_t n);
+    void put(char c);
+    
+    /**
+     * Строка в кавычках без экранирования (имена режимов и участков прошивки)
+     */
+    void str(const char* s);
+    
+    void u32(uint32_t v);
+    void i32(int32_t v);
+    void boolean(bool v) {
+        if (v) {
+            lit("true");
+        } else {
+            lit("false");
+        }
+    }
+    
+    /**
+     * Число с decimals знаками после точки (до 4), округление до ближайшего;
+     * NaN и бесконечность - 0, чтобы запись осталась корректным JSON
+     */
+    void fixed(float v, uint8_t decimals);
+    
+    /**
+     * n символов c (место под значение, которое впишут позже)
+     */
+    void fill(char c, size_t n);
+    
+    size_t length() const { return len; }
+    bool overflowed() const { return overflow; }
+    
+private:
+    char* buf;
+    size_t cap;
+    size_t len;
+    bool overflow;
+};
+
+/**
+ * Разбор JSON за один проход по строке, без копии и без дерева
+ * Ключи объекта читаются по очереди, значение забирает тот, кто знает ключ,
+ * остальные пропускаются. Значение не того типа (null вместо числа) - пропускается
+ * без ошибки; ошибка - только нарушенный синтаксис или обрыв строки
+ */
+class JsonReader {
+public:
+    explicit JsonReader(const char* text) : p(text), error(false) {}
+    
+    /**
+     * Начало объекта '{'
+     */
+    bool beginObject();
+    
+    /**
+     * Следующий ключ объекта (обрезается до keySize - 1)
+     * @return false в конце объекта или при ошибке
+     */
+    bool nextKey(char* key, size_t keySize);
+    
+    /**
+     * Начало массива '['; не массив - значение пропускается
+     */
+    bool beginArray();
+    
+    /**
+     * Есть ли следующий элемент массива
+     * @return false в конце массива или при ошибке
+     */
+    bool nextElement();
+    
+    /**
+     * Следующее значение - строка
+     */
+    bool isString();
+    
+    /**
+     * Строка (обрезается до outSize - 1; out может быть nullptr)
+     * @return false если значение не строка (оно пропущено)
+     */
+    bool readString(char* out, size_t outSize);
+    
+    /**
+     * Целое; дробная часть и экспонента отбрасываются
+     * @return false если значение не число (оно пропущено)
+     */
+    bool readInt(long& out);
+    
+    /**
+     * true или false
+     * @return false если значение не логическое (оно пропущено)
+     */
+    bool readBool(bool& out);
+    
+    /**
+     * Пропуск значения любого типа, включая вложенные объекты и массивы
+     */
+    void skipValue();
+    
+    bool ok() const { return !error; }
+    
+private:
+    const char* p;
+    bool error;
+    
+    void skipSpace();
+    void skipString();
+};
+
+#endif // LINK_JSON_H
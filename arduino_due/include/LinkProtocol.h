@@ -0,0 +1,195 @@
+#ifndef LINK_PROTOCOL_H
+#define LINK_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Print;
+
+/*
+ * Бинарный кадр Serial1 (Due <-> NodeMCU)
+ *
+ *   A5 5A | type | seq | len (LE) | payload[len] | crc16 (LE)
+ *
+ * CRC16-CCITT считается по type, seq, len и payload.
+ * Текстовые строки протокола никогда не начинаются с 0xA5,
+ * поэтому приёмник различает текст и кадры по первому байту.
+ * Многобайтовые поля внутри payload - little-endian.
+ */
+
+#define LINK_SYNC_0 0xA5
+#define LINK_SYNC_1 0x5A
+
+// Типы кадров (совпадают с nodemcu.ino)
+enum LinkFrameType : uint8_t {
+    // Due -> NodeMCU
+    LINK_DATA       = 0x01,   // JSON данных шага (как после "DATA ")
+    LINK_IMG_START  = 0x02,   // width, height, totalChunks, crc (0 - в IMG_END), chunkSize, window (u16),
+                              // codec, flags, keyId (u8, FrameCodec.h)
+    LINK_IMG_CHUNK  = 0x03,   // chunkIdx (u16) + сырые байты
+    LINK_IMG_END    = 0x04,   // CRC16 кадра (u16)
+    LINK_IMG_ABORT  = 0x05,   // без payload
+    LINK_BAUD_REQ   = 0x06,   // скорость (u32): перейти на неё после BAUD_ACK
+    LINK_BAUD_TEST  = 0x07,   // LINK_BAUD_TEST_SIZE байт linkBaudTestByte() на новой скорости
+
+    // NodeMCU -> Due
+    LINK_IMG_READY  = 0x81,   // без payload
+    LINK_ACK        = 0x82,   // chunkIdx (u16)
+    LINK_NAK        = 0x83,   // chunkIdx (u16), 0xFFFF/0xFFFE - нет передачи / ошибка разбора
+    LINK_CMD        = 0x84,   // JSON команды (как после "CMD ")
+    LINK_SACK       = 0x85,   // первый не принятый чанк (u16) + битовая карта (u32)
+    LINK_BAUD_ACK   = 0x86    // скорость (u32): согласие на старой скорости, подтверждение
+                              // теста - на новой, 0 - отказ; без запроса - NodeMCU на базовой
+};
+
+// Согласование скорости Serial1: кандидаты по возрастанию, базовая - Hardware::SERIAL1_BAUD
+const uint32_t LINK_BAUD_RATES[] = { 460800, 921600, 2000000 };
+const uint8_t LINK_BAUD_RATE_COUNT = sizeof(LINK_BAUD_RATES) / sizeof(LINK_BAUD_RATES[0]);
+const size_t LINK_BAUD_TEST_SIZE = 64;
+
+/**
+ * Байт тестового образца BAUD_TEST: все значения битов и переходы 0/1 подряд
+ */
+inline uint8_t linkBaudTestByte(size_t i) {
+    return (uint8_t)((i & 1) ? ~(i * 37) : (i * 37 + 0x55));
+}
+
+// DATA начинается с LINK_DATA_IMAGE_ID_PREFIX и места под значение image_id: null,
+// добитый пробелами. NodeMCU вписывает туда "<id>" на месте, без сдвига записи
+const char LINK_DATA_IMAGE_ID_PREFIX[] = "{\"image\":{\"image_id\":";
+const size_t LINK_DATA_IMAGE_ID_SLOT = 50;   // id до 47 символов в кавычках
+
+const size_t LINK_HEADER_SIZE = 6;   // sync (2) + type + seq + len (2)
+const size_t LINK_CRC_SIZE = 2;
+
+/**
+ * CRC16-CCITT (poly 0x1021, init 0xFFFF)
+ * @param data указатель на данные
+ * @param len длина данных
+ * @return 16-битная контрольная сумма
+ */
+uint16_t crc16_ccitt(const uint8_t* data, size_t len);
+
+/**
+ * Продолжение CRC16-CCITT для данных, приходящих частями
+ * @param crc текущее значение (0xFFFF для начала)
+ */
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t* data, size_t len);
+
+/**
+ * Таблица CRC16-CCITT по старшему байту (512 байт во flash)
+ */
+extern const uint16_t crc16_ccitt_table[256];
+
+/**
+ * Один байт CRC16-CCITT по таблице - для циклов, которые уже читают данные
+ */
+inline uint16_t crc16_ccitt_step(uint16_t crc, uint8_t b) {
+    return (uint16_t)(crc << 8) ^ crc16_ccitt_table[(crc >> 8) ^ b];
+}
+
+/**
+ * Потоковая запись кадра: заголовок, payload частями, CRC
+ * Payload не копируется, CRC считается по мере записи
+ */
+class LinkFrameWriter {
+public:
+    explicit LinkFrameWriter(Print& out) : out(out), crc(0xFFFF), remaining(0) {}
+
+    /**
+     * Заголовок кадра
+     * @param type тип кадра (LinkFrameType)
+     * @param seq номер кадра
+     * @param len полная длина payload
+     */
+    void begin(uint8_t type, uint8_t seq, uint16_t len);
+
+    /**
+     * Очередная часть payload (в сумме ровно len байт)
+     */
+    void write(const uint8_t* data, size_t n);
+    void writeU16(uint16_t value);
+
+    /**
+     * То же, с продолжением ещё одной CRC по тем же байтам (CRC кадра изображения)
+     * @param dataCrc текущее значение, обновляется
+     */
+    void write(const uint8_t* data, size_t n, uint16_t& dataCrc);
+
+    /**
+     * CRC в конец кадра
+     * @return false если записано не len байт payload
+     */
+    bool end();
+
+private:
+    Print& out;
+    uint16_t crc;
+    size_t remaining;
+};
+
+/**
+ * Побайтовый разбор входящих кадров
+ * Ищет sync, накапливает payload во внутреннем буфере,
+ * проверяет CRC; битые и слишком длинные кадры отбрасываются
+ */
+class LinkFrameParser {
+public:
+    static const size_t MAX_PAYLOAD = 256;
+
+    /**
+     * Сброс разбора и счётчика ошибок
+     */
+    void reset();
+
+    /**
+     * Сброс разбора текущего кадра (счётчики сохраняются)
+     */
+    void restart() { state = WAIT_SYNC0; }
+
+    /**
+     * Подать байт
+     * @return true если этим байтом завершён корректный кадр
+     */
+    bool feed(uint8_t b);
+
+    /**
+     * Идёт ли разбор кадра (sync уже найден)
+     */
+    bool inFrame() const { return state != WAIT_SYNC0; }
+
+    uint8_t type() const { return header[0]; }
+    uint8_t seq() const { return header[1]; }
+    uint16_t length() const { return payloadLen; }
+
+    /**
+     * Payload последнего кадра, всегда завершён '\0' (для JSON)
+     */
+    const uint8_t* payload() const { return buffer; }
+
+    /**
+     * Поле u16 (LE) из payload
+     */
+    uint16_t payloadU16(size_t offset) const;
+
+    uint32_t crcErrors;       // кадры с неверной CRC
+    uint32_t oversizeErrors;  // кадры длиннее MAX_PAYLOAD
+
+private:
+    enum State : uint8_t {
+        WAIT_SYNC0,
+        WAIT_SYNC1,
+        HEADER,
+        PAYLOAD,
+        CRC
+    };
+
+    State state;
+    uint8_t header[4];
+    uint8_t crcBytes[2];
+    uint16_t payloadLen;
+    uint16_t pos;
+    uint8_t buffer[MAX_PAYLOAD + 1];
+};
+
+#endif // LINK_PROTOCOL_H
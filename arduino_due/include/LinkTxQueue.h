@@ -0,0 +1,57 @@
+#ifndef LINK_TX_QUEUE_H
+#define LINK_TX_QUEUE_H
+
+#include <Arduino.h>
+#include "MemoryArena.h"
+
+/**
+ * Очередь исходящих байт Serial1 (USART0), которую выгружает PDC
+ * write() только копирует в кольцо, poll() отдаёт PDC непрерывные куски кольца
+ * (текущий и следующий), и UART отправляет их без участия процессора.
+ * Serial1 после begin() используется только на приём: его собственный
+ * TX-буфер и прерывание TXRDY не задействуются
+ */
+class LinkTxQueue : public Print {
+public:
+    static const size_t CAPACITY = ARENA_TX_RING_SIZE;   // окно из 8 бинарных чанков
+
+    /**
+     * Включение PDC передачи USART0 (после Serial1.begin())
+     */
+    void begin();
+
+    /**
+     * Запись в кольцо
+     * При переполнении ждёт, пока PDC освободит место (запасной путь:
+     * передача кадра проверяет space() заранее)
+     */
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t n) override;
+    using Print::write;
+
+    /**
+     * Свободное место в кольце, байт
+     */
+    size_t space() const { return CAPACITY - count; }
+
+    /**
+     * Всё записанное ушло в UART
+     */
+    bool idle() const { return count == 0; }
+
+    /**
+     * Учёт ушедших байт и загрузка следующих кусков в PDC
+     * Вызывать часто (каждый tick): пока PDC держит два куска, пауз на линии нет
+     */
+    void poll();
+
+private:
+    uint8_t* ring;        // ARENA_TX_RING
+    size_t head;          // позиция записи
+    size_t tail;          // самый старый ещё не отправленный байт
+    size_t count;         // байт в кольце, включая отданные PDC
+    size_t inFlight;      // байт от tail, отданных PDC (текущий + следующий кусок)
+    uint8_t* nextPtr;     // начало куска, записанного в TNPR
+};
+
+#endif // LINK_TX_QUEUE_H
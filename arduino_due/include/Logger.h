@@ -2,17 +2,49 @@
 #define LOGGER_H
 
 #include "types.h"
+#include "MemoryArena.h"
+#include <DueFlashStorage.h>
+
+class CommandDictionary;
+
+// Кольцо страниц журнала во flash (адреса DueFlashStorage, за словарём команд)
+#ifndef LOG_FLASH_OFFSET
+#define LOG_FLASH_OFFSET 8192
+#endif
+
+#ifndef LOG_FLASH_PAGES
+#define LOG_FLASH_PAGES 64
+#endif
+
+// Страница журнала во flash: ровно одна страница IFLASH1 (256 байт)
+struct LogFlashPage {
+    static const uint32_t MAGIC = 0x4C4F4731;   // "LOG1"
+    static const uint16_t CAPACITY = 20;
+    
+    uint32_t magic;
+    uint32_t sequence;           // номер страницы с начала журнала, растёт монотонно
+    uint16_t count;              // записей на странице
+    uint16_t crc;                // CRC16-CCITT записей
+    uint32_t reserved;
+    PackedLogEntry entries[CAPACITY];
+};
+
+static_assert(sizeof(LogFlashPage) == 256, "LogFlashPage must fill one flash page");
+static_assert(sizeof(LogFlashPage) <= SCRATCH_LOG_PAGE_SIZE, "LogFlashPage does not fit its arena scratch");
 
 /**
  * Журнал команд
- * Кольцевой буфер на 256 записей
+ * Записи хранятся упакованными (PackedLogEntry): кольцо в RAM и кольцо страниц во flash.
+ * Каждые LogFlashPage::CAPACITY записей одной записью уходят во flash, поэтому
+ * после сброса журнал теряет не больше последней неполной страницы
  */
 class Logger {
 public:
     /**
-     * Инициализация логгера
+     * Инициализация логгера: поиск последней страницы журнала во flash
+     * @param dict словарь команд (имена по индексу)
      */
-    void begin();
+    void begin(const CommandDictionary* dict);
     
     /**
      * Добавление записи в лог
@@ -25,13 +57,26 @@ public:
      */
     void printAllToSerial() const;
     
+    /**
+     * Выгрузка всего журнала (flash и ещё не записанный хвост) одним потоком:
+     * строка "LOGDUMP 1 <n> 12 <имена команд через запятую>", n записей
+     * PackedLogEntry, CRC16-CCITT записей (LE), строка "LOGDUMP END"
+     * Декодер - POST /car-log/decode на сервере
+     */
+    void dumpBinary(Print& out);
+    
     /**
      * Получение количества записей
      */
     size_t getCount() const { return logCount; }
     
     /**
-     * Очистка лога
+     * Записей во flash
+     */
+    size_t getFlashCount() const { return flashCount; }
+    
+    /**
+     * Очистка лога (RAM и flash)
      */
     void clear();
     
@@ -39,16 +84,35 @@ public:
      * Получение записи по индексу (0 = самая старая)
      */
     bool getEntry(size_t index, LogEntry& outEntry) const;
+    
+    /**
+     * Имя причины остановки ("none", "obstacle", "impact")
+     */
+    static const char* abortReasonName(uint8_t reason);
 
 private:
-    static const size_t MAX_LOG_ENTRIES = 256;
-    LogEntry logEntries[MAX_LOG_ENTRIES];
+    static const size_t MAX_LOG_ENTRIES = LOG_RAM_ENTRIES;
+    PackedLogEntry* logEntries;  // ARENA_LOG (LOG_RAM_ENTRIES в MemoryArena.h)
     size_t logCount;
     size_t currentIndex;
+    size_t pendingCount;         // последние записи RAM, ещё не записанные во flash
+    
+    const CommandDictionary* commandDict;
+    DueFlashStorage flashStorage;
+    uint16_t writePage;          // следующая страница кольца (она же самая старая)
+    uint32_t nextSequence;
+    size_t flashCount;
+    
+    void clearRam();
+    void scanFlash();
+    void flushPage();
+    const LogFlashPage* pageAt(uint16_t index);
+    static bool isValidPage(const LogFlashPage* page);
+    
+    PackedLogEntry pack(const LogEntry& e) const;
+    void unpack(const PackedLogEntry& p, LogEntry& out) const;
     
     void formatTimestamp(const DateTime& ts, char* buffer, size_t bufferSize) const;
 };
 
 #endif // LOGGER_H
-
-
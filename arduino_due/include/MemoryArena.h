@@ -0,0 +1,181 @@
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+
+#include "types.h"
+#include "Perf.h"
+
+// ==================== БЮДЖЕТ SRAM ====================
+// SAM3X8E: 64 КБ SRAM0 + 32 КБ SRAM1, линкер Due видит их одним блоком
+const size_t MEMORY_SRAM_SIZE = 96 * 1024;
+
+// Стек loop() и прерываний (фактический максимум - команда "mem")
+#ifndef MEMORY_STACK_RESERVE
+#define MEMORY_STACK_RESERVE 4096
+#endif
+
+// Ядро Arduino SAM 1.6.x и newlib - статические данные вне CarController и Perf:
+//   кольца RX/TX Serial, Serial1..3 (8 x 136, variant.cpp) и сами объекты   ~1250
+//   приём SerialUSB (CDC, 512 + индексы) и состояние USB                      ~620
+//   Wire/Wire1 (rx/tx/srv по 32 + поля)                                       ~280
+//   обработчики attachInterrupt (4 порта x 32 указателя, WInterrupts.c)        512
+//   _impure_data (struct _reent) и __malloc_av_ newlib                      ~2100
+//   прочее ядра (g_pinStatus, тики, ADC/PWM)                                  ~300
+// Оценка по исходникам ядра; фактический конец статических данных (_end) печатает
+// "mem", а MemoryArena::begin() останавливает прошивку, если он залез в резерв стека
+#ifndef MEMORY_CORE_RESERVE
+#define MEMORY_CORE_RESERVE 5120
+#endif
+
+// Поля модулей CarController, не вынесенные в арену
+#ifndef MEMORY_MODULE_RESERVE
+#define MEMORY_MODULE_RESERVE 5632
+#endif
+
+// Записей журнала в RAM (кольцо ARENA_LOG): недавние и ещё не записанные во flash.
+// История и "log dump" - из кольца страниц flash, поэтому кольцу хватает нескольких страниц
+#ifndef LOG_RAM_ENTRIES
+#define LOG_RAM_ENTRIES 128
+#endif
+
+// Регионы арены: крупные буферы модулей в одном статическом блоке
+enum ArenaRegionId : uint8_t {
+    ARENA_FRAMES = 0,      // "frames": двойной буфер кадра камеры, всё время работы
+    ARENA_CODEC_OUT,       // "codec_out": выход FrameCodec, encode() -> конец передачи кадра
+    ARENA_CODEC_KEY,       // "codec_key": опорный кадр inter
+    ARENA_LOG,             // "log": кольцо журнала команд
+    ARENA_TX_RING,         // "tx_ring": очередь PDC Serial1
+    ARENA_SCRATCH,         // "scratch": рабочий буфер одного вызова, пользователи по очереди
+    ARENA_REGION_COUNT
+};
+
+// Пользователи ARENA_SCRATCH. Все работают внутри одного вызова из loop() и
+// друг друга не вызывают, поэтому делят один буфер размером с наибольшего
+enum ArenaScratchUser : uint8_t {
+    SCRATCH_CAMERA_LINE = 0,   // "cam_line": строка RGB565 из FIFO, pollCapture()
+    SCRATCH_CODEC_ROW,         // "codec_row": строка разности перед PackBits, encode()
+    SCRATCH_DATA_JSON,         // "data_json": запись DATA, queueData()
+    SCRATCH_LOG_PAGE,          // "log_page": страница журнала для flash, flushPage()
+    SCRATCH_USER_COUNT,
+    SCRATCH_NONE = 0xFF
+};
+
+constexpr size_t arenaAlign(size_t n) { return (n + 7) & ~(size_t)7; }
+constexpr size_t arenaMax(size_t a, size_t b) { return a > b ? a : b; }
+
+// Размеры регионов
+const size_t ARENA_FRAME_BYTES = (size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT;
+const size_t ARENA_FRAMES_SIZE = 2 * ARENA_FRAME_BYTES;
+const size_t ARENA_CODEC_OUT_SIZE = ARENA_FRAME_BYTES;   // сжатый не больше исходного, иначе raw
+const size_t ARENA_CODEC_KEY_SIZE = ARENA_FRAME_BYTES;
+const size_t ARENA_LOG_SIZE = (size_t)LOG_RAM_ENTRIES * sizeof(PackedLogEntry);
+const size_t ARENA_TX_RING_SIZE = 2048;                  // окно из 8 бинарных чанков
+
+// Размеры пользователей ARENA_SCRATCH
+const size_t SCRATCH_CAMERA_LINE_SIZE = (size_t)Hardware::CAM_WIDTH * 2;
+const size_t SCRATCH_CODEC_ROW_SIZE = Hardware::CAM_WIDTH;
+// 1280 - предел кадра у NodeMCU (LINK_MAX_PAYLOAD); "perf" добавляет до ~400 байт, "rate" - ~90
+const size_t SCRATCH_DATA_JSON_SIZE = 1280;
+const size_t SCRATCH_LOG_PAGE_SIZE = 256;                // LogFlashPage - одна страница flash
+const size_t ARENA_SCRATCH_SIZE =
+    arenaMax(arenaMax(SCRATCH_CAMERA_LINE_SIZE, SCRATCH_CODEC_ROW_SIZE),
+             arenaMax(SCRATCH_DATA_JSON_SIZE, SCRATCH_LOG_PAGE_SIZE));
+
+// Смещения (по 8 байт: uint32_t для PDC и uint64_t внутри структур)
+const size_t ARENA_FRAMES_OFFSET = 0;
+const size_t ARENA_CODEC_OUT_OFFSET = ARENA_FRAMES_OFFSET + arenaAlign(ARENA_FRAMES_SIZE);
+const size_t ARENA_CODEC_KEY_OFFSET = ARENA_CODEC_OUT_OFFSET + arenaAlign(ARENA_CODEC_OUT_SIZE);
+const size_t ARENA_LOG_OFFSET = ARENA_CODEC_KEY_OFFSET + arenaAlign(ARENA_CODEC_KEY_SIZE);
+const size_t ARENA_TX_RING_OFFSET = ARENA_LOG_OFFSET + arenaAlign(ARENA_LOG_SIZE);
+const size_t ARENA_SCRATCH_OFFSET = ARENA_TX_RING_OFFSET + arenaAlign(ARENA_TX_RING_SIZE);
+const size_t ARENA_SIZE = ARENA_SCRATCH_OFFSET + arenaAlign(ARENA_SCRATCH_SIZE);
+
+// Статические данные по бюджету: всё, что линкер кладёт ниже _end
+const size_t MEMORY_STATIC_BUDGET = ARENA_SIZE + MEMORY_MODULE_RESERVE + MEMORY_CORE_RESERVE + Perf::tableBytes();
+
+static_assert(MEMORY_STATIC_BUDGET + MEMORY_STACK_RESERVE <= MEMORY_SRAM_SIZE,
+              "SRAM budget exceeded: shrink an arena region (MemoryArena.h) or a reserve");
+
+/**
+ * Статическая арена крупных буферов и отчёт о памяти (команда "mem")
+ * Регионы постоянные: модуль берёт указатель в begin() и держит его.
+ * ARENA_SCRATCH берётся на время вызова через ArenaScratch; занятый буфер,
+ * взятый ещё раз, считается конфликтом и виден в отчёте.
+ * Размеры проверяются при компиляции: регионы и резервы - здесь,
+ * нужды модулей - static_assert у них (буфер не больше своего региона).
+ * На плате begin() сверяет с резервом стека конец статических данных по линкеру
+ */
+class MemoryArena {
+public:
+    /**
+     * Закраска свободного стека образцом для замера глубины (до begin() модулей)
+     */
+    static void begin();
+    
+    /**
+     * Начало региона
+     */
+    static uint8_t* region(ArenaRegionId id);
+    
+    /**
+     * Учёт заполнения региона (максимум - в отчёте)
+     */
+    static void noteUse(ArenaRegionId id, size_t bytes) {
+        if (bytes > peaks[id]) {
+            peaks[id] = (uint32_t)bytes;
+        }
+    }
+    
+    /**
+     * Глубина стека сейчас и наибольшая с begin(), байт (0 - не измеряется)
+     */
+    static uint32_t stackDepth();
+    static uint32_t stackPeak();
+    
+    /**
+     * Отчёт: регионы с максимумами, пользователи scratch, стек и куча
+     */
+    static void printToSerial();
+    
+    static const char* regionName(uint8_t id);
+    static const char* scratchUserName(uint8_t user);
+    
+private:
+    friend class ArenaScratch;
+    
+    static uint32_t peaks[ARENA_REGION_COUNT];
+    static uint32_t scratchPeaks[SCRATCH_USER_COUNT];
+    static uint8_t scratchOwner;
+    static uint32_t scratchConflicts;
+    static uint8_t lastConflictUser;
+    
+    // Нижняя граница закрашенного стека
+    static uint8_t* stackFloor;
+};
+
+/**
+ * ARENA_SCRATCH на время области видимости
+ * Буфер всегда ARENA_SCRATCH_SIZE байт; use() отмечает, сколько занято на деле
+ */
+class ArenaScratch {
+public:
+    explicit ArenaScratch(ArenaScratchUser user);
+    ~ArenaScratch();
+    
+    uint8_t* data() const { return ptr; }
+    static size_t size() { return ARENA_SCRATCH_SIZE; }
+    
+    /**
+     * Учёт занятых байт (максимум по пользователю - в отчёте)
+     */
+    void use(size_t bytes);
+    
+private:
+    uint8_t* ptr;
+    uint8_t user;
+    uint8_t previousOwner;
+    
+    ArenaScratch(const ArenaScratch&);
+    ArenaScratch& operator=(const ArenaScratch&);
+};
+
+#endif // MEMORY_ARENA_H
@@ -3,28 +3,73 @@
 
 #include "types.h"
 
+// Время разгона мотора от 0 до 100% скважности, мс
+#ifndef MOTOR_RAMP_MS
+#define MOTOR_RAMP_MS 150
+#endif
+
 /**
- * Контроллер моторов без PWM
- * Использует простой драйвер с пинами IN1-IN4
- * Скорость регулируется только временем работы
+ * Контроллер моторов с программным PWM
+ * Использует простой драйвер с пинами IN1-IN4: в фазе "выкл" оба пина мотора
+ * в LOW (свободный выбег), поэтому скважность задаётся переключением пинов
+ *
+ * Команды с длительностью исполняет планировщик на таймере TC3 (TC1, канал 0):
+ * очередь отрезков (направление, скважность, время), переключение и остановка -
+ * в прерывании. PWM 1 кГц - таймер TC4 (TC1, канал 1): RC включает моторы,
+ * RA и RB выключают левый и правый; период за периодом скважность плавно
+ * подходит к заданной. Все четыре пина IN (PC23..PC26) меняются одной записью PIO_ODSR
  */
 class MotorController {
 public:
+    static const uint8_t MAX_SEGMENTS = MAX_COMMAND_SEGMENTS;
+    
     /**
-     * Инициализация драйвера моторов
+     * Инициализация драйвера моторов и таймеров
      */
     void begin();
     
     /**
-     * Остановка обоих моторов
+     * Немедленная остановка обоих моторов (без торможения скважностью)
+     * и сброс очереди отрезков
      */
     void stop();
     
     /**
-     * Применение команды движения
-     * @param cfg конфигурация команды с параметрами направления
+     * Применение команды движения без ограничения по времени
+     * @param cfg конфигурация команды с параметрами направления и скважности
+     * @param speedPercent общая скорость команды, % (масштабирует скважность словаря)
+     */
+    void applyCommand(const CommandConfig& cfg, uint8_t speedPercent = 100);
+    
+    /**
+     * Очистка очереди отрезков перед addSegment() (идущая останавливается)
+     */
+    void clearSequence();
+    
+    /**
+     * Отрезок в очередь
+     * @param cfg направление и скважность моторов (как в applyCommand)
+     * @param durationMs длительность отрезка
+     * @param speedPercent общая скорость команды, %
+     * @return false если очередь полна или уже исполняется
+     */
+    bool addSegment(const CommandConfig& cfg, uint32_t durationMs, uint8_t speedPercent = 100);
+    
+    /**
+     * Запуск очереди: первый отрезок сразу, следующие и остановка - из прерывания
+     * @return false если очередь пуста
+     */
+    bool startSequence();
+    
+    /**
+     * Исполняется ли очередь отрезков
      */
-    void applyCommand(const CommandConfig& cfg);
+    bool isRunning() const { return running; }
+    
+    /**
+     * Едет ли машина сейчас вперёд (оба мотора вперёд)
+     */
+    bool isMovingForward() const;
     
     /**
      * Движение вперед
@@ -45,21 +90,74 @@ public:
      * Поворот вправо (левый вперед, правый стоит)
      */
     void turnRight();
+    
+    /**
+     * Обработчики прерываний таймеров (вызываются из TC3_Handler и TC4_Handler)
+     */
+    void handleTimer();
+    void handlePwmTimer();
 
 private:
+    // Отрезок в виде, готовом для прерывания
+    struct Segment {
+        uint32_t pins;         // биты IN1-IN4 в PIO_ODSR
+        uint16_t leftDuty;     // скважность мотора IN1/IN2, такты периода PWM
+        uint16_t rightDuty;    // скважность мотора IN3/IN4
+        uint32_t ticks;        // длительность в тактах таймера
+    };
+    
+    // MCK/32 = 2.625 МГц: 2625 тактов на мс, 32-битный счётчик - до 27 минут
+    static const uint32_t TIMER_TICKS_PER_MS = VARIANT_MCK / 32 / 1000;
+    
+    // PWM: период 1 мс в тех же тактах, шаг разгона за период
+    static const uint16_t PWM_PERIOD_TICKS = TIMER_TICKS_PER_MS;
+    static const uint16_t PWM_RAMP_STEP = (PWM_PERIOD_TICKS + MOTOR_RAMP_MS - 1) / MOTOR_RAMP_MS;
+    
+    Segment segments[MAX_SEGMENTS];
+    uint8_t segmentCount;
+    volatile uint8_t segmentIndex;
+    volatile bool running;
+    
+    // Пины IN1-IN4 на одном порту: маска и бит каждого пина
+    Pio* motorPort;
+    uint32_t motorMask;
+    uint32_t in1Bit, in2Bit, in3Bit, in4Bit;
+    volatile uint32_t currentPins;
+    
+    // Состояние PWM: направления (пины фазы "вкл"), текущая и целевая скважность
+    volatile uint32_t drivePins;
+    volatile uint16_t leftDuty, rightDuty;
+    volatile uint16_t leftTarget, rightTarget;
+    volatile bool pwmActive;
+    
+    /**
+     * Биты пинов по направлениям
+     * @param left 1=вперед, -1=назад, 0=стоп для левого мотора (IN1, IN2)
+     * @param right то же для правого мотора (IN3, IN4)
+     */
+    uint32_t pinsFor(int8_t left, int8_t right) const;
+    
+    /**
+     * Отрезок из команды словаря: пины и скважность в тактах
+     */
+    Segment segmentFor(const CommandConfig& cfg, uint8_t speedPercent) const;
+    
     /**
-     * Установка состояния левого мотора
-     * @param direction 1=вперед, -1=назад, 0=стоп
+     * Новые направления и целевая скважность (из прерывания или с запрещённым TC3/TC4)
+     * Мотор, сменивший направление, разгоняется заново с нуля
      */
-    void setLeftMotor(int8_t direction);
+    void drive(const Segment& seg);
     
     /**
-     * Установка состояния правого мотора
-     * @param direction 1=вперед, -1=назад, 0=стоп
+     * Одна запись всех четырёх пинов
      */
-    void setRightMotor(int8_t direction);
+    void latch(uint32_t pins);
+    
+    void stopTimer();
+    void startPwm();
+    void stopPwm();
+    
+    static uint16_t rampToward(uint16_t duty, uint16_t target);
 };
 
 #endif // MOTOR_CONTROLLER_H
-
-
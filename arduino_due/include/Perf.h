@@ -0,0 +1,154 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <Arduino.h>
+
+// Пробы PERF_SCOPE/PERF_SPAN_* (0 - компилируются в пустоту)
+#ifndef PERF_ENABLED
+#define PERF_ENABLED 1
+#endif
+
+// Объект "perf" в DATA после старта (переключается командой "perf data on|off")
+#ifndef PERF_DATA_DEFAULT
+#define PERF_DATA_DEFAULT true
+#endif
+
+// Участки шага под наблюдением (короткие имена - в "perf" и в DATA)
+enum PerfProbeId : uint8_t {
+    PERF_CAPTURE = 0,        // "cap": вычитывание порции строк FIFO за один tick
+    PERF_FRAME,              // "frame": startCapture() -> кадр опубликован
+    PERF_CONVERT,            // "conv": RGB565 -> GRAY8, одна строка
+    PERF_ENCODE,             // "enc": FrameCodec::encode()
+    PERF_VISION,             // "vis": VisionPreprocessor::analyze()
+    PERF_BASE64,             // "b64": base64 одного чанка (текстовый режим)
+    PERF_CHUNK,              // "chunk": sendChunk(), чанк в очередь TX
+    PERF_TRANSFER,           // "xfer": startSend() -> конец передачи кадра
+    PERF_WAIT_COMMAND,       // "wait": пребывание в STATE_WAIT_COMMAND
+    PERF_STATE_INIT,         // "s_init".."s_exec": обработчик состояния за один tick
+    PERF_STATE_COLLECT,
+    PERF_STATE_SEND,
+    PERF_STATE_WAIT,
+    PERF_STATE_EXECUTE,
+    PERF_PROBE_COUNT
+};
+
+/**
+ * Замеры по счётчику тактов DWT->CYCCNT (84 МГц, переполнение через 51 с)
+ * Для каждой пробы - гистограмма по степеням двойки тактов (p95 с интерполяцией
+ * внутри корзины), min/max/среднее за сессию и окно с прошлого DATA.
+ * Только из основного цикла: record() не защищён от прерываний
+ */
+class Perf {
+public:
+    struct Stats {
+        uint32_t count;
+        uint32_t minUs;
+        uint32_t avgUs;
+        uint32_t p95Us;
+        uint32_t maxUs;
+    };
+    
+    /**
+     * Включение DWT->CYCCNT и сброс статистики
+     */
+    static void begin();
+    
+    static inline uint32_t cycles() { return DWT->CYCCNT; }
+    
+    /**
+     * Учёт одного замера
+     */
+    static void record(PerfProbeId id, uint32_t elapsedCycles);
+    
+    /**
+     * Интервал, который начинается и кончается в разных местах (разные tick)
+     * spanEnd() без spanBegin() ничего не учитывает
+     */
+    static void spanBegin(PerfProbeId id);
+    static void spanEnd(PerfProbeId id);
+    
+    /**
+     * Статистика пробы за сессию, мкс
+     */
+    static Stats getStats(PerfProbeId id);
+    
+    /**
+     * Окно с прошлого resetWindow(): среднее и максимум, мкс
+     * @return false если в окне нет замеров
+     */
+    static bool getWindow(PerfProbeId id, uint32_t& avgUs, uint32_t& maxUs);
+    static void resetWindow();
+    
+    /**
+     * Имя пробы ("cap", "conv", ...)
+     */
+    static const char* probeName(uint8_t id);
+    
+    /**
+     * Таблица count/min/avg/p95/max в Serial
+     */
+    static void printToSerial();
+    
+    /**
+     * Сброс статистики сессии и окна
+     */
+    static void reset();
+    
+    /**
+     * Передавать ли окно в DATA
+     */
+    static bool isDataEnabled() { return dataEnabled; }
+    static void setDataEnabled(bool enabled) { dataEnabled = enabled; }
+    
+    /**
+     * Таблица проб, байт (своя строка бюджета SRAM в MemoryArena.h)
+     */
+    static constexpr size_t tableBytes() { return sizeof(probes); }
+
+private:
+    static const uint8_t BUCKETS = 32;   // корзина b: [2^b, 2^(b+1)) тактов
+    
+    struct Probe {
+        uint32_t count;
+        uint64_t sumCycles;
+        uint32_t minCycles;
+        uint32_t maxCycles;
+        uint16_t buckets[BUCKETS];   // при насыщении все корзины делятся пополам
+        uint32_t spanStart;
+        bool spanOpen;
+        uint16_t windowCount;
+        uint32_t windowMaxCycles;
+        uint64_t windowSumCycles;
+    };
+    
+    static Probe probes[PERF_PROBE_COUNT];
+    static bool dataEnabled;
+    
+    static uint32_t toUs(uint64_t cycles);
+    static uint32_t percentileCycles(const Probe& p, uint8_t percent);
+};
+
+/**
+ * Замер области видимости: от конструктора до деструктора
+ */
+class PerfScope {
+public:
+    explicit PerfScope(PerfProbeId id) : id(id), start(Perf::cycles()) {}
+    ~PerfScope() { Perf::record(id, Perf::cycles() - start); }
+
+private:
+    PerfProbeId id;
+    uint32_t start;
+};
+
+#if PERF_ENABLED
+#define PERF_SCOPE(id) PerfScope perfScope(id)
+#define PERF_SPAN_BEGIN(id) Perf::spanBegin(id)
+#define PERF_SPAN_END(id) Perf::spanEnd(id)
+#else
+#define PERF_SCOPE(id) do {} while (0)
+#define PERF_SPAN_BEGIN(id) do {} while (0)
+#define PERF_SPAN_END(id) do {} while (0)
+#endif
+
+#endif // PERF_H
@@ -14,14 +14,27 @@
 // Stub класс если библиотека не установлена
 class NewPing {
 public:
-    NewPing(uint8_t trigger, uint8_t echo, int max_cm) {}
+    NewPing(uint8_t, uint8_t, int) {}
     unsigned int ping_cm() { return 0; }
 };
 #endif
 
+// Частота отсчётов MPU6050 (делитель частоты самого датчика), 200..1000 Гц
+#ifndef IMU_SAMPLE_RATE_HZ
+#define IMU_SAMPLE_RATE_HZ 200
+#endif
+
+// Фоновый дальномер: эхо HC-SR04 по прерыванию, расстояние - медиана последних замеров
+// 0 - прежнее блокирующее чтение (NewPing/pulseIn) в readSnapshot()
+#ifndef SONAR_BACKGROUND
+#define SONAR_BACKGROUND 1
+#endif
+
 /**
  * Модуль датчиков
  * Работает с HC-SR04, фоторезистором, ИК-датчиком препятствий и MPU6050
+ * MPU6050 сам отсчитывает время и складывает отсчёты в свой FIFO (1 КБ);
+ * pollImu() забирает их пачками по Wire1 и сворачивает в сводку окна шага
  */
 class Sensors {
 public:
@@ -37,6 +50,46 @@ public:
      */
     SensorSnapshot readSnapshot();
     
+    /**
+     * Выборка FIFO MPU6050 и фильтр ориентации (вызывать каждый tick)
+     * @return количество обработанных отсчётов
+     */
+    uint16_t pollImu();
+    
+    /**
+     * Фоновый дальномер: запуск замера и учёт пойманного эха (вызывать каждый tick)
+     */
+    void pollSonar();
+    
+    /**
+     * Медиана последних замеров HC-SR04 без ожидания
+     * @return расстояние в см (400 - эха нет); до первого замера - 400
+     */
+    float getDistanceCm() const;
+    
+    /**
+     * Последний замер HC-SR04 без медианы (для защитной остановки)
+     * @return расстояние в см; до первого замера - 400
+     */
+    float getLatestDistanceCm() const;
+    
+    /**
+     * Номер последнего замера HC-SR04 (растёт с каждым замером)
+     */
+    uint32_t getSonarSequence() const { return sonarSequence; }
+    
+    /**
+     * Пик |a| по отсчётам FIFO с прошлого вызова (для защитной остановки)
+     * Окно шага в readSnapshot() от этого не меняется
+     * @return м/с², 0 если новых отсчётов не было
+     */
+    float takeAccelPeak();
+    
+    /**
+     * Сколько раз FIFO MPU6050 переполнялся (tick опоздал)
+     */
+    uint32_t getImuOverflows() const { return imuOverflows; }
+    
     /**
      * Проверка, темно ли сейчас
      * @return true если темно
@@ -46,8 +99,90 @@ public:
 private:
     Adafruit_MPU6050 mpu;
     bool mpuInitialized;
+    bool imuFifoEnabled;
     NewPing* sonar;
     
+    // Фоновый дальномер: ISR меряет ширину эха, pollSonar() шлёт импульсы
+    enum SonarState : uint8_t {
+        SONAR_IDLE,
+        SONAR_WAIT_ECHO,     // импульс TRIG отправлен, ждём фронт эха
+        SONAR_ECHO_HIGH,     // эхо идёт
+        SONAR_ECHO_DONE      // спад эха пойман, ширина в echoWidthMicros
+    };
+    volatile uint8_t sonarState;
+    volatile uint32_t echoStartMicros;
+    volatile uint32_t echoWidthMicros;
+    uint32_t pingMicros;
+    uint32_t lastPingMillis;
+    
+    static const uint8_t SONAR_RING_SIZE = 5;            // медиана из 5
+    static const uint32_t SONAR_PING_INTERVAL_MS = 60;   // шаг между замерами по даташиту
+    static const uint32_t SONAR_ECHO_TIMEOUT_US = 30000; // как прежний pulseIn
+    float sonarRing[SONAR_RING_SIZE];
+    uint8_t sonarRingPos;
+    uint8_t sonarRingCount;
+    uint32_t sonarSequence;
+    
+    static Sensors* echoOwner;
+    static void echoIsr();
+    void handleEchoEdge();
+    void pushDistance(float cm);
+    
+    // Регистры MPU6050 для FIFO
+    static const uint8_t MPU_ADDR = 0x68;
+    static const uint8_t REG_SMPLRT_DIV = 0x19;
+    static const uint8_t REG_FIFO_EN = 0x23;
+    static const uint8_t REG_USER_CTRL = 0x6A;
+    static const uint8_t REG_FIFO_COUNT_H = 0x72;
+    static const uint8_t REG_FIFO_R_W = 0x74;
+    
+    static const size_t IMU_SAMPLE_BYTES = 12;      // accel xyz + gyro xyz, big-endian
+    static const size_t IMU_FIFO_SIZE = 1024;
+    static const uint8_t IMU_SAMPLES_PER_READ = 2;  // 24 байта: буфер Wire1 - 32
+    static const uint8_t IMU_MAX_SAMPLES_PER_POLL = 16;
+    static const uint32_t IMU_POLL_INTERVAL_MS = 5;
+    static const float IMU_FILTER_ALPHA;            // доля гироскопа в фильтре
+    
+    uint32_t lastImuPollMillis;
+    uint32_t imuOverflows;
+    
+    // Ориентация и последний отсчёт
+    bool orientationValid;
+    float roll, pitch, yaw;      // градусы
+    float lastAx, lastAy, lastAz;
+    float lastGx, lastGy, lastGz;
+    
+    // Окно с прошлого readSnapshot()
+    uint16_t windowSamples;
+    float windowAccelPeak;
+    float windowGyroPeak;
+    float windowJerkPeak;
+    float windowGyroSumX, windowGyroSumY, windowGyroSumZ;
+    float reflexAccelPeak;       // с прошлого takeAccelPeak()
+    
+    /**
+     * Настройка частоты и FIFO MPU6050 (после mpu.begin())
+     */
+    bool setupImuFifo();
+    
+    /**
+     * Сброс FIFO MPU6050 (после переполнения отсчёты уже не выровнены)
+     */
+    void resetImuFifo();
+    
+    /**
+     * Учёт одного отсчёта: фильтр ориентации и сводка окна
+     */
+    void processImuSample(const uint8_t* raw);
+    
+    /**
+     * Сводка окна в снимок и начало нового окна
+     */
+    void takeImuWindow(SensorSnapshot& snapshot);
+    
+    bool writeMpuRegister(uint8_t reg, uint8_t value);
+    bool readMpuRegisters(uint8_t reg, uint8_t* dst, uint8_t len);
+    
     /**
      * Чтение расстояния от HC-SR04
      * @return расстояние в см
@@ -6,6 +6,8 @@
 class CommandDictionary;
 class Logger;
 class SoftRTC;
+class CameraModule;
+class WifiLink;
 
 /**
  * Процессор команд из Serial Monitor
@@ -16,7 +18,7 @@ public:
     /**
      * Инициализация процессора
      */
-    void begin(CommandDictionary* dict, Logger* logger, SoftRTC* rtc);
+    void begin(CommandDictionary* dict, Logger* logger, SoftRTC* rtc, CameraModule* camera, WifiLink* link);
     
     /**
      * Обработка команд из Serial (неблокирующее)
@@ -26,11 +28,15 @@ public:
     // Указатели на конфигурационные переменные
     bool* serialLoggingEnabled;
     uint32_t* defaultStepDurationMs;
+    bool* pipelinedMode;
+    uint16_t* safetyDistanceCm;
 
 private:
     CommandDictionary* commandDict;
     Logger* logger;
     SoftRTC* rtc;
+    CameraModule* camera;
+    WifiLink* wifiLink;
     
     static const size_t LINE_BUFFER_SIZE = 256;
     char lineBuffer[LINE_BUFFER_SIZE];
@@ -39,6 +45,7 @@ private:
     bool readLine(char* buffer, size_t bufferSize);
     void parseCommand(const char* line);
     void printHelp();
+    void defineMacro(const char* args);
 };
 
 #endif // SERIAL_COMMAND_PROCESSOR_H
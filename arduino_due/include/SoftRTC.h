@@ -30,6 +30,16 @@ public:
      * Обновление времени (вызывать периодически)
      */
     void update();
+    
+    /**
+     * Секунды от 01.01.2000 00:00:00 (компактная метка времени журнала)
+     */
+    static uint32_t toEpoch(const DateTime& ts);
+    
+    /**
+     * Обратное преобразование toEpoch()
+     */
+    static DateTime fromEpoch(uint32_t epoch);
 
 private:
     DateTime baseTime;
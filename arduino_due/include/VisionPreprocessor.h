@@ -0,0 +1,103 @@
+#ifndef VISION_PREPROCESSOR_H
+#define VISION_PREPROCESSOR_H
+
+#include "types.h"
+
+// Порог отличия кадра от последнего переданного: средняя |разность| миниатюр, 0..255.
+// Ниже порога кадр не передаётся, сервер берёт сохранённый (0 - передавать всегда)
+#ifndef VISION_DIFF_THRESHOLD
+#define VISION_DIFF_THRESHOLD 4
+#endif
+
+// Не больше стольких шагов подряд без кадра: медленные изменения тоже доходят
+#ifndef VISION_MAX_REUSE
+#define VISION_MAX_REUSE 10
+#endif
+
+const uint8_t VISION_THUMB_W = 8;
+const uint8_t VISION_THUMB_H = 6;
+const uint8_t VISION_THUMB_SIZE = VISION_THUMB_W * VISION_THUMB_H;
+const uint8_t VISION_HIST_BINS = 8;
+const uint8_t VISION_DIFF_NONE = 255;   // опорного кадра нет или он другой геометрии
+
+// Описание кадра для DATA (поля "diff", "hist", "thumb" секции image)
+struct VisionDescriptor {
+    uint8_t thumb[VISION_THUMB_SIZE];   // средняя яркость блоков 8x6, по строкам
+    uint8_t hist[VISION_HIST_BINS];     // доля пикселей по 32 уровня яркости, %
+    uint8_t diff;                       // отличие от опорного кадра
+};
+
+/**
+ * Анализ кадра перед передачей: миниатюра 8x6, гистограмма и отличие
+ * от последнего доставленного кадра (опорного)
+ * Всё за один проход по кадру, без буферов крупнее миниатюры.
+ * Опорным кадр становится только после доставки (commit), как у FrameCodec
+ */
+class VisionPreprocessor {
+public:
+    /**
+     * Сброс: опорного кадра нет, следующий кадр передаётся
+     */
+    void begin();
+
+    /**
+     * Порог отличия (0 - передавать каждый кадр)
+     */
+    void setThreshold(uint8_t value) { threshold = value; }
+    uint8_t getThreshold() const { return threshold; }
+
+    /**
+     * Анализ кадра
+     * @param image кадр GRAY8
+     * @return true если кадр можно не передавать: сервер возьмёт кадр шага getReferenceStep()
+     */
+    bool analyze(const ImageSnapshot& image);
+
+    /**
+     * Описание последнего проанализированного кадра
+     */
+    const VisionDescriptor& getDescriptor() const { return descriptor; }
+
+    /**
+     * Шаг, в котором доставлен опорный кадр
+     */
+    uint32_t getReferenceStep() const { return referenceStep; }
+
+    /**
+     * Итог передачи проанализированного кадра: доставленный становится опорным
+     */
+    void commit(bool delivered, uint32_t stepId);
+
+    /**
+     * Сервер не нашёл опорный кадр: следующий кадр передаётся
+     */
+    void invalidate() { hasReference = false; }
+
+    /**
+     * Кадров не передано (вместо них - ссылка на опорный) / проанализировано
+     */
+    uint32_t getReusedCount() const { return reusedCount; }
+    uint32_t getAnalyzedCount() const { return analyzedCount; }
+
+private:
+    VisionDescriptor descriptor;
+    uint8_t threshold;
+
+    bool hasReference;
+    uint8_t referenceThumb[VISION_THUMB_SIZE];
+    uint16_t referenceWidth;
+    uint16_t referenceHeight;
+    PixelFormat referenceFormat;
+    uint32_t referenceStep;
+    uint8_t reuseRun;                   // шагов подряд без кадра
+
+    // Параметры последнего analyze() для commit()
+    uint16_t lastWidth;
+    uint16_t lastHeight;
+    PixelFormat lastFormat;
+
+    uint32_t reusedCount;
+    uint32_t analyzedCount;
+};
+
+#endif // VISION_PREPROCESSOR_H
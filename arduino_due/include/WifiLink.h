@@ -2,100 +2,425 @@
 #define WIFI_LINK_H
 
 #include "types.h"
+#include "LinkProtocol.h"
+#include "FrameCodec.h"
+#include "LinkTxQueue.h"
+#include "LinkJson.h"
+#include "VisionPreprocessor.h"
+#include "ImageRateController.h"
+
+// Режим передачи после старта (переключается командой "link text|binary")
+#ifndef WIFI_LINK_DEFAULT_MODE
+#define WIFI_LINK_DEFAULT_MODE WifiLink::MODE_BINARY
+#endif
+
+// Окно передачи изображения после старта (команда "window <n>")
+#ifndef WIFI_LINK_DEFAULT_WINDOW
+#define WIFI_LINK_DEFAULT_WINDOW 4
+#endif
+
+// Предел согласуемой скорости Serial1 (Hardware::SERIAL1_BAUD - без согласования)
+#ifndef WIFI_LINK_MAX_BAUD
+#define WIFI_LINK_MAX_BAUD 2000000
+#endif
+
+// Откат на базовую скорость: столько ошибок линии без ответа CMD между ними за окно, мс
+#ifndef WIFI_LINK_ERROR_BURST
+#define WIFI_LINK_ERROR_BURST 4
+#endif
+#ifndef WIFI_LINK_ERROR_WINDOW_MS
+#define WIFI_LINK_ERROR_WINDOW_MS 30000
+#endif
 
 /**
  * Связь с NodeMCU ESP8266 через Serial1
  * NodeMCU выполняет роль WiFi моста к серверу
  * Arduino DUE отправляет JSON данные и получает команды
+ * Передача - текстовыми строками (base64) или бинарными кадрами (LinkProtocol.h),
+ * приём понимает оба формата
+ * Ничего не блокирует: байты уходят через PDC (LinkTxQueue), передача шага
+ * и приём ответов продвигаются в poll() каждый tick
+ *
+ * Скорость Serial1 согласуется с NodeMCU, пока линия свободна: BAUD_REQ на текущей
+ * скорости, BAUD_ACK, переход обеих сторон, BAUD_TEST с образцом на новой, BAUD_ACK
+ * на новой. Без подтверждения обе стороны возвращаются на прежнюю скорость. Всплеск
+ * ошибок (CRC, NAK битого кадра, срыв передачи, DATA без ответа) откатывает линию на базовую скорость,
+ * и следующее согласование идёт не выше скорости ниже сбойной
  */
 class WifiLink {
 public:
+    // Формат исходящих сообщений
+    enum Mode : uint8_t {
+        MODE_TEXT = 0,     // строки "DATA ..."/"IMG_CHUNK idx base64"
+        MODE_BINARY = 1    // кадры A5 5A, изображение без base64
+    };
+    
     /**
      * Инициализация Serial1 для связи с NodeMCU
      */
     void begin();
     
     /**
-     * Отправка данных датчиков на сервер через NodeMCU
+     * Запуск передачи шага на сервер через NodeMCU (неблокирующий)
+     * Сначала изображение чанками, затем DATA; ход передачи - в poll().
+     * Буфер изображения должен оставаться неизменным, пока isSending()
      * @param sessionId идентификатор сессии
      * @param stepId идентификатор шага
      * @param ts временная метка
      * @param sensors снимок датчиков
      * @param image снимок изображения (может быть пустым)
+     * @return false если предыдущая передача ещё идёт
+     */
+    bool startSend(uint32_t sessionId, uint32_t stepId,
+                   const DateTime& ts,
+                   const SensorSnapshot& sensors,
+                   const ImageSnapshot& image);
+    
+    /**
+     * Идёт ли передача шага (изображение ещё не подтверждено или DATA не в очереди)
      */
-    void sendData(uint32_t sessionId, uint32_t stepId,
-                  const DateTime& ts,
-                  const SensorSnapshot& sensors,
-                  const ImageSnapshot& image);
+    bool isSending() const { return txState != TX_IDLE; }
     
     /**
-     * Ожидание команды от сервера через NodeMCU
+     * Продвижение связи (вызывать каждый tick): выгрузка TX через PDC,
+     * разбор принятого, окно чанков и таймауты
+     */
+    void poll();
+    
+    /**
+     * Команда от сервера, если пришла (неблокирующее)
      * @param outCmd структура для записи полученной команды
-     * @param timeoutMs таймаут ожидания в миллисекундах
-     * @return true если команда получена, false при таймауте
+     * @return true если команда получена
+     */
+    bool takeCommand(Command& outCmd);
+    
+    /**
+     * Выбор формата исходящих сообщений
+     */
+    void setMode(Mode newMode) { mode = newMode; }
+    
+    /**
+     * Текущий формат исходящих сообщений
+     */
+    Mode getMode() const { return mode; }
+    
+    /**
+     * Имя режима ("text", "binary")
+     */
+    static const char* modeName(Mode mode);
+    
+    /**
+     * Разбор имени режима
+     * @return true если имя известно
+     */
+    static bool parseMode(const char* name, Mode& outMode);
+    
+    /**
+     * Количество отброшенных входящих кадров с неверной CRC
+     */
+    uint32_t getRxCrcErrors() const { return rxParser.crcErrors; }
+    
+    /**
+     * Анализ кадров перед передачей (порог отличия, счётчики)
+     */
+    VisionPreprocessor& getVision() { return vision; }
+    
+    /**
+     * Выбор геометрии, кодека и периода кадров по измеренной скорости передачи
+     */
+    ImageRateController& getImageRate() { return imageRate; }
+    
+    /**
+     * Текущая скорость Serial1, бод
+     */
+    uint32_t getBaud() const { return linkBaud; }
+    
+    /**
+     * Предел согласования после откатов, бод
+     */
+    uint32_t getBaudCeiling() const { return baudCeiling; }
+    
+    /**
+     * Идёт ли согласование скорости
+     */
+    bool isNegotiating() const { return rateState != RATE_IDLE; }
+    
+    /**
+     * Откатов на базовую скорость из-за ошибок
+     */
+    uint16_t getBaudFallbacks() const { return baudFallbacks; }
+    
+    /**
+     * Согласовать скорость заново, когда линия освободится
+     * (предел после откатов снимается)
+     */
+    void renegotiate();
+    
+    /**
+     * Последняя строка состояния NodeMCU без префикса "STATUS "
+     * (RSSI, свободная куча и её минимумы); пустая, пока строк не было
+     */
+    const char* getBridgeStatus() const { return bridgeStatus; }
+    
+    /**
+     * Окно передачи изображения: сколько чанков отправляется без ожидания ACK
+     * 1 - stop-and-wait, больше 1 - скользящее окно с выборочным повтором
+     * @param chunks размер окна (ограничивается 1..MAX_WINDOW)
+     */
+    void setWindow(uint8_t chunks);
+    
+    /**
+     * Текущий размер окна
+     */
+    uint8_t getWindow() const { return window; }
+    
+    static const uint8_t MAX_WINDOW = 8;   // 8 бинарных кадров = 2 КБ, размер RX буфера NodeMCU
+    
+    /**
+     * Выбор кодека сжатия изображения (действует со следующего кадра;
+     * на уровнях ImageRateController от 1 кадр кодируется inter)
+     */
+    void setCodec(FrameCodecId id) { userCodec = id; }
+    
+    /**
+     * Кодек сжатия изображения, выбранный пользователем
      */
-    bool waitForCommand(Command& outCmd, uint32_t timeoutMs);
+    FrameCodecId getCodec() const { return userCodec; }
 
 private:
-    // Буфер для приема данных
+    Mode mode;
+    uint8_t window;
+    
+    // Сжатие кадра между захватом и передачей
+    FrameCodec codec;
+    FrameCodecId userCodec;
+    
+    // Исходящие байты Serial1
+    LinkTxQueue txQueue;
+    
+    // Буфер для приема текстовых строк
     static const size_t LINE_BUFFER_SIZE = 512;
     char lineBuffer[LINE_BUFFER_SIZE];
     size_t lineBufferPos;
     
+    // Строка STATUS от NodeMCU приходит между ответами и только сохраняется
+    static const size_t BRIDGE_STATUS_SIZE = 128;
+    char bridgeStatus[BRIDGE_STATUS_SIZE];
+    
+    // Разбор входящих бинарных кадров и номер исходящего кадра
+    LinkFrameParser rxParser;
+    uint8_t txSeq;
+    
+    // JSON сообщения DATA собирается в ARENA_SCRATCH (SCRATCH_DATA_JSON_SIZE байт),
+    // затем копируется в txQueue строкой или кадром
+    
+    // Входящее сообщение, приведённое к одному виду для обоих форматов
+    struct LinkMessage {
+        uint8_t type;          // LinkFrameType
+        uint16_t index;        // индекс чанка для ACK/NAK, для SACK - первый не принятый
+        uint32_t mask;         // SACK: бит i - принят чанк index + 1 + i; BAUD_ACK: скорость
+        const char* text;      // JSON для CMD (действителен до следующего чтения)
+    };
+    
     // Константы для чанкированной передачи изображения
     static const size_t CHUNK_RAW_SIZE = 192;      // 192 байт raw = 256 байт base64
     static const size_t CHUNK_BASE64_SIZE = 256;   // Размер base64 чанка
+    static const size_t BINARY_CHUNK_SIZE = 240;   // чанк бинарного кадра (19200 = 80 x 240)
     static const uint8_t MAX_RETRIES = 3;          // Макс. попыток передачи чанка
     static const uint32_t ACK_TIMEOUT_MS = 500;    // Таймаут ожидания ACK (увеличен для 115200)
+    static const uint32_t READY_TIMEOUT_MS = 2000; // IMG_READY: NodeMCU делает /image/start и открывает поток
+    static const uint16_t MAX_CHUNKS = 256;        // предел битовой карты подтверждений
     
     /**
      * Форматирование временной метки в строку "dd:MM:yyyy hh:mm:ss"
      */
     void formatTimestamp(const DateTime& ts, char* buffer, size_t bufferSize);
     
+    // Передача шага: изображение (если есть), затем DATA
+    enum TxState : uint8_t {
+        TX_IDLE,
+        TX_WAIT_READY,     // IMG_START ушёл, ждём IMG_READY
+        TX_CHUNKS          // окно чанков до подтверждения всех
+    };
+    TxState txState;
+    uint32_t txStateMillis;
+    
+    // Согласование скорости Serial1
+    enum RateState : uint8_t {
+        RATE_IDLE,
+        RATE_WAIT_ACCEPT,  // BAUD_REQ ушёл на текущей скорости
+        RATE_SETTLE,       // обе стороны переключаются
+        RATE_WAIT_CONFIRM, // BAUD_TEST ушёл на новой скорости
+        RATE_FALLBACK      // BAUD_REQ базовой скорости уходит на текущей
+    };
+    RateState rateState;
+    uint32_t rateStateMillis;
+    uint32_t linkBaud;           // текущая скорость
+    uint32_t baudCandidate;      // скорость, которая проверяется
+    uint32_t baudCeiling;        // не согласовывать выше (понижается откатами)
+    bool ratePending;            // согласовать, когда линия свободна
+    bool fallbackPending;        // откатиться на базовую, когда линия свободна
+    uint8_t rateAttempts;        // BAUD_REQ без ответа подряд
+    uint32_t rateRetryMillis;    // не раньше этого времени
+    uint8_t linkErrors;          // ошибок в текущем окне всплеска
+    uint32_t linkErrorMillis;    // начало окна всплеска
+    uint32_t seenCrcErrors;      // rxParser.crcErrors на момент последней проверки
+    uint16_t baudFallbacks;
+    bool replyPending;           // DATA ушёл, CMD ещё нет: NodeMCU занят HTTP
+    uint32_t replyMillis;
+    
+    static const uint32_t RATE_ACCEPT_TIMEOUT_MS = 300;
+    static const uint32_t RATE_SETTLE_MS = 5;
+    static const uint32_t RATE_CONFIRM_TIMEOUT_MS = 400;   // дольше, чем NodeMCU ждёт тест (300)
+    static const uint32_t RATE_RETRY_MS = 5000;
+    static const uint8_t RATE_MAX_ATTEMPTS = 3;
+    static const uint32_t REPLY_QUIET_MS = 15000;          // HTTP таймаут NodeMCU с запасом
+    
+    struct TransferJob {
+        // Формат и окно фиксируются на всю передачу
+        Mode mode;
+        uint8_t window;
+        
+        // Изображение
+        EncodedFrame frame;
+        uint16_t width;
+        uint16_t height;
+        size_t chunkSize;
+        uint16_t totalChunks;
+        bool compact;               // inter по решению imageRate
+        uint32_t startMillis;
+        uint32_t readyMillis;       // IMG_READY получен (0 - ещё нет)
+        
+        // Окно: слот = idx % MAX_WINDOW (в полёте не больше window соседних индексов)
+        uint16_t base;              // первый неподтверждённый
+        uint16_t next;              // следующий ещё не отправленный
+        uint16_t retransmits;
+        uint16_t imageCrc;          // CRC16 кадра: первая отправка чанков идёт строго по индексу
+        uint32_t acked[MAX_CHUNKS / 32];
+        uint32_t sentAt[MAX_WINDOW];
+        uint8_t tries[MAX_WINDOW];
+        bool holeResent[MAX_WINDOW];
+        
+        // Данные шага для DATA после изображения
+        uint32_t sessionId;
+        uint32_t stepId;
+        DateTime ts;
+        SensorSnapshot sensors;
+        ImageGeometry geometry;
+        PixelFormat pixelFormat;
+        bool analyzed;              // в DATA - описание кадра VisionPreprocessor
+        bool reused;                // кадр не передавался: сервер берёт кадр опорного шага
+    };
+    TransferJob job;
+    VisionPreprocessor vision;
+    ImageRateController imageRate;
+    
+    // Последняя принятая команда до takeCommand()
+    Command pendingCommand;
+    bool commandReady;
+    
+    /**
+     * Чтение следующего сообщения (строки или бинарного кадра) из принятых байт
+     * Неизвестные строки и кадры пропускаются
+     * @param msg структура для результата
+     * @return true если сообщение получено
+     */
+    bool readMessage(LinkMessage& msg);
+    
+    /**
+     * Разбор строки lineBuffer / кадра rxParser в LinkMessage
+     */
+    bool decodeLine(LinkMessage& msg);
+    bool decodeFrame(LinkMessage& msg);
+    
+    /**
+     * Разбор JSON команды
+     * @return true если в JSON есть имя команды
+     */
+    static bool parseCommand(const char* json, Command& outCmd);
+    
+    /**
+     * Разбор массива "seq" в отрезки команды
+     */
+    static void parseSegments(JsonReader& json, Command& outCmd);
+    
     /**
-     * Чтение строки из Serial1 до '\n' с таймаутом
-     * @param buffer буфер для строки
-     * @param bufferSize размер буфера
-     * @param timeoutMs таймаут в миллисекундах
-     * @return true если строка прочитана, false при таймауте
+     * Сброс принятых ответов прошлой передачи (команда сохраняется)
      */
-    bool readLine(char* buffer, size_t bufferSize, uint32_t timeoutMs);
+    void flushInput();
     
     /**
-     * CRC16-CCITT вычисление для проверки целостности
-     * @param data указатель на данные
-     * @param len длина данных
-     * @return 16-битная контрольная сумма
+     * Отправка кадра без payload
      */
-    uint16_t crc16_ccitt(const uint8_t* data, size_t len);
+    void sendEmptyFrame(uint8_t type);
     
     /**
-     * Отправка изображения с чанкированием и подтверждением
-     * @param data указатель на raw данные изображения
-     * @param size размер данных
-     * @param width ширина изображения
-     * @param height высота изображения
-     * @return true если передача успешна
+     * Постановка в очередь IMG_START для job.frame
      */
-    bool sendImageChunked(const uint8_t* data, size_t size, uint16_t width, uint16_t height);
+    void queueImageStart();
     
     /**
-     * Отправка одного чанка с ожиданием ACK
-     * @param chunkIdx индекс чанка
-     * @param base64Data base64-закодированные данные чанка
-     * @return true если ACK получен
+     * Постановка в очередь сообщения DATA из данных job
+     * @param imageSent изображение шага доставлено
      */
-    bool sendChunkWithAck(uint16_t chunkIdx, const char* base64Data);
+    void queueData(bool imageSent);
     
     /**
-     * Ожидание ACK/NAK от NodeMCU
-     * @param expectedChunkIdx ожидаемый индекс чанка
-     * @return true если ACK получен для нужного чанка
+     * Чанк в очередь, если в ней есть место
+     * @param firstSend первая отправка: байты чанка продолжают job.imageCrc
+     *        в том же проходе, что и запись кадра / base64
+     * @return false если места нет (повторить в следующем poll)
      */
-    bool waitForAck(uint16_t expectedChunkIdx);
+    bool sendChunk(uint16_t chunkIdx, bool firstSend = false);
+    
+    /**
+     * Реакция окна на ACK/NAK/SACK
+     * @return false если NodeMCU отказался от передачи
+     */
+    bool handleTransferReply(const LinkMessage& msg);
+    
+    /**
+     * Дозаполнение окна и повтор по таймауту
+     * @return false если чанк исчерпал попытки
+     */
+    bool advanceWindow();
+    
+    /**
+     * Завершение передачи изображения: IMG_END или IMG_ABORT, итог в imageRate, затем DATA
+     */
+    void finishTransfer(bool delivered);
+    
+    /**
+     * Шаг согласования скорости и отложенный откат (из poll)
+     */
+    void pollRate();
+    
+    /**
+     * BAUD_ACK от NodeMCU
+     */
+    void handleRateReply(uint32_t baud);
+    
+    /**
+     * Ошибка линии: при всплеске на повышенной скорости - откат на базовую
+     */
+    void noteLinkError();
+    
+    /**
+     * Следующая скорость таблицы выше текущей и не выше предела (0 - нет)
+     */
+    uint32_t nextBaudCandidate() const;
+    
+    /**
+     * Кадр BAUD_REQ с заданной скоростью
+     */
+    void sendBaudRequest(uint32_t baud);
+    
+    /**
+     * Переключение USART0 (очередь передачи должна быть пуста)
+     * Делитель с дробной частью FP: ядро Arduino задаёт только целый CD,
+     * и 921600 при MCK 84 МГц уходит на 14%, а с FP - меньше 1%
+     */
+    void applyBaud(uint32_t baud);
 };
 
 #endif // WIFI_LINK_H
-
-
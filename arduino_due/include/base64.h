@@ -10,9 +10,12 @@
  * @param inputLen длина входных данных
  * @param output буфер для выходной строки
  * @param outputLen размер буфера
+ * @param crc если не nullptr - продолжается CRC16-CCITT входных байт
+ * @param runningCrc если не nullptr - ещё одна CRC по тем же байтам
  * @return длина закодированной строки или 0 при ошибке
  */
-size_t base64_encode(const uint8_t* input, size_t inputLen, char* output, size_t outputLen);
+size_t base64_encode(const uint8_t* input, size_t inputLen, char* output, size_t outputLen,
+                     uint16_t* crc = nullptr, uint16_t* runningCrc = nullptr);
 
 /**
  * Вычисление размера буфера для Base64 кодирования
@@ -0,0 +1,55 @@
+#ifndef RGB565_GRAY_H
+#define RGB565_GRAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Ядра конвертации RGB565 -> GRAY8, выбираются на этапе компиляции
+// (например, -DGRAY_KERNEL=GRAY_KERNEL_LUT)
+#define GRAY_KERNEL_REFERENCE 0   // исходная формула, попиксельно
+#define GRAY_KERNEL_LUT       1   // две таблицы по 256 записей (1 КБ RAM)
+#define GRAY_KERNEL_PACKED    2   // два пикселя в 32-битном слове, без ветвлений
+
+#ifndef GRAY_KERNEL
+#define GRAY_KERNEL GRAY_KERNEL_PACKED
+#endif
+
+/**
+ * Инициализация выбранного ядра (построение таблиц для LUT)
+ */
+void rgb565_gray_init();
+
+/**
+ * Конвертация строки RGB565 (little-endian, как из FIFO) в grayscale
+ * выбранным ядром. Результат совпадает с (R*77 + G*150 + B*29) >> 8
+ * @param src входные данные, 2 байта на пиксель
+ * @param dst выходной буфер, 1 байт на пиксель
+ * @param pixels количество пикселей
+ */
+void rgb565_to_gray(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+/**
+ * Отдельные ядра (для проверки и замеров)
+ */
+void rgb565_to_gray_reference(const uint8_t* src, uint8_t* dst, size_t pixels);
+void rgb565_to_gray_lut(const uint8_t* src, uint8_t* dst, size_t pixels);
+void rgb565_to_gray_packed(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+/**
+ * Полная проверка всех 65536 значений RGB565 для LUT и packed ядер
+ * против исходной формулы
+ * @return true если все ядра совпали
+ */
+bool rgb565_gray_self_test();
+
+/**
+ * Микро-бенчмарк ядер по DWT->CYCCNT, печатает такты/пиксель в Serial
+ */
+void rgb565_gray_benchmark();
+
+/**
+ * Имя ядра, выбранного при компиляции
+ */
+const char* rgb565_gray_kernel_name();
+
+#endif // RGB565_GRAY_H
@@ -49,12 +49,32 @@ namespace Hardware {
     const uint8_t CAM_D5 = 46;
     const uint8_t CAM_D6 = 45;
     const uint8_t CAM_D7 = 44;
+    // D0-D7 = PC12..PC19: вся шина данных на одном порту PIOC,
+    // байт читается одним обращением к PIO_PDSR со сдвигом
+    const uint8_t CAM_DATA_SHIFT = 12;
     
     // Разрешение камеры
     const uint16_t CAM_WIDTH = 160;   // QQVGA (full resolution)
     const uint16_t CAM_HEIGHT = 120;
+    
+    // Полоса у горизонта для GEOMETRY_HORIZON (строки кадра QQVGA)
+    const uint16_t CAM_HORIZON_TOP = 40;
+    const uint16_t CAM_HORIZON_ROWS = 40;
 }
 
+// Геометрия выходного изображения камеры
+enum ImageGeometry : uint8_t {
+    GEOMETRY_FULL = 0,     // 160x120, полный кадр
+    GEOMETRY_HALF = 1,     // 80x60, каждый 2-й пиксель и 2-я строка
+    GEOMETRY_HORIZON = 2   // 160x40, полоса у горизонта
+};
+
+// Формат пикселей OV7670 (конвейер получения grayscale)
+enum PixelFormat : uint8_t {
+    PIXEL_RGB565 = 0,      // RGB565 -> grayscale через rgb565_to_gray()
+    PIXEL_YUV422 = 1       // YUYV, берётся только байт Y (без вычислений)
+};
+
 // Структура для хранения даты и времени
 struct DateTime {
     uint8_t dd;    // день (1-31)
@@ -70,8 +90,16 @@ struct SensorSnapshot {
     float distanceCm;  // расстояние от HC-SR04 (см)
     int lightRaw;      // сырое значение фоторезистора
     bool isDark;       // темно (lightRaw < LIGHT_THRESHOLD)
-    float ax, ay, az;  // ускорение от MPU6050
-    float gx, gy, gz;  // угловая скорость от MPU6050
+    float ax, ay, az;  // ускорение от MPU6050 (последний отсчёт, м/с²)
+    float gx, gy, gz;  // угловая скорость от MPU6050 (последний отсчёт, рад/с)
+    
+    // Сводка отсчётов MPU6050 с прошлого снимка (Sensors::pollImu())
+    float roll, pitch, yaw;            // ориентация (комплементарный фильтр), градусы
+    float accelPeak;                   // максимум |a|, м/с²
+    float gyroPeak;                    // максимум |ω|, рад/с
+    float gyroMeanX, gyroMeanY, gyroMeanZ;  // средняя угловая скорость, рад/с
+    float jerkPeak;                    // максимум |da/dt|, м/с³
+    uint16_t imuSamples;               // отсчётов в окне
 };
 
 // Снимок изображения с камеры
@@ -81,20 +109,51 @@ struct ImageSnapshot {
     uint16_t height;          // высота
     uint8_t* buffer;          // указатель на буфер данных (grayscale)
     size_t bufferSize;        // размер буфера
+    ImageGeometry geometry;   // режим, в котором снят кадр
+    PixelFormat pixelFormat;  // конвейер, которым снят кадр
 };
 
 // Конфигурация команды движения
 struct CommandConfig {
     char name[16];            // "FORWARD", "BACKWARD" и т.д.
-    int16_t leftSpeed;        // -1, 0, 1 (направление без PWM)
-    int16_t rightSpeed;       // -1, 0, 1 (направление без PWM)
+    int16_t leftSpeed;        // -100..100: знак - направление, модуль - скважность, %
+    int16_t rightSpeed;       // -100..100: знак - направление, модуль - скважность, %
     uint32_t baseDurationMs;  // базовая длительность в мс
 };
 
+// ID команд словаря (1 байт вместо имени в CMD): 0..63 - команды, 64..71 - макросы
+// FORWARD, BACKWARD, LEFT, RIGHT, STOP всегда занимают ID 0..4
+const uint8_t COMMAND_DICT_CAPACITY = 64;
+const uint8_t COMMAND_MACRO_CAPACITY = 8;
+const uint8_t COMMAND_MACRO_ID_BASE = COMMAND_DICT_CAPACITY;
+const uint8_t COMMAND_ID_NONE = 0xFF;
+
+// Отрезок составной команды: имя или ID из словаря и время
+const uint8_t MAX_COMMAND_SEGMENTS = 8;
+struct CommandSegment {
+    char name[16];
+    uint32_t durationMs;
+    uint8_t commandId;        // COMMAND_ID_NONE = искать по name
+};
+
 // Команда от сервера
 struct Command {
     char name[16];            // имя команды от сервера
+    uint8_t commandId;        // "id" от сервера вместо имени (COMMAND_ID_NONE = по name)
     uint32_t durationMs;      // 0 = использовать baseDurationMs из словаря
+    char imageMode[12];       // "full"/"half"/"horizon", пусто = без изменений
+    uint32_t stepId;          // шаг, на данные которого ответил сервер (0 = не указан)
+    uint8_t speedPercent;     // масштаб скважности словаря, % (0 = не указан, 100)
+    uint8_t segmentCount;     // > 0: вместо name/durationMs исполняется segments ("seq")
+    CommandSegment segments[MAX_COMMAND_SEGMENTS];
+    bool refreshImage;        // "refresh": у сервера нет опорного кадра, следующий передать
+};
+
+// Причина досрочной остановки команды защитным слоем
+enum AbortReason : uint8_t {
+    ABORT_NONE = 0,           // команда выполнена целиком
+    ABORT_OBSTACLE = 1,       // HC-SR04: препятствие ближе порога при движении вперёд
+    ABORT_IMPACT = 2          // MPU6050: удар (пик |a| выше порога)
 };
 
 // Запись в лог
@@ -106,8 +165,27 @@ struct LogEntry {
     int lightRaw;             // освещенность
     bool isDark;              // темно ли
     bool imageSent;           // отправлено ли изображение
+    uint8_t abortReason;      // AbortReason; durationMs тогда - фактическое время
 };
 
+// Запись журнала в упакованном виде (RAM, flash и "log dump"): 12 байт, little-endian
+struct PackedLogEntry {
+    uint32_t epoch;           // секунды от 01.01.2000 (SoftRTC::toEpoch)
+    uint16_t durationCs;      // длительность, единицы 10 мс (до 655 с)
+    uint16_t distanceMm;      // расстояние, мм
+    uint16_t lightFlags;      // биты 0-11 lightRaw, 12 isDark, 13 imageSent, 14-15 abortReason
+    uint8_t command;          // индекс в CommandDictionary (0xFF = неизвестна)
+    uint8_t reserved;
+};
+
+static_assert(sizeof(PackedLogEntry) == 12, "PackedLogEntry layout is decoded by the server");
+
+const uint16_t LOG_LIGHT_MASK = 0x0FFF;
+const uint16_t LOG_FLAG_DARK = 0x1000;
+const uint16_t LOG_FLAG_IMAGE = 0x2000;
+const uint8_t LOG_ABORT_SHIFT = 14;
+const uint8_t LOG_COMMAND_UNKNOWN = 0xFF;
+
 #endif // TYPES_H
 
 
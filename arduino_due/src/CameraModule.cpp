@@ -1,6 +1,14 @@
 #include "../include/CameraModule.h"
 #include "../include/types.h"
+#include "../include/rgb565_gray.h"
+#include "../include/Perf.h"
 #include <Wire.h>
+#include <cstring>
+
+static_assert(2 * (size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT <= ARENA_FRAMES_SIZE,
+              "Camera frame buffers do not fit ARENA_FRAMES");
+static_assert((size_t)Hardware::CAM_WIDTH * 2 <= SCRATCH_CAMERA_LINE_SIZE,
+              "Camera line buffer does not fit its arena scratch");
 
 // ==================== OV7670 REGISTER DEFINITIONS ====================
 
@@ -20,10 +28,7 @@
 #define REG_COM4        0x0D
 #define REG_COM5        0x0E
 #define REG_COM6        0x0F
-<<<<<<< HEAD
 #define REG_AECH        0x10
-=======
->>>>>>> master
 #define REG_CLKRC       0x11
 #define REG_COM7        0x12
 #define REG_COM8        0x13
@@ -53,15 +58,12 @@
 #define REG_COM16       0x41
 #define REG_COM17       0x42
 #define REG_DENOISE     0x4C
-<<<<<<< HEAD
 #define REG_CMATRIX_1   0x4F
 #define REG_CMATRIX_2   0x50
 #define REG_CMATRIX_3   0x51
 #define REG_CMATRIX_4   0x52
 #define REG_CMATRIX_5   0x53
 #define REG_CMATRIX_6   0x54
-=======
->>>>>>> master
 #define REG_BRIGHT      0x55
 #define REG_CONTRAST    0x56
 #define REG_CMATRIX_SIGN 0x58
@@ -92,13 +94,10 @@
 #define COM7_RGB        0x04
 #define COM7_YUV        0x00
 
-<<<<<<< HEAD
 // COM3 values
 #define COM3_DCWEN      0x04
 #define COM3_SCALEEN    0x08
 
-=======
->>>>>>> master
 // COM8 values
 #define COM8_FASTAEC    0x80
 #define COM8_AECSTEP    0x40
@@ -109,28 +108,18 @@
 
 // COM10 values
 #define COM10_VS_NEG    0x02
-<<<<<<< HEAD
 #define COM10_HSYNC     0x40
 #define COM10_PCLK_HB   0x20
-=======
-
-// COM11 values
-#define COM11_HZAUTO    0x10
-#define COM11_EXP       0x02
->>>>>>> master
 
 // COM13 values
 #define COM13_GAMMA     0x80
 #define COM13_UVSAT     0x40
 #define COM13_UVSWAP    0x01
 
-<<<<<<< HEAD
 // COM14 values
 #define COM14_DCWEN     0x10
 #define COM14_MAN_SCAL  0x08
 
-=======
->>>>>>> master
 // COM15 values
 #define COM15_R00FF     0xC0
 #define COM15_RGB565    0x10
@@ -151,7 +140,6 @@
 // TSLB values
 #define TSLB_YLAST      0x04
 
-<<<<<<< HEAD
 // ==================== CAMERA CONFIGURATION TABLES ====================
 // Ported from working ov7670_due_capture.ino
 
@@ -171,147 +159,28 @@ static const regval_list ov7670_qqvga[] = {
     {REG_SCALING_PCLK_DIV, 0xF2},
     {REG_SCALING_PCLK_DELAY, 0x02},
     {REG_LIST_END_MARKER, REG_LIST_END_MARKER}
-=======
-// Полная конфигурация OV7670 для QQVGA YUV422
-// Регистры перенесены из рабочей прошивки (ov7670_due_capture)
-// Уменьшаем 160x120 → 80x60 программно при чтении (берём каждый 2-й пиксель)
-static const uint8_t ov7670_qqvga_yuv[] = {
-    // === FORMAT: YUV422 ===
-    REG_COM7, COM7_YUV,                // YUV output mode
-    REG_CLKRC, 0x01,                   // Clock prescaler /2
-    REG_RGB444, 0x00,                  // Disable RGB444
-    REG_COM15, COM15_R00FF,            // Full output range [00-FF]
-    REG_TSLB, TSLB_YLAST,             // YUYV byte order (Y first)
-    REG_COM1, 0x00,                    // No CCIR656
-    REG_COM9, 0x68,                    // AGC ceiling 128x
-    
-    // === YUV Color Matrix (from ov7670_yuv422 table) ===
-    0x4F, 0x80,                        // Matrix coefficient 1
-    0x50, 0x80,                        // Matrix coefficient 2
-    0x51, 0x00,                        // Matrix coefficient 3
-    0x52, 0x22,                        // Matrix coefficient 4
-    0x53, 0x5E,                        // Matrix coefficient 5
-    0x54, 0x80,                        // Matrix coefficient 6
-    0x58, 0x9E,                        // Matrix sign
-    REG_COM13, COM13_GAMMA | COM13_UVSAT | COM13_UVSWAP, // Gamma + UV sat + UV swap
-    
-    // === RESOLUTION: QQVGA (160x120) ===
-    REG_COM3, 0x04,                    // Enable scaling
-    REG_COM14, 0x1A,                   // Manual scaling, PCLK divider
-    REG_SCALING_XSC, 0x3A,
-    REG_SCALING_YSC, 0x35,
-    REG_SCALING_DCWCTR, 0x22,          // Downsample by 4
-    REG_SCALING_PCLK_DIV, 0xF2,
-    REG_SCALING_PCLK_DELAY, 0x02,
-    REG_HSTART, 0x16,
-    REG_HSTOP, 0x04,
-    REG_HREF, 0x24,
-    REG_VSTART, 0x02,
-    REG_VSTOP, 0x7A,
-    REG_VREF, 0x0A,
-    
-    // === VSYNC ===
-    REG_COM10, COM10_VS_NEG,           // VSYNC negative polarity
-    
-    // === Gamma Curve ===
-    0x7A, 0x20, 0x7B, 0x10, 0x7C, 0x1E, 0x7D, 0x35,
-    0x7E, 0x5A, 0x7F, 0x69, 0x80, 0x76, 0x81, 0x80,
-    0x82, 0x88, 0x83, 0x8F, 0x84, 0x96, 0x85, 0xA3,
-    0x86, 0xAF, 0x87, 0xC4, 0x88, 0xD7, 0x89, 0xE8,
-    
-    // === AGC and AEC Parameters (progressive enable) ===
-    REG_COM8, COM8_FASTAEC | COM8_AECSTEP | COM8_BFILT, // Step 1: basic
-    REG_GAIN, 0x00,
-    0x10, 0x00,                        // AECH
-    REG_COM4, 0x40,
-    REG_BD50MAX, 0x05,
-    REG_BD60MAX, 0x07,
-    REG_AEW, 0x95,
-    REG_AEB, 0x33,
-    REG_VPT, 0xE3,
-    REG_HAECC1, 0x78,
-    REG_HAECC2, 0x68,
-    0xA1, 0x03,                        // Reserved
-    REG_HAECC3, 0xD8,
-    REG_HAECC4, 0xD8,
-    REG_HAECC5, 0xF0,
-    REG_HAECC6, 0x90,
-    REG_HAECC7, 0x94,
-    REG_COM8, COM8_FASTAEC | COM8_AECSTEP | COM8_BFILT | COM8_AGC | COM8_AEC, // Step 2: +AGC +AEC
-    
-    // === Reserved / Magic Values ===
-    REG_COM5, 0x61,
-    REG_COM6, 0x4B,
-    0x16, 0x02,
-    REG_MVFP, 0x07,                   // Mirror/VFlip
-    0x21, 0x02, 0x22, 0x91,
-    0x29, 0x07, 0x33, 0x0B,
-    0x35, 0x0B, 0x37, 0x1D,
-    0x38, 0x71, 0x39, 0x2A,
-    REG_COM12, 0x78,
-    0x4D, 0x40, 0x4E, 0x20,
-    REG_GFIX, 0x00,
-    REG_DBLV, 0x0A,                   // PLL and regulator
-    0x74, 0x10,
-    0x8D, 0x4F, 0x8E, 0x00,
-    0x8F, 0x00, 0x90, 0x00,
-    0x91, 0x00, 0x96, 0x00,
-    0x9A, 0x00, 0xB0, 0x84,
-    0xB1, 0x0C, 0xB2, 0x0E,
-    0xB3, 0x82, 0xB8, 0x0A,
-    
-    // === White Balance ===
-    0x43, 0x0A, 0x44, 0xF0,
-    0x45, 0x34, 0x46, 0x58,
-    0x47, 0x28, 0x48, 0x3A,
-    0x59, 0x88, 0x5A, 0x88,
-    0x5B, 0x44, 0x5C, 0x67,
-    0x5D, 0x49, 0x5E, 0x0E,
-    0x6C, 0x0A, 0x6D, 0x55,
-    0x6E, 0x11, 0x6F, 0x9F,
-    REG_GGAIN, 0x40,                  // G channel gain
-    REG_BLUE, 0x40,
-    REG_RED, 0x60,
-    REG_COM8, COM8_FASTAEC | COM8_AECSTEP | COM8_BFILT | COM8_AGC | COM8_AEC | COM8_AWB, // Step 3: +AWB
-    
-    // === Edge / Denoise / Contrast ===
-    REG_COM16, COM16_AWBGAIN,         // AWB gain enable
-    REG_EDGE, 0x00,
-    0x75, 0x05,
-    REG_REG76, 0xE1,
-    REG_DENOISE, 0x00,                // Denoise strength
-    0x77, 0x01,
-    0x4B, 0x09,
-    0xC9, 0x60,
-    REG_BRIGHT, 0x00,
-    REG_CONTRAST, 0x40,
-    
-    // === AEC / Exposure Timing ===
-    0x34, 0x11,
-    REG_COM11, COM11_EXP | COM11_HZAUTO, // Exposure + Hz auto detect
-    0xA4, 0x88, 0x96, 0x00,
-    0x97, 0x30, 0x98, 0x20,
-    0x99, 0x30, 0x9A, 0x84,
-    0x9B, 0x29, 0x9C, 0x03,
-    0x9D, 0x4C, 0x9E, 0x3F,
-    0x78, 0x04,
-    
-    // === Multiplexor Register Sequences ===
-    0x79, 0x01, 0xC8, 0xF0,
-    0x79, 0x0F, 0xC8, 0x00,
-    0x79, 0x10, 0xC8, 0x7E,
-    0x79, 0x0A, 0xC8, 0x80,
-    0x79, 0x0B, 0xC8, 0x01,
-    0x79, 0x0C, 0xC8, 0x0F,
-    0x79, 0x0D, 0xC8, 0x20,
-    0x79, 0x09, 0xC8, 0x80,
-    0x79, 0x02, 0xC8, 0xC0,
-    0x79, 0x03, 0xC8, 0x40,
-    0x79, 0x05, 0xC8, 0x30,
-    0x79, 0x26,
-    
-    0xFF, 0xFF                         // End marker
->>>>>>> master
+};
+
+// YUV422 format (YUYV, Y first)
+// Format part of ov7670_qqvga_yuv from ov7670_due_capture; the resolution,
+// gamma, AGC/AEC and white-balance parts of that table are the same as
+// ov7670_qqvga and ov7670_default and are shared with the RGB565 pipeline.
+// CLKRC is left at its default so both pipelines run at the same frame rate.
+static const regval_list ov7670_yuv422[] = {
+    {REG_RGB444, 0x00},                // Disable RGB444
+    {REG_COM15, COM15_R00FF},          // Full output range [00-FF]
+    {REG_TSLB, TSLB_YLAST},            // YUYV byte order (Y first)
+    {REG_COM1, 0x00},                  // No CCIR656
+    {REG_COM9, 0x68},                  // AGC ceiling 128x
+    {REG_CMATRIX_1, 0x80},
+    {REG_CMATRIX_2, 0x80},
+    {REG_CMATRIX_3, 0x00},
+    {REG_CMATRIX_4, 0x22},
+    {REG_CMATRIX_5, 0x5E},
+    {REG_CMATRIX_6, 0x80},
+    {REG_CMATRIX_SIGN, 0x9E},
+    {REG_COM13, COM13_GAMMA | COM13_UVSAT | COM13_UVSWAP},
+    {REG_LIST_END_MARKER, REG_LIST_END_MARKER}
 };
 
 // RGB565 format
@@ -420,6 +289,37 @@ static const regval_list ov7670_default[] = {
     {REG_LIST_END_MARKER, REG_LIST_END_MARKER}
 };
 
+// Registers that a reset returns to other values and that AEC/AGC/AWB never touch.
+// Together with COM7/COM15 (pixel format) they tell a configured sensor from a fresh one
+static const regval_list ov7670_signature[] = {
+    {REG_COM10, COM10_VS_NEG},
+    {REG_HSTART, 0x16},
+    {REG_COM14, 0x1A},
+    {REG_SCALING_PCLK_DIV, 0xF2},
+    {REG_COM5, 0x61},
+    {REG_LIST_END_MARKER, REG_LIST_END_MARKER}
+};
+
+// ==================== BRING-UP TIMING ====================
+
+#if CAM_FAST_INIT
+// OV7670 datasheet: SCCB is usable 1 ms after RESET# and after COM7 software reset
+static const uint32_t CAM_POWER_SETTLE_MS = 0;
+static const uint32_t CAM_RESET_PULSE_MS = 1;
+static const uint32_t CAM_RESET_RECOVER_MS = 3;
+static const uint32_t CAM_SOFT_RESET_MS = 3;
+static const uint32_t CAM_WRITE_GAP_MS = 0;
+#else
+static const uint32_t CAM_POWER_SETTLE_MS = 100;
+static const uint32_t CAM_RESET_PULSE_MS = 10;
+static const uint32_t CAM_RESET_RECOVER_MS = 100;
+static const uint32_t CAM_SOFT_RESET_MS = 200;
+static const uint32_t CAM_WRITE_GAP_MS = 1;
+#endif
+
+// A format change through COM7 restarts the sensor's output path
+static const uint32_t CAM_FORMAT_SWITCH_MS = 1;
+
 // ==================== FAST PIN MANIPULATION ====================
 
 // Fast pin manipulation for Arduino Due
@@ -435,31 +335,60 @@ inline int pinRead(int pin) {
     return (g_APinDescription[pin].pPort->PIO_PDSR & g_APinDescription[pin].ulPin) ? 1 : 0;
 }
 
+// Выдержка после фронта RCK до чтения шины: tAC AL422B (15 нс) +
+// синхронизатор входов PIO (2 такта MCK). 4 такта @ 84 МГц ~ 48 нс
+#define FIFO_ACCESS_DELAY() do { __NOP(); __NOP(); __NOP(); __NOP(); } while (0)
+
 // ==================== INITIALIZATION ====================
 
 bool CameraModule::begin() {
+    uint32_t beginMillis = millis();
     cameraInitialized = false;
-
-    Serial.println("CameraModule: Initializing OV7670 (RGB565)...");
+    warmStarted = false;
+    frameBuffers[0] = MemoryArena::region(ARENA_FRAMES);
+    frameBuffers[1] = frameBuffers[0] + IMAGE_BUFFER_SIZE;
+    settleUntilMillis = beginMillis;
+    captureState = CAPTURE_IDLE;
+    frontIndex = 0;
+    frontValid = false;
+    frontSequence = 0;
+    consumedSequence = 0;
+    framePinned = false;
+    pinnedIndex = 0;
+    requestedGeometry = GEOMETRY_FULL;
+    activeGeometry = GEOMETRY_FULL;
+    frontGeometry = GEOMETRY_FULL;
+    pixelFormat = CAM_DEFAULT_PIXEL_FORMAT;
+    frontFormat = pixelFormat;
+
+    Serial.print("CameraModule: Initializing OV7670 (");
+    Serial.print(pixelFormatName(pixelFormat));
+    Serial.println(")...");
 
     setupPins();
-    delay(100);
+    delay(CAM_POWER_SETTLE_MS);
 
     // Initialize I2C for camera (using Wire, not Wire1 which is for MPU6050)
     Wire.begin();
-    Wire.setClock(100000); // 100kHz for SCCB
-
-    // Reset camera
-    resetCamera();
-
-    // Check camera presence by reading product ID
-    uint8_t pid = readRegister(REG_PID);
+    uint8_t pid = probeSccbClock();
+
+    // Sensor kept its registers across a Due reset: no reset, no reconfiguration
+    warmStarted = CAM_WARM_START && pid == 0x76 && isSensorConfigured(pixelFormat);
+    if (!warmStarted) {
+        resetCamera();
+        // Check camera presence by reading product ID (a sensor that was
+        // not ready before the reset gets the fast clock another chance)
+        pid = probeSccbClock();
+    }
     uint8_t ver = readRegister(REG_VER);
 
     Serial.print("CameraModule: PID=0x");
     Serial.print(pid, HEX);
     Serial.print(", VER=0x");
-    Serial.println(ver, HEX);
+    Serial.print(ver, HEX);
+    Serial.print(", SCCB ");
+    Serial.print(sccbClock / 1000);
+    Serial.println(" kHz");
 
     // OV7670 should return PID=0x76
     if (pid != 0x76) {
@@ -469,15 +398,76 @@ bool CameraModule::begin() {
 
     Serial.println("CameraModule: Camera detected: OV7670");
 
-    // === Configuration order matches working ov7670_due_capture.ino ===
+    rgb565_gray_init();
+    Serial.print("CameraModule: Gray kernel = ");
+    Serial.println(rgb565_gray_kernel_name());
+
+    if (warmStarted) {
+        Serial.println("CameraModule: Warm start, sensor already configured");
+    } else if (!configureSensor(pixelFormat)) {
+        return false;
+    }
+
+    // Frame boundaries for the background capture engine
+    vsyncOwner = this;
+    attachInterrupt(digitalPinToInterrupt(Hardware::CAM_VSYNC), vsyncIsr, CHANGE);
 
-    // 1. Set RGB565 output format
-    writeRegister(REG_COM7, COM7_RGB);
-    if (!writeRegisterList(ov7670_rgb565)) {
-        Serial.println("CameraModule: ERROR - Failed to configure RGB565");
+    cameraInitialized = true;
+    initMillis = millis() - beginMillis;
+    Serial.print("CameraModule: Initialized successfully (");
+    Serial.print(pixelFormatName(pixelFormat));
+    Serial.print(" QQVGA 160x120 -> 160x120 grayscale) in ");
+    Serial.print(initMillis);
+    Serial.println(" ms");
+    return true;
+}
+
+uint8_t CameraModule::probeSccbClock() {
+    sccbClock = CAM_SCCB_CLOCK;
+    Wire.setClock(sccbClock);
+    uint8_t pid = readRegister(REG_PID);
+    if (pid != 0x76 && sccbClock > 100000) {
+        // Long wires or weak pull-ups: standard-mode SCCB
+        sccbClock = 100000;
+        Wire.setClock(sccbClock);
+        pid = readRegister(REG_PID);
+    }
+    return pid;
+}
+
+bool CameraModule::isSensorConfigured(PixelFormat format) {
+    uint8_t com7 = (format == PIXEL_YUV422) ? COM7_YUV : COM7_RGB;
+    uint8_t com15 = (format == PIXEL_YUV422) ? COM15_R00FF : (COM15_R00FF | COM15_RGB565);
+    if (readRegister(REG_COM7) != com7 || readRegister(REG_COM15) != com15) {
         return false;
     }
-    Serial.println("CameraModule: RGB565 format configured");
+    for (uint8_t i = 0; ov7670_signature[i].reg != REG_LIST_END_MARKER; i++) {
+        if (readRegister(ov7670_signature[i].reg) != ov7670_signature[i].val) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CameraModule::configureSensor(PixelFormat format) {
+    // === Configuration order matches working ov7670_due_capture.ino ===
+
+    // 1. Set output format
+    if (format == PIXEL_YUV422) {
+        writeRegister(REG_COM7, COM7_YUV);
+        if (!writeRegisterList(ov7670_yuv422)) {
+            Serial.println("CameraModule: ERROR - Failed to configure YUV422");
+            return false;
+        }
+        Serial.println("CameraModule: YUV422 format configured");
+    } else {
+        writeRegister(REG_COM7, COM7_RGB);
+        if (!writeRegisterList(ov7670_rgb565)) {
+            Serial.println("CameraModule: ERROR - Failed to configure RGB565");
+            return false;
+        }
+        Serial.println("CameraModule: RGB565 format configured");
+    }
 
     // 2. Set QQVGA resolution (160x120)
     if (!writeRegisterList(ov7670_qqvga)) {
@@ -496,103 +486,323 @@ bool CameraModule::begin() {
     }
     Serial.println("CameraModule: Default settings loaded");
 
-    delay(300); // Wait for settings to apply
+#if CAM_FAST_INIT
+    // AEC/AGC settle while the car starts up: only the first capture waits
+    settleUntilMillis = millis() + SENSOR_SETTLE_MS;
+#else
+    delay(SENSOR_SETTLE_MS); // Wait for settings to apply
+#endif
+    return true;
+}
 
-    cameraInitialized = true;
-    Serial.println("CameraModule: Initialized successfully (RGB565 QQVGA 160x120 -> 160x120 grayscale)");
+bool CameraModule::setPixelFormat(PixelFormat format) {
+    if (!cameraInitialized) {
+        return false;
+    }
+    if (format == pixelFormat) {
+        return true;
+    }
+
+    // The frame in the FIFO (if any) was written in the old format
+    abortCapture();
+    pixelFormat = format;
+
+    // COM7 is rewritten first, so the sensor resets its format path too
+    if (!configureSensor(format)) {
+        return false;
+    }
+
+    Serial.print("CameraModule: Pixel format = ");
+    Serial.println(pixelFormatName(format));
     return true;
 }
 
 // ==================== CAPTURE ====================
 
 ImageSnapshot CameraModule::captureIfLight(bool isDark) {
-    ImageSnapshot snapshot;
-    snapshot.available = false;
-    snapshot.width = 0;
-    snapshot.height = 0;
-    snapshot.buffer = nullptr;
-    snapshot.bufferSize = 0;
-
     // Если темно или камера не инициализирована - не захватываем
     if (isDark || !cameraInitialized) {
-        return snapshot;
+        return emptySnapshot();
     }
 
     return capture();
 }
 
 ImageSnapshot CameraModule::capture() {
-    ImageSnapshot snapshot;
-    snapshot.available = false;
-    snapshot.width = 0;
-    snapshot.height = 0;
-    snapshot.buffer = nullptr;
-    snapshot.bufferSize = 0;
-
     if (!cameraInitialized) {
-        return snapshot;
+        return emptySnapshot();
     }
 
-    // Wait for VSYNC (frame boundary)
-    while (digitalRead(Hardware::CAM_VSYNC) == HIGH);
-    while (digitalRead(Hardware::CAM_VSYNC) == LOW);
+    // Same engine as the background path, just driven to completion here
+    if (!startCapture()) {
+        return emptySnapshot();
+    }
 
-    // Reset FIFO write pointer and enable write
-    fifoWriteReset();
-    fifoWriteEnable();
+    while (!pollCapture()) {
+        if (captureState == CAPTURE_IDLE) {
+            // pollCapture() aborted on timeout
+            return emptySnapshot();
+        }
+    }
 
-    // Wait for frame to be written (next VSYNC)
-    while (digitalRead(Hardware::CAM_VSYNC) == HIGH);
+    return latestFrame();
+}
 
-    // Disable write
-    fifoWriteDisable();
+bool CameraModule::startCapture() {
+    if (!cameraInitialized) {
+        return false;
+    }
+    if (captureState != CAPTURE_IDLE) {
+        return true;
+    }
+    if (framePinned && (frontIndex ^ 1) == pinnedIndex) {
+        // Back buffer still being transmitted
+        return false;
+    }
+
+    activeGeometry = requestedGeometry;
+    plan = planFor(activeGeometry);
 
-    delay(1);
+    // Right after configureSensor() the frame start is held off until the sensor settles
+    uint32_t now = millis();
+    captureStartMillis = ((int32_t)(settleUntilMillis - now) > 0) ? settleUntilMillis : now;
+    PERF_SPAN_BEGIN(PERF_FRAME);
+    readRow = 0;
+    captureState = CAPTURE_WAIT_FRAME_START;
+    return true;
+}
 
-    // Enable FIFO output and reset read pointer
-    fifoOutputEnable();
-    fifoReadReset();
+bool CameraModule::pollCapture() {
+    switch (captureState) {
+        case CAPTURE_IDLE:
+            return false;
 
-    // Read RGB565 image from FIFO (160x120)
-    // Convert RGB565 -> grayscale: Y = (R*77 + G*150 + B*29) >> 8
-    // No downsampling - full resolution 160x120
+        case CAPTURE_WAIT_FRAME_START:
+        case CAPTURE_WRITING:
+            // Frame is being written into AL422B by hardware, VSYNC ISR moves us on
+            if ((int32_t)(millis() - captureStartMillis) > (int32_t)CAPTURE_TIMEOUT_MS) {
+                Serial.println("CameraModule: Capture timeout (no VSYNC)");
+                abortCapture();
+            }
+            return false;
 
-    size_t bufIdx = 0;
-    for (int y = 0; y < CAPTURE_HEIGHT; y++) {
-        for (int x = 0; x < CAPTURE_WIDTH; x++) {
-            // RGB565: 2 bytes per pixel, little-endian from OV7670 FIFO
-            uint8_t b1 = readByte();  // Low byte
-            uint8_t b2 = readByte();  // High byte
+        case CAPTURE_FRAME_IN_FIFO:
+            if (micros() - frameEndMicros < FIFO_SETTLE_US) {
+                return false;
+            }
+            // Enable FIFO output and reset read pointer
+            fifoOutputEnable();
+            fifoReadReset();
+            // Rows above the ROI are clocked out without sampling
+            skipBytes((size_t)plan.firstRow * LINE_BYTES);
+            readRow = 0;
+            captureState = CAPTURE_READING;
+            return false;
 
-            // Decode RGB565: RRRRRGGG GGGBBBBB (big-endian after combining)
-            uint16_t rgb565 = (b2 << 8) | b1;
+        case CAPTURE_READING:
+            break;
+    }
 
-            uint8_t r = ((rgb565 >> 11) & 0x1F) << 3;  // 5-bit R -> 8-bit
-            uint8_t g = ((rgb565 >> 5) & 0x3F) << 2;   // 6-bit G -> 8-bit
-            uint8_t b = (rgb565 & 0x1F) << 3;           // 5-bit B -> 8-bit
+    // Drain the FIFO a slice of rows at a time so tick() keeps running
+    PERF_SCOPE(PERF_CAPTURE);
+    uint8_t* back = frameBuffers[frontIndex ^ 1];
+    uint16_t rowsLeft = plan.height - readRow;
+    uint16_t rows = rowsLeft < ROWS_PER_POLL ? rowsLeft : ROWS_PER_POLL;
 
-            // Convert to grayscale using integer luminance formula
-            // Y = (R*77 + G*150 + B*29) >> 8
-            uint8_t gray = (uint8_t)(((uint16_t)r * 77 + (uint16_t)g * 150 + (uint16_t)b * 29) >> 8);
+    ArenaScratch scratch(SCRATCH_CAMERA_LINE);
+    uint8_t* lineBuffer = scratch.data();
+    if (pixelFormat != PIXEL_YUV422) {
+        scratch.use(LINE_BYTES);
+    }
 
-            if (bufIdx < IMAGE_BUFFER_SIZE) {
-                imageBuffer[bufIdx++] = gray;
+    for (uint16_t i = 0; i < rows; i++) {
+        uint8_t* dst = back + (size_t)readRow * plan.width;
+        if (pixelFormat == PIXEL_YUV422) {
+            // Y bytes go straight into the frame, no line buffer, no math
+            readLumaStrided(dst, plan.width, plan.colStep);
+        } else {
+            if (plan.colStep == 1) {
+                // Whole row in one burst (320 bytes), then convert from RAM
+                readLine(lineBuffer, LINE_BYTES);
+            } else {
+                readPixelsStrided(lineBuffer, plan.width, plan.colStep);
             }
+            convertRow(lineBuffer, dst, plan.width);
+        }
+        readRow++;
+
+        // Decimated rows are skipped, not transferred
+        if (plan.rowStep > 1 && readRow < plan.height) {
+            skipBytes((size_t)(plan.rowStep - 1) * LINE_BYTES);
         }
     }
 
-    // Disable output
+    if (readRow < plan.height) {
+        return false;
+    }
+
+    // Rows below the ROI stay in the FIFO: next capture resets the pointers.
+    // Disable output and publish the back buffer
     fifoOutputDisable();
+    frontGeometry = activeGeometry;
+    frontFormat = pixelFormat;
+    frontIndex ^= 1;
+    frontValid = true;
+    frontSequence++;
+    captureState = CAPTURE_IDLE;
+    PERF_SPAN_END(PERF_FRAME);
+    return true;
+}
+
+ImageSnapshot CameraModule::latestFrame() {
+    if (!frontValid) {
+        return emptySnapshot();
+    }
+
+    consumedSequence = frontSequence;
+
+    ReadoutPlan frontPlan = planFor(frontGeometry);
 
+    ImageSnapshot snapshot;
     snapshot.available = true;
-    snapshot.width = IMAGE_WIDTH;
-    snapshot.height = IMAGE_HEIGHT;
-    snapshot.buffer = imageBuffer;
-    snapshot.bufferSize = bufIdx;
+    snapshot.width = frontPlan.width;
+    snapshot.height = frontPlan.height;
+    snapshot.buffer = frameBuffers[frontIndex];
+    snapshot.bufferSize = (size_t)frontPlan.width * frontPlan.height;
+    snapshot.geometry = frontGeometry;
+    snapshot.pixelFormat = frontFormat;
+    return snapshot;
+}
+
+CameraModule::ReadoutPlan CameraModule::planFor(ImageGeometry geometry) {
+    ReadoutPlan p;
+    switch (geometry) {
+        case GEOMETRY_HALF:
+            p.width = CAPTURE_WIDTH / 2;
+            p.height = CAPTURE_HEIGHT / 2;
+            p.firstRow = 0;
+            p.rowStep = 2;
+            p.colStep = 2;
+            break;
+        case GEOMETRY_HORIZON:
+            p.width = CAPTURE_WIDTH;
+            p.height = Hardware::CAM_HORIZON_ROWS;
+            p.firstRow = Hardware::CAM_HORIZON_TOP;
+            p.rowStep = 1;
+            p.colStep = 1;
+            break;
+        case GEOMETRY_FULL:
+        default:
+            p.width = CAPTURE_WIDTH;
+            p.height = CAPTURE_HEIGHT;
+            p.firstRow = 0;
+            p.rowStep = 1;
+            p.colStep = 1;
+            break;
+    }
+    return p;
+}
+
+const char* CameraModule::geometryName(ImageGeometry geometry) {
+    switch (geometry) {
+        case GEOMETRY_HALF:    return "half";
+        case GEOMETRY_HORIZON: return "horizon";
+        case GEOMETRY_FULL:
+        default:               return "full";
+    }
+}
+
+bool CameraModule::parseGeometry(const char* name, ImageGeometry& outGeometry) {
+    if (name == nullptr) {
+        return false;
+    }
+    if (strcmp(name, "full") == 0) {
+        outGeometry = GEOMETRY_FULL;
+    } else if (strcmp(name, "half") == 0) {
+        outGeometry = GEOMETRY_HALF;
+    } else if (strcmp(name, "horizon") == 0) {
+        outGeometry = GEOMETRY_HORIZON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* CameraModule::pixelFormatName(PixelFormat format) {
+    switch (format) {
+        case PIXEL_YUV422: return "yuv422";
+        case PIXEL_RGB565:
+        default:           return "rgb565";
+    }
+}
 
+bool CameraModule::parsePixelFormat(const char* name, PixelFormat& outFormat) {
+    if (name == nullptr) {
+        return false;
+    }
+    if (strcmp(name, "rgb565") == 0 || strcmp(name, "rgb") == 0) {
+        outFormat = PIXEL_RGB565;
+    } else if (strcmp(name, "yuv422") == 0 || strcmp(name, "yuv") == 0) {
+        outFormat = PIXEL_YUV422;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void CameraModule::abortCapture() {
+    noInterrupts();
+    captureState = CAPTURE_IDLE;
+    interrupts();
+    fifoWriteDisable();
+    fifoOutputDisable();
+}
+
+void CameraModule::convertRow(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    // RGB565 -> grayscale: Y = (R*77 + G*150 + B*29) >> 8 (see rgb565_gray.h)
+    PERF_SCOPE(PERF_CONVERT);
+    rgb565_to_gray(src, dst, pixels);
+}
+
+ImageSnapshot CameraModule::emptySnapshot() const {
+    ImageSnapshot snapshot;
+    snapshot.available = false;
+    snapshot.width = 0;
+    snapshot.height = 0;
+    snapshot.buffer = nullptr;
+    snapshot.bufferSize = 0;
+    snapshot.geometry = requestedGeometry;
+    snapshot.pixelFormat = pixelFormat;
     return snapshot;
 }
 
+// ==================== VSYNC INTERRUPT ====================
+
+CameraModule* CameraModule::vsyncOwner = nullptr;
+
+void CameraModule::vsyncIsr() {
+    if (vsyncOwner != nullptr) {
+        vsyncOwner->handleVsyncEdge();
+    }
+}
+
+void CameraModule::handleVsyncEdge() {
+    bool vsyncHigh = pinRead(Hardware::CAM_VSYNC);
+
+    if (captureState == CAPTURE_WAIT_FRAME_START && vsyncHigh &&
+        (int32_t)(millis() - captureStartMillis) >= 0) {
+        // Frame start: reset FIFO write pointer and enable write
+        fifoWriteReset();
+        fifoWriteEnable();
+        captureState = CAPTURE_WRITING;
+    } else if (captureState == CAPTURE_WRITING && !vsyncHigh) {
+        // Frame end: whole frame is now held by AL422B
+        fifoWriteDisable();
+        frameEndMicros = micros();
+        captureState = CAPTURE_FRAME_IN_FIFO;
+    }
+}
+
 // ==================== PIN SETUP ====================
 
 void CameraModule::setupPins() {
@@ -624,6 +834,30 @@ void CameraModule::setupPins() {
     digitalWrite(Hardware::CAM_RRST, HIGH);   // Read reset inactive
     digitalWrite(Hardware::CAM_OE, HIGH);     // Output disabled
     digitalWrite(Hardware::CAM_RCK, LOW);     // Read clock low
+
+    // Cache port/mask for the hot FIFO read loop
+    rckPort = g_APinDescription[Hardware::CAM_RCK].pPort;
+    rckMask = g_APinDescription[Hardware::CAM_RCK].ulPin;
+    dataPort = g_APinDescription[Hardware::CAM_D0].pPort;
+    parallelReadout = checkParallelBus();
+
+    Serial.print("CameraModule: FIFO readout mode = ");
+    Serial.println(parallelReadout ? "parallel (PIO_PDSR)" : "bit-by-bit");
+}
+
+bool CameraModule::checkParallelBus() const {
+    const uint8_t dataPins[8] = {
+        Hardware::CAM_D0, Hardware::CAM_D1, Hardware::CAM_D2, Hardware::CAM_D3,
+        Hardware::CAM_D4, Hardware::CAM_D5, Hardware::CAM_D6, Hardware::CAM_D7
+    };
+
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        const PinDescription& desc = g_APinDescription[dataPins[bit]];
+        if (desc.pPort != dataPort || desc.ulPin != (1u << (Hardware::CAM_DATA_SHIFT + bit))) {
+            return false;
+        }
+    }
+    return true;
 }
 
 // ==================== I2C REGISTER ACCESS ====================
@@ -631,13 +865,12 @@ void CameraModule::setupPins() {
 void CameraModule::resetCamera() {
     // Hardware reset
     digitalWrite(Hardware::CAM_RST, LOW);
-    delay(10);
+    delay(CAM_RESET_PULSE_MS);
     digitalWrite(Hardware::CAM_RST, HIGH);
-    delay(100);
+    delay(CAM_RESET_RECOVER_MS);
 
-    // Software reset
+    // Software reset (writeRegister waits CAM_SOFT_RESET_MS after it)
     writeRegister(REG_COM7, COM7_RESET);
-    delay(200);
 }
 
 bool CameraModule::writeRegister(uint8_t reg, uint8_t val) {
@@ -645,7 +878,13 @@ bool CameraModule::writeRegister(uint8_t reg, uint8_t val) {
     Wire.write(reg);
     Wire.write(val);
     uint8_t result = Wire.endTransmission();
-    delay(1);
+
+    // Only COM7 needs time afterwards: reset reloads defaults, format restarts the output
+    if (reg == REG_COM7) {
+        delay((val & COM7_RESET) ? CAM_SOFT_RESET_MS : CAM_FORMAT_SWITCH_MS);
+    } else if (CAM_WRITE_GAP_MS > 0) {
+        delay(CAM_WRITE_GAP_MS);
+    }
     return (result == 0);
 }
 
@@ -669,11 +908,6 @@ bool CameraModule::writeRegisterList(const regval_list* list) {
             Serial.println(list[i].reg, HEX);
             return false;
         }
-
-        // Extra delay for reset command
-        if (list[i].reg == REG_COM7 && list[i].val == COM7_RESET) {
-            delay(200);
-        }
         i++;
     }
     return true;
@@ -682,6 +916,14 @@ bool CameraModule::writeRegisterList(const regval_list* list) {
 // ==================== FIFO DATA READ ====================
 
 uint8_t CameraModule::readByte() {
+    if (parallelReadout) {
+        rckPort->PIO_SODR = rckMask;
+        FIFO_ACCESS_DELAY();
+        uint8_t value = (uint8_t)(dataPort->PIO_PDSR >> Hardware::CAM_DATA_SHIFT);
+        rckPort->PIO_CODR = rckMask;
+        return value;
+    }
+
     uint8_t data = 0;
 
     fifoReadClockHigh();
@@ -702,6 +944,107 @@ uint8_t CameraModule::readByte() {
     return data;
 }
 
+void CameraModule::readLine(uint8_t* dst, size_t n) {
+    if (!parallelReadout) {
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = readByte();
+        }
+        return;
+    }
+
+    // Hot loop: one SODR, one PDSR read, one CODR per byte, no calls
+    Pio* const rck = rckPort;
+    const uint32_t rckBit = rckMask;
+    volatile const uint32_t* const pdsr = &dataPort->PIO_PDSR;
+
+    for (size_t i = 0; i < n; i++) {
+        rck->PIO_SODR = rckBit;
+        FIFO_ACCESS_DELAY();
+        dst[i] = (uint8_t)(*pdsr >> Hardware::CAM_DATA_SHIFT);
+        rck->PIO_CODR = rckBit;
+    }
+}
+
+void CameraModule::readPixelsStrided(uint8_t* dst, size_t pixels, uint8_t step) {
+    const size_t skip = (size_t)(step - 1) * 2;
+
+    if (!parallelReadout) {
+        for (size_t i = 0; i < pixels; i++) {
+            *dst++ = readByte();
+            *dst++ = readByte();
+            skipBytes(skip);
+        }
+        return;
+    }
+
+    Pio* const rck = rckPort;
+    const uint32_t rckBit = rckMask;
+    volatile const uint32_t* const pdsr = &dataPort->PIO_PDSR;
+
+    for (size_t i = 0; i < pixels; i++) {
+        for (uint8_t b = 0; b < 2; b++) {
+            rck->PIO_SODR = rckBit;
+            FIFO_ACCESS_DELAY();
+            *dst++ = (uint8_t)(*pdsr >> Hardware::CAM_DATA_SHIFT);
+            rck->PIO_CODR = rckBit;
+        }
+        for (size_t k = 0; k < skip; k++) {
+            rck->PIO_SODR = rckBit;
+            __NOP();
+            rck->PIO_CODR = rckBit;
+        }
+    }
+}
+
+void CameraModule::readLumaStrided(uint8_t* dst, size_t pixels, uint8_t step) {
+    // YUYV: byte 0 of every pixel is Y, byte 1 alternates U/V
+    const size_t skip = (size_t)step * 2 - 1;
+
+    if (!parallelReadout) {
+        for (size_t i = 0; i < pixels; i++) {
+            *dst++ = readByte();
+            skipBytes(skip);
+        }
+        return;
+    }
+
+    Pio* const rck = rckPort;
+    const uint32_t rckBit = rckMask;
+    volatile const uint32_t* const pdsr = &dataPort->PIO_PDSR;
+
+    for (size_t i = 0; i < pixels; i++) {
+        rck->PIO_SODR = rckBit;
+        FIFO_ACCESS_DELAY();
+        *dst++ = (uint8_t)(*pdsr >> Hardware::CAM_DATA_SHIFT);
+        rck->PIO_CODR = rckBit;
+        for (size_t k = 0; k < skip; k++) {
+            rck->PIO_SODR = rckBit;
+            __NOP();
+            rck->PIO_CODR = rckBit;
+        }
+    }
+}
+
+void CameraModule::skipBytes(size_t n) {
+    if (!parallelReadout) {
+        for (size_t i = 0; i < n; i++) {
+            fifoReadClockHigh();
+            delayMicroseconds(1);
+            fifoReadClockLow();
+            delayMicroseconds(1);
+        }
+        return;
+    }
+
+    Pio* const rck = rckPort;
+    const uint32_t rckBit = rckMask;
+    for (size_t i = 0; i < n; i++) {
+        rck->PIO_SODR = rckBit;
+        __NOP();
+        rck->PIO_CODR = rckBit;
+    }
+}
+
 // ==================== FIFO CONTROL ====================
 
 void CameraModule::fifoWriteEnable() {
@@ -1,6 +1,14 @@
 #include "../include/CarController.h"
+#include "../include/Perf.h"
+#include "../include/MemoryArena.h"
 #include <cstring>
 
+#if defined(ARDUINO_ARCH_SAM)
+// Крупные буферы - в MemoryArena; в самих модулях остаются поля и мелкие буферы
+static_assert(sizeof(CarController) <= MEMORY_MODULE_RESERVE,
+              "CarController outgrew MEMORY_MODULE_RESERVE: move a buffer into MemoryArena");
+#endif
+
 void CarController::begin() {
     // Инициализация Serial для отладки
     Serial.begin(115200);
@@ -14,6 +22,10 @@ void CarController::begin() {
     Serial.println("========================================");
     Serial.println();
     
+    // До модулей: им нужны регионы арены, а стек закрашивается, пока он мелкий
+    MemoryArena::begin();
+    Perf::begin();
+    
     // Инициализация всех модулей
     Serial.println("Initializing modules...");
     
@@ -27,21 +39,31 @@ void CarController::begin() {
     }
     
     wifiLink.begin();
+    wifiLink.getImageRate().setRequestedGeometry(cameraModule.getGeometry());
     commandDict.begin();
-    logger.begin();
+    logger.begin(&commandDict);
     
     // Настройка процессора команд
-    serialProcessor.begin(&commandDict, &logger, &rtc);
+    serialProcessor.begin(&commandDict, &logger, &rtc, &cameraModule, &wifiLink);
     serialProcessor.serialLoggingEnabled = &serialLoggingEnabled;
     serialProcessor.defaultStepDurationMs = &defaultStepDurationMs;
+    serialProcessor.pipelinedMode = &pipelinedMode;
+    serialProcessor.safetyDistanceCm = &safetyDistanceCm;
     
     // Настройки по умолчанию
     serialLoggingEnabled = true;
     defaultStepDurationMs = 3000;
+    pipelinedMode = CAR_DEFAULT_PIPELINED;
+    safetyDistanceCm = CAR_DEFAULT_SAFETY_CM;
     
     // Инициализация состояния
     sessionId = 1;
     stepId = 0;
+    lastCollectMillis = 0;
+    nextSent = false;
+    nextReady = false;
+    currentAbortReason = ABORT_NONE;
+    lastSonarSequence = 0;
     currentState = STATE_INIT;
     stateStartMillis = millis();
     
@@ -58,22 +80,48 @@ void CarController::tick() {
     
     rtc.update();
     
+    // Отложенная запись словаря после изменений из Serial
+    commandDict.poll();
+    
+    // Фоновый захват кадра (вычитывание FIFO порциями)
+    cameraModule.pollCapture();
+    
+    // Отсчёты MPU6050 и замеры HC-SR04 между шагами
+    sensors.pollImu();
+    sensors.pollSonar();
+    
+    // Передача шага и приём ответов идут в фоне
+    wifiLink.poll();
+    if (!wifiLink.isSending()) {
+        cameraModule.unpinFrame();
+    }
+    
     switch (currentState) {
-        case STATE_INIT:
+        case STATE_INIT: {
+            PERF_SCOPE(PERF_STATE_INIT);
             handleStateInit();
             break;
-        case STATE_COLLECT_SENSORS:
+        }
+        case STATE_COLLECT_SENSORS: {
+            PERF_SCOPE(PERF_STATE_COLLECT);
             handleStateCollectSensors();
             break;
-        case STATE_SEND_TO_SERVER:
+        }
+        case STATE_SEND_TO_SERVER: {
+            PERF_SCOPE(PERF_STATE_SEND);
             handleStateSendToServer();
             break;
-        case STATE_WAIT_COMMAND:
+        }
+        case STATE_WAIT_COMMAND: {
+            PERF_SCOPE(PERF_STATE_WAIT);
             handleStateWaitCommand();
             break;
-        case STATE_EXECUTE_COMMAND:
+        }
+        case STATE_EXECUTE_COMMAND: {
+            PERF_SCOPE(PERF_STATE_EXECUTE);
             handleStateExecuteCommand();
             break;
+        }
     }
 }
 
@@ -86,81 +134,84 @@ void CarController::handleStateInit() {
 }
 
 void CarController::handleStateCollectSensors() {
+    collectStep(currentSensorSnapshot, currentImageSnapshot, currentStepTimestamp);
+    changeState(STATE_SEND_TO_SERVER);
+}
+
+void CarController::collectStep(SensorSnapshot& sensorsOut, ImageSnapshot& imageOut, DateTime& tsOut) {
     // Увеличиваем счетчик шага
     stepId++;
     
+    // Время шага - от снятия данных прошлого; по нему пересчитывается уровень кадров
+    ImageRateController& imageRate = wifiLink.getImageRate();
+    uint32_t now = millis();
+    if (stepId > 1) {
+        imageRate.onCycle(now - lastCollectMillis);
+    }
+    lastCollectMillis = now;
+    cameraModule.setGeometry(imageRate.getGeometry());
+    
     // Получаем текущее время
-    currentStepTimestamp = rtc.now();
+    tsOut = rtc.now();
     
     // Читаем данные с датчиков
-    currentSensorSnapshot = sensors.readSnapshot();
+    sensorsOut = sensors.readSnapshot();
     
-    // Захватываем изображение если достаточно света
-    if (cameraModule.isInitialized() && !currentSensorSnapshot.isDark) {
-        currentImageSnapshot = cameraModule.capture();
+    // Захватываем изображение если достаточно света и шаг с кадром по периоду imageRate
+    // Кадр, снятый в фоне во время выполнения команды, берём без ожидания
+    if (cameraModule.isInitialized() && !sensorsOut.isDark && imageRate.wantImage()) {
+        if (cameraModule.hasFreshFrame()) {
+            imageOut = cameraModule.latestFrame();
+        } else {
+            imageOut = cameraModule.capture();
+        }
     } else {
-        currentImageSnapshot.available = false;
-        currentImageSnapshot.width = 0;
-        currentImageSnapshot.height = 0;
-        currentImageSnapshot.buffer = nullptr;
-        currentImageSnapshot.bufferSize = 0;
+        imageOut.available = false;
+        imageOut.width = 0;
+        imageOut.height = 0;
+        imageOut.buffer = nullptr;
+        imageOut.bufferSize = 0;
+        imageOut.geometry = cameraModule.getGeometry();
     }
     
     if (serialLoggingEnabled) {
         Serial.print("Step ");
         Serial.print(stepId);
         Serial.print(": dist=");
-        Serial.print(currentSensorSnapshot.distanceCm, 1);
+        Serial.print(sensorsOut.distanceCm, 1);
         Serial.print("cm dark=");
-        Serial.print(currentSensorSnapshot.isDark ? "Y" : "N");
+        Serial.print(sensorsOut.isDark ? "Y" : "N");
         Serial.print(" cam=");
-        Serial.println(currentImageSnapshot.available ? "Y" : "N");
+        Serial.print(imageOut.available ? "Y" : "N");
+        Serial.print(" rate=");
+        Serial.println(imageRate.getLevel());
     }
-    
-    changeState(STATE_SEND_TO_SERVER);
 }
 
 void CarController::handleStateSendToServer() {
     // Отправляем данные на сервер через NodeMCU
-    wifiLink.sendData(sessionId, stepId, currentStepTimestamp,
-                      currentSensorSnapshot, currentImageSnapshot);
+    if (!sendStep(currentSensorSnapshot, currentImageSnapshot, currentStepTimestamp)) {
+        return;
+    }
     
     commandWaitStartMillis = millis();
     changeState(STATE_WAIT_COMMAND);
 }
 
 void CarController::handleStateWaitCommand() {
+    // Таймаут ответа считается от конца передачи
+    if (wifiLink.isSending()) {
+        commandWaitStartMillis = millis();
+        return;
+    }
+    
     // Пытаемся получить команду
     Command cmd;
-    if (wifiLink.waitForCommand(cmd, 100)) {
-        // Команда получена
-        currentCommand = cmd;
-        
-        // Ищем конфигурацию в словаре
-        if (!commandDict.getConfig(cmd.name, currentCommandConfig)) {
-            Serial.print("Unknown command: ");
-            Serial.print(cmd.name);
-            Serial.println(", using STOP");
-            commandDict.getConfig("STOP", currentCommandConfig);
-            strncpy(currentCommand.name, "STOP", sizeof(currentCommand.name) - 1);
-        }
-        
-        // Определяем длительность
-        if (cmd.durationMs == 0) {
-            currentCommandDuration = currentCommandConfig.baseDurationMs;
-        } else {
-            currentCommandDuration = cmd.durationMs;
-        }
-        
-        if (serialLoggingEnabled) {
-            Serial.print("Received command: ");
-            Serial.print(currentCommand.name);
-            Serial.print(" for ");
-            Serial.print(currentCommandDuration);
-            Serial.println(" ms");
+    if (wifiLink.takeCommand(cmd)) {
+        if (isStaleCommand(cmd, stepId)) {
+            return;
         }
-        
-        changeState(STATE_EXECUTE_COMMAND);
+        acceptCommand(cmd);
         return;
     }
     
@@ -169,35 +220,255 @@ void CarController::handleStateWaitCommand() {
         Serial.println("Command timeout, using STOP");
         
         strncpy(currentCommand.name, "STOP", sizeof(currentCommand.name) - 1);
+        currentCommand.commandId = COMMAND_ID_NONE;
         currentCommand.durationMs = defaultStepDurationMs;
+        currentCommand.speedPercent = 0;
+        currentCommand.segmentCount = 0;
         commandDict.getConfig("STOP", currentCommandConfig);
         currentCommandDuration = defaultStepDurationMs;
         
-        changeState(STATE_EXECUTE_COMMAND);
+        startCommand();
+    }
+}
+
+void CarController::acceptCommand(const Command& cmd) {
+    // Команда получена
+    currentCommand = cmd;
+    
+    // ID от сервера или поиск имени в словаре (один хеш)
+    int id = (cmd.commandId != COMMAND_ID_NONE) ? cmd.commandId : commandDict.lookup(cmd.name);
+    if (commandDict.isMacro(id) && cmd.segmentCount == 0) {
+        // Макрос разворачивается в отрезки; duration_ms - его общая длительность
+        commandDict.expandMacro(id, cmd.durationMs, currentCommand);
+        commandDict.getConfig("STOP", currentCommandConfig);
+    } else if (id < 0 || !commandDict.getConfigById((uint8_t)id, currentCommandConfig)) {
+        Serial.print("Unknown command: ");
+        Serial.print(cmd.commandId != COMMAND_ID_NONE ? commandDict.nameAt(cmd.commandId) : cmd.name);
+        Serial.println(", using STOP");
+        commandDict.getConfig("STOP", currentCommandConfig);
+        id = commandDict.lookup("STOP");
     }
+    currentCommand.commandId = (uint8_t)id;
+    // Имя - для журнала и вывода, если сервер прислал только ID
+    strncpy(currentCommand.name, commandDict.nameAt((uint8_t)id), sizeof(currentCommand.name) - 1);
+    currentCommand.name[sizeof(currentCommand.name) - 1] = '\0';
+    
+    // Сервер может сменить геометрию кадра для следующих шагов (imageRate может её уменьшить);
+    // без image_mode в CMD остаётся выбранная командой "cam"
+    ImageGeometry geometry;
+    if (cmd.imageMode[0] != '\0' && CameraModule::parseGeometry(cmd.imageMode, geometry)) {
+        wifiLink.getImageRate().setRequestedGeometry(geometry);
+        cameraModule.setGeometry(wifiLink.getImageRate().getGeometry());
+    }
+    
+    // Определяем длительность: у составной команды - сумма отрезков
+    if (currentCommand.segmentCount > 0) {
+        currentCommandDuration = 0;
+        for (uint8_t i = 0; i < currentCommand.segmentCount; i++) {
+            currentCommandDuration += currentCommand.segments[i].durationMs;
+        }
+    } else if (cmd.durationMs == 0) {
+        currentCommandDuration = currentCommandConfig.baseDurationMs;
+    } else {
+        currentCommandDuration = cmd.durationMs;
+    }
+    
+    if (serialLoggingEnabled) {
+        Serial.print("Received command: ");
+        Serial.print(currentCommand.name);
+        Serial.print(" for ");
+        Serial.print(currentCommandDuration);
+        Serial.print(" ms");
+        if (currentCommand.segmentCount > 0) {
+            Serial.print(" in ");
+            Serial.print(currentCommand.segmentCount);
+            Serial.print(" segments");
+        }
+        Serial.println();
+    }
+    
+    startCommand();
+}
+
+bool CarController::isStaleCommand(const Command& cmd, uint32_t expectedStepId) {
+    if (cmd.stepId == 0 || cmd.stepId == expectedStepId) {
+        return false;
+    }
+    if (serialLoggingEnabled) {
+        Serial.print("Dropped stale command for step ");
+        Serial.println(cmd.stepId);
+    }
+    return true;
+}
+
+void CarController::startCommand() {
+    // Отрезки переключает и останавливает прерывание таймера, а не tick
+    motorController.clearSequence();
+    uint8_t speed = (currentCommand.speedPercent > 0) ? currentCommand.speedPercent : 100;
+    if (currentCommand.segmentCount > 0) {
+        for (uint8_t i = 0; i < currentCommand.segmentCount; i++) {
+            // Отрезок по ID или по имени; макрос внутри "seq" не разворачивается
+            const CommandSegment& segment = currentCommand.segments[i];
+            int segmentId = (segment.commandId != COMMAND_ID_NONE) ? segment.commandId
+                                                                   : commandDict.lookup(segment.name);
+            CommandConfig segmentConfig;
+            if (segmentId < 0 || !commandDict.getConfigById((uint8_t)segmentId, segmentConfig)) {
+                commandDict.getConfig("STOP", segmentConfig);
+            }
+            motorController.addSegment(segmentConfig, currentCommand.segments[i].durationMs, speed);
+        }
+    } else {
+        motorController.addSegment(currentCommandConfig, currentCommandDuration, speed);
+    }
+    motorController.startSequence();
+    commandExecStartMillis = millis();
+    currentAbortReason = ABORT_NONE;
+    // Первая проверка - по уже известному замеру: вперёд при препятствии ближе
+    // safetyDistanceCm машина не поедет и до следующего пинга
+    lastSonarSequence = sensors.getSonarSequence() - 1;
+    sensors.takeAccelPeak();   // удары до старта команды не в счёт
+    changeState(STATE_EXECUTE_COMMAND);
 }
 
 void CarController::handleStateExecuteCommand() {
-    // Первый вход в состояние - запускаем команду
-    if (millis() - stateStartMillis < 10) {
-        motorController.applyCommand(currentCommandConfig);
-        commandExecStartMillis = millis();
+    // Защита - первой: моторы гасятся в тот же tick, что пришёл замер
+    if (currentAbortReason == ABORT_NONE) {
+        currentAbortReason = checkReflexStop();
+        if (currentAbortReason != ABORT_NONE) {
+            motorController.stop();
+            // Команда считается выполненной за фактическое время
+            currentCommandDuration = millis() - commandExecStartMillis;
+            Serial.print("Reflex stop: ");
+            Serial.print(Logger::abortReasonName(currentAbortReason));
+            Serial.print(" after ");
+            Serial.print(currentCommandDuration);
+            Serial.println(" ms");
+        }
     }
     
-    // Проверяем окончание команды
-    if (millis() - commandExecStartMillis >= currentCommandDuration) {
-        // Останавливаем моторы
-        motorController.stop();
-        
-        // Логируем команду
-        logCurrentStep();
-        
+    // Пока едем - снимаем следующий кадр в задний буфер
+    if (!cameraModule.isCaptureBusy()) {
+        cameraModule.startCapture();
+    }
+    
+    if (pipelinedMode) {
+        advancePipeline();
+    }
+    
+    // Команда кончается в прерывании таймера, моторы уже стоят
+    if (motorController.isRunning()) {
+        return;
+    }
+    
+    // Логируем команду
+    logCurrentStep();
+    
+    if (!nextSent) {
         // Переходим к следующему шагу
         changeState(STATE_COLLECT_SENSORS);
+        return;
+    }
+
+    // После защитной остановки ответ на шаг, снятый до неё, не исполняется: он может
+    // вести прямо в препятствие. Следующий шаг решается по данным после остановки,
+    // запоздавший ответ отбросит isStaleCommand()
+    if (currentAbortReason != ABORT_NONE) {
+        if (serialLoggingEnabled) {
+            Serial.print("Dropped pipelined step ");
+            Serial.print(stepId);
+            Serial.println(" after reflex stop");
+        }
+        nextSent = false;
+        nextReady = false;
+        changeState(STATE_COLLECT_SENSORS);
+        return;
     }
+    
+    // Следующий шаг уже на сервере: его данные становятся текущими
+    currentSensorSnapshot = nextSensorSnapshot;
+    currentImageSnapshot = nextImageSnapshot;
+    currentStepTimestamp = nextStepTimestamp;
+    nextSent = false;
+    
+    if (nextReady) {
+        nextReady = false;
+        acceptCommand(nextCommand);
+    } else {
+        // Таймаут ответа считается от отправки
+        commandWaitStartMillis = nextSentMillis;
+        changeState(STATE_WAIT_COMMAND);
+    }
+}
+
+uint8_t CarController::checkReflexStop() {
+    // Удар - при любом движении
+    if (sensors.takeAccelPeak() > CAR_SAFETY_IMPACT_G * 9.80665f) {
+        return ABORT_IMPACT;
+    }
+    
+    // Препятствие - только при движении вперёд: назад и разворот на месте уводят от него
+    uint32_t sequence = sensors.getSonarSequence();
+    if (safetyDistanceCm == 0 || sequence == lastSonarSequence) {
+        return ABORT_NONE;
+    }
+    lastSonarSequence = sequence;
+    
+    if (motorController.isMovingForward() && sensors.getLatestDistanceCm() < safetyDistanceCm) {
+        return ABORT_OBSTACLE;
+    }
+    return ABORT_NONE;
+}
+
+void CarController::advancePipeline() {
+    if (!nextSent) {
+        // Ждём кадр, снятый уже после запуска команды, и конца прошлой передачи
+        if (wifiLink.isSending() ||
+            (cameraModule.isInitialized() && !cameraModule.hasFreshFrame())) {
+            return;
+        }
+        
+        collectStep(nextSensorSnapshot, nextImageSnapshot, nextStepTimestamp);
+        sendStep(nextSensorSnapshot, nextImageSnapshot, nextStepTimestamp);
+        nextSent = true;
+        nextReady = false;
+        nextSentMillis = millis();
+        return;
+    }
+    
+    if (wifiLink.isSending()) {
+        // Таймаут ответа считается от конца передачи
+        nextSentMillis = millis();
+        return;
+    }
+    
+    if (!nextReady) {
+        Command cmd;
+        if (wifiLink.takeCommand(cmd) && !isStaleCommand(cmd, stepId)) {
+            nextCommand = cmd;
+            nextReady = true;
+        }
+    }
+}
+
+bool CarController::sendStep(const SensorSnapshot& sensorsIn, const ImageSnapshot& imageIn,
+                             const DateTime& ts) {
+    if (!wifiLink.startSend(sessionId, stepId, ts, sensorsIn, imageIn)) {
+        return false;
+    }
+    // Кадр читается передачей из буфера камеры до её конца
+    if (imageIn.available) {
+        cameraModule.pinFrontFrame();
+    }
+    return true;
 }
 
 void CarController::changeState(State newState) {
+    // Простой в ожидании ответа сервера - от входа в состояние до выхода
+    if (newState == STATE_WAIT_COMMAND && currentState != STATE_WAIT_COMMAND) {
+        PERF_SPAN_BEGIN(PERF_WAIT_COMMAND);
+    } else if (newState != STATE_WAIT_COMMAND && currentState == STATE_WAIT_COMMAND) {
+        PERF_SPAN_END(PERF_WAIT_COMMAND);
+    }
     currentState = newState;
     stateStartMillis = millis();
 }
@@ -212,6 +483,7 @@ void CarController::logCurrentStep() {
     entry.lightRaw = currentSensorSnapshot.lightRaw;
     entry.isDark = currentSensorSnapshot.isDark;
     entry.imageSent = currentImageSnapshot.available;
+    entry.abortReason = currentAbortReason;
     
     logger.add(entry);
     
@@ -1,52 +1,167 @@
 #include "../include/CommandDictionary.h"
 #include "../include/types.h"
+#include "../include/LinkProtocol.h"
 #include <cstring>
 
 bool CommandDictionary::begin() {
+    dirty = false;
+    dirtyMillis = 0;
+    
     if (!loadFromFlash()) {
         Serial.println("CommandDictionary: Invalid flash data, initializing defaults");
         initDefaultCommands();
+        activeSlot = SLOT_COUNT - 1;
         saveToFlash();
     } else {
         Serial.println("CommandDictionary: Loaded from flash");
     }
     
+    buildHash();
     printAllToSerial();
     return true;
 }
 
+void CommandDictionary::poll() {
+    if (dirty && millis() - dirtyMillis >= COMMAND_DICT_SAVE_DELAY_MS) {
+        saveToFlash();
+    }
+}
+
+void CommandDictionary::flush() {
+    if (dirty) {
+        saveToFlash();
+    }
+}
+
 bool CommandDictionary::getConfig(const char* name, CommandConfig& outCfg) const {
-    int index = findCommandIndex(name);
-    if (index >= 0 && index < (int)storage.count) {
-        outCfg = storage.commands[index];
-        return true;
+    int id = lookup(name);
+    if (id < 0) {
+        return false;
     }
-    return false;
+    return getConfigById((uint8_t)id, outCfg);
+}
+
+bool CommandDictionary::getConfigById(uint8_t id, CommandConfig& outCfg) const {
+    if (id >= storage.count) {
+        return false;
+    }
+    outCfg = storage.commands[id];
+    return true;
 }
 
 bool CommandDictionary::updateConfig(const CommandConfig& cfg) {
-    int index = findCommandIndex(cfg.name);
+    int id = lookup(cfg.name);
+    
+    if (isMacro(id)) {
+        Serial.println("CommandDictionary: Name is taken by a macro");
+        return false;
+    }
     
-    if (index >= 0) {
-        storage.commands[index] = cfg;
+    if (id >= 0) {
+        storage.commands[id] = cfg;
     } else {
-        if (storage.count >= DEFAULT_COMMAND_COUNT) {
+        if (storage.count >= COMMAND_DICT_CAPACITY) {
             Serial.println("CommandDictionary: Cannot add, dictionary full");
             return false;
         }
         storage.commands[storage.count] = cfg;
+        storage.commands[storage.count].name[sizeof(cfg.name) - 1] = '\0';
         storage.count++;
+        buildHash();
+    }
+    
+    markDirty();
+    return true;
+}
+
+bool CommandDictionary::updateMacro(const CommandMacro& macro) {
+    if (macro.stepCount == 0 || macro.stepCount > MAX_MACRO_STEPS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < macro.stepCount; i++) {
+        if (macro.steps[i].commandId >= storage.count) {
+            Serial.println("CommandDictionary: Macro step must be a command");
+            return false;
+        }
     }
     
-    saveToFlash();
+    int id = lookup(macro.name);
+    if (id >= 0 && !isMacro(id)) {
+        Serial.println("CommandDictionary: Name is taken by a command");
+        return false;
+    }
+    
+    if (id >= 0) {
+        storage.macros[id - COMMAND_MACRO_ID_BASE] = macro;
+    } else {
+        if (storage.macroCount >= COMMAND_MACRO_CAPACITY) {
+            Serial.println("CommandDictionary: Cannot add, no room for macros");
+            return false;
+        }
+        storage.macros[storage.macroCount] = macro;
+        storage.macros[storage.macroCount].name[sizeof(macro.name) - 1] = '\0';
+        storage.macroCount++;
+        buildHash();
+    }
+    
+    markDirty();
+    return true;
+}
+
+int CommandDictionary::lookup(const char* name) const {
+    if (name == nullptr || name[0] == '\0') {
+        return -1;
+    }
+    if (!hashPerfect) {
+        return findLinear(name);
+    }
+    
+    uint32_t hash = hashName(name);
+    uint8_t id = hashSlots[hashSlot(hash, hashDisplace[hash >> 27])];
+    if (id == COMMAND_ID_NONE || strcmp(nameAt(id), name) != 0) {
+        return -1;
+    }
+    return id;
+}
+
+bool CommandDictionary::expandMacro(int id, uint32_t durationMs, Command& outCmd) const {
+    if (!isMacro(id)) {
+        return false;
+    }
+    
+    const CommandMacro& macro = storage.macros[id - COMMAND_MACRO_ID_BASE];
+    if (durationMs == 0) {
+        durationMs = macro.baseDurationMs;
+    }
+    
+    outCmd.segmentCount = 0;
+    for (uint8_t i = 0; i < macro.stepCount && i < MAX_COMMAND_SEGMENTS; i++) {
+        CommandSegment& segment = outCmd.segments[outCmd.segmentCount++];
+        segment.commandId = macro.steps[i].commandId;
+        strncpy(segment.name, nameAt(segment.commandId), sizeof(segment.name) - 1);
+        segment.name[sizeof(segment.name) - 1] = '\0';
+        segment.durationMs = (uint32_t)((uint64_t)durationMs * macro.steps[i].permille / 1000);
+    }
     return true;
 }
 
+const char* CommandDictionary::nameAt(uint8_t id) const {
+    if (id < storage.count) {
+        return storage.commands[id].name;
+    }
+    if (isMacro(id)) {
+        return storage.macros[id - COMMAND_MACRO_ID_BASE].name;
+    }
+    return "?";
+}
+
 void CommandDictionary::printAllToSerial() const {
     Serial.println("=== Command Dictionary ===");
     for (size_t i = 0; i < storage.count; i++) {
         const CommandConfig& cmd = storage.commands[i];
         Serial.print("  ");
+        Serial.print((int)i);
+        Serial.print(" ");
         Serial.print(cmd.name);
         Serial.print(": L=");
         Serial.print(cmd.leftSpeed);
@@ -55,33 +170,57 @@ void CommandDictionary::printAllToSerial() const {
         Serial.print(" dur=");
         Serial.println(cmd.baseDurationMs);
     }
+    for (size_t i = 0; i < storage.macroCount; i++) {
+        const CommandMacro& macro = storage.macros[i];
+        Serial.print("  ");
+        Serial.print((int)(COMMAND_MACRO_ID_BASE + i));
+        Serial.print(" ");
+        Serial.print(macro.name);
+        Serial.print(": dur=");
+        Serial.print(macro.baseDurationMs);
+        for (uint8_t s = 0; s < macro.stepCount; s++) {
+            Serial.print(" ");
+            Serial.print(nameAt(macro.steps[s].commandId));
+            Serial.print(":");
+            Serial.print(macro.steps[s].permille);
+        }
+        Serial.println();
+    }
+    Serial.print("slot=");
+    Serial.print(activeSlot);
+    Serial.print(" gen=");
+    Serial.print(storage.generation);
+    Serial.print(" hash=");
+    Serial.print(hashPerfect ? "perfect" : "linear");
+    Serial.println(dirty ? " (unsaved)" : "");
     Serial.println("==========================");
 }
 
 void CommandDictionary::initDefaultCommands() {
+    memset(&storage, 0, sizeof(storage));
     storage.magic = MAGIC;
     storage.count = DEFAULT_COMMAND_COUNT;
     
     // FORWARD: оба мотора вперед
     strncpy(storage.commands[0].name, "FORWARD", 15);
-    storage.commands[0].leftSpeed = 1;
-    storage.commands[0].rightSpeed = 1;
+    storage.commands[0].leftSpeed = 100;
+    storage.commands[0].rightSpeed = 100;
     storage.commands[0].baseDurationMs = 3000;
     
     strncpy(storage.commands[1].name, "BACKWARD", 15);
-    storage.commands[1].leftSpeed = -1;
-    storage.commands[1].rightSpeed = -1;
+    storage.commands[1].leftSpeed = -100;
+    storage.commands[1].rightSpeed = -100;
     storage.commands[1].baseDurationMs = 3000;
     
     // LEFT: левый стоит, правый вперед (pivot turn) - для поворота ВЛЕВО правая сторона должна двигаться
     strncpy(storage.commands[2].name, "LEFT", 15);
     storage.commands[2].leftSpeed = 0;
-    storage.commands[2].rightSpeed = 1;
+    storage.commands[2].rightSpeed = 100;
     storage.commands[2].baseDurationMs = 3000;
     
     // RIGHT: левый вперед, правый стоит (pivot turn) - для поворота ВПРАВО левая сторона должна двигаться
     strncpy(storage.commands[3].name, "RIGHT", 15);
-    storage.commands[3].leftSpeed = 1;
+    storage.commands[3].leftSpeed = 100;
     storage.commands[3].rightSpeed = 0;
     storage.commands[3].baseDurationMs = 3000;
     
@@ -90,39 +229,185 @@ void CommandDictionary::initDefaultCommands() {
     storage.commands[4].leftSpeed = 0;
     storage.commands[4].rightSpeed = 0;
     storage.commands[4].baseDurationMs = 3000;
+    
+    // ESCAPE: отъезд назад и разворот влево, доли от общей длительности
+    CommandMacro& escape = storage.macros[0];
+    strncpy(escape.name, "ESCAPE", 15);
+    escape.baseDurationMs = 1800;
+    escape.stepCount = 2;
+    escape.steps[0].commandId = 1;
+    escape.steps[0].permille = 550;
+    escape.steps[1].commandId = 2;
+    escape.steps[1].permille = 450;
+    storage.macroCount = 1;
 }
 
 bool CommandDictionary::loadFromFlash() {
-    byte* flashData = (byte*)flashStorage.readAddress(0);
+    // Действует корректный слот с наибольшим generation
+    int bestSlot = -1;
+    uint32_t bestGeneration = 0;
     
-    if (flashData == nullptr) {
+    for (uint8_t slot = 0; slot < SLOT_COUNT; slot++) {
+        const FlashCommandStorage* candidate =
+            (const FlashCommandStorage*)flashStorage.readAddress(slot * SLOT_SIZE);
+        if (candidate == nullptr || candidate->magic != MAGIC) {
+            continue;
+        }
+        if (candidate->count < DEFAULT_COMMAND_COUNT || candidate->count > COMMAND_DICT_CAPACITY ||
+            candidate->macroCount > COMMAND_MACRO_CAPACITY) {
+            continue;
+        }
+        if (bestSlot >= 0 && (int32_t)(candidate->generation - bestGeneration) <= 0) {
+            continue;
+        }
+        memcpy(&storage, candidate, sizeof(FlashCommandStorage));
+        if (storageCrc() != storage.crc) {
+            continue;
+        }
+        bestSlot = slot;
+        bestGeneration = candidate->generation;
+    }
+    
+    if (bestSlot < 0) {
         return false;
     }
     
-    memcpy(&storage, flashData, sizeof(FlashCommandStorage));
+    memcpy(&storage, flashStorage.readAddress(bestSlot * SLOT_SIZE), sizeof(FlashCommandStorage));
+    activeSlot = (uint8_t)bestSlot;
+    return true;
+}
+
+void CommandDictionary::saveToFlash() {
+    static_assert(sizeof(FlashCommandStorage) <= SLOT_SIZE, "FlashCommandStorage не помещается в слот");
     
-    if (storage.magic != MAGIC) {
-        return false;
+    // Следующий слот по кругу: старый остаётся целым, если запись прервётся
+    activeSlot = (activeSlot + 1) % SLOT_COUNT;
+    storage.generation++;
+    storage.crc = storageCrc();
+    flashStorage.write(activeSlot * SLOT_SIZE, (byte*)&storage, sizeof(FlashCommandStorage));
+    dirty = false;
+}
+
+void CommandDictionary::markDirty() {
+    dirty = true;
+    dirtyMillis = millis();
+}
+
+uint16_t CommandDictionary::storageCrc() const {
+    uint16_t crc = crc16_ccitt((const uint8_t*)storage.commands, storage.count * sizeof(CommandConfig));
+    return crc16_ccitt_update(crc, (const uint8_t*)storage.macros,
+                              storage.macroCount * sizeof(CommandMacro));
+}
+
+void CommandDictionary::buildHash() {
+    memset(hashSlots, COMMAND_ID_NONE, sizeof(hashSlots));
+    memset(hashDisplace, 0, sizeof(hashDisplace));
+    hashPerfect = false;
+    
+    // Корзина - старшие 5 бит хеша; ids/hashes - все имена словаря
+    uint8_t ids[COMMAND_DICT_CAPACITY + COMMAND_MACRO_CAPACITY];
+    uint32_t hashes[COMMAND_DICT_CAPACITY + COMMAND_MACRO_CAPACITY];
+    uint8_t bucketSize[HASH_BUCKETS] = {0};
+    size_t total = 0;
+    for (size_t i = 0; i < storage.count; i++) {
+        ids[total++] = (uint8_t)i;
+    }
+    for (size_t i = 0; i < storage.macroCount; i++) {
+        ids[total++] = (uint8_t)(COMMAND_MACRO_ID_BASE + i);
+    }
+    for (size_t i = 0; i < total; i++) {
+        hashes[i] = hashName(nameAt(ids[i]));
+        bucketSize[hashes[i] >> 27]++;
     }
     
-    if (storage.count == 0 || storage.count > DEFAULT_COMMAND_COUNT) {
-        return false;
+    // Сначала самые большие корзины: им труднее всего найти свободные слоты
+    uint8_t order[HASH_BUCKETS];
+    for (uint8_t b = 0; b < HASH_BUCKETS; b++) {
+        order[b] = b;
+    }
+    for (uint8_t i = 1; i < HASH_BUCKETS; i++) {
+        uint8_t b = order[i];
+        int j = i - 1;
+        while (j >= 0 && bucketSize[order[j]] < bucketSize[b]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = b;
     }
     
-    return true;
+    for (uint8_t k = 0; k < HASH_BUCKETS && bucketSize[order[k]] > 0; k++) {
+        uint8_t bucket = order[k];
+        bool placed = false;
+    
+        for (uint16_t displace = 0; displace < 256 && !placed; displace++) {
+            uint8_t taken[COMMAND_DICT_CAPACITY + COMMAND_MACRO_CAPACITY];
+            uint8_t takenCount = 0;
+            placed = true;
+    
+            for (size_t i = 0; i < total; i++) {
+                if ((hashes[i] >> 27) != bucket) {
+                    continue;
+                }
+                uint8_t slot = hashSlot(hashes[i], (uint8_t)displace);
+                bool clash = hashSlots[slot] != COMMAND_ID_NONE;
+                for (uint8_t t = 0; t < takenCount && !clash; t++) {
+                    clash = taken[t] == slot;
+                }
+                if (clash) {
+                    placed = false;
+                    break;
+                }
+                taken[takenCount++] = slot;
+            }
+    
+            if (placed) {
+                hashDisplace[bucket] = (uint8_t)displace;
+                for (size_t i = 0; i < total; i++) {
+                    if ((hashes[i] >> 27) == bucket) {
+                        hashSlots[hashSlot(hashes[i], (uint8_t)displace)] = ids[i];
+                    }
+                }
+            }
+        }
+    
+        if (!placed) {
+            // Практически невозможно при заполнении <= 72/128; поиск перебором
+            Serial.println("CommandDictionary: Perfect hash failed, using linear lookup");
+            return;
+        }
+    }
+    
+    hashPerfect = true;
 }
 
-void CommandDictionary::saveToFlash() {
-    flashStorage.write(0, (byte*)&storage, sizeof(FlashCommandStorage));
+uint32_t CommandDictionary::hashName(const char* name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
-int CommandDictionary::findCommandIndex(const char* name) const {
+uint8_t CommandDictionary::hashSlot(uint32_t hash, uint8_t displace) {
+    uint32_t x = hash + displace * 0x9E3779B9u;
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    x ^= x >> 12;
+    return (uint8_t)(x & (HASH_SLOTS - 1));
+}
+
+int CommandDictionary::findLinear(const char* name) const {
     for (size_t i = 0; i < storage.count; i++) {
         if (strcmp(storage.commands[i].name, name) == 0) {
             return (int)i;
         }
     }
+    for (size_t i = 0; i < storage.macroCount; i++) {
+        if (strcmp(storage.macros[i].name, name) == 0) {
+            return (int)(COMMAND_MACRO_ID_BASE + i);
+        }
+    }
     return -1;
 }
-
-
@@ -0,0 +1,206 @@
+#include "../include/FrameCodec.h"
+#include <Arduino.h>
+#include <cstring>
+
+static_assert((size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT <= ARENA_CODEC_OUT_SIZE,
+              "Codec output does not fit ARENA_CODEC_OUT");
+static_assert((size_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT <= ARENA_CODEC_KEY_SIZE,
+              "Codec keyframe does not fit ARENA_CODEC_KEY");
+static_assert(Hardware::CAM_WIDTH <= SCRATCH_CODEC_ROW_SIZE, "Codec row does not fit its arena scratch");
+
+void FrameCodec::begin() {
+    outBuffer = MemoryArena::region(ARENA_CODEC_OUT);
+    keyFrame = MemoryArena::region(ARENA_CODEC_KEY);
+    codec = FRAME_CODEC_DEFAULT;
+    keyValid = false;
+    keyPending = false;
+    keyId = 0;
+    keyWidth = 0;
+    keyHeight = 0;
+    framesSinceKey = 0;
+}
+
+void FrameCodec::setCodec(FrameCodecId id) {
+    if (id != codec) {
+        // Опорный кадр мог устареть, пока разностный кодек был выключен
+        keyValid = false;
+    }
+    codec = id;
+}
+
+const char* FrameCodec::codecName(uint8_t id) {
+    switch (id) {
+        case CODEC_INTRA: return "intra";
+        case CODEC_INTER: return "inter";
+        case CODEC_RAW:
+        default:          return "raw";
+    }
+}
+
+bool FrameCodec::parseCodec(const char* name, FrameCodecId& outId) {
+    if (name == nullptr) {
+        return false;
+    }
+    if (strcmp(name, "raw") == 0) {
+        outId = CODEC_RAW;
+    } else if (strcmp(name, "intra") == 0) {
+        outId = CODEC_INTRA;
+    } else if (strcmp(name, "inter") == 0) {
+        outId = CODEC_INTER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+EncodedFrame FrameCodec::encode(const uint8_t* frame, uint16_t width, uint16_t height) {
+    EncodedFrame out;
+    out.data = frame;
+    out.size = (size_t)width * height;
+    out.codec = CODEC_RAW;
+    out.flags = 0;
+    out.keyId = 0;
+    keyPending = false;
+
+    if (codec == CODEC_RAW || out.size > MAX_FRAME_SIZE || width > Hardware::CAM_WIDTH) {
+        return out;
+    }
+
+    bool keyframe = false;
+    if (codec == CODEC_INTER) {
+        keyframe = !keyValid || framesSinceKey >= KEYFRAME_INTERVAL ||
+                   width != keyWidth || height != keyHeight;
+    }
+
+    if (codec == CODEC_INTER && !keyframe) {
+        // Если сцена сменилась целиком, дешевле передать кадр как есть
+        size_t packed = encodeRows(frame, width, height, true);
+        if (packed > 0) {
+            out.data = outBuffer;
+            out.size = packed;
+            out.codec = CODEC_INTER;
+            out.keyId = keyId;
+        }
+        return out;
+    }
+
+    size_t packed = encodeRows(frame, width, height, false);
+    if (packed > 0) {
+        out.data = outBuffer;
+        out.size = packed;
+        out.codec = CODEC_INTRA;
+    }
+
+    if (keyframe) {
+        // Сервер восстанавливает кадр без потерь, опорным становится он же
+        memcpy(keyFrame, frame, (size_t)width * height);
+        MemoryArena::noteUse(ARENA_CODEC_KEY, (size_t)width * height);
+        keyId = (keyId == 255) ? 1 : keyId + 1;
+        keyWidth = width;
+        keyHeight = height;
+        keyValid = false;
+        keyPending = true;
+        out.flags = FRAME_FLAG_KEY;
+        out.keyId = keyId;
+    }
+    return out;
+}
+
+void FrameCodec::commit(bool delivered) {
+    if (keyPending) {
+        keyPending = false;
+        keyValid = delivered;
+        framesSinceKey = 0;
+        return;
+    }
+    if (!delivered) {
+        // Сервер мог потерять опорный кадр (перезапуск) - обновляем его
+        keyValid = false;
+        return;
+    }
+    if (codec == CODEC_INTER && framesSinceKey < 255) {
+        framesSinceKey++;
+    }
+}
+
+size_t FrameCodec::encodeRows(const uint8_t* frame, uint16_t width, uint16_t height, bool inter) {
+    const size_t limit = (size_t)width * height;   // не больше исходного кадра
+    size_t outPos = 0;
+    ArenaScratch scratch(SCRATCH_CODEC_ROW);
+    scratch.use(width);
+    uint8_t* rowBuffer = scratch.data();
+
+    for (uint16_t row = 0; row < height; row++) {
+        const uint8_t* src = frame + (size_t)row * width;
+
+        if (inter) {
+            const uint8_t* key = keyFrame + (size_t)row * width;
+            for (uint16_t x = 0; x < width; x++) {
+                rowBuffer[x] = src[x] ^ key[x];
+            }
+        } else if (row == 0) {
+            // Первая строка - разность с левым соседом
+            rowBuffer[0] = src[0];
+            for (uint16_t x = 1; x < width; x++) {
+                rowBuffer[x] = (uint8_t)(src[x] - src[x - 1]);
+            }
+        } else {
+            const uint8_t* above = src - width;
+            for (uint16_t x = 0; x < width; x++) {
+                rowBuffer[x] = (uint8_t)(src[x] - above[x]);
+            }
+        }
+
+        size_t packed = packBits(rowBuffer, width, outBuffer + outPos, limit - outPos);
+        if (packed == 0) {
+            return 0;
+        }
+        outPos += packed;
+    }
+
+    MemoryArena::noteUse(ARENA_CODEC_OUT, outPos);
+    return (outPos < limit) ? outPos : 0;
+}
+
+size_t FrameCodec::packBits(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    // Заголовок h: 0..127 - далее h+1 байт как есть, 129..255 - байт повторить 257-h раз
+    size_t outPos = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 128 && src[i + run] == src[i]) {
+            run++;
+        }
+
+        if (run >= 3) {
+            if (outPos + 2 > capacity) {
+                return 0;
+            }
+            dst[outPos++] = (uint8_t)(257 - run);
+            dst[outPos++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // Литерал до начала серии из трёх одинаковых байт
+        size_t start = i;
+        size_t len = 0;
+        while (i < n && len < 128) {
+            if (i + 2 < n && src[i] == src[i + 1] && src[i] == src[i + 2]) {
+                break;
+            }
+            i++;
+            len++;
+        }
+
+        if (outPos + 1 + len > capacity) {
+            return 0;
+        }
+        dst[outPos++] = (uint8_t)(len - 1);
+        memcpy(dst + outPos, src + start, len);
+        outPos += len;
+    }
+
+    return outPos;
+}
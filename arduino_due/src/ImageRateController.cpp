@@ -0,0 +1,156 @@
+#include "../include/ImageRateController.h"
+
+// Вес нового замера в EWMA
+static const float RATE_EWMA_ALPHA = 0.25f;
+
+static float ewma(float average, float sample) {
+    // 0 - замеров ещё не было: первый берётся как есть
+    if (average <= 0.0f) {
+        return sample;
+    }
+    return average + (sample - average) * RATE_EWMA_ALPHA;
+}
+
+static uint32_t geometryPixels(ImageGeometry geometry) {
+    switch (geometry) {
+        case GEOMETRY_HALF:
+            return (uint32_t)(Hardware::CAM_WIDTH / 2) * (Hardware::CAM_HEIGHT / 2);
+        case GEOMETRY_HORIZON:
+            return (uint32_t)Hardware::CAM_WIDTH * Hardware::CAM_HORIZON_ROWS;
+        default:
+            return (uint32_t)Hardware::CAM_WIDTH * Hardware::CAM_HEIGHT;
+    }
+}
+
+void ImageRateController::begin() {
+    targetCycleMs = IMAGE_RATE_TARGET_CYCLE_MS;
+    requested = GEOMETRY_FULL;
+    level = 0;
+    calmSteps = 0;
+    sinceImage = 0xFF;   // первый шаг - с кадром
+    rssi = IMAGE_RATE_RSSI_NONE;
+    bytesPerSec = 0.0f;
+    retryRate = 0.0f;
+    readyMs = 0.0f;
+    // До замеров: raw - байт на пиксель, inter - вдвое меньше
+    bytesPerPixel[0] = 1.0f;
+    bytesPerPixel[1] = 0.5f;
+    otherMs = 0.0f;
+    imageMs = 0;
+    lastCycleMs = 0;
+    budgetMs = targetCycleMs;
+    aborted = 0;
+}
+
+void ImageRateController::setTargetCycle(uint32_t ms) {
+    targetCycleMs = ms;
+    if (ms == 0) {
+        level = 0;
+        calmSteps = 0;
+    }
+}
+
+uint8_t ImageRateController::periodFor(uint8_t level) {
+    static const uint8_t PERIODS[IMAGE_RATE_LEVELS] = { 1, 1, 1, 2, 4, 8 };
+    return PERIODS[level];
+}
+
+ImageGeometry ImageRateController::geometryFor(uint8_t level) const {
+    // Полоса horizon уже втрое меньше полного кадра и нужна серверу целиком
+    if (level >= 2 && requested == GEOMETRY_FULL) {
+        return GEOMETRY_HALF;
+    }
+    return requested;
+}
+
+ImageGeometry ImageRateController::getGeometry() const {
+    return geometryFor(level);
+}
+
+bool ImageRateController::wantImage() {
+    if (sinceImage < 0xFF) {
+        sinceImage++;
+    }
+    if (sinceImage < periodFor(level)) {
+        return false;
+    }
+    sinceImage = 0;
+    return true;
+}
+
+float ImageRateController::costMs(uint8_t level) const {
+    float bytes = geometryPixels(geometryFor(level)) * bytesPerPixel[level >= 1 ? 1 : 0];
+    float transferMs = readyMs + bytes * 1000.0f / bytesPerSec * (1.0f + retryRate);
+    return transferMs / periodFor(level);
+}
+
+void ImageRateController::onTransfer(const ImageTransferStats& stats) {
+    imageMs += stats.elapsedMs;
+
+    if (stats.chunks > 0) {
+        retryRate = ewma(retryRate, (float)stats.retransmits / stats.chunks);
+    }
+    if (!stats.delivered) {
+        // Линия не вытянула кадр: сразу на два уровня вверх
+        aborted++;
+        calmSteps = 0;
+        if (targetCycleMs != 0) {
+            level = (level + 2 < IMAGE_RATE_LEVELS) ? level + 2 : IMAGE_RATE_LEVELS - 1;
+        }
+        return;
+    }
+
+    readyMs = ewma(readyMs, (float)stats.readyMs);
+    uint32_t streamMs = stats.elapsedMs - stats.readyMs;
+    if (stats.bytes > 0 && streamMs > 0) {
+        bytesPerSec = ewma(bytesPerSec, stats.bytes * 1000.0f / streamMs);
+    }
+    if (stats.pixels > 0) {
+        float& bpp = bytesPerPixel[stats.compact ? 1 : 0];
+        bpp = ewma(bpp, (float)stats.bytes / stats.pixels);
+    }
+}
+
+void ImageRateController::onCycle(uint32_t cycleMs) {
+    lastCycleMs = cycleMs;
+    otherMs = ewma(otherMs, (cycleMs > imageMs) ? (float)(cycleMs - imageMs) : 1.0f);
+    imageMs = 0;
+    budgetMs = (targetCycleMs > otherMs) ? (uint32_t)(targetCycleMs - otherMs) : 0;
+
+    if (targetCycleMs == 0 || bytesPerSec <= 0.0f) {
+        return;
+    }
+
+    uint8_t fit = 0;
+    while (fit < IMAGE_RATE_LEVELS - 1 && costMs(fit) > budgetMs) {
+        fit++;
+    }
+    if (rssi != IMAGE_RATE_RSSI_NONE && rssi <= IMAGE_RATE_WEAK_RSSI && fit < IMAGE_RATE_WEAK_LEVEL) {
+        fit = IMAGE_RATE_WEAK_LEVEL;
+    }
+
+    if (fit > level) {
+        level = fit;
+        calmSteps = 0;
+    } else if (fit < level && costMs(level - 1) <= budgetMs * 0.8f) {
+        // Вниз - по одному уровню и только после нескольких спокойных шагов
+        if (++calmSteps >= IMAGE_RATE_CALM_STEPS) {
+            level--;
+            calmSteps = 0;
+        }
+    } else {
+        calmSteps = 0;
+    }
+}
+
+uint32_t ImageRateController::getDeadlineMs() const {
+    if (targetCycleMs == 0) {
+        return 0;
+    }
+    // Кадр может занять два своих бюджета (долю периода), но не больше двух шагов
+    uint32_t deadline = 2 * budgetMs * periodFor(level);
+    if (deadline > 2 * targetCycleMs) {
+        deadline = 2 * targetCycleMs;
+    }
+    return (deadline < IMAGE_RATE_MIN_DEADLINE_MS) ? IMAGE_RATE_MIN_DEADLINE_MS : deadline;
+}
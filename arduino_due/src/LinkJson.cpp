@@ -0,0 +1,283 @@
+#include "../include/LinkJson.h"
+#include <stdlib.h>
+
+JsonWriter::JsonWriter(char* buffer, size_t capacity)
+    : buf(buffer), cap(capacity), len(0), overflow(false) {
+    buf[0] = '\0';
+}
+
+void JsonWriter::raw(const char* s, size_t n) {
+    // Место под '\0' остаётся всегда: буфер можно печатать как строку
+    if (len + n >= cap) {
+        overflow = true;
+        n = (len + 1 < cap) ? cap - 1 - len : 0;
+    }
+    memcpy(buf + len, s, n);
+    len += n;
+    buf[len] = '\0';
+}
+
+void JsonWriter::put(char c) {
+    raw(&c, 1);
+}
+
+void JsonWriter::str(const char* s) {
+    put('"');
+    raw(s, strlen(s));
+    put('"');
+}
+
+void JsonWriter::u32(uint32_t v) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    raw(digits + sizeof(digits) - n, n);
+}
+
+void JsonWriter::i32(int32_t v) {
+    if (v < 0) {
+        put('-');
+        u32((uint32_t)(-(v + 1)) + 1);
+    } else {
+        u32((uint32_t)v);
+    }
+}
+
+void JsonWriter::fixed(float v, uint8_t decimals) {
+    static const uint32_t SCALE[] = { 1, 10, 100, 1000, 10000 };
+    if (decimals > 4) {
+        decimals = 4;
+    }
+    if (v != v || v > 1e9f || v < -1e9f) {
+        // NaN и выход за диапазон датчиков
+        put('0');
+        return;
+    }
+    
+    bool negative = v < 0;
+    if (negative) {
+        v = -v;
+    }
+    // Масштаб 1e4 при 1e9 не влезает в u32: целая часть делится отдельно
+    uint32_t whole = (uint32_t)v;
+    uint32_t frac = (uint32_t)((v - (float)whole) * SCALE[decimals] + 0.5f);
+    if (frac >= SCALE[decimals]) {
+        whole++;
+        frac -= SCALE[decimals];
+    }
+    
+    if (negative && (whole != 0 || frac != 0)) {
+        put('-');
+    }
+    u32(whole);
+    if (decimals == 0) {
+        return;
+    }
+    char digits[5];
+    digits[0] = '.';
+    for (uint8_t i = decimals; i > 0; i--) {
+        digits[i] = (char)('0' + frac % 10);
+        frac /= 10;
+    }
+    raw(digits, decimals + 1);
+}
+
+void JsonWriter::fill(char c, size_t n) {
+    while (n-- > 0) {
+        put(c);
+    }
+}
+
+void JsonReader::skipSpace() {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+}
+
+bool JsonReader::beginObject() {
+    skipSpace();
+    if (*p != '{') {
+        error = true;
+        return false;
+    }
+    p++;
+    return true;
+}
+
+bool JsonReader::nextKey(char* key, size_t keySize) {
+    if (error) {
+        return false;
+    }
+    skipSpace();
+    if (*p == ',') {
+        p++;
+        skipSpace();
+    }
+    if (*p == '}') {
+        p++;
+        return false;
+    }
+    if (*p != '"' || !readString(key, keySize)) {
+        error = true;
+        return false;
+    }
+    skipSpace();
+    if (*p != ':') {
+        error = true;
+        return false;
+    }
+    p++;
+    return true;
+}
+
+bool JsonReader::beginArray() {
+    skipSpace();
+    if (*p != '[') {
+        skipValue();
+        return false;
+    }
+    p++;
+    return true;
+}
+
+bool JsonReader::nextElement() {
+    if (error) {
+        return false;
+    }
+    skipSpace();
+    if (*p == ',') {
+        p++;
+        skipSpace();
+    }
+    if (*p == ']') {
+        p++;
+        return false;
+    }
+    if (*p == '\0') {
+        error = true;
+        return false;
+    }
+    return true;
+}
+
+bool JsonReader::isString() {
+    skipSpace();
+    return *p == '"';
+}
+
+void JsonReader::skipString() {
+    // p на открывающей кавычке
+    p++;
+    while (*p != '"') {
+        if (*p == '\0') {
+            error = true;
+            return;
+        }
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        p++;
+    }
+    p++;
+}
+
+bool JsonReader::readString(char* out, size_t outSize) {
+    if (!isString()) {
+        skipValue();
+        return false;
+    }
+    const char* start = p + 1;
+    skipString();
+    if (error) {
+        return false;
+    }
+    if (out == nullptr || outSize == 0) {
+        return true;
+    }
+    // Экранирование в именах команд не встречается: символ после '\' берётся как есть
+    size_t n = 0;
+    for (const char* s = start; s < p - 1 && n + 1 < outSize; s++) {
+        if (*s == '\\') {
+            s++;
+        }
+        out[n++] = *s;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+bool JsonReader::readInt(long& out) {
+    skipSpace();
+    char* end = nullptr;
+    long value = strtol(p, &end, 10);
+    if (end == p) {
+        skipValue();
+        return false;
+    }
+    p = end;
+    while ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-') {
+        p++;
+    }
+    out = value;
+    return true;
+}
+
+bool JsonReader::readBool(bool& out) {
+    skipSpace();
+    if (strncmp(p, "true", 4) == 0) {
+        p += 4;
+        out = true;
+        return true;
+    }
+    if (strncmp(p, "false", 5) == 0) {
+        p += 5;
+        out = false;
+        return true;
+    }
+    skipValue();
+    return false;
+}
+
+void JsonReader::skipValue() {
+    skipSpace();
+    if (*p == '"') {
+        skipString();
+        return;
+    }
+    if (*p == '{' || *p == '[') {
+        // Вложенность считается по скобкам, строки внутри - целиком
+        int depth = 0;
+        do {
+            if (*p == '"') {
+                skipString();
+                if (error) {
+                    return;
+                }
+                continue;
+            }
+            if (*p == '\0') {
+                error = true;
+                return;
+            }
+            if (*p == '{' || *p == '[') {
+                depth++;
+            } else if (*p == '}' || *p == ']') {
+                depth--;
+            }
+            p++;
+        } while (depth > 0);
+        return;
+    }
+    // Число, true/false/null - до разделителя
+    const char* start = p;
+    while (*p != '\0' && *p != ',' && *p != '}' && *p != ']' &&
+           *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    if (p == start) {
+        error = true;
+    }
+}
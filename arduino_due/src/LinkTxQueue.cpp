@@ -0,0 +1,88 @@
+#include "../include/LinkTxQueue.h"
+
+void LinkTxQueue::begin() {
+    ring = MemoryArena::region(ARENA_TX_RING);
+    head = 0;
+    tail = 0;
+    count = 0;
+    inFlight = 0;
+    nextPtr = ring;
+
+    USART0->US_PTCR = US_PTCR_TXTDIS;
+    USART0->US_TCR = 0;
+    USART0->US_TNCR = 0;
+    USART0->US_PTCR = US_PTCR_TXTEN;
+}
+
+size_t LinkTxQueue::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t LinkTxQueue::write(const uint8_t* data, size_t n) {
+    size_t written = 0;
+    while (written < n) {
+        if (count == CAPACITY) {
+            poll();
+            continue;
+        }
+        // Непрерывный кусок до конца кольца или до занятой части
+        size_t part = CAPACITY - head;
+        if (part > CAPACITY - count) {
+            part = CAPACITY - count;
+        }
+        if (part > n - written) {
+            part = n - written;
+        }
+        memcpy(ring + head, data + written, part);
+        head = (head + part) % CAPACITY;
+        count += part;
+        written += part;
+    }
+    MemoryArena::noteUse(ARENA_TX_RING, count);
+    return written;
+}
+
+void LinkTxQueue::poll() {
+    // TNCR читается первым: если между чтениями PDC перешёл на следующий кусок,
+    // остаток только завышается, и байты не освобождаются раньше времени
+    uint32_t next = USART0->US_TNCR;
+    uint32_t current = USART0->US_TCR;
+
+    if (current == 0 && next != 0) {
+        // Следующий кусок записан, когда текущий уже закончился: PDC его не подхватит
+        USART0->US_TNCR = 0;
+        USART0->US_TPR = (uint32_t)(uintptr_t)nextPtr;
+        USART0->US_TCR = next;
+        current = next;
+        next = 0;
+    }
+
+    uint32_t remaining = current + next;
+    if (remaining > inFlight) {
+        return;
+    }
+    size_t done = inFlight - remaining;
+    tail = (tail + done) % CAPACITY;
+    count -= done;
+    inFlight = remaining;
+
+    // Дозагрузка: свободен текущий регистр, затем следующий
+    while (next == 0 && count > inFlight) {
+        size_t start = (tail + inFlight) % CAPACITY;
+        size_t len = count - inFlight;
+        if (len > CAPACITY - start) {
+            len = CAPACITY - start;
+        }
+        if (current == 0) {
+            USART0->US_TPR = (uint32_t)(uintptr_t)(ring + start);
+            USART0->US_TCR = len;
+            current = len;
+        } else {
+            nextPtr = ring + start;
+            USART0->US_TNPR = (uint32_t)(uintptr_t)nextPtr;
+            USART0->US_TNCR = len;
+            next = len;
+        }
+        inFlight += len;
+    }
+}
@@ -1,18 +1,38 @@
 #include "../include/Logger.h"
 #include "../include/types.h"
+#include "../include/CommandDictionary.h"
+#include "../include/SoftRTC.h"
+#include "../include/LinkProtocol.h"
 #include <cstring>
+#include <cstddef>
 
-void Logger::begin() {
-    clear();
-    Serial.println("Logger: Initialized (256 entries ring buffer)");
+static_assert(LOG_RAM_ENTRIES * sizeof(PackedLogEntry) <= ARENA_LOG_SIZE, "Log ring does not fit ARENA_LOG");
+
+void Logger::begin(const CommandDictionary* dict) {
+    commandDict = dict;
+    logEntries = (PackedLogEntry*)MemoryArena::region(ARENA_LOG);
+    clearRam();
+    scanFlash();
+    
+    Serial.print("Logger: Initialized (");
+    Serial.print((unsigned long)MAX_LOG_ENTRIES);
+    Serial.print(" entries in RAM, ");
+    Serial.print((unsigned long)flashCount);
+    Serial.println(" in flash)");
 }
 
 void Logger::add(const LogEntry& e) {
-    logEntries[currentIndex] = e;
+    logEntries[currentIndex] = pack(e);
     currentIndex = (currentIndex + 1) % MAX_LOG_ENTRIES;
     
     if (logCount < MAX_LOG_ENTRIES) {
         logCount++;
+        MemoryArena::noteUse(ARENA_LOG, logCount * sizeof(PackedLogEntry));
+    }
+    
+    pendingCount++;
+    if (pendingCount >= LogFlashPage::CAPACITY) {
+        flushPage();
     }
 }
 
@@ -21,17 +41,9 @@ void Logger::printAllToSerial() const {
     Serial.print("Total entries: ");
     Serial.println(logCount);
     
-    size_t startIndex = 0;
-    size_t entriesToPrint = logCount;
-    
-    if (logCount >= MAX_LOG_ENTRIES) {
-        startIndex = currentIndex;
-        entriesToPrint = MAX_LOG_ENTRIES;
-    }
-    
-    for (size_t i = 0; i < entriesToPrint; i++) {
-        size_t idx = (startIndex + i) % MAX_LOG_ENTRIES;
-        const LogEntry& entry = logEntries[idx];
+    for (size_t i = 0; i < logCount; i++) {
+        LogEntry entry;
+        getEntry(i, entry);
         
         char timestampStr[32];
         formatTimestamp(entry.ts, timestampStr, sizeof(timestampStr));
@@ -48,16 +60,97 @@ void Logger::printAllToSerial() const {
         Serial.print(" img=");
         Serial.print(entry.imageSent ? 1 : 0);
         Serial.print(" dur=");
-        Serial.println(entry.durationMs);
+        Serial.print(entry.durationMs);
+        if (entry.abortReason != ABORT_NONE) {
+            Serial.print(" abort=");
+            Serial.print(abortReasonName(entry.abortReason));
+        }
+        Serial.println();
     }
     
     Serial.println("===================");
 }
 
+void Logger::dumpBinary(Print& out) {
+    size_t total = flashCount + pendingCount;
+    
+    out.print("LOGDUMP 1 ");
+    out.print((unsigned long)total);
+    out.print(" ");
+    out.print((unsigned long)sizeof(PackedLogEntry));
+    out.print(" ");
+    size_t names = commandDict ? commandDict->getCount() : 0;
+    for (size_t i = 0; i < names; i++) {
+        if (i > 0) {
+            out.print(",");
+        }
+        out.print(commandDict->nameAt(i));
+    }
+    // Макросы - с явным ID: "<id>:<имя>"
+    size_t macros = commandDict ? commandDict->getMacroCount() : 0;
+    for (size_t i = 0; i < macros; i++) {
+        out.print(",");
+        out.print((int)(COMMAND_MACRO_ID_BASE + i));
+        out.print(":");
+        out.print(commandDict->nameAt(COMMAND_MACRO_ID_BASE + i));
+    }
+    out.print("\n");
+    
+    // Страницы flash от самой старой: записи отдаются прямо из flash, без копирования
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < LOG_FLASH_PAGES; i++) {
+        const LogFlashPage* page = pageAt((writePage + i) % LOG_FLASH_PAGES);
+        if (!isValidPage(page)) {
+            continue;
+        }
+        size_t bytes = page->count * sizeof(PackedLogEntry);
+        out.write((const uint8_t*)page->entries, bytes);
+        crc = crc16_ccitt_update(crc, (const uint8_t*)page->entries, bytes);
+    }
+    
+    // Хвост, ещё не записанный во flash (в кольце RAM может переходить через конец)
+    size_t start = (currentIndex + MAX_LOG_ENTRIES - pendingCount) % MAX_LOG_ENTRIES;
+    size_t first = pendingCount;
+    if (first > MAX_LOG_ENTRIES - start) {
+        first = MAX_LOG_ENTRIES - start;
+    }
+    out.write((const uint8_t*)(logEntries + start), first * sizeof(PackedLogEntry));
+    crc = crc16_ccitt_update(crc, (const uint8_t*)(logEntries + start), first * sizeof(PackedLogEntry));
+    if (first < pendingCount) {
+        size_t rest = (pendingCount - first) * sizeof(PackedLogEntry);
+        out.write((const uint8_t*)logEntries, rest);
+        crc = crc16_ccitt_update(crc, (const uint8_t*)logEntries, rest);
+    }
+    
+    uint8_t crcBytes[2] = { (uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8) };
+    out.write(crcBytes, 2);
+    out.print("\nLOGDUMP END\n");
+}
+
+const char* Logger::abortReasonName(uint8_t reason) {
+    switch (reason) {
+        case ABORT_OBSTACLE: return "obstacle";
+        case ABORT_IMPACT:   return "impact";
+        case ABORT_NONE:
+        default:             return "none";
+    }
+}
+
 void Logger::clear() {
-    logCount = 0;
-    currentIndex = 0;
-    memset(logEntries, 0, sizeof(logEntries));
+    clearRam();
+    
+    // Стираем только заголовки занятых страниц: без MAGIC страница не читается
+    LogFlashPage header;
+    memset(&header, 0, sizeof(header));
+    for (uint16_t i = 0; i < LOG_FLASH_PAGES; i++) {
+        if (isValidPage(pageAt(i))) {
+            flashStorage.write(LOG_FLASH_OFFSET + (uint32_t)i * sizeof(LogFlashPage),
+                               (byte*)&header, offsetof(LogFlashPage, entries));
+        }
+    }
+    writePage = 0;
+    nextSequence = 1;
+    flashCount = 0;
 }
 
 bool Logger::getEntry(size_t index, LogEntry& outEntry) const {
@@ -71,10 +164,111 @@ bool Logger::getEntry(size_t index, LogEntry& outEntry) const {
     }
     
     size_t realIndex = (startIndex + index) % MAX_LOG_ENTRIES;
-    outEntry = logEntries[realIndex];
+    unpack(logEntries[realIndex], outEntry);
     return true;
 }
 
+void Logger::clearRam() {
+    logCount = 0;
+    currentIndex = 0;
+    pendingCount = 0;
+    memset(logEntries, 0, MAX_LOG_ENTRIES * sizeof(PackedLogEntry));
+}
+
+void Logger::scanFlash() {
+    writePage = 0;
+    nextSequence = 1;
+    flashCount = 0;
+    
+    uint32_t newestSequence = 0;
+    for (uint16_t i = 0; i < LOG_FLASH_PAGES; i++) {
+        const LogFlashPage* page = pageAt(i);
+        if (!isValidPage(page)) {
+            continue;
+        }
+        flashCount += page->count;
+        if (page->sequence >= newestSequence) {
+            newestSequence = page->sequence;
+            writePage = (i + 1) % LOG_FLASH_PAGES;
+        }
+    }
+    nextSequence = newestSequence + 1;
+}
+
+void Logger::flushPage() {
+    const LogFlashPage* old = pageAt(writePage);
+    if (isValidPage(old)) {
+        // Кольцо flash заполнено: страница перезаписывается самыми новыми записями
+        flashCount -= old->count;
+    }
+    
+    size_t start = (currentIndex + MAX_LOG_ENTRIES - pendingCount) % MAX_LOG_ENTRIES;
+    ArenaScratch scratch(SCRATCH_LOG_PAGE);
+    scratch.use(sizeof(LogFlashPage));
+    LogFlashPage& pageBuffer = *(LogFlashPage*)scratch.data();
+    pageBuffer.magic = LogFlashPage::MAGIC;
+    pageBuffer.sequence = nextSequence++;
+    pageBuffer.count = pendingCount;
+    pageBuffer.reserved = 0;
+    for (size_t i = 0; i < pendingCount; i++) {
+        pageBuffer.entries[i] = logEntries[(start + i) % MAX_LOG_ENTRIES];
+    }
+    pageBuffer.crc = crc16_ccitt((const uint8_t*)pageBuffer.entries,
+                                 pageBuffer.count * sizeof(PackedLogEntry));
+    
+    flashStorage.write(LOG_FLASH_OFFSET + (uint32_t)writePage * sizeof(LogFlashPage),
+                       (byte*)&pageBuffer, sizeof(LogFlashPage));
+    
+    flashCount += pendingCount;
+    pendingCount = 0;
+    writePage = (writePage + 1) % LOG_FLASH_PAGES;
+}
+
+const LogFlashPage* Logger::pageAt(uint16_t index) {
+    return (const LogFlashPage*)flashStorage.readAddress(LOG_FLASH_OFFSET + (uint32_t)index * sizeof(LogFlashPage));
+}
+
+bool Logger::isValidPage(const LogFlashPage* page) {
+    if (page == nullptr || page->magic != LogFlashPage::MAGIC ||
+        page->count == 0 || page->count > LogFlashPage::CAPACITY) {
+        return false;
+    }
+    return crc16_ccitt((const uint8_t*)page->entries, page->count * sizeof(PackedLogEntry)) == page->crc;
+}
+
+PackedLogEntry Logger::pack(const LogEntry& e) const {
+    PackedLogEntry p;
+    p.epoch = SoftRTC::toEpoch(e.ts);
+    
+    uint32_t durationCs = (e.durationMs + 5) / 10;
+    p.durationCs = (durationCs > 0xFFFF) ? 0xFFFF : durationCs;
+    
+    float distanceMm = e.distanceCm * 10.0f + 0.5f;
+    p.distanceMm = (distanceMm <= 0.0f) ? 0 : (distanceMm >= 65535.0f ? 0xFFFF : (uint16_t)distanceMm);
+    
+    uint16_t light = (e.lightRaw < 0) ? 0 : (e.lightRaw > LOG_LIGHT_MASK ? LOG_LIGHT_MASK : e.lightRaw);
+    p.lightFlags = light | (e.isDark ? LOG_FLAG_DARK : 0) | (e.imageSent ? LOG_FLAG_IMAGE : 0) |
+                   ((uint16_t)(e.abortReason & 0x03) << LOG_ABORT_SHIFT);
+    
+    int index = commandDict ? commandDict->indexOf(e.commandName) : -1;
+    p.command = (index >= 0 && index < LOG_COMMAND_UNKNOWN) ? (uint8_t)index : LOG_COMMAND_UNKNOWN;
+    p.reserved = 0;
+    return p;
+}
+
+void Logger::unpack(const PackedLogEntry& p, LogEntry& out) const {
+    out.ts = SoftRTC::fromEpoch(p.epoch);
+    const char* name = commandDict ? commandDict->nameAt(p.command) : "?";
+    strncpy(out.commandName, name, sizeof(out.commandName) - 1);
+    out.commandName[sizeof(out.commandName) - 1] = '\0';
+    out.durationMs = (uint32_t)p.durationCs * 10;
+    out.distanceCm = p.distanceMm / 10.0f;
+    out.lightRaw = p.lightFlags & LOG_LIGHT_MASK;
+    out.isDark = (p.lightFlags & LOG_FLAG_DARK) != 0;
+    out.imageSent = (p.lightFlags & LOG_FLAG_IMAGE) != 0;
+    out.abortReason = p.lightFlags >> LOG_ABORT_SHIFT;
+}
+
 void Logger::formatTimestamp(const DateTime& ts, char* buffer, size_t bufferSize) const {
     if (buffer == nullptr || bufferSize < 20) {
         return;
@@ -82,5 +276,3 @@ void Logger::formatTimestamp(const DateTime& ts, char* buffer, size_t bufferSize
     snprintf(buffer, bufferSize, "%02d:%02d:%04d %02d:%02d:%02d",
              ts.dd, ts.MM, ts.yyyy, ts.hh, ts.mm, ts.ss);
 }
-
-
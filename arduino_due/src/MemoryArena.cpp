@@ -0,0 +1,241 @@
+#include "../include/MemoryArena.h"
+#include <cstring>
+
+// Один статический блок: адреса регионов известны линкеру, кучи нет
+alignas(8) static uint8_t arenaPool[ARENA_SIZE];
+
+static const size_t REGION_OFFSETS[ARENA_REGION_COUNT] = {
+    ARENA_FRAMES_OFFSET, ARENA_CODEC_OUT_OFFSET, ARENA_CODEC_KEY_OFFSET,
+    ARENA_LOG_OFFSET, ARENA_TX_RING_OFFSET, ARENA_SCRATCH_OFFSET
+};
+static const size_t REGION_SIZES[ARENA_REGION_COUNT] = {
+    ARENA_FRAMES_SIZE, ARENA_CODEC_OUT_SIZE, ARENA_CODEC_KEY_SIZE,
+    ARENA_LOG_SIZE, ARENA_TX_RING_SIZE, ARENA_SCRATCH_SIZE
+};
+
+uint32_t MemoryArena::peaks[ARENA_REGION_COUNT];
+uint32_t MemoryArena::scratchPeaks[SCRATCH_USER_COUNT];
+uint8_t MemoryArena::scratchOwner = SCRATCH_NONE;
+uint32_t MemoryArena::scratchConflicts = 0;
+uint8_t MemoryArena::lastConflictUser = SCRATCH_NONE;
+uint8_t* MemoryArena::stackFloor = nullptr;
+
+#if defined(ARDUINO_ARCH_SAM)
+extern "C" char* sbrk(int incr);
+extern "C" uint32_t _estack;
+extern "C" uint32_t _srelocate;   // начало .data в RAM (flash.ld ядра Due)
+extern "C" uint32_t _end;         // конец .bss, начало кучи
+
+static const uint8_t STACK_PAINT = 0xA5;
+// Запас над кучей (malloc ядра растёт вверх) и под текущим кадром стека
+static const size_t HEAP_GUARD = 1024;
+static const size_t FRAME_GUARD = 64;
+
+static uint8_t* stackTop() {
+    return (uint8_t*)&_estack;
+}
+
+static uint8_t* heapTop() {
+    return (uint8_t*)sbrk(0);
+}
+
+static size_t staticBytes() {
+    return (uint8_t*)&_end - (uint8_t*)&_srelocate;
+}
+#endif
+
+void MemoryArena::begin() {
+    memset(peaks, 0, sizeof(peaks));
+    memset(scratchPeaks, 0, sizeof(scratchPeaks));
+    scratchOwner = SCRATCH_NONE;
+    scratchConflicts = 0;
+    lastConflictUser = SCRATCH_NONE;
+    stackFloor = nullptr;
+    
+#if defined(ARDUINO_ARCH_SAM)
+    // static_assert видит только оценку ядра; конец статических данных - от линкера.
+    // Залезли в резерв стека - дальше не едем: моторы ещё не настроены
+    if ((uint8_t*)&_end + MEMORY_STACK_RESERVE > stackTop()) {
+        Serial.print("MemoryArena: FATAL static data ");
+        Serial.print((unsigned long)staticBytes());
+        Serial.print(" bytes leave ");
+        Serial.print((unsigned long)(stackTop() - (uint8_t*)&_end));
+        Serial.print(" for stack, need ");
+        Serial.print((unsigned long)MEMORY_STACK_RESERVE);
+        Serial.println(": raise MEMORY_CORE_RESERVE, shrink the arena");
+        while (true) {
+        }
+    }
+    
+    uint8_t marker;
+    uint8_t* floor = heapTop() + HEAP_GUARD;
+    uint8_t* ceiling = &marker - FRAME_GUARD;
+    if (floor < ceiling) {
+        memset(floor, STACK_PAINT, ceiling - floor);
+        stackFloor = floor;
+    }
+#endif
+    
+    Serial.print("MemoryArena: Initialized (");
+    Serial.print((unsigned long)ARENA_SIZE);
+    Serial.print(" bytes in ");
+    Serial.print((int)ARENA_REGION_COUNT);
+    Serial.println(" regions)");
+}
+
+uint8_t* MemoryArena::region(ArenaRegionId id) {
+    return arenaPool + REGION_OFFSETS[id];
+}
+
+uint32_t MemoryArena::stackDepth() {
+#if defined(ARDUINO_ARCH_SAM)
+    uint8_t marker;
+    return (uint32_t)(stackTop() - &marker);
+#else
+    return 0;
+#endif
+}
+
+uint32_t MemoryArena::stackPeak() {
+#if defined(ARDUINO_ARCH_SAM)
+    if (stackFloor == nullptr) {
+        return 0;
+    }
+    // Куча могла дорасти до закрашенной части: её байты за стек не считаются
+    uint8_t* p = stackFloor;
+    uint8_t* heap = heapTop();
+    if (heap > p) {
+        p = heap;
+    }
+    uint8_t* top = stackTop();
+    while (p < top && *p == STACK_PAINT) {
+        p++;
+    }
+    return (uint32_t)(top - p);
+#else
+    return 0;
+#endif
+}
+
+const char* MemoryArena::regionName(uint8_t id) {
+    switch (id) {
+        case ARENA_FRAMES:    return "frames";
+        case ARENA_CODEC_OUT: return "codec_out";
+        case ARENA_CODEC_KEY: return "codec_key";
+        case ARENA_LOG:       return "log";
+        case ARENA_TX_RING:   return "tx_ring";
+        case ARENA_SCRATCH:   return "scratch";
+        default:              return "?";
+    }
+}
+
+const char* MemoryArena::scratchUserName(uint8_t user) {
+    switch (user) {
+        case SCRATCH_CAMERA_LINE: return "cam_line";
+        case SCRATCH_CODEC_ROW:   return "codec_row";
+        case SCRATCH_DATA_JSON:   return "data_json";
+        case SCRATCH_LOG_PAGE:    return "log_page";
+        default:                  return "?";
+    }
+}
+
+void MemoryArena::printToSerial() {
+    char line[64];
+    Serial.println("=== Memory (bytes) ===");
+    snprintf(line, sizeof(line), "%-10s %9s %8s %8s", "region", "offset", "size", "peak");
+    Serial.println(line);
+    for (uint8_t i = 0; i < ARENA_REGION_COUNT; i++) {
+        uint32_t peak = peaks[i];
+        if (i == ARENA_FRAMES) {
+            // Кадры заняты всегда целиком
+            peak = REGION_SIZES[i];
+        } else if (i == ARENA_SCRATCH) {
+            for (uint8_t u = 0; u < SCRATCH_USER_COUNT; u++) {
+                if (scratchPeaks[u] > peak) {
+                    peak = scratchPeaks[u];
+                }
+            }
+        }
+        snprintf(line, sizeof(line), "%-10s %9lu %8lu %8lu", regionName(i),
+                 (unsigned long)REGION_OFFSETS[i], (unsigned long)REGION_SIZES[i],
+                 (unsigned long)peak);
+        Serial.println(line);
+    }
+    snprintf(line, sizeof(line), "%-10s %9s %8lu", "total", "", (unsigned long)ARENA_SIZE);
+    Serial.println(line);
+    
+    snprintf(line, sizeof(line), "%-10s %8s %8s", "scratch", "need", "peak");
+    Serial.println(line);
+    static const size_t USER_SIZES[SCRATCH_USER_COUNT] = {
+        SCRATCH_CAMERA_LINE_SIZE, SCRATCH_CODEC_ROW_SIZE, SCRATCH_DATA_JSON_SIZE, SCRATCH_LOG_PAGE_SIZE
+    };
+    for (uint8_t u = 0; u < SCRATCH_USER_COUNT; u++) {
+        snprintf(line, sizeof(line), "%-10s %8lu %8lu", scratchUserName(u),
+                 (unsigned long)USER_SIZES[u], (unsigned long)scratchPeaks[u]);
+        Serial.println(line);
+    }
+    Serial.print("Scratch conflicts: ");
+    Serial.print((unsigned long)scratchConflicts);
+    if (scratchConflicts > 0) {
+        Serial.print(" (last ");
+        Serial.print(scratchUserName(lastConflictUser));
+        Serial.print(")");
+    }
+    Serial.println();
+    
+    Serial.print("Budget: SRAM ");
+    Serial.print((unsigned long)MEMORY_SRAM_SIZE);
+    Serial.print(", arena ");
+    Serial.print((unsigned long)ARENA_SIZE);
+    Serial.print(", modules ");
+    Serial.print((unsigned long)MEMORY_MODULE_RESERVE);
+    Serial.print(", core ");
+    Serial.print((unsigned long)MEMORY_CORE_RESERVE);
+    Serial.print(", perf ");
+    Serial.print((unsigned long)Perf::tableBytes());
+    Serial.print(", stack ");
+    Serial.println((unsigned long)MEMORY_STACK_RESERVE);
+    
+#if defined(ARDUINO_ARCH_SAM)
+    // Разница с бюджетом - поправка MEMORY_CORE_RESERVE по настоящей сборке
+    Serial.print("Static data (linker): ");
+    Serial.print((unsigned long)staticBytes());
+    Serial.print(" of budget ");
+    Serial.println((unsigned long)MEMORY_STATIC_BUDGET);
+    Serial.print("Stack: now ");
+    Serial.print((unsigned long)stackDepth());
+    Serial.print(", peak ");
+    Serial.print((unsigned long)stackPeak());
+    Serial.print(" of ");
+    Serial.println((unsigned long)MEMORY_STACK_RESERVE);
+    uint8_t marker;
+    uint8_t* heap = heapTop();
+    Serial.print("Heap top: 0x");
+    Serial.print((unsigned long)(uintptr_t)heap, HEX);
+    Serial.print(", free to stack ");
+    Serial.println((unsigned long)((&marker > heap) ? &marker - heap : 0));
+#else
+    Serial.println("Stack: not measured");
+#endif
+    Serial.println("======================");
+}
+
+ArenaScratch::ArenaScratch(ArenaScratchUser owner)
+    : ptr(arenaPool + ARENA_SCRATCH_OFFSET), user(owner), previousOwner(MemoryArena::scratchOwner) {
+    if (previousOwner != SCRATCH_NONE) {
+        // Два пользователя сразу - буфер общий, данные первого испорчены
+        MemoryArena::scratchConflicts++;
+        MemoryArena::lastConflictUser = owner;
+    }
+    MemoryArena::scratchOwner = owner;
+}
+
+ArenaScratch::~ArenaScratch() {
+    MemoryArena::scratchOwner = previousOwner;
+}
+
+void ArenaScratch::use(size_t bytes) {
+    if (bytes > MemoryArena::scratchPeaks[user]) {
+        MemoryArena::scratchPeaks[user] = (uint32_t)bytes;
+    }
+}
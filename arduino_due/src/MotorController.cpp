@@ -1,6 +1,9 @@
 #include "../include/MotorController.h"
 #include "../include/types.h"
 
+// Единственный контроллер моторов: на него указывают прерывания таймеров
+static MotorController* timerOwner = nullptr;
+
 void MotorController::begin() {
     // Настройка пинов моторов как выходы
     pinMode(Hardware::MOTOR_IN1, OUTPUT);
@@ -8,89 +11,311 @@ void MotorController::begin() {
     pinMode(Hardware::MOTOR_IN3, OUTPUT);
     pinMode(Hardware::MOTOR_IN4, OUTPUT);
     
+    motorPort = g_APinDescription[Hardware::MOTOR_IN1].pPort;
+    in1Bit = g_APinDescription[Hardware::MOTOR_IN1].ulPin;
+    in2Bit = g_APinDescription[Hardware::MOTOR_IN2].ulPin;
+    in3Bit = g_APinDescription[Hardware::MOTOR_IN3].ulPin;
+    in4Bit = g_APinDescription[Hardware::MOTOR_IN4].ulPin;
+    motorMask = in1Bit | in2Bit | in3Bit | in4Bit;
+    
+    // Запись PIO_ODSR меняет только биты, разрешённые в OWSR
+    motorPort->PIO_OWER = motorMask;
+    
+    segmentCount = 0;
+    segmentIndex = 0;
+    running = false;
+    drivePins = 0;
+    leftDuty = rightDuty = 0;
+    leftTarget = rightTarget = 0;
+    pwmActive = false;
+    timerOwner = this;
+    
+    // TC1 канал 0 (TC3) - планировщик: сброс по RC, прерывание на совпадении с RC
+    pmc_enable_periph_clk(ID_TC3);
+    TcChannel& ch = TC1->TC_CHANNEL[0];
+    ch.TC_CCR = TC_CCR_CLKDIS;
+    ch.TC_CMR = TC_CMR_TCCLKS_TIMER_CLOCK3 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC;
+    ch.TC_IDR = 0xFFFFFFFF;
+    ch.TC_IER = TC_IER_CPCS;
+    
+    // TC1 канал 1 (TC4) - PWM: RC - начало периода, RA/RB - конец импульса
+    pmc_enable_periph_clk(ID_TC4);
+    TcChannel& pwm = TC1->TC_CHANNEL[1];
+    pwm.TC_CCR = TC_CCR_CLKDIS;
+    pwm.TC_CMR = TC_CMR_TCCLKS_TIMER_CLOCK3 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC;
+    pwm.TC_RC = PWM_PERIOD_TICKS;
+    pwm.TC_IDR = 0xFFFFFFFF;
+    pwm.TC_IER = TC_IER_CPAS | TC_IER_CPBS | TC_IER_CPCS;
+    
+    NVIC_ClearPendingIRQ(TC3_IRQn);
+    NVIC_ClearPendingIRQ(TC4_IRQn);
+    NVIC_EnableIRQ(TC3_IRQn);
+    NVIC_EnableIRQ(TC4_IRQn);
+    
     // Остановка обоих моторов при инициализации
     stop();
     
-    Serial.println("MotorController: Initialized (no PWM mode)");
+    Serial.print("MotorController: Initialized (soft PWM 1 kHz, ramp ");
+    Serial.print(MOTOR_RAMP_MS);
+    Serial.println(" ms, TC3 scheduler)");
 }
 
 void MotorController::stop() {
+    NVIC_DisableIRQ(TC3_IRQn);
+    NVIC_DisableIRQ(TC4_IRQn);
+    stopTimer();
+    stopPwm();
+    running = false;
+    segmentCount = 0;
     // Все пины в LOW = остановка
-    digitalWrite(Hardware::MOTOR_IN1, LOW);
-    digitalWrite(Hardware::MOTOR_IN2, LOW);
-    digitalWrite(Hardware::MOTOR_IN3, LOW);
-    digitalWrite(Hardware::MOTOR_IN4, LOW);
+    latch(0);
+    NVIC_EnableIRQ(TC3_IRQn);
+    NVIC_EnableIRQ(TC4_IRQn);
+}
+
+void MotorController::applyCommand(const CommandConfig& cfg, uint8_t speedPercent) {
+    stop();
+    NVIC_DisableIRQ(TC4_IRQn);
+    drive(segmentFor(cfg, speedPercent));
+    NVIC_EnableIRQ(TC4_IRQn);
+}
+
+void MotorController::clearSequence() {
+    stop();
+}
+
+bool MotorController::addSegment(const CommandConfig& cfg, uint32_t durationMs, uint8_t speedPercent) {
+    if (running || segmentCount >= MAX_SEGMENTS) {
+        return false;
+    }
+    Segment& seg = segments[segmentCount++];
+    seg = segmentFor(cfg, speedPercent);
+    // Нулевой отрезок - один такт: прерывание всё равно перейдёт дальше
+    seg.ticks = (durationMs > 0) ? durationMs * TIMER_TICKS_PER_MS : 1;
+    return true;
+}
+
+bool MotorController::startSequence() {
+    if (segmentCount == 0) {
+        return false;
+    }
+    
+    NVIC_DisableIRQ(TC3_IRQn);
+    NVIC_DisableIRQ(TC4_IRQn);
+    TcChannel& ch = TC1->TC_CHANNEL[0];
+    stopTimer();
+    segmentIndex = 0;
+    running = true;
+    drive(segments[0]);
+    ch.TC_RC = segments[0].ticks;
+    ch.TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+    NVIC_EnableIRQ(TC3_IRQn);
+    NVIC_EnableIRQ(TC4_IRQn);
+    return true;
 }
 
-void MotorController::applyCommand(const CommandConfig& cfg) {
+bool MotorController::isMovingForward() const {
+    return drivePins == (in1Bit | in3Bit);
+}
 
-    if (cfg.rightSpeed > 0) {
-        setLeftMotor(1);   // Вперед
-    } else if (cfg.rightSpeed < 0) {
-        setLeftMotor(-1);  // Назад
-    } else {
-        setLeftMotor(0);   // Стоп
+void MotorController::handleTimer() {
+    TcChannel& ch = TC1->TC_CHANNEL[0];
+    if ((ch.TC_SR & TC_SR_CPCS) == 0 || !running) {
+        return;
     }
     
-    if (cfg.leftSpeed > 0) {
-        setRightMotor(1);  // Вперед
-    } else if (cfg.leftSpeed < 0) {
-        setRightMotor(-1); // Назад
-    } else {
-        setRightMotor(0);  // Стоп
+    uint8_t next = segmentIndex + 1;
+    if (next < segmentCount) {
+        // Счётчик уже сброшен совпадением: новый RC отсчитывается точно от границы
+        drive(segments[next]);
+        ch.TC_RC = segments[next].ticks;
+        segmentIndex = next;
+        return;
+    }
+    
+    // Конец команды - выбег: оба пина каждого мотора в LOW, броска тока нет
+    stopPwm();
+    latch(0);
+    stopTimer();
+    running = false;
+}
+
+void MotorController::handlePwmTimer() {
+    TcChannel& pwm = TC1->TC_CHANNEL[1];
+    uint32_t status = pwm.TC_SR;
+    if (!pwmActive) {
+        return;
+    }
+    
+    uint32_t leftPins = in1Bit | in2Bit;
+    uint32_t rightPins = in3Bit | in4Bit;
+    
+    // Конец импульса: выключаем мотор до начала следующего периода
+    if (status & TC_SR_CPAS) {
+        latch(currentPins & ~leftPins);
+    }
+    if (status & TC_SR_CPBS) {
+        latch(currentPins & ~rightPins);
+    }
+    
+    if (status & TC_SR_CPCS) {
+        // Начало периода: шаг разгона/торможения и включение моторов
+        leftDuty = rampToward(leftDuty, leftTarget);
+        rightDuty = rampToward(rightDuty, rightTarget);
+        
+        uint32_t on = 0;
+        if (leftDuty > 0) {
+            on |= drivePins & leftPins;
+        }
+        if (rightDuty > 0) {
+            on |= drivePins & rightPins;
+        }
+        latch(on);
+        
+        // Полная скважность - совпадение за RC, которого счётчик не достигает
+        pwm.TC_RA = (leftDuty >= PWM_PERIOD_TICKS) ? PWM_PERIOD_TICKS + 1 : leftDuty;
+        pwm.TC_RB = (rightDuty >= PWM_PERIOD_TICKS) ? PWM_PERIOD_TICKS + 1 : rightDuty;
     }
 }
 
 void MotorController::forward() {
-    setLeftMotor(1);
-    setRightMotor(1);
+    CommandConfig cfg = {"", 100, 100, 0};
+    applyCommand(cfg);
 }
 
 void MotorController::backward() {
-    setLeftMotor(-1);
-    setRightMotor(-1);
+    CommandConfig cfg = {"", -100, -100, 0};
+    applyCommand(cfg);
 }
 
 void MotorController::turnLeft() {
-    setLeftMotor(0);   // Левый стоит
-    setRightMotor(1);  // Правый вперед → поворот ВЛЕВО (правая сторона тянет)
+    // Левый стоит, правый вперед → поворот ВЛЕВО (правая сторона тянет)
+    CommandConfig cfg = {"", 0, 100, 0};
+    applyCommand(cfg);
 }
 
 void MotorController::turnRight() {
-    setLeftMotor(1);   // Левый вперед → поворот ВПРАВО (левая сторона тянет)
-    setRightMotor(0);  // Правый стоит
+    // Левый вперед → поворот ВПРАВО (левая сторона тянет), правый стоит
+    CommandConfig cfg = {"", 100, 0, 0};
+    applyCommand(cfg);
 }
 
-void MotorController::setLeftMotor(int8_t direction) {
-    if (direction > 0) {
-        // Вперед: IN1=HIGH, IN2=LOW
-        digitalWrite(Hardware::MOTOR_IN1, HIGH);
-        digitalWrite(Hardware::MOTOR_IN2, LOW);
-    } else if (direction < 0) {
-        // Назад: IN1=LOW, IN2=HIGH
-        digitalWrite(Hardware::MOTOR_IN1, LOW);
-        digitalWrite(Hardware::MOTOR_IN2, HIGH);
-    } else {
-        // Стоп: оба LOW
-        digitalWrite(Hardware::MOTOR_IN1, LOW);
-        digitalWrite(Hardware::MOTOR_IN2, LOW);
+uint32_t MotorController::pinsFor(int8_t left, int8_t right) const {
+    uint32_t pins = 0;
+    // Левый мотор: вперед IN1=HIGH, назад IN2=HIGH, стоп - оба LOW
+    if (left > 0) {
+        pins |= in1Bit;
+    } else if (left < 0) {
+        pins |= in2Bit;
+    }
+    // Правый мотор: вперед IN3=HIGH, назад IN4=HIGH
+    if (right > 0) {
+        pins |= in3Bit;
+    } else if (right < 0) {
+        pins |= in4Bit;
     }
+    return pins;
 }
 
-void MotorController::setRightMotor(int8_t direction) {
-    if (direction > 0) {
-        // Вперед: IN3=HIGH, IN4=LOW
-        digitalWrite(Hardware::MOTOR_IN3, HIGH);
-        digitalWrite(Hardware::MOTOR_IN4, LOW);
-    } else if (direction < 0) {
-        // Назад: IN3=LOW, IN4=HIGH
-        digitalWrite(Hardware::MOTOR_IN3, LOW);
-        digitalWrite(Hardware::MOTOR_IN4, HIGH);
-    } else {
-        // Стоп: оба LOW
-        digitalWrite(Hardware::MOTOR_IN3, LOW);
-        digitalWrite(Hardware::MOTOR_IN4, LOW);
+MotorController::Segment MotorController::segmentFor(const CommandConfig& cfg, uint8_t speedPercent) const {
+    if (speedPercent > 100) {
+        speedPercent = 100;
+    }
+    
+    // rightSpeed словаря управляет мотором на IN1/IN2, leftSpeed - на IN3/IN4 (разводка)
+    int16_t leftSpeed = cfg.rightSpeed;
+    int16_t rightSpeed = cfg.leftSpeed;
+    uint16_t leftPercent = (leftSpeed < 0) ? -leftSpeed : leftSpeed;
+    uint16_t rightPercent = (rightSpeed < 0) ? -rightSpeed : rightSpeed;
+    if (leftPercent > 100) {
+        leftPercent = 100;
     }
+    if (rightPercent > 100) {
+        rightPercent = 100;
+    }
+    
+    Segment seg;
+    seg.pins = pinsFor(leftSpeed > 0 ? 1 : (leftSpeed < 0 ? -1 : 0),
+                       rightSpeed > 0 ? 1 : (rightSpeed < 0 ? -1 : 0));
+    seg.leftDuty = (uint16_t)((uint32_t)PWM_PERIOD_TICKS * leftPercent * speedPercent / 10000);
+    seg.rightDuty = (uint16_t)((uint32_t)PWM_PERIOD_TICKS * rightPercent * speedPercent / 10000);
+    seg.ticks = 0;
+    return seg;
 }
 
+void MotorController::drive(const Segment& seg) {
+    uint32_t leftPins = in1Bit | in2Bit;
+    uint32_t rightPins = in3Bit | in4Bit;
+    
+    // Реверс под током - самый большой бросок: мотор разгоняется заново
+    if ((seg.pins & leftPins) != (drivePins & leftPins)) {
+        leftDuty = 0;
+    }
+    if ((seg.pins & rightPins) != (drivePins & rightPins)) {
+        rightDuty = 0;
+    }
+    drivePins = seg.pins;
+    leftTarget = seg.leftDuty;
+    rightTarget = seg.rightDuty;
+    
+    // Пины выключенного мотора гасим сразу, включит их начало периода PWM
+    latch(currentPins & seg.pins);
+    startPwm();
+}
+
+void MotorController::latch(uint32_t pins) {
+    motorPort->PIO_ODSR = pins;
+    currentPins = pins;
+}
+
+void MotorController::stopTimer() {
+    TcChannel& ch = TC1->TC_CHANNEL[0];
+    ch.TC_CCR = TC_CCR_CLKDIS;
+    (void)ch.TC_SR;   // сброс флага совпадения
+    NVIC_ClearPendingIRQ(TC3_IRQn);
+}
 
+void MotorController::startPwm() {
+    if (pwmActive) {
+        return;
+    }
+    TcChannel& pwm = TC1->TC_CHANNEL[1];
+    pwm.TC_RA = PWM_PERIOD_TICKS + 1;
+    pwm.TC_RB = PWM_PERIOD_TICKS + 1;
+    pwmActive = true;
+    // Первый период начнётся с совпадения RC, то есть не позже чем через 1 мс
+    pwm.TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+}
+
+void MotorController::stopPwm() {
+    TcChannel& pwm = TC1->TC_CHANNEL[1];
+    pwm.TC_CCR = TC_CCR_CLKDIS;
+    (void)pwm.TC_SR;
+    NVIC_ClearPendingIRQ(TC4_IRQn);
+    pwmActive = false;
+    drivePins = 0;
+    leftDuty = rightDuty = 0;
+    leftTarget = rightTarget = 0;
+}
+
+uint16_t MotorController::rampToward(uint16_t duty, uint16_t target) {
+    if (duty < target) {
+        return (target - duty > PWM_RAMP_STEP) ? duty + PWM_RAMP_STEP : target;
+    }
+    if (duty > target) {
+        return (duty - target > PWM_RAMP_STEP) ? duty - PWM_RAMP_STEP : target;
+    }
+    return duty;
+}
+
+void TC3_Handler() {
+    if (timerOwner != nullptr) {
+        timerOwner->handleTimer();
+    }
+}
+
+void TC4_Handler() {
+    if (timerOwner != nullptr) {
+        timerOwner->handlePwmTimer();
+    }
+}
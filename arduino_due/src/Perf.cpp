@@ -0,0 +1,175 @@
+#include "../include/Perf.h"
+#include <cstring>
+
+Perf::Probe Perf::probes[PERF_PROBE_COUNT];
+bool Perf::dataEnabled = PERF_DATA_DEFAULT;
+
+void Perf::begin() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    reset();
+    
+    Serial.print("Perf: Initialized (DWT cycle counter, ");
+    Serial.print((int)PERF_PROBE_COUNT);
+    Serial.println(" probes)");
+}
+
+void Perf::record(PerfProbeId id, uint32_t elapsedCycles) {
+    if (id >= PERF_PROBE_COUNT) {
+        return;
+    }
+    Probe& p = probes[id];
+    
+    uint8_t bucket = (elapsedCycles > 0) ? 31 - __builtin_clz(elapsedCycles) : 0;
+    if (p.buckets[bucket] == 0xFFFF) {
+        // Форма распределения сохраняется, последние замеры весят больше
+        for (uint8_t i = 0; i < BUCKETS; i++) {
+            p.buckets[i] >>= 1;
+        }
+    }
+    p.buckets[bucket]++;
+    
+    if (p.count == 0 || elapsedCycles < p.minCycles) {
+        p.minCycles = elapsedCycles;
+    }
+    if (elapsedCycles > p.maxCycles) {
+        p.maxCycles = elapsedCycles;
+    }
+    p.count++;
+    p.sumCycles += elapsedCycles;
+    
+    if (p.windowCount < 0xFFFF) {
+        p.windowCount++;
+        p.windowSumCycles += elapsedCycles;
+        if (elapsedCycles > p.windowMaxCycles) {
+            p.windowMaxCycles = elapsedCycles;
+        }
+    }
+}
+
+void Perf::spanBegin(PerfProbeId id) {
+    if (id >= PERF_PROBE_COUNT) {
+        return;
+    }
+    probes[id].spanStart = cycles();
+    probes[id].spanOpen = true;
+}
+
+void Perf::spanEnd(PerfProbeId id) {
+    if (id >= PERF_PROBE_COUNT || !probes[id].spanOpen) {
+        return;
+    }
+    probes[id].spanOpen = false;
+    record(id, cycles() - probes[id].spanStart);
+}
+
+Perf::Stats Perf::getStats(PerfProbeId id) {
+    Stats s;
+    memset(&s, 0, sizeof(s));
+    if (id >= PERF_PROBE_COUNT || probes[id].count == 0) {
+        return s;
+    }
+    const Probe& p = probes[id];
+    s.count = p.count;
+    s.minUs = toUs(p.minCycles);
+    s.avgUs = toUs(p.sumCycles / p.count);
+    s.p95Us = toUs(percentileCycles(p, 95));
+    s.maxUs = toUs(p.maxCycles);
+    return s;
+}
+
+bool Perf::getWindow(PerfProbeId id, uint32_t& avgUs, uint32_t& maxUs) {
+    if (id >= PERF_PROBE_COUNT || probes[id].windowCount == 0) {
+        return false;
+    }
+    const Probe& p = probes[id];
+    avgUs = toUs(p.windowSumCycles / p.windowCount);
+    maxUs = toUs(p.windowMaxCycles);
+    return true;
+}
+
+void Perf::resetWindow() {
+    for (uint8_t i = 0; i < PERF_PROBE_COUNT; i++) {
+        probes[i].windowCount = 0;
+        probes[i].windowSumCycles = 0;
+        probes[i].windowMaxCycles = 0;
+    }
+}
+
+const char* Perf::probeName(uint8_t id) {
+    switch (id) {
+        case PERF_CAPTURE:       return "cap";
+        case PERF_FRAME:         return "frame";
+        case PERF_CONVERT:       return "conv";
+        case PERF_ENCODE:        return "enc";
+        case PERF_VISION:        return "vis";
+        case PERF_BASE64:        return "b64";
+        case PERF_CHUNK:         return "chunk";
+        case PERF_TRANSFER:      return "xfer";
+        case PERF_WAIT_COMMAND:  return "wait";
+        case PERF_STATE_INIT:    return "s_init";
+        case PERF_STATE_COLLECT: return "s_coll";
+        case PERF_STATE_SEND:    return "s_send";
+        case PERF_STATE_WAIT:    return "s_wait";
+        case PERF_STATE_EXECUTE: return "s_exec";
+        default:                 return "?";
+    }
+}
+
+void Perf::printToSerial() {
+    Serial.println("=== Perf (us) ===");
+    Serial.println("probe       count      min      avg      p95      max");
+    char line[64];
+    for (uint8_t i = 0; i < PERF_PROBE_COUNT; i++) {
+        Stats s = getStats((PerfProbeId)i);
+        if (s.count == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%-8s %8lu %8lu %8lu %8lu %8lu", probeName(i),
+                 (unsigned long)s.count, (unsigned long)s.minUs, (unsigned long)s.avgUs,
+                 (unsigned long)s.p95Us, (unsigned long)s.maxUs);
+        Serial.println(line);
+    }
+    Serial.println("=================");
+}
+
+void Perf::reset() {
+    memset(probes, 0, sizeof(probes));
+}
+
+uint32_t Perf::toUs(uint64_t cycles) {
+    return (uint32_t)(cycles / (SystemCoreClock / 1000000));
+}
+
+uint32_t Perf::percentileCycles(const Probe& p, uint8_t percent) {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        total += p.buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    
+    uint32_t target = (total * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        if (seen + p.buckets[i] < target) {
+            seen += p.buckets[i];
+            continue;
+        }
+        // Линейно внутри корзины [2^i, 2^(i+1)), суженной до min..max сессии
+        uint32_t low = (i == 0) ? 0 : (1u << i);
+        uint32_t high = (i == 31) ? 0xFFFFFFFFu : (2u << i) - 1;
+        if (low < p.minCycles) {
+            low = p.minCycles;
+        }
+        if (high > p.maxCycles) {
+            high = p.maxCycles;
+        }
+        if (high <= low) {
+            return low;
+        }
+        return low + (uint32_t)((uint64_t)(high - low) * (target - seen) / p.buckets[i]);
+    }
+    return p.maxCycles;
+}
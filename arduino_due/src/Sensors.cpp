@@ -1,16 +1,50 @@
 #include "../include/Sensors.h"
 #include "../include/types.h"
 #include <Wire.h>
+#include <math.h>
+
+const float Sensors::IMU_FILTER_ALPHA = 0.98f;
+
+// Масштаб при MPU6050_RANGE_8_G и MPU6050_RANGE_500_DEG
+static const float ACCEL_SCALE = 9.80665f / 4096.0f;            // LSB -> м/с²
+static const float GYRO_SCALE = (PI / 180.0f) / 65.5f;          // LSB -> рад/с
+static const float RAD_TO_DEGREES = 180.0f / PI;
+static const float IMU_DT = 1.0f / IMU_SAMPLE_RATE_HZ;
 
 bool Sensors::begin() {
     mpuInitialized = false;
+    imuFifoEnabled = false;
+    imuOverflows = 0;
+    lastImuPollMillis = 0;
+    orientationValid = false;
+    roll = pitch = yaw = 0.0f;
+    lastAx = lastAy = lastAz = 0.0f;
+    lastGx = lastGy = lastGz = 0.0f;
+    reflexAccelPeak = 0.0f;
+    SensorSnapshot discard;
+    takeImuWindow(discard);
     
     Serial.println("Sensors: Initializing...");
     
     // Инициализация HC-SR04 через NewPing
     static NewPing sonarInstance(Hardware::TRIG_PIN, Hardware::ECHO_PIN, Hardware::MAX_DISTANCE_CM);
     sonar = &sonarInstance;
+    
+    sonarState = SONAR_IDLE;
+    sonarRingPos = 0;
+    sonarRingCount = 0;
+    sonarSequence = 0;
+    lastPingMillis = 0;
+#if SONAR_BACKGROUND
+    pinMode(Hardware::TRIG_PIN, OUTPUT);
+    digitalWrite(Hardware::TRIG_PIN, LOW);
+    pinMode(Hardware::ECHO_PIN, INPUT);
+    echoOwner = this;
+    attachInterrupt(digitalPinToInterrupt(Hardware::ECHO_PIN), echoIsr, CHANGE);
+    Serial.println("Sensors: HC-SR04 initialized (background, median of 5)");
+#else
     Serial.println("Sensors: HC-SR04 initialized");
+#endif
     
     // Фоторезистор не требует инициализации
     Serial.println("Sensors: Photoresistor ready");
@@ -20,15 +54,25 @@ bool Sensors::begin() {
     Wire1.setClock(400000);
     
     // Инициализация MPU6050
-    if (!mpu.begin(0x68, &Wire1)) {
+    if (!mpu.begin(MPU_ADDR, &Wire1)) {
         Serial.println("Sensors: WARNING - MPU6050 not found!");
         Serial.println("Sensors: Check I2C connections (SDA1=70, SCL1=71)");
     } else {
         mpu.setAccelerometerRange(MPU6050_RANGE_8_G);
         mpu.setGyroRange(MPU6050_RANGE_500_DEG);
-        mpu.setFilterBandwidth(MPU6050_BAND_21_HZ);
+        // Полоса шире прежних 21 Гц: пики и рывки видны на 200+ Гц
+        mpu.setFilterBandwidth(MPU6050_BAND_44_HZ);
         mpuInitialized = true;
         Serial.println("Sensors: MPU6050 initialized");
+        
+        imuFifoEnabled = setupImuFifo();
+        if (imuFifoEnabled) {
+            Serial.print("Sensors: MPU6050 FIFO at ");
+            Serial.print(IMU_SAMPLE_RATE_HZ);
+            Serial.println(" Hz");
+        } else {
+            Serial.println("Sensors: WARNING - MPU6050 FIFO setup failed, single reads");
+        }
     }
     
     Serial.println("Sensors: All sensors ready");
@@ -36,16 +80,23 @@ bool Sensors::begin() {
 }
 
 SensorSnapshot Sensors::readSnapshot() {
-    SensorSnapshot snapshot = {0};
+    SensorSnapshot snapshot = {};
     
-    // Чтение HC-SR04
+    // Чтение HC-SR04: медиана фоновых замеров, пока их нет - один блокирующий
+#if SONAR_BACKGROUND
+    snapshot.distanceCm = (sonarRingCount > 0) ? getDistanceCm() : readHCSR04();
+#else
     snapshot.distanceCm = readHCSR04();
+#endif
     
     // Чтение фоторезистора
     snapshot.isDark = readLightSensor(snapshot.lightRaw);
     
-    // Чтение MPU6050
-    if (mpuInitialized) {
+    // Чтение MPU6050: хвост FIFO и сводка окна, без FIFO - одиночный отсчёт
+    if (imuFifoEnabled) {
+        pollImu();
+        takeImuWindow(snapshot);
+    } else if (mpuInitialized) {
         readMPU6050(snapshot.ax, snapshot.ay, snapshot.az,
                     snapshot.gx, snapshot.gy, snapshot.gz);
     }
@@ -53,6 +104,269 @@ SensorSnapshot Sensors::readSnapshot() {
     return snapshot;
 }
 
+void Sensors::pollSonar() {
+#if SONAR_BACKGROUND
+    uint8_t state = sonarState;
+    
+    if (state == SONAR_ECHO_DONE) {
+        // 58 мкс эха на сантиметр (туда и обратно при 343 м/с)
+        pushDistance(echoWidthMicros * 0.0343f / 2.0f);
+        sonarState = SONAR_IDLE;
+    } else if (state != SONAR_IDLE && micros() - pingMicros > SONAR_ECHO_TIMEOUT_US) {
+        // Эхо не пришло или не кончилось: препятствия в пределах дальности нет
+        pushDistance(400.0f);
+        sonarState = SONAR_IDLE;
+    } else if (state == SONAR_IDLE && millis() - lastPingMillis >= SONAR_PING_INTERVAL_MS) {
+        lastPingMillis = millis();
+        sonarState = SONAR_WAIT_ECHO;
+        digitalWrite(Hardware::TRIG_PIN, HIGH);
+        delayMicroseconds(10);
+        digitalWrite(Hardware::TRIG_PIN, LOW);
+        pingMicros = micros();
+    }
+#endif
+}
+
+float Sensors::getDistanceCm() const {
+    if (sonarRingCount == 0) {
+        return 400.0f;
+    }
+    
+    // Медиана вставками: одиночный выброс (эхо от пола, пропуск) не проходит
+    float sorted[SONAR_RING_SIZE];
+    for (uint8_t i = 0; i < sonarRingCount; i++) {
+        float v = sonarRing[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    return sorted[sonarRingCount / 2];
+}
+
+float Sensors::getLatestDistanceCm() const {
+    if (sonarRingCount == 0) {
+        return 400.0f;
+    }
+    return sonarRing[(sonarRingPos + SONAR_RING_SIZE - 1) % SONAR_RING_SIZE];
+}
+
+float Sensors::takeAccelPeak() {
+    float peak = reflexAccelPeak;
+    reflexAccelPeak = 0.0f;
+    return peak;
+}
+
+void Sensors::pushDistance(float cm) {
+    if (cm > Hardware::MAX_DISTANCE_CM) {
+        cm = Hardware::MAX_DISTANCE_CM;
+    }
+    sonarRing[sonarRingPos] = cm;
+    sonarRingPos = (sonarRingPos + 1) % SONAR_RING_SIZE;
+    if (sonarRingCount < SONAR_RING_SIZE) {
+        sonarRingCount++;
+    }
+    sonarSequence++;
+}
+
+Sensors* Sensors::echoOwner = nullptr;
+
+void Sensors::echoIsr() {
+    if (echoOwner != nullptr) {
+        echoOwner->handleEchoEdge();
+    }
+}
+
+void Sensors::handleEchoEdge() {
+    bool echoHigh = digitalRead(Hardware::ECHO_PIN) == HIGH;
+    
+    if (sonarState == SONAR_WAIT_ECHO && echoHigh) {
+        echoStartMicros = micros();
+        sonarState = SONAR_ECHO_HIGH;
+    } else if (sonarState == SONAR_ECHO_HIGH && !echoHigh) {
+        echoWidthMicros = micros() - echoStartMicros;
+        sonarState = SONAR_ECHO_DONE;
+    }
+}
+
+uint16_t Sensors::pollImu() {
+    if (!imuFifoEnabled || millis() - lastImuPollMillis < IMU_POLL_INTERVAL_MS) {
+        return 0;
+    }
+    lastImuPollMillis = millis();
+    
+    uint8_t countBytes[2];
+    if (!readMpuRegisters(REG_FIFO_COUNT_H, countBytes, 2)) {
+        return 0;
+    }
+    size_t count = ((size_t)countBytes[0] << 8) | countBytes[1];
+    
+    if (count > IMU_FIFO_SIZE - IMU_SAMPLE_BYTES) {
+        // При переполнении датчик затирает старые байты: границы отсчётов потеряны
+        resetImuFifo();
+        imuOverflows++;
+        return 0;
+    }
+    
+    size_t available = count / IMU_SAMPLE_BYTES;
+    if (available > IMU_MAX_SAMPLES_PER_POLL) {
+        available = IMU_MAX_SAMPLES_PER_POLL;   // остаток - в следующем tick
+    }
+    
+    uint8_t burst[IMU_SAMPLES_PER_READ * IMU_SAMPLE_BYTES];
+    uint16_t processed = 0;
+    while (processed < available) {
+        uint8_t n = (available - processed < IMU_SAMPLES_PER_READ)
+                    ? (uint8_t)(available - processed) : IMU_SAMPLES_PER_READ;
+        if (!readMpuRegisters(REG_FIFO_R_W, burst, n * IMU_SAMPLE_BYTES)) {
+            resetImuFifo();
+            break;
+        }
+        for (uint8_t i = 0; i < n; i++) {
+            processImuSample(burst + i * IMU_SAMPLE_BYTES);
+        }
+        processed += n;
+    }
+    return processed;
+}
+
+void Sensors::processImuSample(const uint8_t* raw) {
+    float ax = (int16_t)((raw[0] << 8) | raw[1]) * ACCEL_SCALE;
+    float ay = (int16_t)((raw[2] << 8) | raw[3]) * ACCEL_SCALE;
+    float az = (int16_t)((raw[4] << 8) | raw[5]) * ACCEL_SCALE;
+    float gx = (int16_t)((raw[6] << 8) | raw[7]) * GYRO_SCALE;
+    float gy = (int16_t)((raw[8] << 8) | raw[9]) * GYRO_SCALE;
+    float gz = (int16_t)((raw[10] << 8) | raw[11]) * GYRO_SCALE;
+    
+    // Комплементарный фильтр: гироскоп за короткое время, акселерометр - против дрейфа
+    float accelRoll = atan2f(ay, az) * RAD_TO_DEGREES;
+    float accelPitch = atan2f(-ax, sqrtf(ay * ay + az * az)) * RAD_TO_DEGREES;
+    if (!orientationValid) {
+        roll = accelRoll;
+        pitch = accelPitch;
+        yaw = 0.0f;
+        orientationValid = true;
+    } else {
+        roll = IMU_FILTER_ALPHA * (roll + gx * RAD_TO_DEGREES * IMU_DT) +
+               (1.0f - IMU_FILTER_ALPHA) * accelRoll;
+        pitch = IMU_FILTER_ALPHA * (pitch + gy * RAD_TO_DEGREES * IMU_DT) +
+                (1.0f - IMU_FILTER_ALPHA) * accelPitch;
+        // Курс без магнитометра - только интеграл гироскопа (дрейфует)
+        yaw += gz * RAD_TO_DEGREES * IMU_DT;
+        if (yaw > 180.0f) {
+            yaw -= 360.0f;
+        } else if (yaw < -180.0f) {
+            yaw += 360.0f;
+        }
+    }
+    
+    float accelMag = sqrtf(ax * ax + ay * ay + az * az);
+    float gyroMag = sqrtf(gx * gx + gy * gy + gz * gz);
+    if (windowSamples > 0) {
+        float dx = ax - lastAx;
+        float dy = ay - lastAy;
+        float dz = az - lastAz;
+        float jerk = sqrtf(dx * dx + dy * dy + dz * dz) / IMU_DT;
+        if (jerk > windowJerkPeak) {
+            windowJerkPeak = jerk;
+        }
+    }
+    if (accelMag > windowAccelPeak) {
+        windowAccelPeak = accelMag;
+    }
+    if (accelMag > reflexAccelPeak) {
+        reflexAccelPeak = accelMag;
+    }
+    if (gyroMag > windowGyroPeak) {
+        windowGyroPeak = gyroMag;
+    }
+    windowGyroSumX += gx;
+    windowGyroSumY += gy;
+    windowGyroSumZ += gz;
+    if (windowSamples < 0xFFFF) {
+        windowSamples++;
+    }
+    
+    lastAx = ax;
+    lastAy = ay;
+    lastAz = az;
+    lastGx = gx;
+    lastGy = gy;
+    lastGz = gz;
+}
+
+void Sensors::takeImuWindow(SensorSnapshot& snapshot) {
+    snapshot.ax = lastAx;
+    snapshot.ay = lastAy;
+    snapshot.az = lastAz;
+    snapshot.gx = lastGx;
+    snapshot.gy = lastGy;
+    snapshot.gz = lastGz;
+    snapshot.roll = roll;
+    snapshot.pitch = pitch;
+    snapshot.yaw = yaw;
+    snapshot.accelPeak = windowAccelPeak;
+    snapshot.gyroPeak = windowGyroPeak;
+    snapshot.jerkPeak = windowJerkPeak;
+    snapshot.imuSamples = windowSamples;
+    if (windowSamples > 0) {
+        snapshot.gyroMeanX = windowGyroSumX / windowSamples;
+        snapshot.gyroMeanY = windowGyroSumY / windowSamples;
+        snapshot.gyroMeanZ = windowGyroSumZ / windowSamples;
+    } else {
+        snapshot.gyroMeanX = snapshot.gyroMeanY = snapshot.gyroMeanZ = 0.0f;
+    }
+    
+    windowSamples = 0;
+    windowAccelPeak = 0.0f;
+    windowGyroPeak = 0.0f;
+    windowJerkPeak = 0.0f;
+    windowGyroSumX = windowGyroSumY = windowGyroSumZ = 0.0f;
+}
+
+bool Sensors::setupImuFifo() {
+    // При включённом DLPF внутренняя частота гироскопа - 1 кГц
+    if (!writeMpuRegister(REG_SMPLRT_DIV, (uint8_t)(1000 / IMU_SAMPLE_RATE_HZ - 1))) {
+        return false;
+    }
+    // XG, YG, ZG и ACCEL: в FIFO по 12 байт на отсчёт, в порядке регистров
+    if (!writeMpuRegister(REG_FIFO_EN, 0x78)) {
+        return false;
+    }
+    resetImuFifo();
+    lastImuPollMillis = millis();
+    return true;
+}
+
+void Sensors::resetImuFifo() {
+    writeMpuRegister(REG_USER_CTRL, 0x04);   // FIFO_RESET
+    writeMpuRegister(REG_USER_CTRL, 0x40);   // FIFO_EN
+}
+
+bool Sensors::writeMpuRegister(uint8_t reg, uint8_t value) {
+    Wire1.beginTransmission(MPU_ADDR);
+    Wire1.write(reg);
+    Wire1.write(value);
+    return Wire1.endTransmission() == 0;
+}
+
+bool Sensors::readMpuRegisters(uint8_t reg, uint8_t* dst, uint8_t len) {
+    Wire1.beginTransmission(MPU_ADDR);
+    Wire1.write(reg);
+    if (Wire1.endTransmission(false) != 0) {
+        return false;
+    }
+    if (Wire1.requestFrom(MPU_ADDR, len) != len) {
+        return false;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        dst[i] = (uint8_t)Wire1.read();
+    }
+    return true;
+}
+
 bool Sensors::isDark() {
     int lightRaw;
     return readLightSensor(lightRaw);
@@ -2,12 +2,20 @@
 #include "../include/CommandDictionary.h"
 #include "../include/Logger.h"
 #include "../include/SoftRTC.h"
+#include "../include/CameraModule.h"
+#include "../include/WifiLink.h"
+#include "../include/CarController.h"
+#include "../include/rgb565_gray.h"
+#include "../include/Perf.h"
+#include "../include/MemoryArena.h"
 #include <cstring>
 
-void SerialCommandProcessor::begin(CommandDictionary* dict, Logger* log, SoftRTC* clock) {
+void SerialCommandProcessor::begin(CommandDictionary* dict, Logger* log, SoftRTC* clock, CameraModule* cam, WifiLink* link) {
     commandDict = dict;
     logger = log;
     rtc = clock;
+    camera = cam;
+    wifiLink = link;
     lineBufferPos = 0;
     
     Serial.println("SerialCommandProcessor: Ready");
@@ -27,9 +35,10 @@ bool SerialCommandProcessor::readLine(char* buffer, size_t bufferSize) {
         
         if (c == '\n' || c == '\r') {
             if (lineBufferPos > 0) {
-                lineBuffer[lineBufferPos] = '\0';
-                strncpy(buffer, lineBuffer, bufferSize - 1);
-                buffer[bufferSize - 1] = '\0';
+                // Длина строки известна: копия с явным терминатором
+                size_t len = (lineBufferPos < bufferSize - 1) ? lineBufferPos : bufferSize - 1;
+                memcpy(buffer, lineBuffer, len);
+                buffer[len] = '\0';
                 lineBufferPos = 0;
                 return true;
             }
@@ -64,10 +73,91 @@ void SerialCommandProcessor::parseCommand(const char* line) {
         Serial.print("Step duration: ");
         Serial.print(*defaultStepDurationMs);
         Serial.println(" ms");
+        Serial.print("Step mode: ");
+        Serial.println(*pipelinedMode ? "pipelined" : "serial");
+        Serial.print("Reflex stop: ");
+        if (*safetyDistanceCm == 0) {
+            Serial.print("obstacle off");
+        } else {
+            Serial.print("obstacle < ");
+            Serial.print(*safetyDistanceCm);
+            Serial.print(" cm");
+        }
+        Serial.print(", impact > ");
+        Serial.print(CAR_SAFETY_IMPACT_G, 1);
+        Serial.println(" g");
+        Serial.print("Camera: ");
+        Serial.print(camera->isInitialized() ? "ON" : "OFF");
+        Serial.print(", mode ");
+        Serial.print(CameraModule::geometryName(camera->getGeometry()));
+        Serial.print(", pipeline ");
+        Serial.print(CameraModule::pixelFormatName(camera->getPixelFormat()));
+        if (camera->isInitialized()) {
+            Serial.print(", SCCB ");
+            Serial.print(camera->getSccbClock() / 1000);
+            Serial.print(" kHz, init ");
+            Serial.print(camera->getInitMillis());
+            Serial.print(camera->isWarmStarted() ? " ms (warm)" : " ms");
+        }
+        Serial.println();
+        Serial.print("Link: ");
+        Serial.print(WifiLink::modeName(wifiLink->getMode()));
+        Serial.print(", window ");
+        Serial.print(wifiLink->getWindow());
+        Serial.print(", codec ");
+        Serial.print(FrameCodec::codecName(wifiLink->getCodec()));
+        Serial.print(", RX CRC errors ");
+        Serial.println(wifiLink->getRxCrcErrors());
+        Serial.print("Serial1: ");
+        Serial.print(wifiLink->getBaud());
+        Serial.print(" baud, ceiling ");
+        Serial.print(wifiLink->getBaudCeiling());
+        Serial.print(", fallbacks ");
+        Serial.print(wifiLink->getBaudFallbacks());
+        Serial.println(wifiLink->isNegotiating() ? ", negotiating" : "");
+        Serial.print("Vision: threshold ");
+        Serial.print(wifiLink->getVision().getThreshold());
+        Serial.print(", reused ");
+        Serial.print(wifiLink->getVision().getReusedCount());
+        Serial.print("/");
+        Serial.println(wifiLink->getVision().getAnalyzedCount());
+        const ImageRateController& imageRate = wifiLink->getImageRate();
+        Serial.print("Image rate: ");
+        if (imageRate.getTargetCycle() == 0) {
+            Serial.print("off");
+        } else {
+            Serial.print("level ");
+            Serial.print(imageRate.getLevel());
+            Serial.print(" (");
+            Serial.print(CameraModule::geometryName(imageRate.getGeometry()));
+            Serial.print(imageRate.useCompactCodec() ? " inter" : "");
+            Serial.print(", every ");
+            Serial.print(imageRate.getPeriod());
+            Serial.print("), target ");
+            Serial.print(imageRate.getTargetCycle());
+            Serial.print(" ms");
+        }
+        Serial.print(", cycle ");
+        Serial.print(imageRate.getCycleMs());
+        Serial.print(" ms, budget ");
+        Serial.print(imageRate.getBudgetMs());
+        Serial.print(" ms, ");
+        Serial.print(imageRate.getThroughput());
+        Serial.print(" B/s, retry ");
+        Serial.print(imageRate.getRetryPermille());
+        Serial.print("/1000, aborted ");
+        Serial.print(imageRate.getAborted());
+        Serial.print(", rssi ");
+        Serial.println(imageRate.getRssi());
+        Serial.print("Bridge: ");
+        Serial.println(wifiLink->getBridgeStatus()[0] ? wifiLink->getBridgeStatus() : "no status yet");
     }
     else if (strcmp(line, "log") == 0) {
         logger->printAllToSerial();
     }
+    else if (strcmp(line, "log dump") == 0) {
+        logger->dumpBinary(Serial);
+    }
     else if (strcmp(line, "log clear") == 0) {
         logger->clear();
         Serial.println("Log cleared");
@@ -75,6 +165,34 @@ void SerialCommandProcessor::parseCommand(const char* line) {
     else if (strcmp(line, "dict") == 0) {
         commandDict->printAllToSerial();
     }
+    else if (strncmp(line, "dict set ", 9) == 0) {
+        CommandConfig cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        int left = 0;
+        int right = 0;
+        unsigned long ms = 0;
+        if (sscanf(line + 9, "%15s %d %d %lu", cfg.name, &left, &right, &ms) == 4 &&
+            left >= -100 && left <= 100 && right >= -100 && right <= 100) {
+            cfg.leftSpeed = (int16_t)left;
+            cfg.rightSpeed = (int16_t)right;
+            cfg.baseDurationMs = ms;
+            if (commandDict->updateConfig(cfg)) {
+                Serial.print("Command ");
+                Serial.print(cfg.name);
+                Serial.print(" id=");
+                Serial.println(commandDict->lookup(cfg.name));
+            }
+        } else {
+            Serial.println("Usage: dict set NAME <left -100..100> <right -100..100> <ms>");
+        }
+    }
+    else if (strncmp(line, "dict macro ", 11) == 0) {
+        defineMacro(line + 11);
+    }
+    else if (strcmp(line, "dict save") == 0) {
+        commandDict->flush();
+        Serial.println("Dictionary saved");
+    }
     else if (strcmp(line, "serial on") == 0) {
         *serialLoggingEnabled = true;
         Serial.println("Serial logging enabled");
@@ -92,6 +210,128 @@ void SerialCommandProcessor::parseCommand(const char* line) {
         Serial.print(*defaultStepDurationMs);
         Serial.println(" ms");
     }
+    else if (strcmp(line, "step serial") == 0) {
+        *pipelinedMode = false;
+        Serial.println("Step mode set to serial");
+    }
+    else if (strcmp(line, "step pipelined") == 0) {
+        *pipelinedMode = true;
+        Serial.println("Step mode set to pipelined");
+    }
+    else if (strncmp(line, "safety ", 7) == 0) {
+        int cm = atoi(line + 7);
+        if (cm >= 0 && cm <= Hardware::MAX_DISTANCE_CM) {
+            *safetyDistanceCm = (uint16_t)cm;
+            Serial.print("Reflex stop distance set to ");
+            Serial.print(*safetyDistanceCm);
+            Serial.println(cm == 0 ? " cm (off)" : " cm");
+        } else {
+            Serial.print("Usage: safety 0..");
+            Serial.println(Hardware::MAX_DISTANCE_CM);
+        }
+    }
+    else if (strncmp(line, "cam ", 4) == 0) {
+        ImageGeometry geometry;
+        PixelFormat format;
+        if (CameraModule::parseGeometry(line + 4, geometry)) {
+            // Геометрия для уровня 0; на уровнях от 2 full снимается как half
+            wifiLink->getImageRate().setRequestedGeometry(geometry);
+            camera->setGeometry(wifiLink->getImageRate().getGeometry());
+            Serial.print("Camera mode set to ");
+            Serial.println(CameraModule::geometryName(geometry));
+        } else if (CameraModule::parsePixelFormat(line + 4, format)) {
+            if (camera->setPixelFormat(format)) {
+                Serial.print("Camera pipeline set to ");
+                Serial.println(CameraModule::pixelFormatName(format));
+            } else {
+                Serial.println("Camera pipeline change failed");
+            }
+        } else {
+            Serial.println("Usage: cam full|half|horizon|rgb|yuv");
+        }
+    }
+    else if (strcmp(line, "link baud") == 0) {
+        wifiLink->renegotiate();
+        Serial.println("Serial1 rate negotiation scheduled");
+    }
+    else if (strncmp(line, "link ", 5) == 0) {
+        WifiLink::Mode mode;
+        if (WifiLink::parseMode(line + 5, mode)) {
+            wifiLink->setMode(mode);
+            Serial.print("Link mode set to ");
+            Serial.println(WifiLink::modeName(mode));
+        } else {
+            Serial.println("Usage: link text|binary|baud");
+        }
+    }
+    else if (strncmp(line, "window ", 7) == 0) {
+        int chunks = atoi(line + 7);
+        if (chunks >= 1 && chunks <= WifiLink::MAX_WINDOW) {
+            wifiLink->setWindow((uint8_t)chunks);
+            Serial.print("Transfer window set to ");
+            Serial.println(wifiLink->getWindow());
+        } else {
+            Serial.print("Usage: window 1..");
+            Serial.println(WifiLink::MAX_WINDOW);
+        }
+    }
+    else if (strncmp(line, "vision ", 7) == 0) {
+        // atoi("off") == 0: порог 0 - передавать каждый кадр
+        int diff = atoi(line + 7);
+        if (diff >= 0 && diff < VISION_DIFF_NONE) {
+            wifiLink->getVision().setThreshold((uint8_t)diff);
+            Serial.print("Frame reuse threshold set to ");
+            Serial.print(diff);
+            Serial.println(diff == 0 ? " (off)" : "");
+        } else {
+            Serial.print("Usage: vision 0..");
+            Serial.println(VISION_DIFF_NONE - 1);
+        }
+    }
+    else if (strncmp(line, "rate ", 5) == 0) {
+        // atoi("off") == 0: без адаптации
+        long ms = atol(line + 5);
+        if (ms >= 0 && ms <= 60000) {
+            wifiLink->getImageRate().setTargetCycle((uint32_t)ms);
+            camera->setGeometry(wifiLink->getImageRate().getGeometry());
+            Serial.print("Image rate target cycle set to ");
+            Serial.print(ms);
+            Serial.println(ms == 0 ? " ms (off)" : " ms");
+        } else {
+            Serial.println("Usage: rate 0..60000");
+        }
+    }
+    else if (strncmp(line, "codec ", 6) == 0) {
+        FrameCodecId id;
+        if (FrameCodec::parseCodec(line + 6, id)) {
+            wifiLink->setCodec(id);
+            Serial.print("Image codec set to ");
+            Serial.println(FrameCodec::codecName(id));
+        } else {
+            Serial.println("Usage: codec raw|intra|inter");
+        }
+    }
+    else if (strcmp(line, "perf") == 0) {
+        Perf::printToSerial();
+    }
+    else if (strcmp(line, "perf reset") == 0) {
+        Perf::reset();
+        Serial.println("Perf stats reset");
+    }
+    else if (strcmp(line, "perf data on") == 0) {
+        Perf::setDataEnabled(true);
+        Serial.println("Perf in DATA: on");
+    }
+    else if (strcmp(line, "perf data off") == 0) {
+        Perf::setDataEnabled(false);
+        Serial.println("Perf in DATA: off");
+    }
+    else if (strcmp(line, "mem") == 0) {
+        MemoryArena::printToSerial();
+    }
+    else if (strcmp(line, "bench gray") == 0) {
+        rgb565_gray_benchmark();
+    }
     else if (strlen(line) > 0) {
         Serial.print("Unknown command: ");
         Serial.println(line);
@@ -104,13 +344,69 @@ void SerialCommandProcessor::printHelp() {
     Serial.println("  help              - Show this help");
     Serial.println("  status            - Show system status");
     Serial.println("  log               - Print command log");
-    Serial.println("  log clear         - Clear command log");
+    Serial.println("  log dump          - Stream packed log (flash + RAM) as binary");
+    Serial.println("  log clear         - Clear command log (RAM and flash)");
     Serial.println("  dict              - Print command dictionary");
+    Serial.println("  dict set NAME L R ms - Add or change command (L/R -100..100)");
+    Serial.println("  dict macro NAME ms CMD:permille... - Add or change macro (up to 4 steps)");
+    Serial.println("  dict save         - Write dictionary changes to flash now");
     Serial.println("  serial on         - Enable serial logging");
     Serial.println("  serial off        - Disable serial logging");
     Serial.println("  time dd:MM:yyyy hh:mm:ss - Set time");
     Serial.println("  duration <ms>     - Set step duration");
+    Serial.println("  step serial|pipelined - Overlap next step upload with driving");
+    Serial.println("  safety <cm>       - Reflex stop distance while driving (0 = off)");
+    Serial.println("  cam full|half|horizon - Set camera image mode");
+    Serial.println("  cam rgb|yuv       - Set camera pixel pipeline");
+    Serial.println("  link text|binary  - Set Serial1 format to NodeMCU");
+    Serial.println("  link baud         - Renegotiate Serial1 rate (up to WIFI_LINK_MAX_BAUD)");
+    Serial.println("  window <n>        - Image chunks in flight (1 = stop-and-wait)");
+    Serial.println("  codec raw|intra|inter - Image compression before transfer");
+    Serial.println("  vision <diff>|off - Skip upload of frames closer than diff to last sent");
+    Serial.println("  rate <ms>|off     - Target step time for adaptive image size/codec/period");
+    Serial.println("  perf              - Stage latency stats (count/min/avg/p95/max, us)");
+    Serial.println("  perf reset        - Reset stage latency stats");
+    Serial.println("  perf data on|off  - Stage latencies in DATA JSON");
+    Serial.println("  mem               - Arena regions, scratch peaks, stack depth");
+    Serial.println("  bench gray        - Benchmark RGB565->gray kernels");
     Serial.println("==========================");
 }
 
-
+void SerialCommandProcessor::defineMacro(const char* args) {
+    // NAME ms CMD:permille [CMD:permille ...]
+    CommandMacro macro;
+    memset(&macro, 0, sizeof(macro));
+    int consumed = 0;
+    unsigned long ms = 0;
+    if (sscanf(args, "%15s %lu%n", macro.name, &ms, &consumed) < 2) {
+        Serial.println("Usage: dict macro NAME <ms> CMD:permille [CMD:permille ...]");
+        return;
+    }
+    macro.baseDurationMs = ms;
+    
+    const char* p = args + consumed;
+    char stepName[16];
+    unsigned int permille = 0;
+    int stepLen = 0;
+    while (sscanf(p, " %15[^:]:%u%n", stepName, &permille, &stepLen) == 2) {
+        int id = commandDict->lookup(stepName);
+        if (id < 0 || commandDict->isMacro(id) || macro.stepCount >= MAX_MACRO_STEPS || permille > 1000) {
+            Serial.print("Bad macro step: ");
+            Serial.println(stepName);
+            return;
+        }
+        CommandMacroStep& step = macro.steps[macro.stepCount++];
+        step.commandId = (uint8_t)id;
+        step.permille = (uint16_t)permille;
+        p += stepLen;
+    }
+    
+    if (macro.stepCount == 0 || !commandDict->updateMacro(macro)) {
+        Serial.println("Macro not saved");
+        return;
+    }
+    Serial.print("Macro ");
+    Serial.print(macro.name);
+    Serial.print(" id=");
+    Serial.println(commandDict->lookup(macro.name));
+}
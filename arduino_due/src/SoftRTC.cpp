@@ -65,6 +65,53 @@ void SoftRTC::update() {
     }
 }
 
+static bool isLeapYear(uint16_t year) {
+    return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
+}
+
+static uint8_t daysInMonthOf(uint8_t month, uint16_t year) {
+    static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return (month == 2 && isLeapYear(year)) ? 29 : days[month - 1];
+}
+
+uint32_t SoftRTC::toEpoch(const DateTime& ts) {
+    if (ts.yyyy < 2000 || ts.MM < 1 || ts.MM > 12 || ts.dd < 1) {
+        return 0;
+    }
+    uint32_t days = 0;
+    for (uint16_t y = 2000; y < ts.yyyy; y++) {
+        days += isLeapYear(y) ? 366 : 365;
+    }
+    for (uint8_t m = 1; m < ts.MM; m++) {
+        days += daysInMonthOf(m, ts.yyyy);
+    }
+    days += ts.dd - 1;
+    return ((days * 24 + ts.hh) * 60 + ts.mm) * 60 + ts.ss;
+}
+
+DateTime SoftRTC::fromEpoch(uint32_t epoch) {
+    DateTime ts;
+    ts.ss = epoch % 60;
+    epoch /= 60;
+    ts.mm = epoch % 60;
+    epoch /= 60;
+    ts.hh = epoch % 24;
+    uint32_t days = epoch / 24;
+    
+    ts.yyyy = 2000;
+    while (days >= (uint32_t)(isLeapYear(ts.yyyy) ? 366 : 365)) {
+        days -= isLeapYear(ts.yyyy) ? 366 : 365;
+        ts.yyyy++;
+    }
+    ts.MM = 1;
+    while (days >= daysInMonthOf(ts.MM, ts.yyyy)) {
+        days -= daysInMonthOf(ts.MM, ts.yyyy);
+        ts.MM++;
+    }
+    ts.dd = days + 1;
+    return ts;
+}
+
 void SoftRTC::addSeconds(uint32_t seconds) {
     baseTime.ss += seconds;
     
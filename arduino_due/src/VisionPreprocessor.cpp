@@ -0,0 +1,97 @@
+#include "../include/VisionPreprocessor.h"
+#include <string.h>
+
+void VisionPreprocessor::begin() {
+    memset(&descriptor, 0, sizeof(descriptor));
+    descriptor.diff = VISION_DIFF_NONE;
+    threshold = VISION_DIFF_THRESHOLD;
+    hasReference = false;
+    referenceStep = 0;
+    reuseRun = 0;
+    lastWidth = 0;
+    lastHeight = 0;
+    reusedCount = 0;
+    analyzedCount = 0;
+}
+
+bool VisionPreprocessor::analyze(const ImageSnapshot& image) {
+    const uint8_t* frame = image.buffer;
+    uint16_t width = image.width;
+    uint16_t height = image.height;
+    lastWidth = width;
+    lastHeight = height;
+    lastFormat = image.pixelFormat;
+    analyzedCount++;
+
+    if (frame == nullptr || width < VISION_THUMB_W || height < VISION_THUMB_H) {
+        descriptor.diff = VISION_DIFF_NONE;
+        return false;
+    }
+
+    // Блоки миниатюры - целочисленные границы, у полосы 160x40 они неравные
+    uint16_t xEdge[VISION_THUMB_W + 1];
+    for (uint8_t bx = 0; bx <= VISION_THUMB_W; bx++) {
+        xEdge[bx] = (uint32_t)bx * width / VISION_THUMB_W;
+    }
+    uint16_t hist[VISION_HIST_BINS] = { 0 };
+    for (uint8_t by = 0; by < VISION_THUMB_H; by++) {
+        uint16_t y0 = (uint32_t)by * height / VISION_THUMB_H;
+        uint16_t y1 = (uint32_t)(by + 1) * height / VISION_THUMB_H;
+        uint32_t sums[VISION_THUMB_W] = { 0 };
+        for (uint16_t y = y0; y < y1; y++) {
+            const uint8_t* row = frame + (size_t)y * width;
+            for (uint8_t bx = 0; bx < VISION_THUMB_W; bx++) {
+                uint32_t sum = 0;
+                for (uint16_t x = xEdge[bx]; x < xEdge[bx + 1]; x++) {
+                    uint8_t p = row[x];
+                    sum += p;
+                    hist[p >> 5]++;
+                }
+                sums[bx] += sum;
+            }
+        }
+        for (uint8_t bx = 0; bx < VISION_THUMB_W; bx++) {
+            uint32_t area = (uint32_t)(y1 - y0) * (xEdge[bx + 1] - xEdge[bx]);
+            descriptor.thumb[by * VISION_THUMB_W + bx] = (uint8_t)((sums[bx] + area / 2) / area);
+        }
+    }
+
+    uint32_t total = (uint32_t)width * height;
+    for (uint8_t i = 0; i < VISION_HIST_BINS; i++) {
+        descriptor.hist[i] = (uint8_t)(((uint32_t)hist[i] * 100 + total / 2) / total);
+    }
+
+    if (!hasReference || width != referenceWidth || height != referenceHeight ||
+        image.pixelFormat != referenceFormat) {
+        descriptor.diff = VISION_DIFF_NONE;
+        return false;
+    }
+
+    uint32_t diffSum = 0;
+    for (uint8_t i = 0; i < VISION_THUMB_SIZE; i++) {
+        int d = (int)descriptor.thumb[i] - (int)referenceThumb[i];
+        diffSum += (d < 0) ? -d : d;
+    }
+    uint32_t diff = (diffSum + VISION_THUMB_SIZE / 2) / VISION_THUMB_SIZE;
+    descriptor.diff = (diff >= VISION_DIFF_NONE) ? VISION_DIFF_NONE - 1 : (uint8_t)diff;
+
+    if (descriptor.diff >= threshold || reuseRun >= VISION_MAX_REUSE) {
+        return false;
+    }
+    reuseRun++;
+    reusedCount++;
+    return true;
+}
+
+void VisionPreprocessor::commit(bool delivered, uint32_t stepId) {
+    if (!delivered) {
+        return;
+    }
+    memcpy(referenceThumb, descriptor.thumb, sizeof(referenceThumb));
+    referenceWidth = lastWidth;
+    referenceHeight = lastHeight;
+    referenceFormat = lastFormat;
+    referenceStep = stepId;
+    hasReference = true;
+    reuseRun = 0;
+}
@@ -1,195 +1,748 @@
 #include "../include/WifiLink.h"
 #include "../include/types.h"
 #include "../include/base64.h"
+#include "../include/CameraModule.h"
+#include "../include/LinkProtocol.h"
+#include "../include/Perf.h"
+#include "../include/LinkJson.h"
+#include "../include/MemoryArena.h"
 #include <Arduino.h>
 #include <cstring>
 
-#if __has_include(<ArduinoJson.h>)
-#include <ArduinoJson.h>
-#define HAS_ARDUINO_JSON 1
-#else
-#define HAS_ARDUINO_JSON 0
-#endif
-
 void WifiLink::begin() {
-    Serial1.begin(Hardware::SERIAL1_BAUD);
+    applyBaud(Hardware::SERIAL1_BAUD);
     lineBufferPos = 0;
+    bridgeStatus[0] = '\0';
+    txState = TX_IDLE;
+    commandReady = false;
+    rxParser.reset();
+    txSeq = 0;
+    mode = WIFI_LINK_DEFAULT_MODE;
+    setWindow(WIFI_LINK_DEFAULT_WINDOW);
+    codec.begin();
+    userCodec = codec.getCodec();
+    vision.begin();
+    imageRate.begin();
+    
+    // Согласование скорости - с первого poll, когда линия свободна
+    rateState = RATE_IDLE;
+    linkBaud = Hardware::SERIAL1_BAUD;
+    baudCandidate = 0;
+    baudCeiling = WIFI_LINK_MAX_BAUD;
+    ratePending = true;
+    fallbackPending = false;
+    rateAttempts = 0;
+    rateRetryMillis = millis();
+    linkErrors = 0;
+    linkErrorMillis = millis();
+    seenCrcErrors = 0;
+    baudFallbacks = 0;
+    replyPending = false;
+    replyMillis = 0;
     
     Serial.println("WifiLink: Serial1 initialized for NodeMCU communication");
     Serial.print("WifiLink: Baud rate = ");
-    Serial.println(Hardware::SERIAL1_BAUD);
+    Serial.print(Hardware::SERIAL1_BAUD);
+    Serial.print(", negotiating up to ");
+    Serial.println((uint32_t)WIFI_LINK_MAX_BAUD);
+    Serial.print("WifiLink: Mode = ");
+    Serial.print(modeName(mode));
+    Serial.print(", window = ");
+    Serial.print(window);
+    Serial.print(", codec = ");
+    Serial.println(FrameCodec::codecName(codec.getCodec()));
 }
 
-uint16_t WifiLink::crc16_ccitt(const uint8_t* data, size_t len) {
-    uint16_t crc = 0xFFFF;
-    for (size_t i = 0; i < len; i++) {
-        crc ^= (uint16_t)data[i] << 8;
-        for (uint8_t j = 0; j < 8; j++) {
-            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
-        }
+void WifiLink::setWindow(uint8_t chunks) {
+    if (chunks < 1) {
+        chunks = 1;
+    } else if (chunks > MAX_WINDOW) {
+        chunks = MAX_WINDOW;
     }
-    return crc;
+    window = chunks;
+}
+
+const char* WifiLink::modeName(Mode mode) {
+    return mode == MODE_BINARY ? "binary" : "text";
 }
 
-void WifiLink::sendData(uint32_t sessionId, uint32_t stepId,
-                        const DateTime& ts,
-                        const SensorSnapshot& sensors,
-                        const ImageSnapshot& image) {
+bool WifiLink::parseMode(const char* name, Mode& outMode) {
+    if (name == nullptr) {
+        return false;
+    }
+    if (strcmp(name, "text") == 0) {
+        outMode = MODE_TEXT;
+    } else if (strcmp(name, "binary") == 0) {
+        outMode = MODE_BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool WifiLink::startSend(uint32_t sessionId, uint32_t stepId,
+                         const DateTime& ts,
+                         const SensorSnapshot& sensors,
+                         const ImageSnapshot& image) {
+    if (txState != TX_IDLE || rateState != RATE_IDLE) {
+        return false;
+    }
     
-    bool imageTransferSuccess = false;
+    job.mode = mode;
+    job.window = window;
+    job.sessionId = sessionId;
+    job.stepId = stepId;
+    job.ts = ts;
+    job.sensors = sensors;
+    job.geometry = image.geometry;
+    job.pixelFormat = image.pixelFormat;
+    job.width = image.width;
+    job.height = image.height;
+    job.analyzed = false;
+    job.reused = false;
     
-    if (image.available && image.buffer != nullptr && image.bufferSize > 0) {
-        imageTransferSuccess = sendImageChunked(image.buffer, image.bufferSize, image.width, image.height);
-        if (!imageTransferSuccess) {
-            Serial.println("WifiLink: Image transfer failed");
-        } else {
-            delay(50);
-        }
+    if (!image.available || image.buffer == nullptr || image.bufferSize == 0) {
+        queueData(false);
+        return true;
+    }
+    
+    // Сцена не изменилась с последнего доставленного кадра: только ссылка на него
+    {
+        PERF_SCOPE(PERF_VISION);
+        job.reused = vision.analyze(image);
+    }
+    job.analyzed = true;
+    if (job.reused) {
+        Serial.print("WifiLink: Frame unchanged (diff ");
+        Serial.print(vision.getDescriptor().diff);
+        Serial.print("), reusing step ");
+        Serial.println(vision.getReferenceStep());
+        queueData(false);
+        return true;
+    }
+    
+    // Ответы от прошлых передач не должны попасть в окно этой
+    flushInput();
+    
+    PERF_SPAN_BEGIN(PERF_TRANSFER);
+    job.startMillis = millis();
+    job.readyMillis = 0;
+    job.compact = imageRate.useCompactCodec();
+    codec.setCodec(job.compact ? CODEC_INTER : userCodec);
+    {
+        PERF_SCOPE(PERF_ENCODE);
+        job.frame = codec.encode(image.buffer, image.width, image.height);
+    }
+    job.chunkSize = (job.mode == MODE_BINARY) ? BINARY_CHUNK_SIZE : CHUNK_RAW_SIZE;
+    job.totalChunks = (job.frame.size + job.chunkSize - 1) / job.chunkSize;
+    if (job.totalChunks > MAX_CHUNKS) {
+        Serial.println("WifiLink: Image too large for chunk map");
+        codec.commit(false);
+        vision.commit(false, stepId);
+        queueData(false);
+        return true;
     }
     
+    Serial.print("WifiLink: Sending image ");
+    Serial.print(job.width);
+    Serial.print("x");
+    Serial.print(job.height);
+    Serial.print(" in ");
+    Serial.print(job.totalChunks);
+    Serial.print(" chunks, ");
+    Serial.print(FrameCodec::codecName(job.frame.codec));
+    if (job.frame.flags & FRAME_FLAG_KEY) {
+        Serial.print(" key");
+    }
+    Serial.print(" ");
+    Serial.print(job.frame.size);
+    Serial.print("/");
+    Serial.print((uint32_t)job.width * job.height);
+    Serial.print(" bytes (");
+    Serial.print(modeName(job.mode));
+    Serial.print(", window ");
+    Serial.print(job.window);
+    Serial.println(")");
+    
+    // CRC кадра считается по ходу первой отправки чанков и уходит в IMG_END
+    queueImageStart();
+    txState = TX_WAIT_READY;
+    txStateMillis = millis();
+    return true;
+}
+
+void WifiLink::queueImageStart() {
+    const uint16_t crc = 0;   // 0 - CRC кадра в IMG_END
+    if (job.mode == MODE_BINARY) {
+        const uint8_t codecInfo[3] = { job.frame.codec, job.frame.flags, job.frame.keyId };
+        LinkFrameWriter start(txQueue);
+        start.begin(LINK_IMG_START, txSeq++, 15);
+        start.writeU16(job.width);
+        start.writeU16(job.height);
+        start.writeU16(job.totalChunks);
+        start.writeU16(crc);
+        start.writeU16((uint16_t)job.chunkSize);
+        start.writeU16(job.window);
+        start.write(codecInfo, sizeof(codecInfo));
+        start.end();
+    } else {
+        txQueue.print("IMG_START ");
+        txQueue.print(job.width);
+        txQueue.print(" ");
+        txQueue.print(job.height);
+        txQueue.print(" ");
+        txQueue.print(job.totalChunks);
+        txQueue.print(" 0x");
+        txQueue.print(crc, HEX);
+        txQueue.print(" ");
+        txQueue.print(job.window);
+        txQueue.print(" ");
+        txQueue.print(job.frame.codec);
+        txQueue.print(" ");
+        txQueue.print(job.frame.flags);
+        txQueue.print(" ");
+        txQueue.println(job.frame.keyId);
+    }
+}
+
+void WifiLink::queueData(bool imageSent) {
     char timestampStr[32];
-    formatTimestamp(ts, timestampStr, sizeof(timestampStr));
-    
-#if HAS_ARDUINO_JSON
-    StaticJsonDocument<1024> doc;
-    
-    doc["session_id"] = sessionId;
-    doc["step"] = stepId;
-    doc["timestamp"] = timestampStr;
-    
-    JsonObject sensorsObj = doc.createNestedObject("sensors");
-    sensorsObj["distance_cm"] = sensors.distanceCm;
-    sensorsObj["light_raw"] = sensors.lightRaw;
-    sensorsObj["light_dark"] = sensors.isDark;
-    
-    JsonObject mpuObj = sensorsObj.createNestedObject("mpu6050");
-    mpuObj["ax"] = sensors.ax;
-    mpuObj["ay"] = sensors.ay;
-    mpuObj["az"] = sensors.az;
-    mpuObj["gx"] = sensors.gx;
-    mpuObj["gy"] = sensors.gy;
-    mpuObj["gz"] = sensors.gz;
-    
-    JsonObject imageObj = doc.createNestedObject("image");
-    imageObj["available"] = imageTransferSuccess;
-    imageObj["width"] = imageTransferSuccess ? image.width : 0;
-    imageObj["height"] = imageTransferSuccess ? image.height : 0;
-    imageObj["format"] = "GRAY8";
-    
-    Serial1.print("DATA ");
-    serializeJson(doc, Serial1);
-    Serial1.println();
-    
-#else
-    Serial1.print("DATA {");
-    Serial1.print("\"session_id\":");
-    Serial1.print(sessionId);
-    Serial1.print(",\"step\":");
-    Serial1.print(stepId);
-    Serial1.print(",\"timestamp\":\"");
-    Serial1.print(timestampStr);
-    Serial1.print("\",\"sensors\":{");
-    Serial1.print("\"distance_cm\":");
-    Serial1.print(sensors.distanceCm, 1);
-    Serial1.print(",\"light_raw\":");
-    Serial1.print(sensors.lightRaw);
-    Serial1.print(",\"light_dark\":");
-    Serial1.print(sensors.isDark ? "true" : "false");
-    Serial1.print(",\"mpu6050\":{");
-    Serial1.print("\"ax\":");
-    Serial1.print(sensors.ax, 2);
-    Serial1.print(",\"ay\":");
-    Serial1.print(sensors.ay, 2);
-    Serial1.print(",\"az\":");
-    Serial1.print(sensors.az, 2);
-    Serial1.print(",\"gx\":");
-    Serial1.print(sensors.gx, 2);
-    Serial1.print(",\"gy\":");
-    Serial1.print(sensors.gy, 2);
-    Serial1.print(",\"gz\":");
-    Serial1.print(sensors.gz, 2);
-    Serial1.print("}},\"image\":{");
-    Serial1.print("\"available\":");
-    Serial1.print(imageTransferSuccess ? "true" : "false");
-    Serial1.print(",\"width\":");
-    Serial1.print(imageTransferSuccess ? image.width : 0);
-    Serial1.print(",\"height\":");
-    Serial1.print(imageTransferSuccess ? image.height : 0);
-    Serial1.print(",\"format\":\"GRAY8\"");
-    Serial1.println("}}");
-#endif
+    formatTimestamp(job.ts, timestampStr, sizeof(timestampStr));
+    const SensorSnapshot& sensors = job.sensors;
+    
+    // Порядок полей фиксирован: секция image первой, чтобы место под image_id
+    // стояло со смещения sizeof(LINK_DATA_IMAGE_ID_PREFIX) - 1
+    ArenaScratch scratch(SCRATCH_DATA_JSON);
+    char* txBuffer = (char*)scratch.data();
+    JsonWriter json(txBuffer, SCRATCH_DATA_JSON_SIZE);
+    json.lit(LINK_DATA_IMAGE_ID_PREFIX);
+    json.lit("null");
+    json.fill(' ', LINK_DATA_IMAGE_ID_SLOT - 4);
+    json.lit(",\"available\":");
+    json.boolean(imageSent);
+    json.lit(",\"width\":");
+    json.u32(imageSent ? job.width : 0);
+    json.lit(",\"height\":");
+    json.u32(imageSent ? job.height : 0);
+    json.lit(",\"format\":\"GRAY8\",\"mode\":");
+    json.str(CameraModule::geometryName(job.geometry));
+    json.lit(",\"pipeline\":");
+    json.str(CameraModule::pixelFormatName(job.pixelFormat));
+    if (job.reused) {
+        json.lit(",\"reuse_step\":");
+        json.u32(vision.getReferenceStep());
+    }
+    if (job.analyzed) {
+        // Миниатюра 8x6 - hex по строкам, гистограмма - % пикселей по 32 уровня
+        static const char HEX_DIGITS[] = "0123456789abcdef";
+        const VisionDescriptor& d = vision.getDescriptor();
+        json.lit(",\"diff\":");
+        json.u32(d.diff);
+        json.lit(",\"hist\":[");
+        for (uint8_t i = 0; i < VISION_HIST_BINS; i++) {
+            if (i > 0) {
+                json.put(',');
+            }
+            json.u32(d.hist[i]);
+        }
+        json.lit("],\"thumb\":\"");
+        for (uint8_t i = 0; i < VISION_THUMB_SIZE; i++) {
+            json.put(HEX_DIGITS[d.thumb[i] >> 4]);
+            json.put(HEX_DIGITS[d.thumb[i] & 0x0F]);
+        }
+        json.put('"');
+    }
+    
+    json.lit("},\"session_id\":");
+    json.u32(job.sessionId);
+    json.lit(",\"step\":");
+    json.u32(job.stepId);
+    json.lit(",\"timestamp\":");
+    json.str(timestampStr);
+    
+    json.lit(",\"sensors\":{\"distance_cm\":");
+    json.fixed(sensors.distanceCm, 1);
+    json.lit(",\"light_raw\":");
+    json.i32(sensors.lightRaw);
+    json.lit(",\"light_dark\":");
+    json.boolean(sensors.isDark);
+    json.lit(",\"mpu6050\":{\"ax\":");
+    json.fixed(sensors.ax, 2);
+    json.lit(",\"ay\":");
+    json.fixed(sensors.ay, 2);
+    json.lit(",\"az\":");
+    json.fixed(sensors.az, 2);
+    json.lit(",\"gx\":");
+    json.fixed(sensors.gx, 2);
+    json.lit(",\"gy\":");
+    json.fixed(sensors.gy, 2);
+    json.lit(",\"gz\":");
+    json.fixed(sensors.gz, 2);
+    json.lit(",\"roll\":");
+    json.fixed(sensors.roll, 1);
+    json.lit(",\"pitch\":");
+    json.fixed(sensors.pitch, 1);
+    json.lit(",\"yaw\":");
+    json.fixed(sensors.yaw, 1);
+    json.lit(",\"a_peak\":");
+    json.fixed(sensors.accelPeak, 2);
+    json.lit(",\"g_peak\":");
+    json.fixed(sensors.gyroPeak, 2);
+    json.lit(",\"g_mean\":[");
+    json.fixed(sensors.gyroMeanX, 3);
+    json.put(',');
+    json.fixed(sensors.gyroMeanY, 3);
+    json.put(',');
+    json.fixed(sensors.gyroMeanZ, 3);
+    json.lit("],\"jerk\":");
+    json.fixed(sensors.jerkPeak, 1);
+    json.lit(",\"samples\":");
+    json.u32(sensors.imuSamples);
+    json.lit("}}");
+    
+    // Решение ImageRateController для следующих кадров и его входы
+    json.lit(",\"rate\":{\"level\":");
+    json.u32(imageRate.getLevel());
+    json.lit(",\"period\":");
+    json.u32(imageRate.getPeriod());
+    json.lit(",\"bps\":");
+    json.u32(imageRate.getThroughput());
+    json.lit(",\"retry\":");
+    json.u32(imageRate.getRetryPermille());
+    json.lit(",\"cycle_ms\":");
+    json.u32(imageRate.getCycleMs());
+    json.lit(",\"budget_ms\":");
+    json.u32(imageRate.getBudgetMs());
+    json.lit(",\"rssi\":");
+    json.i32(imageRate.getRssi());
+    json.put('}');
+    
+    // Участки с прошлого DATA: [среднее, максимум], мкс
+    if (Perf::isDataEnabled()) {
+        json.lit(",\"perf\":{");
+        bool first = true;
+        for (uint8_t i = 0; i < PERF_PROBE_COUNT; i++) {
+            uint32_t avgUs, maxUs;
+            if (!Perf::getWindow((PerfProbeId)i, avgUs, maxUs)) {
+                continue;
+            }
+            if (!first) {
+                json.put(',');
+            }
+            json.str(Perf::probeName(i));
+            json.lit(":[");
+            json.u32(avgUs);
+            json.put(',');
+            json.u32(maxUs);
+            json.put(']');
+            first = false;
+        }
+        json.put('}');
+    }
+    json.put('}');
+    size_t jsonLen = json.length();
+    bool overflow = json.overflowed();
+    scratch.use(jsonLen + 1);
+    
+    if (overflow) {
+        Serial.println("WifiLink: DATA record truncated");
+    }
+    Perf::resetWindow();
+    
+    if (job.mode == MODE_BINARY) {
+        LinkFrameWriter frame(txQueue);
+        frame.begin(LINK_DATA, txSeq++, (uint16_t)jsonLen);
+        frame.write((const uint8_t*)txBuffer, jsonLen);
+        frame.end();
+    } else {
+        txQueue.print("DATA ");
+        txQueue.write((const uint8_t*)txBuffer, jsonLen);
+        txQueue.println();
+    }
+    txState = TX_IDLE;
+    replyPending = true;
+    replyMillis = millis();
 }
 
-bool WifiLink::waitForCommand(Command& outCmd, uint32_t timeoutMs) {
-    memset(outCmd.name, 0, sizeof(outCmd.name));
-    outCmd.durationMs = 0;
+void WifiLink::poll() {
+    txQueue.poll();
+    
+    LinkMessage msg;
+    while (readMessage(msg)) {
+        if (msg.type == LINK_CMD) {
+            // Команда приходит только после DATA, но сохраняем в любом состоянии
+            commandReady = parseCommand(msg.text, pendingCommand);
+            // Полный обмен прошёл: линия в порядке
+            replyPending = false;
+            linkErrors = 0;
+            continue;
+        }
+        if (msg.type == LINK_BAUD_ACK) {
+            handleRateReply(msg.mask);
+            continue;
+        }
+        if (msg.type == LINK_NAK && msg.index == 0xFFFE) {
+            // NodeMCU принял битый кадр
+            noteLinkError();
+        }
         
-    char buffer[256];
-    if (!readLine(buffer, sizeof(buffer), timeoutMs)) {
-        return false;
+        if (msg.type == LINK_IMG_READY && (txState == TX_WAIT_READY || txState == TX_CHUNKS)) {
+            if (txState == TX_CHUNKS) {
+                // Поток NodeMCU к серверу оборвался: мост забыл принятые чанки,
+                // кадр передаётся заново с чанка 0
+                Serial.println("WifiLink: NodeMCU restarted the transfer");
+                job.retransmits += job.next;
+            } else {
+                job.readyMillis = millis();
+                job.retransmits = 0;
+            }
+            memset(job.acked, 0, sizeof(job.acked));
+            job.base = 0;
+            job.next = 0;
+            job.imageCrc = 0xFFFF;
+            txState = TX_CHUNKS;
+        } else if (txState == TX_CHUNKS && !handleTransferReply(msg)) {
+            Serial.println("WifiLink: Transfer rejected by NodeMCU");
+            finishTransfer(false);
+        }
+        // ACK/NAK от прерванной передачи и прочие сообщения пропускаются
     }
     
-    if (strncmp(buffer, "CMD ", 4) != 0) {
-        return false;
+    if (rxParser.crcErrors != seenCrcErrors) {
+        seenCrcErrors = rxParser.crcErrors;
+        noteLinkError();
     }
     
-    const char* jsonStr = buffer + 4;
+    // Медленная линия не задерживает шаг: кадр бросается, DATA уходит без него
+    uint32_t deadline = imageRate.getDeadlineMs();
+    if (txState != TX_IDLE && deadline != 0 && millis() - job.startMillis >= deadline) {
+        Serial.print("WifiLink: Image transfer over ");
+        Serial.print(deadline);
+        Serial.println(" ms deadline");
+        finishTransfer(false);
+    } else if (txState == TX_WAIT_READY && millis() - txStateMillis >= READY_TIMEOUT_MS) {
+        Serial.println("WifiLink: No IMG_READY received");
+        noteLinkError();
+        finishTransfer(false);
+    } else if (txState == TX_CHUNKS && !advanceWindow()) {
+        noteLinkError();
+        finishTransfer(false);
+    }
     
-#if HAS_ARDUINO_JSON
-    StaticJsonDocument<256> doc;
-    DeserializationError error = deserializeJson(doc, jsonStr);
+    pollRate();
+    txQueue.poll();
+}
+
+void WifiLink::renegotiate() {
+    baudCeiling = WIFI_LINK_MAX_BAUD;
+    ratePending = true;
+    rateAttempts = 0;
+    rateRetryMillis = millis();
+}
+
+void WifiLink::pollRate() {
+    switch (rateState) {
+        case RATE_WAIT_ACCEPT:
+            if (millis() - rateStateMillis >= RATE_ACCEPT_TIMEOUT_MS) {
+                // NodeMCU ещё не готов (подключается к WiFi) или без согласования: позже
+                rateState = RATE_IDLE;
+                if (++rateAttempts < RATE_MAX_ATTEMPTS) {
+                    ratePending = true;
+                    rateRetryMillis = millis() + RATE_RETRY_MS;
+                } else {
+                    Serial.print("WifiLink: No baud negotiation reply, staying at ");
+                    Serial.println(linkBaud);
+                }
+            }
+            return;
+        
+        case RATE_SETTLE:
+            // NodeMCU переключается сразу после BAUD_ACK, небольшой запас на это
+            if (millis() - rateStateMillis >= RATE_SETTLE_MS) {
+                LinkFrameWriter test(txQueue);
+                test.begin(LINK_BAUD_TEST, txSeq++, LINK_BAUD_TEST_SIZE);
+                for (size_t i = 0; i < LINK_BAUD_TEST_SIZE; i++) {
+                    uint8_t b = linkBaudTestByte(i);
+                    test.write(&b, 1);
+                }
+                test.end();
+                rateState = RATE_WAIT_CONFIRM;
+                rateStateMillis = millis();
+            }
+            return;
+        
+        case RATE_WAIT_CONFIRM:
+            if (millis() - rateStateMillis >= RATE_CONFIRM_TIMEOUT_MS) {
+                // Образец не дошёл или ответ потерян: NodeMCU к этому времени уже вернулся
+                Serial.print("WifiLink: ");
+                Serial.print(baudCandidate);
+                Serial.print(" baud failed the test, staying at ");
+                Serial.println(linkBaud);
+                applyBaud(linkBaud);
+                baudCeiling = baudCandidate - 1;
+                rateState = RATE_IDLE;
+            }
+            return;
+        
+        case RATE_FALLBACK:
+            if (txQueue.idle() && (USART0->US_CSR & US_CSR_TXEMPTY)) {
+                applyBaud(Hardware::SERIAL1_BAUD);
+                linkBaud = Hardware::SERIAL1_BAUD;
+                rateState = RATE_IDLE;
+                // Выше - не раньше, чем через паузу, и не до сбойной скорости
+                ratePending = true;
+                rateAttempts = 0;
+                rateRetryMillis = millis() + RATE_RETRY_MS;
+            }
+            return;
+        
+        case RATE_IDLE:
+            break;
+    }
     
-    if (error) {
-        Serial.print("WifiLink: JSON parse error: ");
-        Serial.println(error.c_str());
-        return false;
+    if (replyPending && millis() - replyMillis >= REPLY_QUIET_MS) {
+        // DATA ушёл, а CMD так и нет: возможно, NodeMCU на другой скорости
+        replyPending = false;
+        noteLinkError();
     }
     
-    if (!doc.containsKey("command")) {
-        return false;
+    // Переключаться можно только на свободной линии
+    if (txState != TX_IDLE || !txQueue.idle() || !(USART0->US_CSR & US_CSR_TXEMPTY)) {
+        return;
     }
     
-    const char* commandName = doc["command"];
-    if (commandName == nullptr || strlen(commandName) == 0) {
-        return false;
+    if (fallbackPending) {
+        // Запрос базовой скорости ещё на текущей: NodeMCU вернётся, если его слышит
+        fallbackPending = false;
+        sendBaudRequest(Hardware::SERIAL1_BAUD);
+        rateState = RATE_FALLBACK;
+        return;
     }
     
-    strncpy(outCmd.name, commandName, sizeof(outCmd.name) - 1);
-    outCmd.name[sizeof(outCmd.name) - 1] = '\0';
+    // Пока NodeMCU занят HTTP запросом DATA, он не ответит на BAUD_REQ
+    if (!ratePending || replyPending || (int32_t)(millis() - rateRetryMillis) < 0) {
+        return;
+    }
+    ratePending = false;
     
-    if (doc.containsKey("duration_ms")) {
-        outCmd.durationMs = doc["duration_ms"];
+    baudCandidate = nextBaudCandidate();
+    if (baudCandidate == 0) {
+        return;
     }
-#else
-    const char* cmdStart = strstr(jsonStr, "\"command\":\"");
-    if (cmdStart == nullptr) {
-        return false;
+    sendBaudRequest(baudCandidate);
+    rateState = RATE_WAIT_ACCEPT;
+    rateStateMillis = millis();
+}
+
+void WifiLink::handleRateReply(uint32_t baud) {
+    if (rateState == RATE_WAIT_ACCEPT) {
+        rateAttempts = 0;
+        if (baud != baudCandidate) {
+            // NodeMCU не поддерживает эту скорость: выше не идём
+            Serial.print("WifiLink: NodeMCU refused ");
+            Serial.print(baudCandidate);
+            Serial.println(" baud");
+            baudCeiling = baudCandidate - 1;
+            rateState = RATE_IDLE;
+            return;
+        }
+        // BAUD_ACK пришёл целиком - BAUD_REQ давно ушёл, очередь пуста
+        applyBaud(baudCandidate);
+        rateState = RATE_SETTLE;
+        rateStateMillis = millis();
+    } else if (rateState == RATE_WAIT_CONFIRM) {
+        if (baud != baudCandidate) {
+            return;
+        }
+        linkBaud = baudCandidate;
+        rateState = RATE_IDLE;
+        Serial.print("WifiLink: Serial1 at ");
+        Serial.print(linkBaud);
+        Serial.println(" baud");
+        // Следующая ступень - сразу, пока линия свободна
+        ratePending = true;
+        rateRetryMillis = millis();
+    } else if (rateState == RATE_IDLE && baud == Hardware::SERIAL1_BAUD) {
+        // BAUD_ACK без запроса: NodeMCU запустился или откатился и готов к согласованию
+        ratePending = true;
+        rateAttempts = 0;
+        rateRetryMillis = millis();
+    }
+}
+
+void WifiLink::noteLinkError() {
+    if (millis() - linkErrorMillis > WIFI_LINK_ERROR_WINDOW_MS) {
+        linkErrorMillis = millis();
+        linkErrors = 0;
     }
-    cmdStart += 11;
+    if (++linkErrors < WIFI_LINK_ERROR_BURST || linkBaud == Hardware::SERIAL1_BAUD ||
+        rateState != RATE_IDLE || fallbackPending) {
+        return;
+    }
+    linkErrors = 0;
     
-    const char* cmdEnd = strchr(cmdStart, '"');
-    if (cmdEnd == nullptr) {
+    Serial.print("WifiLink: Error burst at ");
+    Serial.print(linkBaud);
+    Serial.println(" baud, falling back");
+    baudCeiling = linkBaud - 1;
+    baudFallbacks++;
+    fallbackPending = true;
+}
+
+uint32_t WifiLink::nextBaudCandidate() const {
+    for (uint8_t i = 0; i < LINK_BAUD_RATE_COUNT; i++) {
+        uint32_t baud = LINK_BAUD_RATES[i];
+        if (baud > linkBaud && baud <= baudCeiling && baud <= (uint32_t)WIFI_LINK_MAX_BAUD) {
+            return baud;
+        }
+    }
+    return 0;
+}
+
+void WifiLink::sendBaudRequest(uint32_t baud) {
+    LinkFrameWriter request(txQueue);
+    request.begin(LINK_BAUD_REQ, txSeq++, 4);
+    request.writeU16((uint16_t)(baud & 0xFFFF));
+    request.writeU16((uint16_t)(baud >> 16));
+    request.end();
+}
+
+void WifiLink::applyBaud(uint32_t baud) {
+    Serial1.begin(baud);
+    // CD + FP/8 = MCK / (16 * baud), округление до 1/8
+    uint32_t div8 = (VARIANT_MCK + baud) / (2 * baud);
+    USART0->US_BRGR = US_BRGR_CD(div8 >> 3) | US_BRGR_FP(div8 & 7);
+    // Serial1.begin() выключает PDC передачи
+    txQueue.begin();
+    rxParser.restart();
+    lineBufferPos = 0;
+}
+
+bool WifiLink::takeCommand(Command& outCmd) {
+    if (!commandReady) {
         return false;
     }
-    
-    size_t cmdLen = cmdEnd - cmdStart;
-    if (cmdLen >= sizeof(outCmd.name)) {
-        cmdLen = sizeof(outCmd.name) - 1;
+    outCmd = pendingCommand;
+    commandReady = false;
+    if (outCmd.refreshImage) {
+        // Сервер потерял кадр сессии или опорный кадр кодека (перезапуск,
+        // вытеснение): следующий кадр - целиком и ключевым
+        vision.invalidate();
+        codec.requestKeyframe();
     }
+    return true;
+}
+
+bool WifiLink::parseCommand(const char* jsonStr, Command& outCmd) {
+    memset(outCmd.name, 0, sizeof(outCmd.name));
+    memset(outCmd.imageMode, 0, sizeof(outCmd.imageMode));
+    outCmd.commandId = COMMAND_ID_NONE;
+    outCmd.durationMs = 0;
+    outCmd.stepId = 0;
+    outCmd.speedPercent = 0;
+    outCmd.segmentCount = 0;
+    outCmd.refreshImage = false;
     
-    strncpy(outCmd.name, cmdStart, cmdLen);
-    outCmd.name[cmdLen] = '\0';
+    // Один проход по JSON: значение забирается по ключу, остальные пропускаются
+    JsonReader json(jsonStr);
+    bool hasName = false;
+    char key[16];
+    if (json.beginObject()) {
+        while (json.nextKey(key, sizeof(key))) {
+            long value;
+            if (strcmp(key, "command") == 0) {
+                hasName = json.readString(outCmd.name, sizeof(outCmd.name)) && outCmd.name[0] != '\0';
+            } else if (strcmp(key, "id") == 0) {
+                // 1 байт ID словаря вместо имени
+                if (json.readInt(value) && value >= 0 && value < COMMAND_ID_NONE) {
+                    outCmd.commandId = (uint8_t)value;
+                }
+            } else if (strcmp(key, "duration_ms") == 0) {
+                if (json.readInt(value) && value > 0) {
+                    outCmd.durationMs = (uint32_t)value;
+                }
+            } else if (strcmp(key, "image_mode") == 0) {
+                json.readString(outCmd.imageMode, sizeof(outCmd.imageMode));
+            } else if (strcmp(key, "step") == 0) {
+                if (json.readInt(value) && value > 0) {
+                    outCmd.stepId = (uint32_t)value;
+                }
+            } else if (strcmp(key, "speed") == 0) {
+                if (json.readInt(value)) {
+                    outCmd.speedPercent = (value < 0) ? 0 : (value > 100 ? 100 : value);
+                }
+            } else if (strcmp(key, "refresh") == 0) {
+                bool flag;
+                if (json.readBool(flag)) {
+                    outCmd.refreshImage = flag;
+                }
+            } else if (strcmp(key, "seq") == 0) {
+                parseSegments(json, outCmd);
+            } else {
+                json.skipValue();
+            }
+        }
+    }
     
-    const char* durStart = strstr(jsonStr, "\"duration_ms\":");
-    if (durStart != nullptr) {
-        durStart += 14;
-        outCmd.durationMs = atol(durStart);
+    if (!json.ok()) {
+        Serial.println("WifiLink: CMD JSON parse error");
+        return false;
+    }
+    if (!hasName) {
+        outCmd.name[0] = '\0';
+        if (outCmd.commandId == COMMAND_ID_NONE) {
+            return false;
+        }
     }
-#endif
-
     return true;
 }
 
+void WifiLink::parseSegments(JsonReader& json, Command& outCmd) {
+    // "seq": [["FORWARD", 400], ["LEFT", 250], ...] или [[0, 400], [2, 250], ...]
+    if (!json.beginArray()) {
+        return;
+    }
+    while (json.nextElement()) {
+        if (outCmd.segmentCount >= MAX_COMMAND_SEGMENTS) {
+            json.skipValue();
+            continue;
+        }
+        // Не массив: beginArray() уже пропустил элемент, отбрасывается только он
+        if (!json.beginArray()) {
+            continue;
+        }
+        CommandSegment& out = outCmd.segments[outCmd.segmentCount];
+        out.name[0] = '\0';
+        out.commandId = COMMAND_ID_NONE;
+        out.durationMs = 0;
+        bool valid = false;
+        long value;
+        // nextElement() == false уже закрыл массив отрезка
+        bool more = json.nextElement();
+        if (more) {
+            if (json.isString()) {
+                valid = json.readString(out.name, sizeof(out.name));
+            } else if (json.readInt(value) && value >= 0 && value < COMMAND_ID_NONE) {
+                out.commandId = (uint8_t)value;
+                valid = true;
+            }
+            more = json.nextElement();
+        }
+        if (more) {
+            if (json.readInt(value) && value > 0) {
+                out.durationMs = (uint32_t)value;
+            }
+            // Лишние элементы отрезка
+            while (json.nextElement()) {
+                json.skipValue();
+            }
+        }
+        if (valid) {
+            outCmd.segmentCount++;
+        }
+    }
+}
+
 void WifiLink::formatTimestamp(const DateTime& ts, char* buffer, size_t bufferSize) {
     if (buffer == nullptr || bufferSize < 20) {
         return;
@@ -199,154 +752,297 @@ void WifiLink::formatTimestamp(const DateTime& ts, char* buffer, size_t bufferSi
              ts.dd, ts.MM, ts.yyyy, ts.hh, ts.mm, ts.ss);
 }
 
-bool WifiLink::readLine(char* buffer, size_t bufferSize, uint32_t timeoutMs) {
-    if (buffer == nullptr || bufferSize == 0) {
-        return false;
-    }
-    
-    uint32_t startTime = millis();
-    size_t pos = 0;
-    
-    while ((millis() - startTime) < timeoutMs) {
-        if (Serial1.available() > 0) {
-            char c = Serial1.read();
-            
-            if (c == '\n') {
-                buffer[pos] = '\0';
-                return pos > 0;
-            } else if (c == '\r') {
-                continue;
-            } else if (pos < bufferSize - 1) {
-                buffer[pos++] = c;
+bool WifiLink::readMessage(LinkMessage& msg) {
+    while (Serial1.available() > 0) {
+        uint8_t c = (uint8_t)Serial1.read();
+        
+        // Байт 0xA5 не встречается в текстовых строках: это начало кадра
+        if (rxParser.inFrame() || c == LINK_SYNC_0) {
+            if (rxParser.feed(c) && decodeFrame(msg)) {
+                return true;
+            }
+            continue;
+        }
+        
+        if (c == '\n') {
+            lineBuffer[lineBufferPos] = '\0';
+            size_t len = lineBufferPos;
+            lineBufferPos = 0;
+            if (len > 0 && decodeLine(msg)) {
+                return true;
             }
+        } else if (c != '\r' && lineBufferPos < LINE_BUFFER_SIZE - 1) {
+            lineBuffer[lineBufferPos++] = (char)c;
         }
     }
     
-    buffer[pos] = '\0';
     return false;
 }
 
-bool WifiLink::sendImageChunked(const uint8_t* data, size_t size, uint16_t width, uint16_t height) {
-    while (Serial1.available()) {
-        Serial1.read();
-    }
-    
-    uint16_t crc = crc16_ccitt(data, size);
-    
-    uint16_t totalChunks = (size + CHUNK_RAW_SIZE - 1) / CHUNK_RAW_SIZE;
+bool WifiLink::decodeLine(LinkMessage& msg) {
+    msg.index = 0;
+    msg.mask = 0;
+    msg.text = nullptr;
     
-    Serial.print("WifiLink: Sending image ");
-    Serial.print(width);
-    Serial.print("x");
-    Serial.print(height);
-    Serial.print(" in ");
-    Serial.print(totalChunks);
-    Serial.println(" chunks");
-    
-    Serial1.print("IMG_START ");
-    Serial1.print(width);
-    Serial1.print(" ");
-    Serial1.print(height);
-    Serial1.print(" ");
-    Serial1.print(totalChunks);
-    Serial1.print(" 0x");
-    Serial1.println(crc, HEX);
-    Serial1.flush();
-    
-    char readyBuf[32];
-    if (!readLine(readyBuf, sizeof(readyBuf), ACK_TIMEOUT_MS)) {
-        Serial.println("WifiLink: No IMG_READY received");
+    if (strncmp(lineBuffer, "CMD ", 4) == 0) {
+        msg.type = LINK_CMD;
+        msg.text = lineBuffer + 4;
+    } else if (strncmp(lineBuffer, "ACK ", 4) == 0) {
+        msg.type = LINK_ACK;
+        msg.index = (uint16_t)atoi(lineBuffer + 4);
+    } else if (strncmp(lineBuffer, "NAK ", 4) == 0) {
+        msg.type = LINK_NAK;
+        msg.index = (uint16_t)atoi(lineBuffer + 4);
+    } else if (strncmp(lineBuffer, "SACK ", 5) == 0) {
+        // SACK <first missing> 0x<mask>
+        char* maskStart = nullptr;
+        msg.type = LINK_SACK;
+        msg.index = (uint16_t)strtoul(lineBuffer + 5, &maskStart, 10);
+        msg.mask = strtoul(maskStart, nullptr, 16);
+    } else if (strncmp(lineBuffer, "IMG_READY", 9) == 0) {
+        msg.type = LINK_IMG_READY;
+    } else if (strncmp(lineBuffer, "STATUS ", 7) == 0) {
+        // Не ответ: запоминаем для команды status и ждём дальше
+        strncpy(bridgeStatus, lineBuffer + 7, BRIDGE_STATUS_SIZE - 1);
+        bridgeStatus[BRIDGE_STATUS_SIZE - 1] = '\0';
+        const char* rssi = strstr(bridgeStatus, "rssi=");
+        if (rssi != nullptr) {
+            imageRate.setRssi((int8_t)atoi(rssi + 5));
+        }
         return false;
-    }
-    if (strncmp(readyBuf, "IMG_READY", 9) != 0) {
-        Serial.print("WifiLink: Expected IMG_READY, got: ");
-        Serial.println(readyBuf);
+    } else {
         return false;
     }
+    return true;
+}
+
+bool WifiLink::decodeFrame(LinkMessage& msg) {
+    msg.type = rxParser.type();
+    msg.index = 0;
+    msg.mask = 0;
+    msg.text = nullptr;
     
-    char base64Chunk[CHUNK_BASE64_SIZE + 1];
-    
-    for (uint16_t chunkIdx = 0; chunkIdx < totalChunks; chunkIdx++) {
-        size_t offset = chunkIdx * CHUNK_RAW_SIZE;
-        size_t chunkLen = (offset + CHUNK_RAW_SIZE <= size) ? CHUNK_RAW_SIZE : (size - offset);
-        
-        size_t encoded = base64_encode(data + offset, chunkLen, base64Chunk, sizeof(base64Chunk));
-        if (encoded == 0) {
-            Serial.println("WifiLink: Base64 encoding failed");
+    switch (msg.type) {
+        case LINK_CMD:
+            msg.text = (const char*)rxParser.payload();
+            return true;
+        case LINK_ACK:
+        case LINK_NAK:
+            msg.index = rxParser.payloadU16(0);
+            return true;
+        case LINK_SACK:
+            msg.index = rxParser.payloadU16(0);
+            msg.mask = rxParser.payloadU16(2) | ((uint32_t)rxParser.payloadU16(4) << 16);
+            return true;
+        case LINK_IMG_READY:
+            return true;
+        case LINK_BAUD_ACK:
+            msg.mask = rxParser.payloadU16(0) | ((uint32_t)rxParser.payloadU16(2) << 16);
+            return true;
+        default:
             return false;
+    }
+}
+
+void WifiLink::flushInput() {
+    LinkMessage msg;
+    while (readMessage(msg)) {
+        if (msg.type == LINK_CMD) {
+            commandReady = parseCommand(msg.text, pendingCommand);
+            replyPending = false;
+        } else if (msg.type == LINK_BAUD_ACK) {
+            handleRateReply(msg.mask);
         }
-        
-        if (!sendChunkWithAck(chunkIdx, base64Chunk)) {
-            Serial.print("WifiLink: Failed to send chunk ");
-            Serial.println(chunkIdx);
-            Serial1.println("IMG_ABORT");
+    }
+}
+
+void WifiLink::sendEmptyFrame(uint8_t type) {
+    LinkFrameWriter frame(txQueue);
+    frame.begin(type, txSeq++, 0);
+    frame.end();
+}
+
+bool WifiLink::sendChunk(uint16_t chunkIdx, bool firstSend) {
+    PERF_SCOPE(PERF_CHUNK);
+    size_t offset = (size_t)chunkIdx * job.chunkSize;
+    size_t len = (offset + job.chunkSize <= job.frame.size) ? job.chunkSize : (job.frame.size - offset);
+    const uint8_t* data = job.frame.data + offset;
+    
+    if (job.mode == MODE_BINARY) {
+        if (txQueue.space() < LINK_HEADER_SIZE + 2 + len + LINK_CRC_SIZE) {
             return false;
         }
+        LinkFrameWriter frame(txQueue);
+        frame.begin(LINK_IMG_CHUNK, txSeq++, (uint16_t)(2 + len));
+        frame.writeU16(chunkIdx);
+        if (firstSend) {
+            frame.write(data, len, job.imageCrc);
+        } else {
+            frame.write(data, len);
+        }
+        frame.end();
+        return true;
     }
     
-    Serial1.println("IMG_END");
-    Serial1.flush();
+    // "IMG_CHUNK " + индекс + пробел + base64 + пробел + CRC чанка (hex) + "\r\n"
+    if (txQueue.space() < 10 + 6 + CHUNK_BASE64_SIZE + 5 + 2) {
+        return false;
+    }
+    char base64Chunk[CHUNK_BASE64_SIZE + 1];
+    uint16_t chunkCrc = 0xFFFF;
+    size_t encoded;
+    {
+        PERF_SCOPE(PERF_BASE64);
+        encoded = base64_encode(data, len, base64Chunk, sizeof(base64Chunk),
+                                &chunkCrc, firstSend ? &job.imageCrc : nullptr);
+    }
+    if (encoded == 0) {
+        Serial.println("WifiLink: Base64 encoding failed");
+        return true;   // повторит таймаут
+    }
+    txQueue.print("IMG_CHUNK ");
+    txQueue.print(chunkIdx);
+    txQueue.print(" ");
+    txQueue.print(base64Chunk);
+    txQueue.print(" ");
+    txQueue.println(chunkCrc, HEX);
+    return true;
+}
+
+// Битовая карта подтверждённых чанков
+static inline bool chunkAcked(const uint32_t* map, uint32_t idx) {
+    return (map[idx >> 5] >> (idx & 31)) & 1u;
+}
+
+static inline void markChunkAcked(uint32_t* map, uint32_t idx) {
+    map[idx >> 5] |= 1u << (idx & 31);
+}
+
+bool WifiLink::handleTransferReply(const LinkMessage& msg) {
+    if (msg.type == LINK_SACK) {
+        for (uint16_t i = job.base; i < msg.index && i < job.totalChunks; i++) {
+            markChunkAcked(job.acked, i);
+        }
+        uint16_t highest = msg.index;
+        for (uint8_t b = 0; b < 32; b++) {
+            uint32_t idx = (uint32_t)msg.index + 1 + b;
+            if ((msg.mask >> b) & 1u && idx < job.totalChunks) {
+                markChunkAcked(job.acked, idx);
+                highest = (uint16_t)idx;
+            }
+        }
+        // Дыры ниже последнего принятого потеряны: повторяем сразу, по одному разу
+        for (uint16_t i = job.base; i < highest && i < job.next; i++) {
+            uint8_t slot = i % MAX_WINDOW;
+            if (!chunkAcked(job.acked, i) && !job.holeResent[slot] && sendChunk(i)) {
+                job.sentAt[slot] = millis();
+                job.holeResent[slot] = true;
+                job.retransmits++;
+            }
+        }
+    } else if (msg.type == LINK_ACK && msg.index < job.totalChunks) {
+        markChunkAcked(job.acked, msg.index);
+    } else if (msg.type == LINK_NAK) {
+        if (msg.index == 0xFFFF) {
+            // NodeMCU не ведёт передачу - повторять бесполезно
+            return false;
+        }
+        // Отвергнутый чанк (или битый кадр, 0xFFFE - самый старый) повторяется
+        // по таймауту сразу, с учётом попыток
+        uint16_t idx = (msg.index == 0xFFFE) ? job.base : msg.index;
+        if (idx >= job.base && idx < job.next && !chunkAcked(job.acked, idx)) {
+            job.sentAt[idx % MAX_WINDOW] = millis() - ACK_TIMEOUT_MS;
+        }
+    }
     
-    Serial.println("WifiLink: Image transfer complete");
+    while (job.base < job.next && chunkAcked(job.acked, job.base)) {
+        job.base++;
+    }
     return true;
 }
 
-bool WifiLink::sendChunkWithAck(uint16_t chunkIdx, const char* base64Data) {
-    for (uint8_t retry = 0; retry < MAX_RETRIES; retry++) {
-        while (Serial1.available()) {
-            Serial1.read();
+bool WifiLink::advanceWindow() {
+    if (job.base >= job.totalChunks) {
+        if (job.retransmits > 0) {
+            Serial.print("WifiLink: Retransmitted ");
+            Serial.print(job.retransmits);
+            Serial.println(" chunks");
         }
-        
-        Serial1.print("IMG_CHUNK ");
-        Serial1.print(chunkIdx);
-        Serial1.print(" ");
-        Serial1.println(base64Data);
-        Serial1.flush();
-        
-        if (waitForAck(chunkIdx)) {
-            return true;
+        finishTransfer(true);
+        return true;
+    }
+    
+    // Повтор по таймауту: только неподтверждённые чанки окна
+    for (uint16_t i = job.base; i < job.next; i++) {
+        uint8_t slot = i % MAX_WINDOW;
+        if (chunkAcked(job.acked, i) || millis() - job.sentAt[slot] < ACK_TIMEOUT_MS) {
+            continue;
+        }
+        if (job.tries[slot] >= MAX_RETRIES) {
+            Serial.print("WifiLink: Failed to send chunk ");
+            Serial.println(i);
+            return false;
+        }
+        if (!sendChunk(i)) {
+            return true;   // очередь полна, повторим в следующем poll
         }
+        job.sentAt[slot] = millis();
+        job.tries[slot]++;
+        job.holeResent[slot] = false;
+        job.retransmits++;
         
         Serial.print("WifiLink: Retry chunk ");
-        Serial.print(chunkIdx);
+        Serial.print(i);
         Serial.print(" attempt ");
-        Serial.println(retry + 2);
-        
-        delay(50);
+        Serial.println(job.tries[slot]);
     }
     
-    return false;
+    // Заполняем окно новыми чанками, пока есть место в очереди
+    while (job.next < job.totalChunks && job.next < job.base + job.window && sendChunk(job.next, true)) {
+        uint8_t slot = job.next % MAX_WINDOW;
+        job.sentAt[slot] = millis();
+        job.tries[slot] = 1;
+        job.holeResent[slot] = false;
+        job.next++;
+    }
+    return true;
 }
 
-bool WifiLink::waitForAck(uint16_t expectedChunkIdx) {
-    char buffer[32];
-    uint32_t startTime = millis();
-    size_t pos = 0;
-    
-    while ((millis() - startTime) < ACK_TIMEOUT_MS) {
-        if (Serial1.available() > 0) {
-            char c = Serial1.read();
-            
-            if (c == '\n') {
-                buffer[pos] = '\0';
-                
-                if (strncmp(buffer, "ACK ", 4) == 0) {
-                    uint16_t ackIdx = atoi(buffer + 4);
-                    if (ackIdx == expectedChunkIdx) {
-                        return true;
-                    }
-                } else if (strncmp(buffer, "NAK ", 4) == 0) {
-                    return false;
-                }
-                
-                pos = 0;
-            } else if (c != '\r' && pos < sizeof(buffer) - 1) {
-                buffer[pos++] = c;
-            }
+void WifiLink::finishTransfer(bool delivered) {
+    if (!delivered) {
+        if (job.mode == MODE_BINARY) {
+            sendEmptyFrame(LINK_IMG_ABORT);
+        } else {
+            txQueue.println("IMG_ABORT");
         }
+    } else if (job.mode == MODE_BINARY) {
+        LinkFrameWriter end(txQueue);
+        end.begin(LINK_IMG_END, txSeq++, 2);
+        end.writeU16(job.imageCrc);
+        end.end();
+    } else {
+        txQueue.print("IMG_END 0x");
+        txQueue.println(job.imageCrc, HEX);
     }
+    codec.commit(delivered);
+    vision.commit(delivered, job.stepId);
+    PERF_SPAN_END(PERF_TRANSFER);
     
-    return false;
+    ImageTransferStats stats;
+    stats.bytes = job.frame.size;
+    stats.pixels = (uint32_t)job.width * job.height;
+    stats.elapsedMs = millis() - job.startMillis;
+    stats.readyMs = (job.readyMillis != 0) ? job.readyMillis - job.startMillis : stats.elapsedMs;
+    stats.chunks = (job.readyMillis != 0) ? job.next : 0;
+    stats.retransmits = (job.readyMillis != 0) ? job.retransmits : 0;
+    stats.compact = job.compact;
+    stats.delivered = delivered;
+    imageRate.onTransfer(stats);
+    
+    if (delivered) {
+        Serial.println("WifiLink: Image transfer complete");
+    } else {
+        Serial.println("WifiLink: Image transfer failed");
+    }
+    queueData(delivered);
 }
-
-
@@ -1,4 +1,5 @@
 #include "../include/base64.h"
+#include "../include/LinkProtocol.h"
 
 static const char base64_chars[] = 
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
@@ -9,7 +10,18 @@ size_t base64_encode_length(size_t inputLen) {
     return ((inputLen + 2) / 3) * 4 + 1; // +1 для нулевого терминатора
 }
 
-size_t base64_encode(const uint8_t* input, size_t inputLen, char* output, size_t outputLen) {
+// CRC по байту, который кодер уже прочитал
+static inline void crcByte(uint16_t* crc, uint16_t* runningCrc, uint8_t b) {
+    if (crc != nullptr) {
+        *crc = crc16_ccitt_step(*crc, b);
+    }
+    if (runningCrc != nullptr) {
+        *runningCrc = crc16_ccitt_step(*runningCrc, b);
+    }
+}
+
+size_t base64_encode(const uint8_t* input, size_t inputLen, char* output, size_t outputLen,
+                     uint16_t* crc, uint16_t* runningCrc) {
     if (input == nullptr || output == nullptr) {
         return 0;
     }
@@ -23,9 +35,20 @@ size_t base64_encode(const uint8_t* input, size_t inputLen, char* output, size_t
     size_t i = 0;
     
     while (i < inputLen) {
-        uint32_t octet_a = i < inputLen ? input[i++] : 0;
-        uint32_t octet_b = i < inputLen ? input[i++] : 0;
-        uint32_t octet_c = i < inputLen ? input[i++] : 0;
+        size_t left = inputLen - i;
+        uint32_t octet_a = input[i++];
+        uint32_t octet_b = left > 1 ? input[i++] : 0;
+        uint32_t octet_c = left > 2 ? input[i++] : 0;
+        
+        if (crc != nullptr || runningCrc != nullptr) {
+            crcByte(crc, runningCrc, (uint8_t)octet_a);
+            if (left > 1) {
+                crcByte(crc, runningCrc, (uint8_t)octet_b);
+            }
+            if (left > 2) {
+                crcByte(crc, runningCrc, (uint8_t)octet_c);
+            }
+        }
         
         uint32_t triple = (octet_a << 16) + (octet_b << 8) + octet_c;
         
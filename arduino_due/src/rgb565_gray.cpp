@@ -0,0 +1,178 @@
+#include "../include/rgb565_gray.h"
+#include <Arduino.h>
+#include <cstring>
+
+// Y = (R8*77 + G8*150 + B8*29) >> 8, где R8 = R5<<3, G8 = G6<<2, B8 = B5<<3
+// => Y = (R5*616 + G6*600 + B5*232) >> 8, сумма не больше 64088 (влезает в 16 бит)
+static const uint32_t R_WEIGHT = 616;
+static const uint32_t G_WEIGHT = 600;
+static const uint32_t B_WEIGHT = 232;
+
+// LUT: G6 = (hi & 7) << 3 | lo >> 5, поэтому сумма раскладывается на
+// вклад старшего байта (R5, G6[5:3]) и младшего (G6[2:0], B5)
+static uint16_t lutHigh[256];
+static uint16_t lutLow[256];
+static bool lutReady = false;
+
+static void buildLut() {
+    for (uint32_t v = 0; v < 256; v++) {
+        lutHigh[v] = (uint16_t)((v >> 3) * R_WEIGHT + (v & 0x07) * 8 * G_WEIGHT);
+        lutLow[v] = (uint16_t)((v >> 5) * G_WEIGHT + (v & 0x1F) * B_WEIGHT);
+    }
+    lutReady = true;
+}
+
+void rgb565_gray_init() {
+    if (!lutReady) {
+        buildLut();
+    }
+}
+
+void rgb565_to_gray_reference(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    for (size_t x = 0; x < pixels; x++) {
+        uint16_t rgb565 = (uint16_t)((src[2 * x + 1] << 8) | src[2 * x]);
+
+        uint8_t r = ((rgb565 >> 11) & 0x1F) << 3;
+        uint8_t g = ((rgb565 >> 5) & 0x3F) << 2;
+        uint8_t b = (rgb565 & 0x1F) << 3;
+
+        dst[x] = (uint8_t)(((uint16_t)r * 77 + (uint16_t)g * 150 + (uint16_t)b * 29) >> 8);
+    }
+}
+
+void rgb565_to_gray_lut(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    for (size_t x = 0; x < pixels; x++) {
+        dst[x] = (uint8_t)((lutHigh[src[2 * x + 1]] + lutLow[src[2 * x]]) >> 8);
+    }
+}
+
+void rgb565_to_gray_packed(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    size_t pairs = pixels / 2;
+
+    for (size_t i = 0; i < pairs; i++) {
+        // Два пикселя в одном слове: [15:0] - первый, [31:16] - второй
+        uint32_t w;
+        memcpy(&w, src, sizeof(w));
+
+        uint32_t r = (w >> 11) & 0x001F001F;
+        uint32_t g = (w >> 5) & 0x003F003F;
+        uint32_t b = w & 0x001F001F;
+
+        // Каждая 16-битная дорожка не больше 64088 - переносов между ними нет
+        uint32_t sum = r * R_WEIGHT + g * G_WEIGHT + b * B_WEIGHT;
+
+        uint16_t out = (uint16_t)(((sum >> 8) & 0x00FF) | ((sum >> 16) & 0xFF00));
+        memcpy(dst, &out, sizeof(out));
+
+        src += 4;
+        dst += 2;
+    }
+
+    if (pixels & 1) {
+        rgb565_to_gray_reference(src, dst, 1);
+    }
+}
+
+void rgb565_to_gray(const uint8_t* src, uint8_t* dst, size_t pixels) {
+#if GRAY_KERNEL == GRAY_KERNEL_LUT
+    rgb565_to_gray_lut(src, dst, pixels);
+#elif GRAY_KERNEL == GRAY_KERNEL_PACKED
+    rgb565_to_gray_packed(src, dst, pixels);
+#else
+    rgb565_to_gray_reference(src, dst, pixels);
+#endif
+}
+
+const char* rgb565_gray_kernel_name() {
+#if GRAY_KERNEL == GRAY_KERNEL_LUT
+    return "lut";
+#elif GRAY_KERNEL == GRAY_KERNEL_PACKED
+    return "packed";
+#else
+    return "reference";
+#endif
+}
+
+bool rgb565_gray_self_test() {
+    rgb565_gray_init();
+
+    // 256 пикселей за проход: старший байт фиксирован, младший 0..255
+    uint8_t src[512];
+    uint8_t expected[256];
+    uint8_t actual[256];
+
+    for (uint32_t hi = 0; hi < 256; hi++) {
+        for (uint32_t lo = 0; lo < 256; lo++) {
+            src[2 * lo] = (uint8_t)lo;
+            src[2 * lo + 1] = (uint8_t)hi;
+        }
+
+        rgb565_to_gray_reference(src, expected, 256);
+
+        rgb565_to_gray_lut(src, actual, 256);
+        if (memcmp(expected, actual, sizeof(expected)) != 0) {
+            return false;
+        }
+
+        rgb565_to_gray_packed(src, actual, 256);
+        if (memcmp(expected, actual, sizeof(expected)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ==================== BENCHMARK ====================
+
+typedef void (*GrayKernelFn)(const uint8_t*, uint8_t*, size_t);
+
+static uint32_t benchKernel(GrayKernelFn fn, const uint8_t* src, uint8_t* dst,
+                            size_t pixels, uint16_t rows) {
+    uint32_t start = DWT->CYCCNT;
+    for (uint16_t y = 0; y < rows; y++) {
+        fn(src, dst, pixels);
+    }
+    return DWT->CYCCNT - start;
+}
+
+void rgb565_gray_benchmark() {
+    // Одна строка QQVGA, прогоняется 120 раз = один кадр
+    static const size_t PIXELS = 160;
+    static const uint16_t ROWS = 120;
+    static uint8_t src[PIXELS * 2] __attribute__((aligned(4)));
+    static uint8_t dst[PIXELS] __attribute__((aligned(4)));
+
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t)(i * 37 + 11);
+    }
+
+    rgb565_gray_init();
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    const char* names[3] = {"reference", "lut", "packed"};
+    GrayKernelFn kernels[3] = {
+        rgb565_to_gray_reference, rgb565_to_gray_lut, rgb565_to_gray_packed
+    };
+
+    Serial.println("=== RGB565 -> GRAY8 benchmark (160x120) ===");
+    Serial.print("Selected kernel: ");
+    Serial.println(rgb565_gray_kernel_name());
+
+    for (uint8_t k = 0; k < 3; k++) {
+        uint32_t cycles = benchKernel(kernels[k], src, dst, PIXELS, ROWS);
+        Serial.print("  ");
+        Serial.print(names[k]);
+        Serial.print(": ");
+        Serial.print((float)cycles / (PIXELS * ROWS), 2);
+        Serial.print(" cycles/px, ");
+        Serial.print(cycles / (VARIANT_MCK / 1000000));
+        Serial.println(" us/frame");
+    }
+
+    Serial.print("Self-test: ");
+    Serial.println(rgb565_gray_self_test() ? "PASS" : "FAIL");
+    Serial.println("===========================================");
+}
@@ -3,6 +3,7 @@
  * 
  * Действует как мост между Arduino Due и сервером с LLM:
  * 1. Получает JSON данные от Arduino Due через Serial
+ *    (текстовыми строками или бинарными кадрами A5 5A, см. LinkProtocol.h в скетче Due)
  * 2. Отправляет данные на сервер через HTTP POST
  * 3. Получает команду от сервера
  * 4. Передает команду обратно на Arduino Due
@@ -31,8 +32,9 @@ const char* SERVER_HOST = "10.223.177.203";
 const int SERVER_PORT = 8000;
 String SERVER_URL = "http://10.223.177.203:8000/command";
 String SERVER_IMG_START_URL = "http://10.223.177.203:8000/image/start";
-String SERVER_IMG_CHUNK_URL = "http://10.223.177.203:8000/image/chunk";
+const char* SERVER_IMG_CHUNK_RAW_URL = "http://10.223.177.203:8000/image/chunk/raw";
 String SERVER_IMG_END_URL   = "http://10.223.177.203:8000/image/end";
+const char* SERVER_IMG_STREAM_PATH = "/image/stream";   // все чанки одним POST
 
 // Serial настройки (для связи с Arduino Due)
 const int SERIAL_BAUD = 115200;
@@ -41,11 +43,64 @@ const int SERIAL_BAUD = 115200;
 const unsigned long HTTP_TIMEOUT = 10000;      // 10 секунд на HTTP запрос
 const unsigned long SERIAL_TIMEOUT = 500;      // 500 мс на чтение Serial
 const unsigned long WIFI_CHECK_INTERVAL = 5000; // Проверка WiFi каждые 5 секунд
+const unsigned long HEAP_SAMPLE_INTERVAL = 1000; // Замер кучи раз в секунду
+const unsigned long STATUS_INTERVAL = 10000;     // Строка STATUS для Due не чаще раза в 10 секунд
+
+// ==================== БИНАРНЫЕ КАДРЫ ====================
+// A5 5A | type | seq | len (LE) | payload[len] | crc16 (LE)
+// CRC16-CCITT по type, seq, len и payload. Совпадает с LinkProtocol.h на Due.
+
+const uint8_t LINK_SYNC_0 = 0xA5;
+const uint8_t LINK_SYNC_1 = 0x5A;
+
+// Due -> NodeMCU
+const uint8_t LINK_DATA      = 0x01;
+const uint8_t LINK_IMG_START = 0x02;  // width, height, totalChunks, crc, chunkSize, window (u16),
+                                      // codec, flags, keyId (u8)
+const uint8_t LINK_IMG_CHUNK = 0x03;  // chunkIdx (u16) + сырые байты
+const uint8_t LINK_IMG_END   = 0x04;
+const uint8_t LINK_IMG_ABORT = 0x05;
+const uint8_t LINK_BAUD_REQ  = 0x06;  // скорость (u32): ответ BAUD_ACK на текущей, затем переход
+const uint8_t LINK_BAUD_TEST = 0x07;  // образец на новой скорости: подтверждение перехода
+
+// NodeMCU -> Due
+const uint8_t LINK_IMG_READY = 0x81;
+const uint8_t LINK_ACK       = 0x82;  // chunkIdx (u16)
+const uint8_t LINK_NAK       = 0x83;  // chunkIdx (u16)
+const uint8_t LINK_CMD       = 0x84;  // JSON команды
+const uint8_t LINK_SACK      = 0x85;  // первый не принятый чанк (u16) + битовая карта (u32)
+const uint8_t LINK_BAUD_ACK  = 0x86;  // скорость (u32); 0 - отказ; без запроса - мы на SERIAL_BAUD
+
+const size_t LINK_MAX_PAYLOAD = 1280;   // самый длинный кадр от Due (DATA)
+const size_t LINK_MAX_REPLY = 256;      // самый длинный кадр, который принимает Due
+
+// DATA от Due начинается с префикса и места под image_id (null, добитый пробелами):
+// id вписывается на место, запись не сдвигается
+const char DATA_IMAGE_ID_PREFIX[] = "{\"image\":{\"image_id\":";
+const size_t DATA_IMAGE_ID_OFFSET = sizeof(DATA_IMAGE_ID_PREFIX) - 1;
+const size_t DATA_IMAGE_ID_SLOT = 50;
+
+// Согласование скорости Serial (как в LinkProtocol.h на Due)
+const uint32_t LINK_BAUD_RATES[] = { 460800, 921600, 2000000 };
+const size_t LINK_BAUD_RATE_COUNT = sizeof(LINK_BAUD_RATES) / sizeof(LINK_BAUD_RATES[0]);
+const size_t LINK_BAUD_TEST_SIZE = 64;
+const unsigned long BAUD_TEST_TIMEOUT = 300;   // нет образца - назад на прежнюю скорость
+const uint8_t BAUD_ERROR_BURST = 4;            // битых кадров на повышенной скорости...
+const unsigned long BAUD_ERROR_WINDOW = 3000;  // ...за это время - назад на SERIAL_BAUD
+
+const uint16_t MAX_IMAGE_CHUNKS = 256;  // предел битовой карты принятых чанков
+const size_t IMAGE_ID_SIZE = 48;        // image_id от сервера вида s0_st0_1760000000
+
+// Запись потока /image/stream: chunk_idx (u16 LE), len (u16 LE), байты чанка.
+// Каждая запись - один кусок chunked transfer encoding: "<hex len>\r\n" ... "\r\n"
+const size_t STREAM_RECORD_HEADER = 4;
+const size_t STREAM_CHUNK_OVERHEAD = 8;  // "xxx\r\n" + "\r\n" с запасом
+const uint16_t STREAM_CRC_RECORD = 0xFFFF;  // служебная запись: CRC16 кадра (u16 LE)
 
 // ==================== ГЛОБАЛЬНЫЕ ПЕРЕМЕННЫЕ ====================
 
 WiFiClient wifiClient;
-String serialBuffer = "";
+WiFiClient streamClient;   // соединение /image/stream на время одного изображения
 unsigned long lastWiFiCheck = 0;
 bool serverAvailable = false;
 
@@ -55,9 +110,16 @@ struct ImageTransfer {
     uint16_t height;
     uint16_t totalChunks;
     uint16_t expectedCrc;
-    uint16_t receivedChunks;
-    String imageId;          // image_id от сервера
+    uint16_t receivedChunks;  // сколько разных чанков принято
+    uint16_t window;          // окно отправителя; 1 - stop-and-wait со строгим порядком
+    uint16_t firstMissing;    // первый ещё не принятый индекс (кумулятивный ACK)
+    uint8_t codec;            // кодек кадра (0 raw, 1 intra, 2 inter), декодирует сервер
+    uint8_t flags;            // бит 0 - ключевой кадр
+    uint8_t keyId;            // номер ключевого / опорного кадра
+    uint32_t receivedMap[MAX_IMAGE_CHUNKS / 32];
+    char imageId[IMAGE_ID_SIZE];  // image_id от сервера
     bool transferInProgress;
+    bool streaming;          // чанки идут в streamClient, иначе POST на каждый чанк
     
     void reset() {
         width = 0;
@@ -65,35 +127,146 @@ struct ImageTransfer {
         totalChunks = 0;
         expectedCrc = 0;
         receivedChunks = 0;
-        imageId = "";
+        window = 1;
+        firstMissing = 0;
+        codec = 0;
+        flags = 0;
+        keyId = 0;
+        memset(receivedMap, 0, sizeof(receivedMap));
+        imageId[0] = '\0';
         transferInProgress = false;
+        streaming = false;
+    }
+    
+    bool isReceived(uint32_t idx) const {
+        return idx < MAX_IMAGE_CHUNKS && ((receivedMap[idx >> 5] >> (idx & 31)) & 1u);
+    }
+    
+    void markReceived(uint16_t idx) {
+        receivedMap[idx >> 5] |= 1u << (idx & 31);
+        receivedChunks++;
+        while (firstMissing < totalChunks && isReceived(firstMissing)) {
+            firstMissing++;
+        }
     }
 };
 
 ImageTransfer imageTransfer;
 
 // image_id последнего успешно загруженного изображения (для вставки в DATA)
-String currentImageId = "";
+char currentImageId[IMAGE_ID_SIZE] = "";
+
+// Отвечаем Due в том же формате, в котором пришло последнее сообщение
+bool replyBinary = false;
+uint8_t txSeq = 0;
+
+// Скорость Serial: подтверждённая и пробная (между BAUD_REQ и BAUD_TEST)
+uint32_t linkBaud = SERIAL_BAUD;
+uint32_t pendingBaud = 0;
+unsigned long pendingBaudMillis = 0;
+uint8_t baudErrors = 0;
+unsigned long baudErrorMillis = 0;
+
+// Payload последнего принятого кадра или текст строки (+1 байт под '\0' для JSON)
+uint8_t frameBuffer[LINK_MAX_PAYLOAD + 1];
+uint8_t frameType = 0;
+uint16_t frameLen = 0;
+
+// Разбор входящих байт: кольцом служит RX-буфер UART ядра (setRxBufferSize),
+// автомат забирает из него байты между вызовами loop() и ничего не выделяет в куче
+enum RxState : uint8_t {
+    RX_IDLE,        // между сообщениями
+    RX_LINE,        // текстовая строка до '\n'
+    RX_LINE_SKIP,   // слишком длинная строка, ждём '\n'
+    RX_SYNC1,       // после 0xA5
+    RX_HEADER,      // type, seq, len
+    RX_PAYLOAD,
+    RX_CRC
+};
+RxState rxState = RX_IDLE;
+uint8_t rxHeader[4];
+uint8_t rxCrc[2];
+uint16_t rxCrcAcc = 0xFFFF;   // CRC кадра по мере приёма байт: в конце - только сравнение
+uint16_t rxPos = 0;
+uint16_t rxLen = 0;
+unsigned long rxLastByte = 0;
+
+// Ответ сервера на DATA (передаётся на Due как есть)
+char replyBuffer[LINK_MAX_REPLY + 1];
+// Тела, URL и заголовки коротких HTTP запросов, строка STATUS
+char httpText[256];
+
+// Минимумы свободной кучи и самого большого блока с момента старта
+uint32_t heapMinFree = 0xFFFFFFFF;
+uint32_t heapMinBlock = 0xFFFFFFFF;
+unsigned long lastHeapSample = 0;
+unsigned long lastStatus = 0;
+
+// Сборка одной записи потока (заголовок куска + запись + "\r\n") для одного write()
+uint8_t streamRecord[STREAM_CHUNK_OVERHEAD + STREAM_RECORD_HEADER + LINK_MAX_PAYLOAD];
+// Чанк текстового протокола после base64
+uint8_t decodedChunk[LINK_MAX_PAYLOAD];
 
 // ==================== CRC16 ФУНКЦИЯ ====================
 
-uint16_t crc16_ccitt(const uint8_t* data, size_t len) {
-    uint16_t crc = 0xFFFF;
+// Таблица по старшему байту, та же, что в LinkProtocol.cpp на Due. Лежит в RAM, а не
+// в PROGMEM: байт CRC считается прямо в автомате приёма, чтение flash там медленнее
+const uint16_t crc16_ccitt_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+inline uint16_t crc16_ccitt_step(uint16_t crc, uint8_t b) {
+    return (uint16_t)(crc << 8) ^ crc16_ccitt_table[(crc >> 8) ^ b];
+}
+
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t* data, size_t len) {
     for (size_t i = 0; i < len; i++) {
-        crc ^= (uint16_t)data[i] << 8;
-        for (uint8_t j = 0; j < 8; j++) {
-            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
-        }
+        crc = crc16_ccitt_step(crc, data[i]);
     }
     return crc;
 }
 
+uint16_t crc16_ccitt(const uint8_t* data, size_t len) {
+    return crc16_ccitt_update(0xFFFF, data, len);
+}
+
 // ==================== SETUP ====================
 
 void setup() {
     // Инициализация Serial
     Serial.begin(SERIAL_BAUD);
-    Serial.setRxBufferSize(512);  // Увеличенный буфер для чанков
+    Serial.setRxBufferSize(2048);  // Окно до 8 бинарных кадров по 250 байт, пока идёт HTTP
     delay(100);
     
     // Инициализация структуры передачи
@@ -113,6 +286,10 @@ void setup() {
     Serial.println();
     Serial.println("Ready to receive data from Arduino Due");
     Serial.println();
+    
+    // Due мог остаться на повышенной скорости после нашего перезапуска: сообщаем,
+    // что мы на SERIAL_BAUD и готовы к согласованию
+    sendBaudAck(SERIAL_BAUD);
 }
 
 // ==================== MAIN LOOP ====================
@@ -124,6 +301,15 @@ void loop() {
     // Чтение данных от Arduino Due
     processSerialData();
     
+    // Пробная скорость без образца: Due её не подтвердил
+    checkBaudTimeout();
+    
+    // Водяные знаки кучи: фрагментация видна по падению максимального блока
+    if (millis() - lastHeapSample >= HEAP_SAMPLE_INTERVAL) {
+        lastHeapSample = millis();
+        sampleHeap();
+    }
+    
     // yield вместо delay для более быстрой обработки Serial
     yield();
 }
@@ -202,68 +388,189 @@ bool checkServer() {
 // ==================== SERIAL ФУНКЦИИ ====================
 
 void processSerialData() {
-    if (!Serial.available()) {
-        return;
+    // Строка или кадр оборвались на середине: сбой линии, начинаем заново
+    if (rxState != RX_IDLE && millis() - rxLastByte > SERIAL_TIMEOUT) {
+        rxDrop();
     }
     
-    // Читаем строку от Arduino Due
-    String line = readSerialLine();
-    if (line.length() == 0) {
-        return;
+    while (Serial.available()) {
+        rxLastByte = millis();
+        if (rxFeed(Serial.read())) {
+            // Сообщение обработано: даём loop() проверить WiFi
+            return;
+        }
+    }
+}
+
+bool rxFeed(uint8_t b) {
+    switch (rxState) {
+        case RX_IDLE:
+            // 0xA5 не встречается в текстовых строках: это бинарный кадр
+            if (b == LINK_SYNC_0) {
+                rxState = RX_SYNC1;
+                return false;
+            }
+            if (b == '\r' || b == '\n') {
+                return false;
+            }
+            rxPos = 0;
+            rxState = RX_LINE;
+            // fall through: первый байт строки
+        case RX_LINE:
+            if (b == '\n') {
+                rxState = RX_IDLE;
+                while (rxPos > 0 && (frameBuffer[rxPos - 1] == ' ' || frameBuffer[rxPos - 1] == '\t')) {
+                    rxPos--;
+                }
+                frameBuffer[rxPos] = '\0';
+                replyBinary = false;
+                processLine((char*)frameBuffer, rxPos);
+                return true;
+            }
+            if (b == '\r') {
+                return false;
+            }
+            if (rxPos >= LINK_MAX_PAYLOAD) {
+                rxState = RX_LINE_SKIP;
+                return false;
+            }
+            frameBuffer[rxPos++] = b;
+            return false;
+        
+        case RX_LINE_SKIP:
+            if (b == '\n') {
+                rxState = RX_IDLE;
+            }
+            return false;
+        
+        case RX_SYNC1:
+            if (b == LINK_SYNC_1) {
+                rxPos = 0;
+                rxCrcAcc = 0xFFFF;
+                rxState = RX_HEADER;
+            } else if (b != LINK_SYNC_0) {
+                rxDrop();
+            }
+            return false;
+        
+        case RX_HEADER:
+            rxHeader[rxPos++] = b;
+            rxCrcAcc = crc16_ccitt_step(rxCrcAcc, b);
+            if (rxPos < sizeof(rxHeader)) {
+                return false;
+            }
+            rxLen = rxHeader[2] | ((uint16_t)rxHeader[3] << 8);
+            if (rxLen > LINK_MAX_PAYLOAD) {
+                rxDrop();
+                return false;
+            }
+            rxPos = 0;
+            rxState = (rxLen > 0) ? RX_PAYLOAD : RX_CRC;
+            return false;
+        
+        case RX_PAYLOAD:
+            frameBuffer[rxPos++] = b;
+            rxCrcAcc = crc16_ccitt_step(rxCrcAcc, b);
+            if (rxPos == rxLen) {
+                rxPos = 0;
+                rxState = RX_CRC;
+            }
+            return false;
+        
+        case RX_CRC:
+            rxCrc[rxPos++] = b;
+            if (rxPos < sizeof(rxCrc)) {
+                return false;
+            }
+            if (rxCrcAcc != (rxCrc[0] | ((uint16_t)rxCrc[1] << 8))) {
+                rxDrop();
+                return false;
+            }
+            rxState = RX_IDLE;
+            frameBuffer[rxLen] = '\0';
+            frameType = rxHeader[0];
+            frameLen = rxLen;
+            replyBinary = true;
+            processFrame();
+            return true;
     }
     
+    rxState = RX_IDLE;
+    return false;
+}
+
+void rxDrop() {
+    // Битый кадр посреди передачи: пусть Due повторит сразу, а не по таймауту
+    bool inFrame = rxState >= RX_SYNC1;
+    rxState = RX_IDLE;
+    if (inFrame) {
+        noteBaudError();
+    }
+    if (inFrame && imageTransfer.transferInProgress) {
+        replyBinary = true;
+        sendNak(-2);
+    }
+}
+
+void processLine(char* line, size_t len) {
     // Обработка разных типов сообщений
-    if (line.startsWith("DATA ")) {
+    if (strncmp(line, "DATA ", 5) == 0) {
         // Получены данные датчиков
-        String jsonData = line.substring(5);
-        handleSensorData(jsonData);
+        handleSensorData(line + 5, len - 5);
     }
-    else if (line.startsWith("IMG_START ")) {
+    else if (strncmp(line, "IMG_START ", 10) == 0) {
         // Начало чанкированной передачи изображения
-        // Формат: IMG_START width height totalChunks 0xCRC
-        handleImageStart(line);
+        // Формат: IMG_START width height totalChunks 0xCRC window codec flags keyId
+        handleImageStart(line + 10);
     }
-    else if (line.startsWith("IMG_CHUNK ")) {
+    else if (strncmp(line, "IMG_CHUNK ", 10) == 0) {
         // Чанк изображения
-        // Формат: IMG_CHUNK idx base64data
-        handleImageChunk(line);
+        // Формат: IMG_CHUNK idx base64data [CRC чанка hex]
+        handleImageChunk(line + 10, len - 10);
     }
-    else if (line.startsWith("IMG_END")) {
+    else if (strncmp(line, "IMG_END", 7) == 0) {
         // Конец передачи изображения
+        // Формат: IMG_END [0xCRC кадра]
+        if (line[7] == ' ') {
+            imageTransfer.expectedCrc = strtoul(line + 8, NULL, 16);
+        }
         handleImageEnd();
     }
-    else if (line.startsWith("IMG_ABORT")) {
+    else if (strncmp(line, "IMG_ABORT", 9) == 0) {
         // Отмена передачи (без отладочного вывода)
+        closeImageStream();
         imageTransfer.reset();
     }
     // Устаревший формат IMAGE больше не поддерживается
     // Неизвестные сообщения игнорируем молча - любой вывод мешает протоколу
 }
 
-void handleImageStart(String line) {
-    // Парсим: IMG_START width height totalChunks 0xCRC
-    int idx1 = line.indexOf(' ', 10);
-    int idx2 = line.indexOf(' ', idx1 + 1);
-    int idx3 = line.indexOf(' ', idx2 + 1);
-    
-    if (idx1 < 0 || idx2 < 0 || idx3 < 0) {
+void handleImageStart(const char* args) {
+    // Парсим: width height totalChunks 0xCRC [window codec flags keyId]
+    unsigned int width = 0, height = 0, totalChunks = 0, crc = 0;
+    unsigned int window = 1, codec = 0, flags = 0, keyId = 0;
+    int fields = sscanf(args, "%u %u %u %x %u %u %u %u",
+                        &width, &height, &totalChunks, &crc,
+                        &window, &codec, &flags, &keyId);
+    if (fields < 4) {
         return;
     }
     
+    closeImageStream();
     imageTransfer.reset();
-    imageTransfer.width = line.substring(10, idx1).toInt();
-    imageTransfer.height = line.substring(idx1 + 1, idx2).toInt();
-    imageTransfer.totalChunks = line.substring(idx2 + 1, idx3).toInt();
-    
-    // Парсим CRC (формат 0xABCD)
-    String crcStr = line.substring(idx3 + 1);
-    crcStr.trim();
-    if (crcStr.startsWith("0x") || crcStr.startsWith("0X")) {
-        imageTransfer.expectedCrc = strtol(crcStr.c_str() + 2, NULL, 16);
-    } else {
-        imageTransfer.expectedCrc = strtol(crcStr.c_str(), NULL, 16);
-    }
+    imageTransfer.width = width;
+    imageTransfer.height = height;
+    imageTransfer.totalChunks = totalChunks;
+    imageTransfer.expectedCrc = crc;    // %x принимает и префикс 0x
+    imageTransfer.window = window;
+    imageTransfer.codec = codec;
+    imageTransfer.flags = flags;
+    imageTransfer.keyId = keyId;
     
+    beginImageUpload();
+}
+
+void beginImageUpload() {
     // Отправляем POST /image/start на сервер и получаем image_id
     if (WiFi.status() != WL_CONNECTED) {
         return;
@@ -274,175 +581,601 @@ void handleImageStart(String line) {
     http.addHeader("Content-Type", "application/json");
     http.setTimeout(5000);
     
-    String body = "{\"session_id\":0,\"step\":0,\"width\":";
-    body += imageTransfer.width;
-    body += ",\"height\":";
-    body += imageTransfer.height;
-    body += ",\"total_chunks\":";
-    body += imageTransfer.totalChunks;
-    body += ",\"crc\":\"0x";
-    body += String(imageTransfer.expectedCrc, HEX);
-    body += "\"}";
+    int len = snprintf(httpText, sizeof(httpText),
+                       "{\"session_id\":0,\"step\":0,\"width\":%u,\"height\":%u,"
+                       "\"total_chunks\":%u,\"crc\":\"0x%x\",\"codec\":%u,\"flags\":%u,\"key_id\":%u}",
+                       imageTransfer.width, imageTransfer.height, imageTransfer.totalChunks,
+                       imageTransfer.expectedCrc, imageTransfer.codec, imageTransfer.flags,
+                       imageTransfer.keyId);
     
-    int httpCode = http.POST(body);
+    int httpCode = http.POST((uint8_t*)httpText, len);
     
-    if (httpCode == 200) {
-        String response = http.getString();
+    if (httpCode == 200 && readHttpBody(http, replyBuffer, sizeof(replyBuffer)) > 0) {
         // Парсим image_id из {"image_id":"..."}
-        int idStart = response.indexOf("\"image_id\":\"");
-        if (idStart >= 0) {
+        const char* idStart = strstr(replyBuffer, "\"image_id\":\"");
+        if (idStart != NULL) {
             idStart += 12;
-            int idEnd = response.indexOf('"', idStart);
-            if (idEnd > idStart) {
-                imageTransfer.imageId = response.substring(idStart, idEnd);
+            const char* idEnd = strchr(idStart, '"');
+            if (idEnd != NULL && idEnd > idStart && (size_t)(idEnd - idStart) < IMAGE_ID_SIZE) {
+                memcpy(imageTransfer.imageId, idStart, idEnd - idStart);
+                imageTransfer.imageId[idEnd - idStart] = '\0';
             }
         }
     }
     
     http.end();
     
-    if (imageTransfer.imageId.length() == 0) {
+    if (imageTransfer.imageId[0] == '\0' || imageTransfer.totalChunks > MAX_IMAGE_CHUNKS) {
         imageTransfer.reset();
         return;
     }
     
     imageTransfer.transferInProgress = true;
     
+    // Одно соединение на всё изображение; не открылось - остаются POST на каждый чанк
+    imageTransfer.streaming = openImageStream();
+    
     // Отправляем подтверждение готовности
-    Serial.println("IMG_READY");
+    sendReady();
 }
 
-void handleImageChunk(String line) {
+void handleImageChunk(const char* args, size_t len) {
     if (!imageTransfer.transferInProgress) {
-        Serial.println("NAK -1");
+        sendNak(-1);
         return;
     }
     
-    // Парсим: IMG_CHUNK idx base64data
-    int spaceIdx = line.indexOf(' ', 10);
-    if (spaceIdx < 0) {
-        Serial.println("NAK -2");
+    // Парсим: idx base64data [crc]
+    char* data = NULL;
+    unsigned long chunkIdx = strtoul(args, &data, 10);
+    if (data == args || *data != ' ') {
+        sendNak(-2);
         return;
     }
+    data++;
+    size_t dataLen = len - (data - args);
     
-    uint16_t chunkIdx = line.substring(10, spaceIdx).toInt();
-    String chunkData = line.substring(spaceIdx + 1);
+    // CRC чанка после base64 (прошивки без неё шлют только base64)
+    const char* crcField = (const char*)memchr(data, ' ', dataLen);
+    if (crcField != NULL) {
+        dataLen = crcField - data;
+    }
     
-    // Проверяем порядок чанков
-    if (chunkIdx != imageTransfer.receivedChunks) {
-        Serial.print("NAK ");
-        Serial.println(chunkIdx);
+    // На сервер уходят сырые байты: base64 декодируем здесь, CRC - тем же проходом
+    uint16_t crc = 0xFFFF;
+    size_t rawLen = decodeBase64(data, dataLen, decodedChunk, sizeof(decodedChunk), &crc);
+    if (rawLen == 0 || (crcField != NULL && crc != strtoul(crcField + 1, NULL, 16))) {
+        sendNak(chunkIdx);
         return;
     }
     
-    imageTransfer.receivedChunks++;
+    if (!acceptChunk(chunkIdx)) {
+        return;
+    }
     
-    // Отправляем ACK немедленно (Arduino ждёт его)
-    Serial.print("ACK ");
-    Serial.println(chunkIdx);
-    Serial.flush();
+    forwardChunk(chunkIdx, decodedChunk, rawLen);
+}
+
+void handleImageChunkRaw(uint16_t chunkIdx, const uint8_t* data, size_t len) {
+    if (!imageTransfer.transferInProgress) {
+        sendNak(-1);
+        return;
+    }
+    
+    if (!acceptChunk(chunkIdx)) {
+        return;
+    }
     
-    // Отправляем чанк на сервер по HTTP (не храним в памяти)
+    forwardChunk(chunkIdx, data, len);
+}
+
+void forwardChunk(uint16_t chunkIdx, const uint8_t* data, size_t len) {
+    if (imageTransfer.streaming) {
+        if (writeStreamRecord(chunkIdx, data, len)) {
+            return;
+        }
+        // Соединение оборвалось. Удачный write() лишь положил запись в буфер TCP,
+        // какие из прошлых дошли до сервера - неизвестно: кадр принимается
+        // заново с чанка 0, и каждый чанк уходит отдельным POST
+        restartImageUpload();
+        return;
+    }
+    
+    // Сырые байты уходят на сервер как есть, без base64 и JSON
     if (WiFi.status() == WL_CONNECTED) {
         HTTPClient http;
-        http.begin(wifiClient, SERVER_IMG_CHUNK_URL);
-        http.addHeader("Content-Type", "application/json");
+        snprintf(httpText, sizeof(httpText), "%s?image_id=%s&chunk_idx=%u",
+                 SERVER_IMG_CHUNK_RAW_URL, imageTransfer.imageId, chunkIdx);
+        http.begin(wifiClient, httpText);
+        http.addHeader("Content-Type", "application/octet-stream");
         http.setTimeout(5000);
         
-        String body = "{\"image_id\":\"";
-        body += imageTransfer.imageId;
-        body += "\",\"chunk_idx\":";
-        body += chunkIdx;
-        body += ",\"data\":\"";
-        body += chunkData;
-        body += "\"}";
-        
-        http.POST(body);
+        http.POST((uint8_t*)data, len);
         http.end();
     }
 }
 
+void restartImageUpload() {
+    closeImageStream();
+    imageTransfer.receivedChunks = 0;
+    imageTransfer.firstMissing = 0;
+    memset(imageTransfer.receivedMap, 0, sizeof(imageTransfer.receivedMap));
+    // IMG_READY во время передачи: Due начинает её с начала
+    sendReady();
+}
+
+// ==================== ПОТОК /image/stream ====================
+
+bool openImageStream() {
+    if (WiFi.status() != WL_CONNECTED) {
+        return false;
+    }
+    
+    streamClient.setTimeout(HTTP_TIMEOUT);
+    if (!streamClient.connect(SERVER_HOST, SERVER_PORT)) {
+        return false;
+    }
+    // Запись уходит сразу, не дожидаясь заполнения сегмента
+    streamClient.setNoDelay(true);
+    
+    int len = snprintf(httpText, sizeof(httpText),
+                       "POST %s?image_id=%s HTTP/1.1\r\nHost: %s:%d"
+                       "\r\nContent-Type: application/octet-stream"
+                       "\r\nTransfer-Encoding: chunked"
+                       "\r\nConnection: close\r\n\r\n",
+                       SERVER_IMG_STREAM_PATH, imageTransfer.imageId, SERVER_HOST, SERVER_PORT);
+    
+    if (len <= 0 || (size_t)len >= sizeof(httpText) ||
+        streamClient.write((const uint8_t*)httpText, len) != (size_t)len) {
+        streamClient.stop();
+        return false;
+    }
+    return true;
+}
+
+bool writeStreamRecord(uint16_t chunkIdx, const uint8_t* data, size_t len) {
+    if (!streamClient.connected() || len > LINK_MAX_PAYLOAD) {
+        return false;
+    }
+    
+    // "<hex>\r\n" + idx + len + data + "\r\n" одним write(), чтобы запись шла одним сегментом
+    int pos = snprintf((char*)streamRecord, STREAM_CHUNK_OVERHEAD, "%X\r\n",
+                       (unsigned int)(len + STREAM_RECORD_HEADER));
+    streamRecord[pos++] = chunkIdx & 0xFF;
+    streamRecord[pos++] = chunkIdx >> 8;
+    streamRecord[pos++] = len & 0xFF;
+    streamRecord[pos++] = len >> 8;
+    memcpy(streamRecord + pos, data, len);
+    pos += len;
+    streamRecord[pos++] = '\r';
+    streamRecord[pos++] = '\n';
+    
+    return streamClient.write(streamRecord, pos) == (size_t)pos;
+}
+
+bool finishImageStream() {
+    // Последний кусок нулевой длины закрывает тело, сервер собирает кадр и отвечает
+    bool ok = streamClient.print("0\r\n\r\n") == 5;
+    if (ok) {
+        // "HTTP/1.1 200 OK": код ответа после первого пробела
+        size_t n = streamClient.readBytesUntil('\n', httpText, sizeof(httpText) - 1);
+        httpText[n] = '\0';
+        const char* space = strchr(httpText, ' ');
+        ok = space != NULL && atoi(space + 1) == 200;
+    }
+    streamClient.stop();
+    imageTransfer.streaming = false;
+    return ok;
+}
+
+void closeImageStream() {
+    if (imageTransfer.streaming) {
+        streamClient.stop();
+        imageTransfer.streaming = false;
+    }
+}
+
+size_t decodeBase64(const char* src, size_t len, uint8_t* dst, size_t capacity, uint16_t* crc) {
+    uint32_t acc = 0;
+    uint8_t bits = 0;
+    size_t out = 0;
+    
+    for (size_t i = 0; i < len; i++) {
+        char c = src[i];
+        uint8_t v;
+        if (c >= 'A' && c <= 'Z')      v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+')             v = 62;
+        else if (c == '/')             v = 63;
+        else if (c == '=')             break;
+        else                           return 0;
+        
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (out >= capacity) {
+                return 0;
+            }
+            uint8_t byte = (acc >> bits) & 0xFF;
+            if (crc != NULL) {
+                *crc = crc16_ccitt_step(*crc, byte);
+            }
+            dst[out++] = byte;
+        }
+    }
+    return out;
+}
+
+bool acceptChunk(uint16_t chunkIdx) {
+    if (chunkIdx >= imageTransfer.totalChunks) {
+        sendNak(chunkIdx);
+        return false;
+    }
+    
+    if (imageTransfer.window <= 1) {
+        // Повтор последнего чанка: его ACK потерялся, подтверждаем ещё раз
+        if (chunkIdx + 1 == imageTransfer.firstMissing) {
+            sendAck(chunkIdx);
+            return false;
+        }
+        
+        // Проверяем порядок чанков
+        if (chunkIdx != imageTransfer.firstMissing) {
+            sendNak(chunkIdx);
+            return false;
+        }
+        
+        imageTransfer.markReceived(chunkIdx);
+        
+        // Отправляем ACK немедленно (Arduino ждёт его)
+        sendAck(chunkIdx);
+        Serial.flush();
+        return true;
+    }
+    
+    // Скользящее окно: принимаем любой порядок, дубликаты только подтверждаем
+    bool fresh = !imageTransfer.isReceived(chunkIdx);
+    if (fresh) {
+        imageTransfer.markReceived(chunkIdx);
+    }
+    sendSack();
+    Serial.flush();
+    return fresh;
+}
+
 void handleImageEnd() {
     if (!imageTransfer.transferInProgress) {
         return;
     }
     
     // Проверяем что получили все чанки
-    if (imageTransfer.receivedChunks == imageTransfer.totalChunks) {
-        // Отправляем POST /image/end на сервер
-        if (WiFi.status() == WL_CONNECTED) {
-            HTTPClient http;
-            http.begin(wifiClient, SERVER_IMG_END_URL);
-            http.addHeader("Content-Type", "application/json");
-            http.setTimeout(10000);
-            
-            String body = "{\"image_id\":\"";
-            body += imageTransfer.imageId;
-            body += "\"}";
-            
-            int httpCode = http.POST(body);
-            
-            if (httpCode == 200) {
-                // Сохраняем image_id для вставки в следующий DATA запрос
-                currentImageId = imageTransfer.imageId;
-            }
-            
-            http.end();
+    if (imageTransfer.receivedChunks != imageTransfer.totalChunks) {
+        closeImageStream();
+        imageTransfer.reset();
+        return;
+    }
+    
+    bool done = false;
+    if (imageTransfer.streaming) {
+        // CRC кадра - служебной записью с индексом 0xFFFF перед концом тела:
+        // сервер собирает кадр, как только закрыто тело потока
+        uint8_t crcRecord[2] = { (uint8_t)(imageTransfer.expectedCrc & 0xFF),
+                                 (uint8_t)(imageTransfer.expectedCrc >> 8) };
+        if (writeStreamRecord(STREAM_CRC_RECORD, crcRecord, sizeof(crcRecord))) {
+            done = finishImageStream();
+        } else {
+            closeImageStream();
         }
     }
+    // Без потока или без его ответа: сервер мог собрать кадр (тогда /image/end
+    // отвечает 200) или недосчитаться записей (400 со списком "missing")
+    if (!done) {
+        done = postImageEnd();
+    }
+    if (done) {
+        // Сохраняем image_id для вставки в следующий DATA запрос
+        strcpy(currentImageId, imageTransfer.imageId);
+    }
     
     imageTransfer.reset();
 }
 
-String readSerialLine() {
-    String result = "";
-    unsigned long startTime = millis();
-    
-    while (millis() - startTime < SERIAL_TIMEOUT) {
-        if (Serial.available()) {
-            char c = Serial.read();
-            
-            if (c == '\n') {
-                result.trim();
-                return result;
-            } else if (c == '\r') {
-                continue;
-            } else {
-                result += c;
-                startTime = millis(); // Сброс таймаута при получении символа
+bool postImageEnd() {
+    if (WiFi.status() != WL_CONNECTED) {
+        return false;
+    }
+    
+    HTTPClient http;
+    http.begin(wifiClient, SERVER_IMG_END_URL);
+    http.addHeader("Content-Type", "application/json");
+    http.setTimeout(10000);
+    
+    int len = snprintf(httpText, sizeof(httpText), "{\"image_id\":\"%s\",\"crc\":\"0x%x\"}",
+                       imageTransfer.imageId, imageTransfer.expectedCrc);
+    
+    int httpCode = http.POST((uint8_t*)httpText, len);
+    http.end();
+    return httpCode == 200;
+}
+
+uint16_t frameU16(size_t offset) {
+    return frameBuffer[offset] | ((uint16_t)frameBuffer[offset + 1] << 8);
+}
+
+void processFrame() {
+    switch (frameType) {
+        case LINK_DATA:
+            handleSensorData((char*)frameBuffer, frameLen);
+            break;
+        
+        case LINK_IMG_START:
+            if (frameLen < 10) {
+                return;
             }
+            closeImageStream();
+            imageTransfer.reset();
+            imageTransfer.width = frameU16(0);
+            imageTransfer.height = frameU16(2);
+            imageTransfer.totalChunks = frameU16(4);
+            imageTransfer.expectedCrc = frameU16(6);
+            imageTransfer.window = (frameLen >= 12) ? frameU16(10) : 1;
+            if (frameLen >= 15) {
+                imageTransfer.codec = frameBuffer[12];
+                imageTransfer.flags = frameBuffer[13];
+                imageTransfer.keyId = frameBuffer[14];
+            }
+            beginImageUpload();
+            break;
+        
+        case LINK_IMG_CHUNK:
+            if (frameLen < 2) {
+                sendNak(-2);
+                return;
+            }
+            handleImageChunkRaw(frameU16(0), frameBuffer + 2, frameLen - 2);
+            break;
+        
+        case LINK_IMG_END:
+            // CRC кадра (прошивки без неё шлют IMG_END без payload)
+            if (frameLen >= 2) {
+                imageTransfer.expectedCrc = frameU16(0);
+            }
+            handleImageEnd();
+            break;
+        
+        case LINK_IMG_ABORT:
+            closeImageStream();
+            imageTransfer.reset();
+            break;
+        
+        case LINK_BAUD_REQ:
+            if (frameLen >= 4) {
+                handleBaudRequest(frameU16(0) | ((uint32_t)frameU16(2) << 16));
+            }
+            break;
+        
+        case LINK_BAUD_TEST:
+            handleBaudTest();
+            break;
+        
+        default:
+            // Неизвестные кадры игнорируем молча
+            break;
+    }
+}
+
+// ==================== СКОРОСТЬ SERIAL ====================
+
+uint8_t baudTestByte(size_t i) {
+    // Чередование с переходами во всех битах: сбой делителя портит образец
+    return (uint8_t)((i & 1) ? ~(i * 37) : (i * 37 + 0x55));
+}
+
+bool baudSupported(uint32_t baud) {
+    if (baud == (uint32_t)SERIAL_BAUD) {
+        return true;
+    }
+    for (size_t i = 0; i < LINK_BAUD_RATE_COUNT; i++) {
+        if (LINK_BAUD_RATES[i] == baud) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void switchBaud(uint32_t baud) {
+    // Всё, что уже ушло в UART, дойдёт на прежней скорости
+    Serial.flush();
+    Serial.updateBaudRate(baud);
+    rxState = RX_IDLE;
+}
+
+void handleBaudRequest(uint32_t baud) {
+    if (!baudSupported(baud)) {
+        sendBaudAck(0);
+        return;
+    }
+    sendBaudAck(baud);
+    switchBaud(baud);
+    if (baud == (uint32_t)SERIAL_BAUD) {
+        // Базовая подтверждается сразу: на неё же возвращаемся при сбоях
+        linkBaud = baud;
+        pendingBaud = 0;
+    } else {
+        pendingBaud = baud;
+        pendingBaudMillis = millis();
+    }
+}
+
+void handleBaudTest() {
+    if (pendingBaud == 0 || frameLen != LINK_BAUD_TEST_SIZE) {
+        return;
+    }
+    for (size_t i = 0; i < LINK_BAUD_TEST_SIZE; i++) {
+        if (frameBuffer[i] != baudTestByte(i)) {
+            return;
+        }
+    }
+    linkBaud = pendingBaud;
+    pendingBaud = 0;
+    baudErrors = 0;
+    sendBaudAck(linkBaud);
+}
+
+void checkBaudTimeout() {
+    if (pendingBaud != 0 && millis() - pendingBaudMillis >= BAUD_TEST_TIMEOUT) {
+        pendingBaud = 0;
+        switchBaud(linkBaud);
+    }
+}
+
+void noteBaudError() {
+    if (linkBaud == (uint32_t)SERIAL_BAUD || pendingBaud != 0) {
+        return;
+    }
+    if (millis() - baudErrorMillis > BAUD_ERROR_WINDOW) {
+        baudErrorMillis = millis();
+        baudErrors = 0;
+    }
+    if (++baudErrors < BAUD_ERROR_BURST) {
+        return;
+    }
+    // Всплеск сбоев: обе стороны откатываются на SERIAL_BAUD, Due согласует заново
+    baudErrors = 0;
+    switchBaud(SERIAL_BAUD);
+    linkBaud = SERIAL_BAUD;
+    sendBaudAck(SERIAL_BAUD);
+}
+
+// ==================== ОТВЕТЫ ДЛЯ DUE ====================
+
+void sendFrame(uint8_t type, const uint8_t* payload, uint16_t len) {
+    uint8_t header[6] = {
+        LINK_SYNC_0, LINK_SYNC_1, type, txSeq++,
+        (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)
+    };
+    uint16_t crc = crc16_ccitt_update(0xFFFF, header + 2, 4);
+    crc = crc16_ccitt_update(crc, payload, len);
+    uint8_t tail[2] = { (uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8) };
+    
+    Serial.write(header, sizeof(header));
+    if (len > 0) {
+        Serial.write(payload, len);
+    }
+    Serial.write(tail, sizeof(tail));
+}
+
+void sendBaudAck(uint32_t baud) {
+    // Только кадром: BAUD_REQ приходит только кадром
+    uint8_t payload[4] = {
+        (uint8_t)(baud & 0xFF), (uint8_t)(baud >> 8),
+        (uint8_t)(baud >> 16), (uint8_t)(baud >> 24)
+    };
+    sendFrame(LINK_BAUD_ACK, payload, sizeof(payload));
+}
+
+void sendReady() {
+    if (replyBinary) {
+        sendFrame(LINK_IMG_READY, NULL, 0);
+    } else {
+        Serial.println("IMG_READY");
+    }
+}
+
+void sendAck(uint16_t chunkIdx) {
+    if (replyBinary) {
+        uint8_t payload[2] = { (uint8_t)(chunkIdx & 0xFF), (uint8_t)(chunkIdx >> 8) };
+        sendFrame(LINK_ACK, payload, sizeof(payload));
+    } else {
+        Serial.print("ACK ");
+        Serial.println(chunkIdx);
+    }
+}
+
+void sendSack() {
+    // Кумулятивно: всё до firstMissing принято; бит i - принят firstMissing + 1 + i
+    uint16_t first = imageTransfer.firstMissing;
+    uint32_t mask = 0;
+    for (uint8_t b = 0; b < 32; b++) {
+        if (imageTransfer.isReceived((uint32_t)first + 1 + b)) {
+            mask |= 1u << b;
         }
-        yield();  // Даем время WiFi стеку, но без delay
     }
     
-    result.trim();
-    return result;
+    if (replyBinary) {
+        uint8_t payload[6] = {
+            (uint8_t)(first & 0xFF), (uint8_t)(first >> 8),
+            (uint8_t)(mask & 0xFF), (uint8_t)(mask >> 8),
+            (uint8_t)(mask >> 16), (uint8_t)(mask >> 24)
+        };
+        sendFrame(LINK_SACK, payload, sizeof(payload));
+    } else {
+        Serial.print("SACK ");
+        Serial.print(first);
+        Serial.print(" 0x");
+        Serial.println(mask, HEX);
+    }
+}
+
+void sendNak(int chunkIdx) {
+    // -1 = нет активной передачи, -2 = ошибка разбора (в кадре 0xFFFF / 0xFFFE)
+    if (replyBinary) {
+        uint16_t idx = (uint16_t)chunkIdx;
+        uint8_t payload[2] = { (uint8_t)(idx & 0xFF), (uint8_t)(idx >> 8) };
+        sendFrame(LINK_NAK, payload, sizeof(payload));
+    } else {
+        Serial.print("NAK ");
+        Serial.println(chunkIdx);
+    }
+}
+
+void sendCommand(const char* json, size_t len) {
+    if (replyBinary) {
+        sendFrame(LINK_CMD, (const uint8_t*)json, len);
+    } else {
+        Serial.print("CMD ");
+        Serial.write((const uint8_t*)json, len);
+        Serial.println();
+    }
+}
+
+void sendStatusLine() {
+    // Текстом в любом режиме: Due разбирает строки и кадры одновременно
+    int len = snprintf(httpText, sizeof(httpText),
+                       "STATUS rssi=%d heap=%u heap_min=%u block=%u block_min=%u frag=%u baud=%u",
+                       WiFi.RSSI(), ESP.getFreeHeap(), heapMinFree,
+                       ESP.getMaxFreeBlockSize(), heapMinBlock, ESP.getHeapFragmentation(),
+                       (unsigned)linkBaud);
+    Serial.write((const uint8_t*)httpText, len);
+    Serial.println();
 }
 
 // ==================== HTTP ФУНКЦИИ ====================
 
-void handleSensorData(String jsonData) {
+void handleSensorData(char* json, size_t len) {
     // Проверяем WiFi
     if (WiFi.status() != WL_CONNECTED) {
         sendDefaultCommand();
         return;
     }
     
-    // Если есть загруженное изображение, вставляем image_id в секцию image
-    if (currentImageId.length() > 0) {
-        int imageSection = jsonData.indexOf("\"image\":");
-        if (imageSection > 0) {
-            int imageEnd = jsonData.indexOf('}', imageSection);
-            if (imageEnd > 0) {
-                String beforeEnd = jsonData.substring(0, imageEnd);
-                String afterEnd = jsonData.substring(imageEnd);
-                
-                jsonData = beforeEnd + ",\"image_id\":\"" + currentImageId + "\"" + afterEnd;
-            }
+    // Если есть загруженное изображение, вписываем image_id в место под него
+    // прямо в буфере приёма: без поиска и без сдвига остальной записи
+    if (currentImageId[0] != '\0') {
+        size_t idLen = strlen(currentImageId);
+        if (len >= DATA_IMAGE_ID_OFFSET + DATA_IMAGE_ID_SLOT && idLen + 2 <= DATA_IMAGE_ID_SLOT &&
+            memcmp(json, DATA_IMAGE_ID_PREFIX, DATA_IMAGE_ID_OFFSET) == 0) {
+            char* slot = json + DATA_IMAGE_ID_OFFSET;
+            memset(slot, ' ', DATA_IMAGE_ID_SLOT);
+            slot[0] = '"';
+            memcpy(slot + 1, currentImageId, idLen);
+            slot[idLen + 1] = '"';
         }
         
         // Очищаем после использования
-        currentImageId = "";
+        currentImageId[0] = '\0';
     }
     
     // Отправляем HTTP POST запрос
@@ -451,52 +1184,69 @@ void handleSensorData(String jsonData) {
     http.addHeader("Content-Type", "application/json");
     http.setTimeout(HTTP_TIMEOUT);
     
-    int httpCode = http.POST(jsonData);
+    int httpCode = http.POST((uint8_t*)json, len);
+    int replyLen = (httpCode == HTTP_CODE_OK)
+                   ? readHttpBody(http, replyBuffer, sizeof(replyBuffer)) : -1;
+    http.end();
     
-    if (httpCode > 0) {
-        if (httpCode == HTTP_CODE_OK) {
-            String response = http.getString();
-            handleServerResponse(response);
-        } else {
-            sendDefaultCommand();
-        }
-    } else {
-        sendDefaultCommand();
+    // Due ждёт CMD и читает линию: удобный момент для редкой строки STATUS
+    if (millis() - lastStatus >= STATUS_INTERVAL) {
+        lastStatus = millis();
+        printStatus();
     }
     
-    http.end();
+    if (replyLen < 0) {
+        sendDefaultCommand();
+        return;
+    }
+    handleServerResponse(replyBuffer, replyLen);
+}
+
+int readHttpBody(HTTPClient& http, char* dst, size_t capacity) {
+    // Ответ читается в статический буфер; без Content-Length или длиннее буфера - отказ
+    int size = http.getSize();
+    if (size < 0 || (size_t)size >= capacity) {
+        return -1;
+    }
+    size_t got = http.getStream().readBytes(dst, size);
+    dst[got] = '\0';
+    return (got == (size_t)size) ? (int)got : -1;
 }
 
-void handleServerResponse(String response) {
+void handleServerResponse(const char* response, size_t len) {
     // Отправляем команду на Arduino Due
     // Формат: CMD {"command": "FORWARD", "duration_ms": 3000}
     // ВАЖНО: никаких других Serial.print здесь - они мешают протоколу!
-    Serial.print("CMD ");
-    Serial.println(response);
+    if (len > LINK_MAX_REPLY) {
+        sendDefaultCommand();
+        return;
+    }
+    sendCommand(response, len);
 }
 
 void sendDefaultCommand() {
     // Отправляем STOP если сервер недоступен
-    Serial.println("CMD {\"command\":\"STOP\",\"duration_ms\":3000}");
+    static const char STOP_COMMAND[] = "{\"command\":\"STOP\",\"duration_ms\":3000}";
+    sendCommand(STOP_COMMAND, sizeof(STOP_COMMAND) - 1);
 }
 
 // ==================== ВСПОМОГАТЕЛЬНЫЕ ФУНКЦИИ ====================
 
+void sampleHeap() {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+    if (freeHeap < heapMinFree) {
+        heapMinFree = freeHeap;
+    }
+    if (maxBlock < heapMinBlock) {
+        heapMinBlock = maxBlock;
+    }
+}
+
 void printStatus() {
-    Serial.println("=== Status ===");
-    Serial.print("WiFi: ");
-    Serial.println(WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected");
-    Serial.print("IP: ");
-    Serial.println(WiFi.localIP());
-    Serial.print("RSSI: ");
-    Serial.print(WiFi.RSSI());
-    Serial.println(" dBm");
-    Serial.print("Server: ");
-    Serial.println(serverAvailable ? "Available" : "Not available");
-    Serial.print("Free heap: ");
-    Serial.print(ESP.getFreeHeap());
-    Serial.println(" bytes");
-    Serial.println("==============");
+    // Одна строка "STATUS key=value ...": её видно и в мониторе, и на Due (команда status)
+    sampleHeap();
+    sendStatusLine();
 }
 
 
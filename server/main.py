@@ -10,19 +10,23 @@ FastAPI сервер для управления моделью автомоби
 """
 
 import os
+import asyncio
 import base64
+import binascii
 import json
 import logging
+import struct
 import time
-from datetime import datetime
-from typing import Optional, List, Dict, Any
+from datetime import datetime, timedelta
+from typing import Optional, List, Dict, Any, Set
 from io import BytesIO
 from pathlib import Path
 
 from fastapi import FastAPI, Request, HTTPException
-from fastapi.responses import JSONResponse, FileResponse, HTMLResponse
+from fastapi.responses import JSONResponse, FileResponse, HTMLResponse, StreamingResponse
 from fastapi.staticfiles import StaticFiles
 from fastapi.middleware.cors import CORSMiddleware
+from starlette.requests import ClientDisconnect
 from pydantic import BaseModel
 import uvicorn
 
@@ -60,12 +64,38 @@ API_MODEL = os.getenv("OPENAI_MODEL", "google/gemini-2.0-flash-exp:free")
 # Доступные команды
 AVAILABLE_COMMANDS = ["FORWARD", "BACKWARD", "LEFT", "RIGHT", "STOP"]
 
+# Ответ /command с ID словаря машины ("id", и в "seq") вместо имён команд:
+# на Due ID 0..4 - AVAILABLE_COMMANDS в том же порядке. COMMAND_IDS=0 - по именам
+COMMAND_IDS = os.getenv("COMMAND_IDS", "1") != "0"
+
 # Базовая длительность команды (мс)
 DEFAULT_DURATION_MS = 3000
 
+# Составной манёвр "seq": до 8 отрезков (очередь таймера машины), каждый не длиннее 10 с
+MAX_SEQ_SEGMENTS = 8
+MAX_SEGMENT_MS = 10000
+
+# Скорость (скважность PWM моторов), %: ниже MIN_SPEED_PERCENT моторы не трогаются с места
+MIN_SPEED_PERCENT = 20
+MAX_SPEED_PERCENT = 100
+
 # Режим работы без API (для тестирования)
 DEMO_MODE = not API_KEY
 
+# Геометрия кадра, которую машина должна снимать на следующих шагах
+# full = 160x120, half = 80x60, horizon = 160x40 (полоса у горизонта)
+# Без IMAGE_MODE сервер геометрию не навязывает: действует выбранная на машине
+# (команда "cam"), поле image_mode в CMD не передаётся
+IMAGE_MODES = ["full", "half", "horizon"]
+DEFAULT_IMAGE_MODE: Optional[str] = os.getenv("IMAGE_MODE") or None
+if DEFAULT_IMAGE_MODE not in IMAGE_MODES:
+    DEFAULT_IMAGE_MODE = None
+
+# Кадр, который машина не передала (сцена не изменилась, "reuse_step"), берётся из
+# последнего кадра сессии. REUSED_IMAGE_TO_LLM=0 - LLM получает вместо него только
+# текст "вид не изменился", без токенов изображения
+REUSED_IMAGE_TO_LLM = os.getenv("REUSED_IMAGE_TO_LLM", "1") != "0"
+
 # ==================== PYDANTIC МОДЕЛИ ====================
 
 class MPU6050Data(BaseModel):
@@ -75,6 +105,15 @@ class MPU6050Data(BaseModel):
     gx: float = 0.0
     gy: float = 0.0
     gz: float = 0.0
+    # Сводка отсчётов FIFO за шаг (прошивки без неё шлют только последний отсчёт)
+    roll: Optional[float] = None    # градусы, комплементарный фильтр на Due
+    pitch: Optional[float] = None
+    yaw: Optional[float] = None     # интеграл гироскопа, дрейфует
+    a_peak: Optional[float] = None  # максимум |a| за шаг, м/с²
+    g_peak: Optional[float] = None  # максимум |ω| за шаг, рад/с
+    g_mean: Optional[List[float]] = None  # средняя угловая скорость по осям, рад/с
+    jerk: Optional[float] = None    # максимум |da/dt| за шаг, м/с³
+    samples: int = 0
 
 class SensorData(BaseModel):
     distance_cm: float = 400.0
@@ -87,8 +126,18 @@ class ImageData(BaseModel):
     width: int = 0
     height: int = 0
     format: str = "GRAY8"
+    mode: str = "full"  # геометрия кадра на машине
+    pipeline: str = "rgb565"  # конвейер камеры: rgb565 или yuv422 (только Y)
     data_base64: Optional[str] = None
     image_id: Optional[str] = None  # ID для чанкированной загрузки
+    # Описание кадра с машины (VisionPreprocessor): отличие от переданного кадра
+    # (0..254, 255 - не с чем сравнить), гистограмма по 32 уровня в %, миниатюра 8x6 hex
+    diff: Optional[int] = None
+    hist: Optional[List[int]] = None
+    thumb: Optional[str] = None
+    # Кадр не передан: сцена та же, что в кадре этого шага
+    reuse_step: Optional[int] = None
+    reused: bool = False  # кадр подставлен сервером из кэша сессии
 
 class CarDataRequest(BaseModel):
     session_id: int = 1
@@ -96,10 +145,25 @@ class CarDataRequest(BaseModel):
     timestamp: str = ""
     sensors: SensorData
     image: Optional[ImageData] = None
+    # Длительности участков шага на Due с прошлого DATA: имя -> [среднее, максимум], мкс
+    perf: Optional[Dict[str, List[float]]] = None
+    # Решение ImageRateController: уровень 0..5, кадр каждый period-й шаг, измеренные
+    # байт/с и повторы на 1000 чанков, время шага и бюджет кадра в нём, мс, RSSI NodeMCU, дБм
+    rate: Optional[Dict[str, int]] = None
 
 class CommandResponse(BaseModel):
-    command: str
+    command: Optional[str] = None  # нет, если передан id
+    id: Optional[int] = None  # ID команды в словаре машины вместо command
     duration_ms: int
+    image_mode: Optional[str] = None  # геометрия кадра для следующих шагов (нет - без изменений)
+    step: int = 0  # шаг, на данные которого дан ответ (машина отбрасывает чужие)
+    # Составной манёвр: [[команда, мс], ...], исполняется таймером машины без
+    # промежуточных запросов; command/duration_ms - первая команда и общее время
+    seq: Optional[List[List[Any]]] = None
+    # Скорость команды, % от скорости словаря (нет = 100)
+    speed: Optional[int] = None
+    # Кадра для reuse_step нет (перезапуск сервера): машина передаст следующий целиком
+    refresh: Optional[bool] = None
 
 # ==================== FASTAPI ПРИЛОЖЕНИЕ ====================
 
@@ -152,6 +216,10 @@ MAX_ALERTS = 200
 pending_images: Dict[str, Dict[str, Any]] = {}
 PENDING_IMAGE_TIMEOUT = 60  # Секунд до удаления незавершённой загрузки
 
+# Последний полученный кадр каждой сессии (session_id -> step, data_base64, width, height)
+# для шагов, на которых машина передала только "reuse_step"
+session_frames: Dict[int, Dict[str, Any]] = {}
+
 # Пороги детекции падения по MPU6050
 # Нормально: az ≈ 9.8 (гравитация вниз), ax ≈ 0, ay ≈ 0
 FALL_THRESHOLDS = {
@@ -159,6 +227,8 @@ FALL_THRESHOLDS = {
     "ax_max": 7.0,     # Если |ax| > 7 — машина на боку
     "ay_max": 7.0,     # Если |ay| > 7 — машина на боку
     "gyro_max": 5.0,   # Если любая ось гироскопа > 5 рад/с — вращение
+    "tilt_max": 45.0,  # Если |roll| или |pitch| > 45° — машина на боку
+    "impact_g": 3.0,   # Если пик |a| за шаг > 3 g — удар
 }
 
 # ==================== ФОРМИРОВАНИЕ ПРОМПТА ====================
@@ -176,6 +246,13 @@ Available commands:
 You must respond with a valid JSON object in this format:
 {"command": "COMMAND_NAME", "duration_ms": 3000}
 
+For a multi-part maneuver (e.g. back off, then turn) you may instead send up to 8 segments,
+executed back to back by the car without waiting for the next decision:
+{"seq": [["BACKWARD", 500], ["LEFT", 400], ["FORWARD", 1000]]}
+
+Optionally add "speed" (20-100, percent of full speed, default 100) to drive slower,
+e.g. {"command": "FORWARD", "duration_ms": 2000, "speed": 50}
+
 You may include additional text before or after the JSON to provide context, observations, or answer questions (e.g., whether you can see an image, what you observe, etc.). The JSON will be extracted automatically.
 
 Rules for decision making:
@@ -190,6 +267,9 @@ Always prioritize safety - when in doubt, STOP."""
 # Текущий системный промпт (изменяемый в рантайме)
 current_system_prompt: str = SYSTEM_PROMPT
 
+# Текущий режим кадра (изменяемый в рантайме через /image-mode); None - решает машина
+current_image_mode: Optional[str] = DEFAULT_IMAGE_MODE
+
 
 def build_user_prompt(data: CarDataRequest) -> str:
     """Формирование промпта из данных датчиков"""
@@ -211,13 +291,30 @@ def build_user_prompt(data: CarDataRequest) -> str:
             f"Acceleration: X={mpu.ax:.2f}, Y={mpu.ay:.2f}, Z={mpu.az:.2f} m/s²",
             f"Gyroscope: X={mpu.gx:.2f}, Y={mpu.gy:.2f}, Z={mpu.gz:.2f} rad/s",
         ])
+        if mpu.samples > 0:
+            prompt_parts.extend([
+                f"Orientation: roll={mpu.roll:.1f}°, pitch={mpu.pitch:.1f}°, heading change={mpu.yaw:.1f}°",
+                f"Over last step ({mpu.samples} samples): peak accel={mpu.a_peak:.1f} m/s², "
+                f"peak rotation={mpu.g_peak:.2f} rad/s, peak jerk={mpu.jerk:.0f} m/s³",
+            ])
     
     # Добавляем информацию об изображении
     if data.image and data.image.available:
         prompt_parts.extend([
             "",
-            f"=== CAMERA IMAGE ({data.image.width}x{data.image.height}) ===",
-            "Image is available for analysis",
+            f"=== CAMERA IMAGE ({data.image.width}x{data.image.height}, mode {data.image.mode}, pipeline {data.image.pipeline}) ===",
+        ])
+        if data.image.reused:
+            prompt_parts.append(f"Camera view unchanged since step {data.image.reuse_step} "
+                                f"(frame difference {data.image.diff}/255)")
+            if REUSED_IMAGE_TO_LLM:
+                prompt_parts.append("The image from that step is attached again")
+        else:
+            prompt_parts.append("Image is available for analysis")
+    elif data.rate and data.rate.get("period", 1) > 1:
+        prompt_parts.extend([
+            "",
+            f"=== CAMERA: slow link, image only every {data.rate['period']} steps, none this step ===",
         ])
     
     # Добавляем историю последних команд
@@ -239,6 +336,41 @@ def build_user_prompt(data: CarDataRequest) -> str:
     return "\n".join(prompt_parts)
 
 
+def attach_session_frame(data: CarDataRequest) -> bool:
+    """
+    Кэш последнего кадра сессии: свежий кадр запоминается, вместо непереданного
+    ("reuse_step") подставляется запомненный. True - запомненного кадра нет,
+    машина должна передать следующий кадр целиком
+    """
+    image = data.image
+    if image is None:
+        return False
+    
+    if image.available and image.data_base64:
+        session_frames[data.session_id] = {
+            "step": data.step,
+            "data_base64": image.data_base64,
+            "width": image.width,
+            "height": image.height,
+        }
+        return False
+    
+    if image.reuse_step is None:
+        return False
+    frame = session_frames.get(data.session_id)
+    if frame is None or frame["step"] != image.reuse_step:
+        logger.warning(f"Reused frame of step {image.reuse_step} is not cached, requesting refresh")
+        return True
+    
+    image.available = True
+    image.reused = True
+    image.data_base64 = frame["data_base64"]
+    image.width = frame["width"]
+    image.height = frame["height"]
+    logger.info(f"Reusing frame of step {image.reuse_step} (diff {image.diff})")
+    return False
+
+
 def save_image(image_data: ImageData, session_id: int, step: int) -> Optional[Dict[str, Any]]:
     """Сохранение изображения на диск"""
     global saved_images
@@ -406,6 +538,9 @@ async def get_llm_command(data: CarDataRequest) -> CommandResponse:
         )
         
         # Если изображение доступно, используем Vision API
+        # (кадр без изменений - только если REUSED_IMAGE_TO_LLM)
+        if image_available and data.image.reused and not REUSED_IMAGE_TO_LLM:
+            image_available = False
         image_url = None
         if image_available:
             image_url = decode_image_for_vision(data.image)
@@ -498,6 +633,11 @@ async def get_llm_command(data: CarDataRequest) -> CommandResponse:
                 
                 command = result.get("command", "STOP").upper()
                 duration = result.get("duration_ms", DEFAULT_DURATION_MS)
+                seq = parse_sequence(result.get("seq"))
+                speed = parse_speed(result.get("speed"))
+                if seq:
+                    command = seq[0][0]
+                    duration = sum(segment[1] for segment in seq)
                 
                 # Валидация команды
                 if command not in AVAILABLE_COMMANDS:
@@ -506,12 +646,16 @@ async def get_llm_command(data: CarDataRequest) -> CommandResponse:
                 
                 log_entry["parsed_command"] = command
                 log_entry["parsed_duration_ms"] = duration
+                if seq:
+                    log_entry["parsed_seq"] = seq
+                if speed is not None:
+                    log_entry["parsed_speed"] = speed
                 
                 llm_log.append(log_entry)
                 if len(llm_log) > MAX_LLM_LOG:
                     llm_log.pop(0)
                 
-                return CommandResponse(command=command, duration_ms=duration)
+                return CommandResponse(command=command, duration_ms=duration, seq=seq, speed=speed)
         except json.JSONDecodeError as e:
             logger.error(f"Failed to parse LLM JSON response: {e}")
             log_entry["error"] = f"JSON parse error: {e}"
@@ -537,6 +681,51 @@ async def get_llm_command(data: CarDataRequest) -> CommandResponse:
         return CommandResponse(command="STOP", duration_ms=DEFAULT_DURATION_MS)
 
 
+def encode_command_ids(response: CommandResponse) -> CommandResponse:
+    """Имена команд в ответе -> ID словаря машины (история хранит имена)"""
+    if response.command not in AVAILABLE_COMMANDS:
+        return response
+    seq = None
+    if response.seq:
+        seq = [[AVAILABLE_COMMANDS.index(name), ms] for name, ms in response.seq]
+    return response.model_copy(update={
+        "command": None,
+        "id": AVAILABLE_COMMANDS.index(response.command),
+        "seq": seq,
+    })
+
+
+def parse_sequence(raw: Any) -> Optional[List[List[Any]]]:
+    """Проверка составного манёвра от LLM: до MAX_SEQ_SEGMENTS пар [команда, мс]."""
+    if not isinstance(raw, list):
+        return None
+    seq = []
+    for segment in raw[:MAX_SEQ_SEGMENTS]:
+        if not isinstance(segment, (list, tuple)) or len(segment) != 2:
+            continue
+        name = str(segment[0]).upper()
+        if name not in AVAILABLE_COMMANDS:
+            logger.warning(f"Invalid sequence command from LLM: {name}, using STOP")
+            name = "STOP"
+        try:
+            duration = int(segment[1])
+        except (TypeError, ValueError):
+            continue
+        seq.append([name, max(0, min(duration, MAX_SEGMENT_MS))])
+    return seq or None
+
+
+def parse_speed(raw: Any) -> Optional[int]:
+    """Скорость от LLM в пределах MIN_SPEED_PERCENT..MAX_SPEED_PERCENT (None - полная)."""
+    if raw is None:
+        return None
+    try:
+        speed = int(raw)
+    except (TypeError, ValueError):
+        return None
+    return max(MIN_SPEED_PERCENT, min(speed, MAX_SPEED_PERCENT))
+
+
 def get_demo_command(data: CarDataRequest) -> CommandResponse:
     """Демо логика без LLM"""
     
@@ -544,8 +733,10 @@ def get_demo_command(data: CarDataRequest) -> CommandResponse:
     
     # Простая логика принятия решений на основе расстояния
     if sensors.distance_cm < 20:
-        # Очень близко - отъезжаем назад
-        return CommandResponse(command="BACKWARD", duration_ms=1000)
+        # Очень близко - отъезжаем назад и сразу отворачиваем одним манёвром
+        turn = "LEFT" if data.step % 2 == 0 else "RIGHT"
+        return CommandResponse(command="BACKWARD", duration_ms=1800,
+                               seq=[["BACKWARD", 1000], [turn, 800]])
     
     if sensors.distance_cm < 50:
         # Близко - поворачиваем
@@ -556,8 +747,8 @@ def get_demo_command(data: CarDataRequest) -> CommandResponse:
             return CommandResponse(command="RIGHT", duration_ms=1500)
     
     if sensors.light_dark:
-        # Темно - осторожно вперед
-        return CommandResponse(command="FORWARD", duration_ms=1000)
+        # Темно - осторожно вперед на половинной скорости
+        return CommandResponse(command="FORWARD", duration_ms=1000, speed=50)
     
     # Путь свободен - едем вперед
     return CommandResponse(command="FORWARD", duration_ms=DEFAULT_DURATION_MS)
@@ -581,10 +772,18 @@ def check_fall_detection(data: CarDataRequest):
         or abs(mpu.gy) > FALL_THRESHOLDS["gyro_max"]
         or abs(mpu.gz) > FALL_THRESHOLDS["gyro_max"]
     )
+    is_impact = False
+
+    # Со сводкой окна: наклон по фильтру, вращение и удар - по пикам за весь шаг
+    if mpu.samples > 0:
+        is_tilted_x = is_tilted_x or abs(mpu.roll or 0.0) > FALL_THRESHOLDS["tilt_max"]
+        is_tilted_y = is_tilted_y or abs(mpu.pitch or 0.0) > FALL_THRESHOLDS["tilt_max"]
+        is_rotating = is_rotating or (mpu.g_peak or 0.0) > FALL_THRESHOLDS["gyro_max"]
+        is_impact = (mpu.a_peak or 0.0) > FALL_THRESHOLDS["impact_g"] * 9.80665
 
     # Машина считается «упавшей» если она наклонена И вращается
     # ИЛИ если она явно не вертикальна (az далёк от 9.8)
-    if (is_tilted_x or is_tilted_y or is_not_upright) and is_rotating:
+    if ((is_tilted_x or is_tilted_y or is_not_upright) and is_rotating) or is_impact:
         alert_message = "⚠ Car might have FALLEN or is unstable!"
         alert_details = {
             "ax": mpu.ax, "ay": mpu.ay, "az": mpu.az,
@@ -593,6 +792,9 @@ def check_fall_detection(data: CarDataRequest):
             "is_tilted_y": is_tilted_y,
             "is_not_upright": is_not_upright,
             "is_rotating": is_rotating,
+            "is_impact": is_impact,
+            "roll": mpu.roll, "pitch": mpu.pitch,
+            "a_peak": mpu.a_peak, "g_peak": mpu.g_peak,
         }
         alert_entry = {
             "timestamp": datetime.now().isoformat(),
@@ -605,6 +807,7 @@ def check_fall_detection(data: CarDataRequest):
         alerts.append(alert_entry)
         if len(alerts) > MAX_ALERTS:
             alerts.pop(0)
+        publish_telemetry("alert", alert_entry)
         logger.warning(f"🚨 ALERT: {alert_message} | MPU: ax={mpu.ax} ay={mpu.ay} az={mpu.az} gx={mpu.gx} gy={mpu.gy} gz={mpu.gz}")
 
 
@@ -632,7 +835,7 @@ async def health():
     return {"status": "healthy"}
 
 
-@app.post("/command", response_model=CommandResponse)
+@app.post("/command", response_model=CommandResponse, response_model_exclude_none=True)
 async def get_command(request: Request):
     """
     Основной endpoint для получения команды
@@ -655,6 +858,12 @@ async def get_command(request: Request):
                 # Удаляем после использования
                 del pending_images[data.image.image_id]
         
+        refresh_image = attach_session_frame(data)
+        if data.session_id in keyframe_lost_sessions:
+            # Due начнёт новую цепочку inter с ключевого кадра
+            keyframe_lost_sessions.discard(data.session_id)
+            refresh_image = True
+        
         # Проверяем наличие изображения
         has_image = (
             data.image is not None and 
@@ -681,6 +890,13 @@ async def get_command(request: Request):
             },
             "image_available": data.image.available if data.image else False
         }
+        if data.image and data.image.diff is not None:
+            metrics_entry["image_diff"] = data.image.diff
+            metrics_entry["image_reused"] = data.image.reused
+        if data.perf:
+            metrics_entry["perf"] = data.perf
+        if data.rate:
+            metrics_entry["rate"] = data.rate
         
         # Добавляем данные MPU6050 если есть
         if data.sensors.mpu6050:
@@ -691,10 +907,18 @@ async def get_command(request: Request):
                 "gx": data.sensors.mpu6050.gx,
                 "gy": data.sensors.mpu6050.gy,
                 "gz": data.sensors.mpu6050.gz,
+                "roll": data.sensors.mpu6050.roll,
+                "pitch": data.sensors.mpu6050.pitch,
+                "yaw": data.sensors.mpu6050.yaw,
+                "a_peak": data.sensors.mpu6050.a_peak,
+                "g_peak": data.sensors.mpu6050.g_peak,
+                "g_mean": data.sensors.mpu6050.g_mean,
+                "jerk": data.sensors.mpu6050.jerk,
+                "samples": data.sensors.mpu6050.samples,
             }
         
-        # Сохраняем изображение если есть
-        if data.image and data.image.available and data.image.data_base64:
+        # Сохраняем изображение если есть (подставленный из кэша уже сохранён)
+        if data.image and data.image.available and data.image.data_base64 and not data.image.reused:
             image_info = save_image(data.image, data.session_id, data.step)
             if image_info:
                 metrics_entry["image_path"] = image_info["filename"]
@@ -710,12 +934,18 @@ async def get_command(request: Request):
         
         # Получаем команду от LLM
         response = await get_llm_command(data)
+        response.image_mode = current_image_mode
+        response.step = data.step
+        if refresh_image:
+            response.refresh = True
         
         # Сохраняем в историю
         command_history.append({
             "step": data.step,
             "command": response.command,
             "duration_ms": response.duration_ms,
+            "seq": response.seq,
+            "speed": response.speed,
             "timestamp": datetime.now().isoformat()
         })
         
@@ -725,7 +955,9 @@ async def get_command(request: Request):
         
         logger.info(f"Response: {response.command} for {response.duration_ms}ms")
         
-        return response
+        publish_step(metrics_entry, command_history[-1])
+        
+        return encode_command_ids(response) if COMMAND_IDS else response
         
     except Exception as e:
         logger.error(f"Error processing request: {e}")
@@ -753,6 +985,7 @@ async def get_history():
 async def clear_history():
     """Очистка истории команд"""
     command_history.clear()
+    publish_telemetry("resync", {})
     return {"status": "cleared"}
 
 
@@ -810,6 +1043,80 @@ async def clear_metrics():
     return {"status": "cleared"}
 
 
+# ==================== FRAME CODECS ====================
+# Совпадают с FrameCodec.h на Arduino Due
+
+CODEC_RAW = 0    # байты кадра как есть
+CODEC_INTRA = 1  # разность с пикселем строкой выше + PackBits
+CODEC_INTER = 2  # XOR с ключевым кадром + PackBits
+CODEC_NAMES = {CODEC_RAW: "raw", CODEC_INTRA: "intra", CODEC_INTER: "inter"}
+FRAME_FLAG_KEY = 0x01
+
+# Восстановленные ключевые кадры: key_id -> (width, height, bytes)
+codec_keyframes: Dict[int, Any] = {}
+MAX_KEYFRAMES = 4
+
+# Сессии, разностный кадр которых не к чему применить (ключевой кадр потерян
+# перезапуском или вытеснен): следующий ответ /command несёт "refresh"
+keyframe_lost_sessions: Set[int] = set()
+
+
+class KeyframeMissing(ValueError):
+    """Разностный кадр ссылается на ключевой, которого нет в codec_keyframes"""
+
+
+def unpack_bits(data: bytes, size: int) -> bytearray:
+    """PackBits: h < 128 - далее h+1 байт как есть, h > 128 - байт повторить 257-h раз"""
+    out = bytearray()
+    i = 0
+    while i < len(data) and len(out) < size:
+        h = data[i]
+        i += 1
+        if h < 128:
+            out += data[i:i + h + 1]
+            i += h + 1
+        elif h > 128:
+            out += bytes([data[i]]) * (257 - h)
+            i += 1
+    if len(out) != size:
+        raise ValueError(f"PackBits stream decodes to {len(out)} bytes, expected {size}")
+    return out
+
+
+def decode_frame(payload: bytes, width: int, height: int, codec: int, flags: int, key_id: int) -> bytes:
+    """Восстановление кадра GRAY8 из данных кодека; ключевые кадры запоминаются"""
+    size = width * height
+    if codec == CODEC_RAW:
+        if len(payload) != size:
+            raise ValueError(f"raw frame is {len(payload)} bytes, expected {size}")
+        frame = bytes(payload)
+    elif codec == CODEC_INTRA:
+        residual = unpack_bits(payload, size)
+        pixels = bytearray(size)
+        # Первая строка - разность с левым соседом, остальные - со строкой выше
+        acc = 0
+        for x in range(width):
+            acc = (acc + residual[x]) & 0xFF
+            pixels[x] = acc
+        for i in range(width, size):
+            pixels[i] = (pixels[i - width] + residual[i]) & 0xFF
+        frame = bytes(pixels)
+    elif codec == CODEC_INTER:
+        key = codec_keyframes.get(key_id)
+        if key is None or key[0] != width or key[1] != height:
+            raise KeyframeMissing(f"keyframe {key_id} for {width}x{height} is not available")
+        residual = unpack_bits(payload, size)
+        frame = bytes(a ^ b for a, b in zip(residual, key[2]))
+    else:
+        raise ValueError(f"unknown codec {codec}")
+
+    if flags & FRAME_FLAG_KEY:
+        codec_keyframes[key_id] = (width, height, frame)
+        while len(codec_keyframes) > MAX_KEYFRAMES:
+            del codec_keyframes[next(iter(codec_keyframes))]
+    return frame
+
+
 # ==================== CHUNKED IMAGE UPLOAD ====================
 
 def cleanup_pending_images():
@@ -836,6 +1143,9 @@ async def image_start(request: Request):
     height = body.get("height", 0)
     total_chunks = body.get("total_chunks", 0)
     crc = body.get("crc", "")
+    codec = int(body.get("codec", CODEC_RAW))
+    flags = int(body.get("flags", 0))
+    key_id = int(body.get("key_id", 0))
     
     image_id = f"s{session_id}_st{step}_{int(time.time())}"
     
@@ -846,13 +1156,17 @@ async def image_start(request: Request):
         "height": height,
         "total_chunks": total_chunks,
         "crc": crc,
+        "codec": codec,
+        "flags": flags,
+        "key_id": key_id,
         "chunks": {},
         "created_at": time.time(),
         "completed": False,
         "data_base64": None,
     }
     
-    logger.info(f"Image upload started: {image_id} ({width}x{height}, {total_chunks} chunks)")
+    logger.info(f"Image upload started: {image_id} ({width}x{height}, {total_chunks} chunks, "
+                f"codec {CODEC_NAMES.get(codec, codec)}{' key' if flags & FRAME_FLAG_KEY else ''})")
     return {"image_id": image_id}
 
 
@@ -871,6 +1185,61 @@ async def image_chunk(request: Request):
     return {"status": "ok"}
 
 
+@app.post("/image/chunk/raw")
+async def image_chunk_raw(request: Request, image_id: str = "", chunk_idx: int = -1):
+    """Приём одного чанка сырыми байтами (бинарный протокол Due -> NodeMCU)"""
+    if image_id not in pending_images:
+        raise HTTPException(status_code=404, detail="Unknown image_id")
+    
+    pending_images[image_id]["chunks"][chunk_idx] = await request.body()
+    return {"status": "ok"}
+
+
+# Запись потока /image/stream: chunk_idx (u16 LE), len (u16 LE), байты чанка
+STREAM_RECORD_HEADER = struct.Struct("<HH")
+# Служебная запись: CRC16 кадра (u16 LE), Due передаёт её в IMG_END
+STREAM_CRC_RECORD = 0xFFFF
+
+
+@app.post("/image/stream")
+async def image_stream(request: Request, image_id: str = ""):
+    """Все чанки изображения одним POST (chunked transfer encoding от NodeMCU)
+
+    Чанки сохраняются по мере прихода записей, поэтому при обрыве соединения
+    NodeMCU дошлёт оставшиеся через /image/chunk/raw и завершит через /image/end.
+    Когда тело закончилось и все чанки на месте, изображение собирается сразу.
+    """
+    if image_id not in pending_images:
+        raise HTTPException(status_code=404, detail="Unknown image_id")
+    
+    chunks = pending_images[image_id]["chunks"]
+    buf = bytearray()
+    try:
+        async for part in request.stream():
+            buf += part
+            pos = 0
+            while len(buf) - pos >= STREAM_RECORD_HEADER.size:
+                chunk_idx, length = STREAM_RECORD_HEADER.unpack_from(buf, pos)
+                end = pos + STREAM_RECORD_HEADER.size + length
+                if end > len(buf):
+                    break
+                record = bytes(buf[pos + STREAM_RECORD_HEADER.size:end])
+                if chunk_idx == STREAM_CRC_RECORD and len(record) == 2:
+                    pending_images[image_id]["crc"] = f"0x{struct.unpack('<H', record)[0]:x}"
+                else:
+                    chunks[chunk_idx] = record
+                pos = end
+            del buf[:pos]
+    except ClientDisconnect:
+        logger.warning(f"Image {image_id}: stream closed after {len(chunks)} chunks")
+        return {"status": "partial", "received": len(chunks),
+                "missing": missing_chunks(pending_images[image_id])}
+    
+    if buf:
+        logger.warning(f"Image {image_id}: {len(buf)} trailing bytes in stream")
+    return finish_image(image_id)
+
+
 @app.post("/image/end")
 async def image_end(request: Request):
     """Завершение чанкированной загрузки — склейка и сохранение"""
@@ -879,21 +1248,67 @@ async def image_end(request: Request):
     
     if image_id not in pending_images:
         raise HTTPException(status_code=404, detail="Unknown image_id")
+    if pending_images[image_id]["completed"]:
+        # Поток собрал кадр, но NodeMCU не дождалась его ответа
+        return {"status": "ok", "image_id": image_id}
+    # CRC кадра приходит в конце передачи (в /image/start прошивка шлёт 0)
+    if body.get("crc"):
+        pending_images[image_id]["crc"] = body["crc"]
     
+    return finish_image(image_id)
+
+
+def parse_crc(value: Any) -> int:
+    """CRC из JSON NodeMCU: строка "0x1a2b" или число; 0 если нет или не разобрать"""
+    try:
+        return int(value, 16) if isinstance(value, str) else int(value or 0)
+    except ValueError:
+        return 0
+
+
+def missing_chunks(img: Dict[str, Any]) -> List[int]:
+    """Индексы чанков, которых сервер не получил (у собранного кадра - ни одного)"""
+    if img["completed"]:
+        return []
+    return [i for i in range(img["total_chunks"]) if i not in img["chunks"]]
+
+
+def finish_image(image_id: str) -> Dict[str, Any]:
+    """Склейка чанков, декодирование кадра и сохранение на диск"""
     img = pending_images[image_id]
     total = img["total_chunks"]
     
     # Проверяем что все чанки получены
-    if len(img["chunks"]) != total:
-        logger.warning(f"Image {image_id}: expected {total} chunks, got {len(img['chunks'])}")
-        raise HTTPException(status_code=400, detail="Not all chunks received")
+    missing = missing_chunks(img)
+    if missing:
+        logger.warning(f"Image {image_id}: expected {total} chunks, missing {missing}")
+        raise HTTPException(status_code=400,
+                            detail={"error": "Not all chunks received", "missing": missing})
     
-    # Склеиваем base64 в порядке индексов
-    full_base64 = ""
+    # Склеиваем в порядке индексов: чанки приходят base64-строками (текстовый
+    # протокол) или сырыми байтами (/image/chunk/raw, /image/stream)
+    raw = bytearray()
     for i in range(total):
         if i not in img["chunks"]:
             raise HTTPException(status_code=400, detail=f"Missing chunk {i}")
-        full_base64 += img["chunks"][i]
+        chunk = img["chunks"][i]
+        raw += chunk if isinstance(chunk, bytes) else base64.b64decode(chunk)
+    
+    # CRC16-CCITT закодированного кадра, как его считает Due (0 - не передана)
+    expected_crc = parse_crc(img.get("crc"))
+    if expected_crc and binascii.crc_hqx(bytes(raw), 0xFFFF) != expected_crc:
+        logger.warning(f"Image {image_id}: CRC mismatch (expected 0x{expected_crc:04x})")
+        raise HTTPException(status_code=400, detail="CRC mismatch")
+    
+    try:
+        frame = decode_frame(bytes(raw), img["width"], img["height"],
+                             img["codec"], img["flags"], img["key_id"])
+    except ValueError as e:
+        logger.warning(f"Image {image_id}: decode failed: {e}")
+        if isinstance(e, KeyframeMissing):
+            keyframe_lost_sessions.add(img["session_id"])
+        raise HTTPException(status_code=400, detail=f"Decode failed: {e}")
+    full_base64 = base64.b64encode(frame).decode()
     
     img["data_base64"] = full_base64
     img["completed"] = True
@@ -910,7 +1325,8 @@ async def image_end(request: Request):
     )
     save_image(image_data, img["session_id"], img["step"])
     
-    logger.info(f"Image upload complete: {image_id} ({len(full_base64)} bytes base64)")
+    logger.info(f"Image upload complete: {image_id} ({len(raw)} bytes on the wire, "
+                f"{len(frame)} bytes decoded)")
     return {"status": "ok", "image_id": image_id}
 
 
@@ -998,10 +1414,35 @@ async def get_config():
         "api_base": API_BASE_URL,
         "model": API_MODEL,
         "available_commands": AVAILABLE_COMMANDS,
-        "default_duration_ms": DEFAULT_DURATION_MS
+        "default_duration_ms": DEFAULT_DURATION_MS,
+        "image_mode": current_image_mode,
+        "image_modes": IMAGE_MODES,
     }
 
 
+@app.get("/image-mode")
+async def get_image_mode():
+    """Текущий режим кадра, передаваемый машине в ответе CMD (null - не передаётся)"""
+    return {"image_mode": current_image_mode, "available": IMAGE_MODES}
+
+
+@app.put("/image-mode")
+async def set_image_mode(request: Request):
+    """Смена режима кадра (full / half / horizon) на лету; null или "auto" - решает машина"""
+    global current_image_mode
+    body = await request.json()
+    mode = str(body.get("image_mode") or "auto").strip().lower()
+    if mode == "auto":
+        current_image_mode = None
+        logger.info("Image mode released to the car")
+        return {"status": "updated", "image_mode": None}
+    if mode not in IMAGE_MODES:
+        raise HTTPException(status_code=400, detail=f"image_mode must be one of {IMAGE_MODES}")
+    current_image_mode = mode
+    logger.info(f"Image mode set to {mode}")
+    return {"status": "updated", "image_mode": mode}
+
+
 # ==================== SYSTEM PROMPT ENDPOINTS ====================
 
 @app.get("/system-prompt")
@@ -1030,6 +1471,7 @@ async def set_system_prompt(request: Request):
     logger.info(f"System prompt updated: {old_length} -> {new_length} chars. "
                 f"First 100 chars: {new_prompt[:100]}...")
     logger.info("New prompt will be used in all subsequent LLM requests")
+    publish_prompt()
     
     return {"status": "updated", "length": len(new_prompt)}
 
@@ -1040,6 +1482,7 @@ async def reset_system_prompt():
     global current_system_prompt
     current_system_prompt = SYSTEM_PROMPT
     logger.info("System prompt reset to default")
+    publish_prompt()
     return {"status": "reset", "system_prompt": current_system_prompt}
 
 
@@ -1066,9 +1509,74 @@ async def get_latest_llm_log():
 async def clear_llm_log():
     """Очистка лога LLM"""
     llm_log.clear()
+    publish_telemetry("resync", {})
     return {"status": "cleared"}
 
 
+# ==================== ЖУРНАЛ МАШИНЫ ====================
+
+# PackedLogEntry (arduino_due/include/types.h): epoch, durationCs, distanceMm, lightFlags, command
+CAR_LOG_ENTRY = struct.Struct("<IHHHBx")
+CAR_LOG_EPOCH = datetime(2000, 1, 1)
+CAR_LOG_ABORT_REASONS = ["none", "obstacle", "impact"]
+
+
+def decode_car_log(dump: bytes) -> Dict[str, Any]:
+    """Разбор вывода "log dump" с Due: заголовок, записи PackedLogEntry, CRC16, "LOGDUMP END"."""
+    start = dump.find(b"LOGDUMP ")
+    header_end = dump.find(b"\n", start)
+    if start < 0 or header_end < 0:
+        raise ValueError("LOGDUMP header not found")
+    fields = dump[start:header_end].decode("ascii", "replace").split(" ")
+    if len(fields) < 4 or fields[1] != "1":
+        raise ValueError(f"Unsupported LOGDUMP header: {fields}")
+    count, entry_size = int(fields[2]), int(fields[3])
+    if entry_size != CAR_LOG_ENTRY.size:
+        raise ValueError(f"Unexpected entry size {entry_size}")
+    # Команды по порядку ID, затем макросы "<id>:<имя>"
+    names: Dict[int, str] = {}
+    tokens = fields[4].split(",") if len(fields) > 4 and fields[4] else []
+    for index, token in enumerate(tokens):
+        macro_id, sep, macro_name = token.partition(":")
+        if sep and macro_id.isdigit():
+            names[int(macro_id)] = macro_name
+        else:
+            names[index] = token
+
+    body_start = header_end + 1
+    body_end = body_start + count * entry_size
+    if len(dump) < body_end + 2:
+        raise ValueError("LOGDUMP truncated")
+    body = dump[body_start:body_end]
+    crc = struct.unpack_from("<H", dump, body_end)[0]
+    if binascii.crc_hqx(body, 0xFFFF) != crc:
+        raise ValueError("LOGDUMP CRC mismatch")
+
+    entries = []
+    for epoch, duration_cs, distance_mm, light_flags, command in CAR_LOG_ENTRY.iter_unpack(body):
+        abort = light_flags >> 14
+        entries.append({
+            "timestamp": (CAR_LOG_EPOCH + timedelta(seconds=epoch)).isoformat(),
+            "command": names.get(command, "?"),
+            "duration_ms": duration_cs * 10,
+            "distance_cm": distance_mm / 10,
+            "light_raw": light_flags & 0x0FFF,
+            "light_dark": bool(light_flags & 0x1000),
+            "image_sent": bool(light_flags & 0x2000),
+            "abort_reason": CAR_LOG_ABORT_REASONS[abort] if abort < len(CAR_LOG_ABORT_REASONS) else str(abort),
+        })
+    return {"total": len(entries), "entries": entries}
+
+
+@app.post("/car-log/decode")
+async def car_log_decode(request: Request):
+    """Декодирование бинарного журнала машины (сохранённый вывод Serial-команды "log dump")"""
+    try:
+        return decode_car_log(await request.body())
+    except (ValueError, struct.error) as e:
+        raise HTTPException(status_code=400, detail=str(e))
+
+
 @app.get("/llm-log/stats")
 async def get_llm_log_stats():
     """Статистика LLM лога"""
@@ -1109,6 +1617,7 @@ async def clear_alerts():
     global alerts
     count = len(alerts)
     alerts = []
+    publish_telemetry("resync", {})
     return {"message": f"Cleared {count} alerts"}
 
 
@@ -1123,7 +1632,100 @@ async def dashboard():
     return HTMLResponse(content=dashboard_path.read_text(encoding="utf-8"))
 
 
-# Полная сводка для dashboard polling
+# ==================== TELEMETRY STREAM ====================
+#
+# Дашборд берёт полную сводку /dashboard/poll один раз, дальше получает
+# приращения по SSE (/dashboard/stream): строка метрик шага, его запись LLM,
+# команда и имя кадра; алерты; смена промпта. Событие кодируется в JSON один
+# раз и раскладывается по очередям клиентов без await: /command не ждёт
+# зрителей. Очередь клиента ограничена - отстающий клиент теряет накопленное
+# и получает "resync" (перечитать /dashboard/poll)
+
+TELEMETRY_QUEUE_SIZE = 64     # событий на клиента
+TELEMETRY_MAX_CLIENTS = 16
+TELEMETRY_KEEPALIVE_S = 15    # комментарий SSE, чтобы прокси не рвали тишину
+
+telemetry_clients: List[asyncio.Queue] = []
+telemetry_seq = 0
+
+
+def publish_telemetry(event: str, payload: Dict[str, Any]) -> None:
+    """Разослать событие всем подписчикам; переполненная очередь - resync"""
+    global telemetry_seq
+    if not telemetry_clients:
+        return
+    telemetry_seq += 1
+    message = f"id: {telemetry_seq}\nevent: {event}\ndata: {json.dumps(payload, default=str)}\n\n"
+    for queue in telemetry_clients:
+        if queue.full():
+            while not queue.empty():
+                queue.get_nowait()
+            queue.put_nowait(f"id: {telemetry_seq}\nevent: resync\ndata: {{}}\n\n")
+        else:
+            queue.put_nowait(message)
+
+
+def publish_step(metrics_entry: Dict[str, Any], command_entry: Dict[str, Any]) -> None:
+    """Приращение шага: метрики, запись LLM без промптов, команда, кадр"""
+    if not telemetry_clients:
+        return
+    llm_entry = None
+    if llm_log and llm_log[-1].get("step") == metrics_entry["step"] \
+            and llm_log[-1].get("session_id") == metrics_entry["session_id"]:
+        # Промпты - килобайты на шаг; дашборд берёт их по запросу из /llm-log
+        llm_entry = {k: v for k, v in llm_log[-1].items() if k not in ("system_prompt", "user_prompt")}
+    publish_telemetry("step", {
+        "metrics": metrics_entry,
+        "llm": llm_entry,
+        "command": command_entry,
+        "image": metrics_entry.get("image_path"),
+        "images_saved": len(saved_images),
+    })
+
+
+def publish_prompt() -> None:
+    publish_telemetry("prompt", {
+        "system_prompt": current_system_prompt,
+        "is_default_prompt": current_system_prompt == SYSTEM_PROMPT,
+    })
+
+
+@app.get("/dashboard/stream")
+async def dashboard_stream(request: Request):
+    """Поток приращений для дашборда (Server-Sent Events)"""
+    if len(telemetry_clients) >= TELEMETRY_MAX_CLIENTS:
+        raise HTTPException(status_code=503, detail="Too many dashboard clients, use /dashboard/poll")
+
+    async def events():
+        # Клиент регистрируется при первой итерации: если он ушёл раньше, генератор
+        # не запускается и finally не сработал бы - очередь осталась бы в списке
+        if len(telemetry_clients) >= TELEMETRY_MAX_CLIENTS:
+            # Места заняли параллельные подключения: пустой поток, на повторе
+            # EventSource получит 503 и дашборд перейдёт на polling
+            return
+        queue: asyncio.Queue = asyncio.Queue(maxsize=TELEMETRY_QUEUE_SIZE)
+        telemetry_clients.append(queue)
+        logger.info(f"Dashboard stream opened ({len(telemetry_clients)} clients)")
+        try:
+            # Повтор подключения EventSource - через 2 с, как период polling
+            yield "retry: 2000\nevent: hello\ndata: {}\n\n"
+            while True:
+                try:
+                    message = await asyncio.wait_for(queue.get(), timeout=TELEMETRY_KEEPALIVE_S)
+                except asyncio.TimeoutError:
+                    if await request.is_disconnected():
+                        break
+                    message = ": keepalive\n\n"
+                yield message
+        finally:
+            telemetry_clients.remove(queue)
+            logger.info(f"Dashboard stream closed ({len(telemetry_clients)} clients)")
+
+    return StreamingResponse(events(), media_type="text/event-stream",
+                             headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"})
+
+
+# Полная сводка для dashboard polling (и начальное состояние потока)
 @app.get("/dashboard/poll")
 async def dashboard_poll():
     """Единый endpoint для polling всех данных дашборда"""
@@ -1162,6 +1764,7 @@ async def dashboard_poll():
             "min_ms": min(latencies) if latencies else 0,
             "max_ms": max(latencies) if latencies else 0,
             "avg_ms": round(sum(latencies) / len(latencies)) if latencies else 0,
+            "count": len(latencies),
         },
         "error_count": sum(1 for e in llm_log if e.get("error")),
         "alerts": alerts[-20:],